@@ -6,10 +6,13 @@
 #include "audio_codec.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
+#include "racing_protocol.h"
 #include "assets/lang_config.h"
 #include "mcp_server.h"
 #include "assets.h"
 #include "settings.h"
+#include "settings_store.h"
+#include "connection_cache.h"
 #include "touch_button_settings.h"
 
 #include <cstring>
@@ -38,7 +41,7 @@ Application::Application() {
     esp_timer_create_args_t clock_timer_args = {
         .callback = [](void* arg) {
             Application* app = (Application*)arg;
-            xEventGroupSetBits(app->event_group_, MAIN_EVENT_CLOCK_TICK);
+            app->SetMainEvents(MAIN_EVENT_CLOCK_TICK);
         },
         .arg = this,
         .dispatch_method = ESP_TIMER_TASK,
@@ -56,49 +59,68 @@ Application::~Application() {
     vEventGroupDelete(event_group_);
 }
 
-bool Application::SetDeviceState(DeviceState state) {
-    return state_machine_.TransitionTo(state);
+bool Application::SetDeviceState(DeviceState state, const char* cause) {
+    return state_machine_.TransitionTo(state, cause);
 }
 
 void Application::Initialize() {
     auto& board = Board::GetInstance();
     SetDeviceState(kDeviceStateStarting);
 
-    // Setup the display
-    auto display = board.GetDisplay();
+    // Add state change listeners
+    state_machine_.AddStateChangeListener([this](DeviceState old_state, DeviceState new_state) {
+        SetMainEvents(MAIN_EVENT_STATE_CHANGED);
+    });
 
-    // Print board name/version info
-    display->SetChatMessage("system", SystemInfo::GetUserAgent().c_str());
+    // The steps run on both cores as soon as their dependencies are done
+    boot_sequence_.AddStep("display", {}, [&board]() {
+        // Print board name/version info
+        auto display = board.GetDisplay();
+        display->SetChatMessage("system", SystemInfo::GetUserAgent().c_str());
+    });
 
-    // Setup the audio service
-    auto codec = board.GetAudioCodec();
-    audio_service_.Initialize(codec);
-    audio_service_.Start();
+    // Maps the assets partition and verifies its checksum
+    boot_sequence_.AddStep("assets_partition", {}, []() {
+        Assets::GetInstance();
+    });
 
-    AudioServiceCallbacks callbacks;
-    callbacks.on_send_queue_available = [this]() {
-        xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
-    };
-    callbacks.on_wake_word_detected = [this](const std::string& wake_word) {
-        xEventGroupSetBits(event_group_, MAIN_EVENT_WAKE_WORD_DETECTED);
-    };
-    callbacks.on_vad_change = [this](bool speaking) {
-        xEventGroupSetBits(event_group_, MAIN_EVENT_VAD_CHANGE);
-    };
-    audio_service_.SetCallbacks(callbacks);
+    boot_sequence_.AddStep("audio", {}, [this, &board]() {
+        // Setup the audio service
+        auto codec = board.GetAudioCodec();
+        audio_service_.Initialize(codec);
+        audio_service_.Start();
 
-    // Add state change listeners
-    state_machine_.AddStateChangeListener([this](DeviceState old_state, DeviceState new_state) {
-        xEventGroupSetBits(event_group_, MAIN_EVENT_STATE_CHANGED);
+        xTaskCreate([](void* arg) {
+            Application* app = static_cast<Application*>(arg);
+            app->AudioUplinkTask();
+            vTaskDelete(NULL);
+        }, "audio_uplink", 4096 * 2, this, 4, &audio_uplink_task_handle_);
+
+        AudioServiceCallbacks callbacks;
+        callbacks.on_send_queue_available = [this]() {
+            xTaskNotifyGive(audio_uplink_task_handle_);
+        };
+        callbacks.on_wake_word_detected = [this](const std::string& wake_word) {
+            SetMainEvents(MAIN_EVENT_WAKE_WORD_DETECTED);
+        };
+        callbacks.on_vad_change = [this](bool speaking) {
+            SetMainEvents(MAIN_EVENT_VAD_CHANGE);
+        };
+        audio_service_.SetCallbacks(callbacks);
     });
 
-    // Start the clock timer to update the status bar
-    esp_timer_start_periodic(clock_timer_handle_, 1000000);
+    // Fonts, emoji and srmodels, unless new assets are going to be downloaded after activation
+    boot_sequence_.AddStep("assets_apply", {"assets_partition", "display", "audio"}, [this]() {
+        ApplyAssets();
+    });
 
     // Add MCP common tools (only once during initialization)
-    auto& mcp_server = McpServer::GetInstance();
-    mcp_server.AddCommonTools();
-    mcp_server.AddUserOnlyTools();
+    boot_sequence_.AddStep("mcp_tools", {"assets_partition"}, []() {
+        auto& mcp_server = McpServer::GetInstance();
+        mcp_server.AddCommonTools();
+        mcp_server.AddUserOnlyTools();
+        mcp_server.AddDeviceResources();
+    });
 
     // Set network event callback for UI updates and network state handling
     board.SetNetworkEventCallback([this](NetworkEvent event, const std::string& data) {
@@ -107,7 +129,7 @@ void Application::Initialize() {
         switch (event) {
             case NetworkEvent::Scanning:
                 display->ShowNotification(Lang::Strings::SCANNING_WIFI, 30000);
-                xEventGroupSetBits(event_group_, MAIN_EVENT_NETWORK_DISCONNECTED);
+                SetMainEvents(MAIN_EVENT_NETWORK_DISCONNECTED);
                 break;
             case NetworkEvent::Connecting: {
                 if (data.empty()) {
@@ -125,12 +147,14 @@ void Application::Initialize() {
             case NetworkEvent::Connected: {
                 std::string msg = Lang::Strings::CONNECTED_TO;
                 msg += data;
+                // Cellular boards report no SSID
+                network_name_ = data.empty() ? "cellular" : data;
                 display->ShowNotification(msg.c_str(), 30000);
-                xEventGroupSetBits(event_group_, MAIN_EVENT_NETWORK_CONNECTED);
+                SetMainEvents(MAIN_EVENT_NETWORK_CONNECTED);
                 break;
             }
             case NetworkEvent::Disconnected:
-                xEventGroupSetBits(event_group_, MAIN_EVENT_NETWORK_DISCONNECTED);
+                SetMainEvents(MAIN_EVENT_NETWORK_DISCONNECTED);
                 break;
             case NetworkEvent::WifiConfigModeEnter:
                 // WiFi config mode enter is handled by WifiBoard internally
@@ -158,17 +182,24 @@ void Application::Initialize() {
         }
     });
 
-    // Start network asynchronously
-    board.StartNetwork();
+    // Network events can raise alerts, which play sounds through the audio service
+    boot_sequence_.AddStep("network", {"audio"}, [&board]() {
+        // Start network asynchronously
+        board.StartNetwork();
+    });
+
+    boot_sequence_.Run();
+
+    // Start the clock timer to update the status bar
+    esp_timer_start_periodic(clock_timer_handle_, 1000000);
 
     // Update the status bar immediately to show the network state
-    display->UpdateStatusBar(true);
+    board.GetDisplay()->UpdateStatusBar(true);
 }
 
 void Application::Run() {
     const EventBits_t ALL_EVENTS = 
         MAIN_EVENT_SCHEDULE |
-        MAIN_EVENT_SEND_AUDIO |
         MAIN_EVENT_WAKE_WORD_DETECTED |
         MAIN_EVENT_VAD_CHANGE |
         MAIN_EVENT_CLOCK_TICK |
@@ -185,51 +216,56 @@ void Application::Run() {
         auto bits = xEventGroupWaitBits(event_group_, ALL_EVENTS, pdTRUE, pdFALSE, portMAX_DELAY);
 
         if (bits & MAIN_EVENT_ERROR) {
+            MAIN_LOOP_PROFILE_EVENT(MAIN_EVENT_ERROR);
             SetDeviceState(kDeviceStateIdle);
             Alert(Lang::Strings::ERROR, last_error_message_.c_str(), "circle_xmark", Lang::Sounds::OGG_EXCLAMATION);
         }
 
         if (bits & MAIN_EVENT_NETWORK_CONNECTED) {
+            MAIN_LOOP_PROFILE_EVENT(MAIN_EVENT_NETWORK_CONNECTED);
             HandleNetworkConnectedEvent();
         }
 
         if (bits & MAIN_EVENT_NETWORK_DISCONNECTED) {
+            MAIN_LOOP_PROFILE_EVENT(MAIN_EVENT_NETWORK_DISCONNECTED);
             HandleNetworkDisconnectedEvent();
         }
 
         if (bits & MAIN_EVENT_ACTIVATION_DONE) {
+            MAIN_LOOP_PROFILE_EVENT(MAIN_EVENT_ACTIVATION_DONE);
             HandleActivationDoneEvent();
         }
 
         if (bits & MAIN_EVENT_STATE_CHANGED) {
+            MAIN_LOOP_PROFILE_EVENT(MAIN_EVENT_STATE_CHANGED);
+            int64_t start_time = esp_timer_get_time();
             HandleStateChangedEvent();
+            state_machine_.RecordHandlerDuration(esp_timer_get_time() - start_time);
+            McpServer::GetInstance().CheckSubscriptions();
         }
 
         if (bits & MAIN_EVENT_TOGGLE_CHAT) {
+            MAIN_LOOP_PROFILE_EVENT(MAIN_EVENT_TOGGLE_CHAT);
             HandleToggleChatEvent();
         }
 
         if (bits & MAIN_EVENT_START_LISTENING) {
+            MAIN_LOOP_PROFILE_EVENT(MAIN_EVENT_START_LISTENING);
             HandleStartListeningEvent();
         }
 
         if (bits & MAIN_EVENT_STOP_LISTENING) {
+            MAIN_LOOP_PROFILE_EVENT(MAIN_EVENT_STOP_LISTENING);
             HandleStopListeningEvent();
         }
 
-        if (bits & MAIN_EVENT_SEND_AUDIO) {
-            while (auto packet = audio_service_.PopPacketFromSendQueue()) {
-                if (protocol_ && !protocol_->SendAudio(std::move(packet))) {
-                    break;
-                }
-            }
-        }
-
         if (bits & MAIN_EVENT_WAKE_WORD_DETECTED) {
+            MAIN_LOOP_PROFILE_EVENT(MAIN_EVENT_WAKE_WORD_DETECTED);
             HandleWakeWordDetectedEvent();
         }
 
         if (bits & MAIN_EVENT_VAD_CHANGE) {
+            MAIN_LOOP_PROFILE_EVENT(MAIN_EVENT_VAD_CHANGE);
             if (GetDeviceState() == kDeviceStateListening) {
                 auto led = Board::GetInstance().GetLed();
                 led->OnStateChanged();
@@ -237,29 +273,99 @@ void Application::Run() {
         }
 
         if (bits & MAIN_EVENT_SCHEDULE) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            auto tasks = std::move(main_tasks_);
-            lock.unlock();
-            for (auto& task : tasks) {
-                task();
-            }
+            MAIN_LOOP_PROFILE_EVENT(MAIN_EVENT_SCHEDULE);
+            RunScheduledTasks();
         }
 
         if (bits & MAIN_EVENT_CLOCK_TICK) {
+            MAIN_LOOP_PROFILE_EVENT(MAIN_EVENT_CLOCK_TICK);
             clock_ticks_++;
             auto display = Board::GetInstance().GetDisplay();
             display->UpdateStatusBar();
+            McpServer::GetInstance().CheckSubscriptions();
         
             // Print debug info every 10 seconds
             if (clock_ticks_ % 10 == 0) {
                 SystemInfo::PrintHeapStats();
+                auto stats = main_tasks_.stats();
+                if (stats.overflowed + stats.dropped != reported_task_overflows_) {
+                    reported_task_overflows_ = stats.overflowed + stats.dropped;
+                    ESP_LOGW(TAG, "Main tasks: %lu overflowed, %lu dropped, peak depth control %lu ui %lu",
+                        stats.overflowed, stats.dropped, stats.peak_depth[kScheduleLaneControl], stats.peak_depth[kScheduleLaneUi]);
+                }
+#if CONFIG_USE_MAIN_LOOP_PROFILER
+                MainLoopProfiler::GetInstance().PrintStats();
+#endif
+            }
+        }
+    }
+}
+
+void Application::AudioUplinkTask() {
+    std::vector<std::unique_ptr<AudioStreamPacket>> packets;
+    packets.reserve(UPLINK_MAX_BATCH_PACKETS);
+
+    // Statistics for the current reporting interval
+    uint32_t sent_packets = 0;
+    uint32_t dropped_packets = 0;
+    uint32_t batches = 0;
+    int64_t send_time_total = 0;
+    int64_t send_time_max = 0;
+    int64_t queue_age_total = 0;
+    int64_t queue_age_max = 0;
+    int64_t last_report_time = esp_timer_get_time();
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(UPLINK_STATS_INTERVAL_MS));
+
+        while (audio_service_.PopPacketsFromSendQueue(packets, UPLINK_MAX_BATCH_PACKETS)) {
+            auto start_time = esp_timer_get_time();
+            for (auto& packet : packets) {
+                auto age = start_time - packet->enqueue_time;
+                queue_age_total += age;
+                queue_age_max = std::max(queue_age_max, age);
+            }
+
+            size_t count = packets.size();
+            size_t sent = 0;
+            {
+                std::lock_guard<std::mutex> lock(protocol_mutex_);
+                if (protocol_) {
+                    sent = protocol_->SendAudioBatch(packets);
+                }
+            }
+            auto send_time = esp_timer_get_time() - start_time;
+            packets.clear();
+
+            batches++;
+            sent_packets += sent;
+            dropped_packets += count - sent;
+            send_time_total += send_time;
+            send_time_max = std::max(send_time_max, send_time);
+            if (sent < count) {
+                // The audio channel is not ready, the rest of the queue is drained on the next notification
+                break;
             }
         }
+
+        auto now = esp_timer_get_time();
+        if (now - last_report_time >= UPLINK_STATS_INTERVAL_MS * 1000LL) {
+            if (batches > 0) {
+                uint32_t packets_seen = sent_packets + dropped_packets;
+                ESP_LOGI(TAG, "Uplink: %lu packets in %lu batches, %lu dropped, send avg %lu us max %lu us, queue age avg %lu ms max %lu ms",
+                    sent_packets, batches, dropped_packets, (uint32_t)(send_time_total / batches), (uint32_t)send_time_max,
+                    (uint32_t)(queue_age_total / packets_seen / 1000), (uint32_t)(queue_age_max / 1000));
+            }
+            sent_packets = dropped_packets = batches = 0;
+            send_time_total = send_time_max = queue_age_total = queue_age_max = 0;
+            last_report_time = now;
+        }
     }
 }
 
 void Application::HandleNetworkConnectedEvent() {
     ESP_LOGI(TAG, "Network connected");
+    boot_sequence_.MarkMilestone("network_connected");
     auto state = GetDeviceState();
 
     if (state == kDeviceStateStarting || state == kDeviceStateWifiConfiguring) {
@@ -284,6 +390,9 @@ void Application::HandleNetworkConnectedEvent() {
 }
 
 void Application::HandleNetworkDisconnectedEvent() {
+    // Cached DNS answers may not be valid on the next network
+    ConnectionCache::GetInstance().Clear();
+
     // Close current conversation when network disconnected
     auto state = GetDeviceState();
     if (state == kDeviceStateConnecting || state == kDeviceStateListening || state == kDeviceStateSpeaking) {
@@ -298,6 +407,7 @@ void Application::HandleNetworkDisconnectedEvent() {
 
 void Application::HandleActivationDoneEvent() {
     ESP_LOGI(TAG, "Activation done");
+    boot_sequence_.MarkMilestone("activated");
 
     SystemInfo::PrintHeapStats();
     SetDeviceState(kDeviceStateIdle);
@@ -353,6 +463,14 @@ void Application::HandleActivationDoneEvent() {
             touch_panel->SetVolumeChangeCallback([codec](int value) {
                 codec->SetOutputVolume(value);
             });
+
+            // Keep the slider in step with volume changes from elsewhere, e.g. the MCP set_volume tool
+            SettingsStore::GetInstance().AddListener("audio", [touch_panel, codec, display](const std::string& key) {
+                if (key == "output_volume") {
+                    DisplayLockGuard lock(display);
+                    touch_panel->SetVolume(codec->output_volume());
+                }
+            });
             
             // Set rotation callback - toggle and reboot
             touch_panel->SetRotationChangeCallback([this, display]() {
@@ -387,6 +505,9 @@ void Application::ActivationTask() {
     // Create OTA object for activation process
     ota_ = std::make_unique<Ota>();
 
+    // Resolve the OTA server while the assets are being checked
+    ConnectionCache::GetInstance().Prefetch({ota_->GetCheckVersionUrl()});
+
     // Check for new assets version
     CheckAssetsVersion();
 
@@ -397,7 +518,21 @@ void Application::ActivationTask() {
     InitializeProtocol();
 
     // Signal completion to main loop
-    xEventGroupSetBits(event_group_, MAIN_EVENT_ACTIVATION_DONE);
+    SetMainEvents(MAIN_EVENT_ACTIVATION_DONE);
+}
+
+void Application::ApplyAssets() {
+    auto& assets = Assets::GetInstance();
+    if (!assets.partition_valid()) {
+        return;
+    }
+
+    // New assets are downloaded and applied by CheckAssetsVersion() once activation starts
+    Settings settings("assets");
+    if (!settings.GetString("download_url").empty() || !assets.GetResumableDownloadUrl().empty()) {
+        return;
+    }
+    assets_applied_ = assets.Apply();
 }
 
 void Application::CheckAssetsVersion() {
@@ -419,9 +554,16 @@ void Application::CheckAssetsVersion() {
     Settings settings("assets", true);
     // Check if there is a new assets need to be downloaded
     std::string download_url = settings.GetString("download_url");
+    if (download_url.empty()) {
+        // A download cut off by a reboot continues where it stopped
+        download_url = assets.GetResumableDownloadUrl();
+    }
+
+    std::string delta_url = settings.GetString("delta_url");
 
     if (!download_url.empty()) {
         settings.EraseKey("download_url");
+        settings.EraseKey("delta_url");
 
         char message[256];
         snprintf(message, sizeof(message), Lang::Strings::FOUND_NEW_ASSETS, download_url.c_str());
@@ -433,13 +575,24 @@ void Application::CheckAssetsVersion() {
         board.SetPowerSaveLevel(PowerSaveLevel::PERFORMANCE);
         display->SetChatMessage("system", Lang::Strings::PLEASE_WAIT);
 
-        bool success = assets.Download(download_url, [display](int progress, size_t speed) -> void {
+        auto progress_callback = [display](int progress, size_t speed) -> void {
             std::thread([display, progress, speed]() {
                 char buffer[32];
                 snprintf(buffer, sizeof(buffer), "%d%% %uKB/s", progress, speed / 1024);
                 display->SetChatMessage("system", buffer);
             }).detach();
-        });
+        };
+        // A patch of the installed assets is much smaller, the full download is the fallback
+        bool success = false;
+        if (!delta_url.empty()) {
+            success = assets.DownloadDelta(delta_url, download_url, progress_callback);
+            if (!success) {
+                ESP_LOGW(TAG, "Failed to patch the assets, downloading them in full");
+            }
+        }
+        if (!success) {
+            success = assets.Download(download_url, progress_callback);
+        }
 
         board.SetPowerSaveLevel(PowerSaveLevel::LOW_POWER);
         vTaskDelay(pdMS_TO_TICKS(1000));
@@ -452,8 +605,10 @@ void Application::CheckAssetsVersion() {
         }
     }
 
-    // Apply assets
-    assets.Apply();
+    // Apply assets, unless that was already done during boot
+    if (!assets_applied_) {
+        assets_applied_ = assets.Apply();
+    }
     display->SetChatMessage("system", "");
     display->SetEmotion("microchip_ai");
 }
@@ -496,7 +651,8 @@ void Application::CheckNewVersion() {
         retry_delay = 10; // Reset retry delay
 
         if (ota_->HasNewVersion()) {
-            if (UpgradeFirmware(ota_->GetFirmwareUrl(), ota_->GetFirmwareVersion())) {
+            if (UpgradeFirmware(ota_->GetFirmwareUrl(), ota_->GetFirmwareVersion(), ota_->GetFirmwareSha256(),
+                ota_->GetFirmwareDeltaUrl())) {
                 return; // This line will never be reached after reboot
             }
             // If upgrade failed, continue to normal operation
@@ -540,13 +696,24 @@ void Application::InitializeProtocol() {
 
     display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
 
+    std::unique_ptr<Protocol> protocol;
+#ifdef CONFIG_ENABLE_TRANSPORT_RACING
+    if (ota_->HasMqttConfig() && ota_->HasWebsocketConfig()) {
+        protocol = std::make_unique<RacingProtocol>(std::make_unique<MqttProtocol>(), "mqtt",
+            std::make_unique<WebsocketProtocol>(), "websocket", network_name_);
+    } else
+#endif
     if (ota_->HasMqttConfig()) {
-        protocol_ = std::make_unique<MqttProtocol>();
+        protocol = std::make_unique<MqttProtocol>();
     } else if (ota_->HasWebsocketConfig()) {
-        protocol_ = std::make_unique<WebsocketProtocol>();
+        protocol = std::make_unique<WebsocketProtocol>();
     } else {
         ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
-        protocol_ = std::make_unique<MqttProtocol>();
+        protocol = std::make_unique<MqttProtocol>();
+    }
+    {
+        std::lock_guard<std::mutex> lock(protocol_mutex_);
+        protocol_ = std::move(protocol);
     }
 
     protocol_->OnConnected([this]() {
@@ -555,7 +722,7 @@ void Application::InitializeProtocol() {
 
     protocol_->OnNetworkError([this](const std::string& message) {
         last_error_message_ = message;
-        xEventGroupSetBits(event_group_, MAIN_EVENT_ERROR);
+        SetMainEvents(MAIN_EVENT_ERROR);
     });
     
     protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
@@ -566,6 +733,11 @@ void Application::InitializeProtocol() {
     
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
         board.SetPowerSaveLevel(PowerSaveLevel::PERFORMANCE);
+        audio_service_.SetUplinkRedundancyAllowed(protocol_->server_accepts_redundancy());
+        Schedule([this]() {
+            feedback_sequence_ = 0;
+            feedback_received_ = 0;
+        });
         if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
@@ -581,97 +753,172 @@ void Application::InitializeProtocol() {
         });
     });
     
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
-                Schedule([this]() {
-                    aborted_ = false;
-                    SetDeviceState(kDeviceStateSpeaking);
-                });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
-                    if (GetDeviceState() == kDeviceStateSpeaking) {
-                        if (listening_mode_ == kListeningModeManualStop) {
-                            SetDeviceState(kDeviceStateIdle);
-                        } else {
-                            SetDeviceState(kDeviceStateListening);
-                        }
-                    }
-                });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (cJSON_IsString(text)) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
-                    });
-                }
-            }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (cJSON_IsString(text)) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(emotion)) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "mcp") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            if (cJSON_IsObject(payload)) {
-                McpServer::GetInstance().ParseMessage(payload);
-            }
-        } else if (strcmp(type->valuestring, "system") == 0) {
-            auto command = cJSON_GetObjectItem(root, "command");
-            if (cJSON_IsString(command)) {
-                ESP_LOGI(TAG, "System command: %s", command->valuestring);
-                if (strcmp(command->valuestring, "reboot") == 0) {
-                    // Do a reboot if user requests a OTA update
-                    Schedule([this]() {
-                        Reboot();
-                    });
+    protocol_->OnIncomingJson([this](const JsonValue& root) {
+        HandleIncomingJson(root);
+    });
+    
+    protocol_->Start();
+}
+
+void Application::HandleIncomingJson(const JsonValue& root) {
+    using Handler = void (Application::*)(const JsonValue& root);
+    static const struct {
+        std::string_view type;
+        Handler handler;
+    } handlers[] = {
+        {"tts", &Application::HandleTtsMessage},
+        {"stt", &Application::HandleSttMessage},
+        {"llm", &Application::HandleLlmMessage},
+        {"mcp", &Application::HandleMcpMessage},
+        {"system", &Application::HandleSystemMessage},
+        {"alert", &Application::HandleAlertMessage},
+        {"audio_feedback", &Application::HandleAudioFeedbackMessage},
+#if CONFIG_RECEIVE_CUSTOM_MESSAGE
+        {"custom", &Application::HandleCustomMessage},
+#endif
+    };
+
+    auto type = root["type"];
+    for (const auto& entry : handlers) {
+        if (type.Equals(entry.type)) {
+            (this->*entry.handler)(root);
+            return;
+        }
+    }
+    ESP_LOGW(TAG, "Unknown message type: %s", type.ToString().c_str());
+}
+
+void Application::HandleTtsMessage(const JsonValue& root) {
+    auto state = root["state"];
+    if (state.Equals("start")) {
+        Schedule([this]() {
+            aborted_ = false;
+            SetDeviceState(kDeviceStateSpeaking);
+        });
+    } else if (state.Equals("stop")) {
+        Schedule([this]() {
+            if (GetDeviceState() == kDeviceStateSpeaking) {
+                if (listening_mode_ == kListeningModeManualStop) {
+                    SetDeviceState(kDeviceStateIdle);
                 } else {
-                    ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
+                    SetDeviceState(kDeviceStateListening);
                 }
             }
-        } else if (strcmp(type->valuestring, "alert") == 0) {
-            auto status = cJSON_GetObjectItem(root, "status");
-            auto message = cJSON_GetObjectItem(root, "message");
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
-                Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::OGG_VIBRATION);
-            } else {
-                ESP_LOGW(TAG, "Alert command requires status, message and emotion");
-            }
-#if CONFIG_RECEIVE_CUSTOM_MESSAGE
-        } else if (strcmp(type->valuestring, "custom") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            ESP_LOGI(TAG, "Received custom message: %s", cJSON_PrintUnformatted(root));
-            if (cJSON_IsObject(payload)) {
-                Schedule([this, display, payload_str = std::string(cJSON_PrintUnformatted(payload))]() {
-                    display->SetChatMessage("system", payload_str.c_str());
-                });
-            } else {
-                ESP_LOGW(TAG, "Invalid custom message format: missing payload");
-            }
-#endif
+        });
+    } else if (state.Equals("sentence_start")) {
+        auto text = root["text"];
+        if (text.IsString()) {
+            auto message = text.ToString();
+            ESP_LOGI(TAG, "<< %s", message.c_str());
+            Schedule([message = std::move(message)]() {
+                Board::GetInstance().GetDisplay()->SetChatMessage("assistant", message.c_str());
+            }, kScheduleLaneUi);
+        }
+    }
+}
+
+void Application::HandleSttMessage(const JsonValue& root) {
+    auto text = root["text"];
+    if (text.IsString()) {
+        auto message = text.ToString();
+        ESP_LOGI(TAG, ">> %s", message.c_str());
+        Schedule([message = std::move(message)]() {
+            Board::GetInstance().GetDisplay()->SetChatMessage("user", message.c_str());
+        }, kScheduleLaneUi);
+    }
+}
+
+void Application::HandleLlmMessage(const JsonValue& root) {
+    auto emotion = root["emotion"];
+    if (emotion.IsString()) {
+        Schedule([emotion_str = emotion.ToString()]() {
+            Board::GetInstance().GetDisplay()->SetEmotion(emotion_str.c_str());
+        }, kScheduleLaneUi);
+    }
+}
+
+void Application::HandleMcpMessage(const JsonValue& root) {
+    // Hand the raw payload text to the MCP server, it is parsed only once there
+    auto payload = root["payload"];
+    if (payload.IsObject()) {
+        McpServer::GetInstance().ParseMessage(payload.raw());
+    }
+}
+
+void Application::HandleSystemMessage(const JsonValue& root) {
+    auto command = root["command"];
+    if (command.IsString()) {
+        auto command_str = command.ToString();
+        ESP_LOGI(TAG, "System command: %s", command_str.c_str());
+        if (command_str == "reboot") {
+            // Do a reboot if user requests a OTA update
+            Schedule([this]() {
+                Reboot();
+            });
         } else {
-            ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
+            ESP_LOGW(TAG, "Unknown system command: %s", command_str.c_str());
         }
-    });
-    
-    protocol_->Start();
+    }
 }
 
+void Application::HandleAlertMessage(const JsonValue& root) {
+    auto status = root["status"];
+    auto message = root["message"];
+    auto emotion = root["emotion"];
+    if (status.IsString() && message.IsString() && emotion.IsString()) {
+        Alert(status.ToString().c_str(), message.ToString().c_str(), emotion.ToString().c_str(), Lang::Sounds::OGG_VIBRATION);
+    } else {
+        ESP_LOGW(TAG, "Alert command requires status, message and emotion");
+    }
+}
+
+/*
+ * Uplink loss reported by the server, either directly:
+ *   {"type":"audio_feedback","loss":4}
+ * or as counters for the session, from which the loss since the previous report is derived:
+ *   {"type":"audio_feedback","sequence":<highest uplink sequence seen>,"received":<uplink packets received>}
+ */
+void Application::HandleAudioFeedbackMessage(const JsonValue& root) {
+    auto loss = root["loss"];
+    auto sequence = root["sequence"];
+    auto received = root["received"];
+    if (loss.IsNumber()) {
+        Schedule([this, loss_percent = loss.ToInt()]() {
+            audio_service_.ReportUplinkLoss(loss_percent);
+        });
+    } else if (sequence.IsNumber() && received.IsNumber()) {
+        Schedule([this, sequence = (uint32_t)sequence.ToDouble(), received = (uint32_t)received.ToDouble()]() {
+            uint32_t expected = sequence - feedback_sequence_;
+            uint32_t arrived = received - feedback_received_;
+            if (sequence <= feedback_sequence_ || received < feedback_received_ || arrived > expected) {
+                // Counters restarted or out of order, measure from here on
+                feedback_sequence_ = sequence;
+                feedback_received_ = received;
+                return;
+            }
+            feedback_sequence_ = sequence;
+            feedback_received_ = received;
+            audio_service_.ReportUplinkLoss((expected - arrived) * 100 / expected);
+        });
+    } else {
+        ESP_LOGW(TAG, "Audio feedback requires loss, or sequence and received");
+    }
+}
+
+#if CONFIG_RECEIVE_CUSTOM_MESSAGE
+void Application::HandleCustomMessage(const JsonValue& root) {
+    auto payload = root["payload"];
+    ESP_LOGI(TAG, "Received custom message: %.*s", (int)root.raw().size(), root.raw().data());
+    if (payload.IsObject()) {
+        Schedule([payload_str = std::string(payload.raw())]() {
+            Board::GetInstance().GetDisplay()->SetChatMessage("system", payload_str.c_str());
+        }, kScheduleLaneUi);
+    } else {
+        ESP_LOGW(TAG, "Invalid custom message format: missing payload");
+    }
+}
+#endif
+
 void Application::ShowActivationCode(const std::string& code, const std::string& message) {
     struct digit_sound {
         char digit;
@@ -723,15 +970,15 @@ void Application::DismissAlert() {
 }
 
 void Application::ToggleChatState() {
-    xEventGroupSetBits(event_group_, MAIN_EVENT_TOGGLE_CHAT);
+    SetMainEvents(MAIN_EVENT_TOGGLE_CHAT);
 }
 
 void Application::StartListening() {
-    xEventGroupSetBits(event_group_, MAIN_EVENT_START_LISTENING);
+    SetMainEvents(MAIN_EVENT_START_LISTENING);
 }
 
 void Application::StopListening() {
-    xEventGroupSetBits(event_group_, MAIN_EVENT_STOP_LISTENING);
+    SetMainEvents(MAIN_EVENT_STOP_LISTENING);
 }
 
 void Application::HandleToggleChatEvent() {
@@ -885,6 +1132,7 @@ void Application::HandleStateChangedEvent() {
             display->SetEmotion("neutral");
             audio_service_.EnableVoiceProcessing(false);
             audio_service_.EnableWakeWordDetection(true);
+            boot_sequence_.MarkMilestone("wake_word_ready");
             break;
         case kDeviceStateConnecting:
             display->SetStatus(Lang::Strings::CONNECTING);
@@ -929,12 +1177,39 @@ void Application::HandleStateChangedEvent() {
     }
 }
 
-void Application::Schedule(std::function<void()>&& callback) {
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        main_tasks_.push_back(std::move(callback));
+void Application::Schedule(InlineTask&& callback, ScheduleLane lane) {
+    MAIN_LOOP_PROFILE_SCHEDULED(callback);
+    main_tasks_.Push(std::move(callback), lane);
+    SetMainEvents(MAIN_EVENT_SCHEDULE);
+}
+
+bool Application::ScheduleTaskFromIsr(InlineTask&& callback, ScheduleLane lane) {
+    MAIN_LOOP_PROFILE_SCHEDULED(callback);
+    if (!main_tasks_.PushFromIsr(std::move(callback), lane)) {
+        return false;
+    }
+    MAIN_LOOP_PROFILE_MARK(MAIN_EVENT_SCHEDULE);
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    xEventGroupSetBitsFromISR(event_group_, MAIN_EVENT_SCHEDULE, &higher_priority_task_woken);
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+    return true;
+}
+
+void Application::RunScheduledTasks() {
+    // Pop() prefers the control lane, so control work scheduled meanwhile overtakes queued UI work.
+    // Stop after a full queue worth of tasks, callbacks that keep scheduling must not starve the other events.
+    InlineTask task;
+    for (int i = 0; i < MAIN_TASK_CONTROL_QUEUE_SIZE + MAIN_TASK_UI_QUEUE_SIZE; i++) {
+        if (!main_tasks_.Pop(task)) {
+            return;
+        }
+        {
+            MAIN_LOOP_PROFILE_TASK(task);
+            task();
+        }
+        task.Reset();
     }
-    xEventGroupSetBits(event_group_, MAIN_EVENT_SCHEDULE);
+    SetMainEvents(MAIN_EVENT_SCHEDULE);
 }
 
 void Application::AbortSpeaking(AbortReason reason) {
@@ -952,18 +1227,23 @@ void Application::SetListeningMode(ListeningMode mode) {
 
 void Application::Reboot() {
     ESP_LOGI(TAG, "Rebooting...");
+    state_machine_.PrintTrace();
     // Disconnect the audio channel
     if (protocol_ && protocol_->IsAudioChannelOpened()) {
         protocol_->CloseAudioChannel();
     }
-    protocol_.reset();
+    {
+        std::lock_guard<std::mutex> lock(protocol_mutex_);
+        protocol_.reset();
+    }
     audio_service_.Stop();
 
     vTaskDelay(pdMS_TO_TICKS(1000));
     esp_restart();
 }
 
-bool Application::UpgradeFirmware(const std::string& url, const std::string& version) {
+bool Application::UpgradeFirmware(const std::string& url, const std::string& version, const std::string& sha256,
+    const std::string& delta_url) {
     auto& board = Board::GetInstance();
     auto display = board.GetDisplay();
 
@@ -989,13 +1269,18 @@ bool Application::UpgradeFirmware(const std::string& url, const std::string& ver
     audio_service_.Stop();
     vTaskDelay(pdMS_TO_TICKS(1000));
 
-    bool upgrade_success = Ota::Upgrade(upgrade_url, [display](int progress, size_t speed) {
+    auto progress_callback = [display](int progress, size_t speed) {
         std::thread([display, progress, speed]() {
             char buffer[32];
             snprintf(buffer, sizeof(buffer), "%d%% %uKB/s", progress, speed / 1024);
             display->SetChatMessage("system", buffer);
         }).detach();
-    });
+    };
+    // A patch from the running version is much smaller, the full image is the fallback
+    bool upgrade_success = !delta_url.empty() && Ota::UpgradeDelta(delta_url, progress_callback, sha256);
+    if (!upgrade_success) {
+        upgrade_success = Ota::Upgrade(upgrade_url, progress_callback, sha256);
+    }
 
     if (!upgrade_success) {
         // Upgrade failed, restart audio service and continue running
@@ -1078,7 +1363,7 @@ bool Application::CanEnterSleepMode() {
     return true;
 }
 
-void Application::SendMcpMessage(const std::string& payload) {
+void Application::SendMcpMessage(std::string payload) {
     // Always schedule to run in main task for thread safety
     Schedule([this, payload = std::move(payload)]() {
         if (protocol_) {
@@ -1087,6 +1372,15 @@ void Application::SendMcpMessage(const std::string& payload) {
     });
 }
 
+void Application::SendMcpMessageStream(std::function<bool(std::string& piece)> next) {
+    // Sent from the main task like every other MCP message, so the order is kept
+    Schedule([this, next = std::move(next)]() {
+        if (protocol_) {
+            protocol_->SendMcpMessageStream(next);
+        }
+    });
+}
+
 void Application::SetAecMode(AecMode mode) {
     aec_mode_ = mode;
     Schedule([this]() {
@@ -1125,6 +1419,7 @@ void Application::ResetProtocol() {
             protocol_->CloseAudioChannel();
         }
         // Reset protocol
+        std::lock_guard<std::mutex> lock(protocol_mutex_);
         protocol_.reset();
     });
 }
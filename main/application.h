@@ -16,10 +16,12 @@
 #include "audio_service.h"
 #include "device_state.h"
 #include "device_state_machine.h"
+#include "main_task_queue.h"
+#include "main_loop_profiler.h"
+#include "boot_sequence.h"
 
 // Main event bits
 #define MAIN_EVENT_SCHEDULE             (1 << 0)
-#define MAIN_EVENT_SEND_AUDIO           (1 << 1)
 #define MAIN_EVENT_WAKE_WORD_DETECTED   (1 << 2)
 #define MAIN_EVENT_VAD_CHANGE           (1 << 3)
 #define MAIN_EVENT_ERROR                (1 << 4)
@@ -32,6 +34,9 @@
 #define MAIN_EVENT_STOP_LISTENING       (1 << 11)
 #define MAIN_EVENT_STATE_CHANGED        (1 << 12)
 
+// Uplink audio sender
+#define UPLINK_MAX_BATCH_PACKETS        8
+#define UPLINK_STATS_INTERVAL_MS        10000
 
 enum AecMode {
     kAecOff,
@@ -69,13 +74,33 @@ public:
     /**
      * Request state transition
      * Returns true if transition was successful
+     * The cause defaults to the calling function and is recorded in the state trace
      */
-    bool SetDeviceState(DeviceState state);
+    bool SetDeviceState(DeviceState state, const char* cause = __builtin_FUNCTION());
 
     /**
      * Schedule a callback to be executed in the main task
+     * Control lane callbacks run before any queued UI lane callback.
      */
-    void Schedule(std::function<void()>&& callback);
+    void Schedule(InlineTask&& callback, ScheduleLane lane = kScheduleLaneControl);
+
+    /**
+     * Schedule from an interrupt handler, the callback must fit in InlineTask
+     * Returns false if the lane is full and the callback was dropped
+     */
+    template <typename F>
+    bool ScheduleFromIsr(F&& callback, ScheduleLane lane = kScheduleLaneControl) {
+        static_assert(InlineTask::FitsInline<std::decay_t<F>>(), "ISR callbacks must not allocate");
+        return ScheduleTaskFromIsr(InlineTask(std::forward<F>(callback)), lane);
+    }
+
+    MainTaskQueueStats GetMainTaskStats() const { return main_tasks_.stats(); }
+
+    /**
+     * Boot steps with their core, start and duration, the critical path and later milestones
+     */
+    std::string GetBootTimelineJson() const { return boot_sequence_.GetTimelineJson(); }
+    std::string GetStateTraceJson() const { return state_machine_.GetTraceJson(); }
 
     /**
      * Alert with status, message, emotion and optional sound
@@ -105,9 +130,14 @@ public:
 
     void Reboot();
     void WakeWordInvoke(const std::string& wake_word);
-    bool UpgradeFirmware(const std::string& url, const std::string& version = "");
+    bool UpgradeFirmware(const std::string& url, const std::string& version = "", const std::string& sha256 = "",
+        const std::string& delta_url = "");
     bool CanEnterSleepMode();
-    void SendMcpMessage(const std::string& payload);
+    void SendMcpMessage(std::string payload);
+    /**
+     * Send an MCP message produced in pieces by next(), see Protocol::SendMcpMessageStream()
+     */
+    void SendMcpMessageStream(std::function<bool(std::string& piece)> next);
     void SetAecMode(AecMode mode);
     AecMode GetAecMode() const { return aec_mode_; }
     void PlaySound(const std::string_view& sound);
@@ -124,9 +154,11 @@ private:
     Application();
     ~Application();
 
-    std::mutex mutex_;
-    std::deque<std::function<void()>> main_tasks_;
+    MainTaskQueue main_tasks_;
+    uint32_t reported_task_overflows_ = 0;
     std::unique_ptr<Protocol> protocol_;
+    // Held while replacing protocol_ or sending uplink audio through it
+    std::mutex protocol_mutex_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
     DeviceStateMachine state_machine_;
@@ -135,13 +167,20 @@ private:
     std::string last_error_message_;
     AudioService audio_service_;
     std::unique_ptr<Ota> ota_;
+    std::string network_name_;
+    BootSequence boot_sequence_;
 
     bool has_server_time_ = false;
     bool aborted_ = false;
     bool assets_version_checked_ = false;
+    bool assets_applied_ = false;
     bool play_popup_on_listening_ = false;  // Flag to play popup sound after state changes to listening
     int clock_ticks_ = 0;
+    // Uplink counters of the last audio feedback from the server, see HandleAudioFeedbackMessage()
+    uint32_t feedback_sequence_ = 0;
+    uint32_t feedback_received_ = 0;
     TaskHandle_t activation_task_handle_ = nullptr;
+    TaskHandle_t audio_uplink_task_handle_ = nullptr;
 
 
     // Event handlers
@@ -154,10 +193,35 @@ private:
     void HandleActivationDoneEvent();
     void HandleWakeWordDetectedEvent();
 
+    // Incoming server messages, dispatched on "type"
+    void HandleIncomingJson(const JsonValue& root);
+    void HandleTtsMessage(const JsonValue& root);
+    void HandleSttMessage(const JsonValue& root);
+    void HandleLlmMessage(const JsonValue& root);
+    void HandleMcpMessage(const JsonValue& root);
+    void HandleSystemMessage(const JsonValue& root);
+    void HandleAlertMessage(const JsonValue& root);
+    void HandleAudioFeedbackMessage(const JsonValue& root);
+#if CONFIG_RECEIVE_CUSTOM_MESSAGE
+    void HandleCustomMessage(const JsonValue& root);
+#endif
+
+    // Sets main event bits, stamped for the main loop profiler
+    void SetMainEvents(EventBits_t bits) {
+        MAIN_LOOP_PROFILE_MARK(bits);
+        xEventGroupSetBits(event_group_, bits);
+    }
+    bool ScheduleTaskFromIsr(InlineTask&& callback, ScheduleLane lane);
+    void RunScheduledTasks();
+
     // Activation task (runs in background)
     void ActivationTask();
 
+    // Sends encoded audio from the send queue, off the main task
+    void AudioUplinkTask();
+
     // Helper methods
+    void ApplyAssets();
     void CheckAssetsVersion();
     void CheckNewVersion();
     void InitializeProtocol();
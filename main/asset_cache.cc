@@ -0,0 +1,62 @@
+#include "asset_cache.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+#define TAG "AssetCache"
+
+std::shared_ptr<const char> AssetCache::Get(const std::string& name, size_t size, const Loader& load) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->name == name) {
+            hits_++;
+            entries_.splice(entries_.begin(), entries_, it);
+            return entries_.front().data;
+        }
+    }
+
+    misses_++;
+    Evict(size);
+    auto buffer = (char*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (buffer == nullptr) {
+        buffer = (char*)heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+    }
+    if (buffer == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for %s", size, name.c_str());
+        return nullptr;
+    }
+    std::shared_ptr<char> data(buffer, heap_caps_free);
+
+    auto start_time = esp_timer_get_time();
+    if (!load(buffer, size)) {
+        ESP_LOGE(TAG, "Failed to load %s", name.c_str());
+        return nullptr;
+    }
+    entries_.push_front(Entry{ name, data, size });
+    bytes_ += size;
+    ESP_LOGI(TAG, "Loaded %s (%u bytes) in %d ms, %u bytes cached, %lu hits / %lu misses", name.c_str(), size,
+        int((esp_timer_get_time() - start_time) / 1000), bytes_, hits_, misses_);
+    return data;
+}
+
+void AssetCache::Evict(size_t incoming) {
+    for (auto it = entries_.end(); it != entries_.begin() && bytes_ + incoming > budget_;) {
+        --it;
+        if (it->data.use_count() > 1) {
+            continue;
+        }
+        ESP_LOGD(TAG, "Evicting %s (%u bytes)", it->name.c_str(), it->size);
+        bytes_ -= it->size;
+        it = entries_.erase(it);
+    }
+    if (bytes_ + incoming > budget_) {
+        ESP_LOGW(TAG, "%u bytes in use exceed the budget of %u bytes", bytes_ + incoming, budget_);
+    }
+}
+
+void AssetCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    bytes_ = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef ASSET_CACHE_H
+#define ASSET_CACHE_H
+
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * AssetCache - Decompressed assets in PSRAM, least recently used first out under a byte budget
+ *
+ * Get() hands out shared pointers. An entry is only evicted while the cache holds the last
+ * reference, so data in use stays valid and the budget can be exceeded while everything is in
+ * use. A dropped entry that is still referenced is freed with its last reference.
+ */
+class AssetCache {
+public:
+    /**
+     * Fills the buffer of the given size, false if the data is corrupted
+     */
+    using Loader = std::function<bool(char* buffer, size_t size)>;
+
+    explicit AssetCache(size_t budget) : budget_(budget) {}
+
+    std::shared_ptr<const char> Get(const std::string& name, size_t size, const Loader& load);
+    void Clear();
+
+private:
+    struct Entry {
+        std::string name;
+        std::shared_ptr<char> data;
+        size_t size;
+    };
+
+    size_t budget_;
+    size_t bytes_ = 0;
+    uint32_t hits_ = 0;
+    uint32_t misses_ = 0;
+    // Most recently used first
+    std::list<Entry> entries_;
+    std::mutex mutex_;
+
+    void Evict(size_t incoming);
+};
+
+#endif // ASSET_CACHE_H
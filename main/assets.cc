@@ -2,6 +2,12 @@
 #include "board.h"
 #include "display.h"
 #include "application.h"
+#include "connection_cache.h"
+#include "settings.h"
+#include "settings_store.h"
+#include "write_pipeline.h"
+#include "lz4_block.h"
+#include "delta_patcher.h"
 #include "lvgl_theme.h"
 #include "emote_display.h"
 #include "expression_emote.h"
@@ -12,11 +18,18 @@
 
 #include <esp_log.h>
 #include <esp_timer.h>
+#include <esp_rom_crc.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <cbin_font.h>
+#include <cstring>
+#include <algorithm>
+#include <string_view>
 
 
 #define TAG "Assets"
 #define PARTITION_LABEL "assets"
+#define CHUNK_DIGESTS_MAGIC 0x43524341 // "ACRC"
 
 struct mmap_assets_table {
     char asset_name[32];          /*!< Name of the asset */
@@ -26,6 +39,19 @@ struct mmap_assets_table {
     uint16_t asset_height;        /*!< Height of the asset */
 };
 
+// Follows the image at 12 + stored_len rounded up to 4 bytes, then the crc32 of the digests
+struct assets_chunk_digests {
+    uint32_t magic;               /*!< CHUNK_DIGESTS_MAGIC */
+    uint32_t chunk_size;          /*!< Bytes covered by each digest */
+    uint32_t chunk_count;         /*!< Number of digests */
+    uint32_t chunk_crc[];         /*!< CRC32 of each chunk of the image, header included */
+};
+
+// The name is only NUL terminated if it is shorter than the field
+static std::string_view AssetName(const mmap_assets_table& item) {
+    return std::string_view(item.asset_name, strnlen(item.asset_name, sizeof(item.asset_name)));
+}
+
 Assets::Assets() {
 #if HAVE_LVGL
     strategy_ = std::make_unique<Assets::LvglStrategy>();
@@ -67,6 +93,10 @@ bool Assets::GetAssetData(const std::string& name, void*& ptr, size_t& size) {
     return strategy_ ? strategy_->GetAssetData(this, name, ptr, size) : false;
 }
 
+std::shared_ptr<const char> Assets::AcquireAssetData(const std::string& name, size_t& size) {
+    return strategy_ ? strategy_->AcquireAssetData(this, name, size) : nullptr;
+}
+
 bool Assets::LoadSrmodelsFromIndex(Assets* assets, cJSON* root) {
     void* ptr = nullptr;
     size_t size = 0;
@@ -129,6 +159,8 @@ uint32_t Assets::LvglStrategy::CalculateChecksum(const char* data, uint32_t leng
 bool Assets::LvglStrategy::InitializePartition(Assets* assets) {
     assets->partition_valid_ = false;
     assets_.clear();
+    table_ = nullptr;
+    table_files_ = 0;
 
     if (!Assets::FindPartition(assets)) {
         return false;
@@ -160,30 +192,222 @@ bool Assets::LvglStrategy::InitializePartition(Assets* assets) {
         return false;
     }
 
+    if (stored_files > stored_len / sizeof(mmap_assets_table)) {
+        ESP_LOGE(TAG, "The stored_files (%lu) does not fit in the stored_len (0x%lx)", stored_files, stored_len);
+        return false;
+    }
+
     auto start_time = esp_timer_get_time();
-    uint32_t calculated_checksum = CalculateChecksum(mmap_root_ + 12, stored_len);
+    checksum_valid_ = VerifyPartition(assets, stored_files, stored_chksum, stored_len);
     auto end_time = esp_timer_get_time();
-    ESP_LOGI(TAG, "The checksum calculation time is %d ms", int((end_time - start_time) / 1000));
-
-    if (calculated_checksum != stored_chksum) {
-        ESP_LOGE(TAG, "The calculated checksum (0x%lx) does not match the stored checksum (0x%lx)", calculated_checksum, stored_chksum);
+    ESP_LOGI(TAG, "The partition verification time is %d ms", int((end_time - start_time) / 1000));
+    if (!checksum_valid_) {
         return false;
     }
 
-    checksum_valid_ = true;
+    // The pack scripts sort the table by name, older packs are indexed in a map
+    auto table = (const mmap_assets_table*)(mmap_root_ + 12);
+    table_files_ = stored_files;
+    bool sorted = true;
+    for (uint32_t i = 1; i < stored_files && sorted; i++) {
+        sorted = AssetName(table[i - 1]) < AssetName(table[i]);
+    }
+    if (sorted) {
+        table_ = table;
+        ESP_LOGI(TAG, "The asset table of %lu files is sorted, searching it in place", stored_files);
+        return checksum_valid_;
+    }
 
     for (uint32_t i = 0; i < stored_files; i++) {
-        auto item = (const mmap_assets_table*)(mmap_root_ + 12 + i * sizeof(mmap_assets_table));
+        auto item = &table[i];
         auto asset = Asset{
             .size = static_cast<size_t>(item->asset_size),
             .offset = static_cast<size_t>(12 + sizeof(mmap_assets_table) * stored_files + item->asset_offset)
         };
-        assets_[item->asset_name] = asset;
+        assets_[std::string(AssetName(*item))] = asset;
     }
     return checksum_valid_;
 }
 
+bool Assets::LvglStrategy::VerifyPartition(Assets* assets, uint32_t stored_files, uint32_t stored_chksum, uint32_t stored_len) {
+    chunk_crcs_ = nullptr;
+    chunk_verified_.clear();
+    image_size_ = 12 + stored_len;
+
+    uint32_t digests_crc = 0;
+    bool has_digests = LoadChunkDigests(assets, stored_len, digests_crc);
+
+    // Any rewrite of the partition changes the header or the digests
+    char key[40];
+    snprintf(key, sizeof(key), "%08lx%08lx%08lx%08lx", stored_files, stored_chksum, stored_len, digests_crc);
+    verified_key_ = key;
+    {
+        Settings settings("assets");
+        if (settings.GetString("verified") == verified_key_) {
+            ESP_LOGI(TAG, "The partition was verified on an earlier boot");
+            chunk_crcs_ = nullptr;
+            return true;
+        }
+    }
+
+    if (!has_digests) {
+        // Packs from older scripts only carry the byte sum
+        uint32_t calculated_checksum = CalculateChecksum(mmap_root_ + 12, stored_len);
+        if (calculated_checksum != stored_chksum) {
+            ESP_LOGE(TAG, "The calculated checksum (0x%lx) does not match the stored checksum (0x%lx)", calculated_checksum, stored_chksum);
+            return false;
+        }
+        Settings settings("assets", true);
+        settings.SetString("verified", verified_key_);
+        return true;
+    }
+
+#if CONFIG_ASSETS_LAZY_VERIFY
+    return VerifyChunks(0, 12 + sizeof(mmap_assets_table) * stored_files);
+#else
+    return VerifyChunks(0, image_size_);
+#endif
+}
+
+bool Assets::LvglStrategy::LoadChunkDigests(Assets* assets, uint32_t stored_len, uint32_t& digests_crc) {
+    size_t offset = (12 + stored_len + 3) & ~3;
+    size_t partition_size = assets->partition_->size;
+    if (offset + sizeof(assets_chunk_digests) > partition_size) {
+        return false;
+    }
+    auto digests = (const assets_chunk_digests*)(mmap_root_ + offset);
+    if (digests->magic != CHUNK_DIGESTS_MAGIC || digests->chunk_size == 0) {
+        return false;
+    }
+    uint32_t chunk_count = (image_size_ + digests->chunk_size - 1) / digests->chunk_size;
+    size_t length = sizeof(assets_chunk_digests) + chunk_count * sizeof(uint32_t);
+    if (digests->chunk_count != chunk_count || offset + length + sizeof(uint32_t) > partition_size) {
+        ESP_LOGW(TAG, "Ignoring chunk digests that do not match the image");
+        return false;
+    }
+    digests_crc = esp_rom_crc32_le(0, (const uint8_t*)digests, length);
+    if (digests_crc != *(const uint32_t*)(mmap_root_ + offset + length)) {
+        ESP_LOGW(TAG, "Ignoring corrupted chunk digests");
+        return false;
+    }
+
+    chunk_crcs_ = digests->chunk_crc;
+    chunk_size_ = digests->chunk_size;
+    chunk_count_ = chunk_count;
+    chunks_left_ = chunk_count;
+    chunk_verified_.assign(chunk_count, 0);
+    return true;
+}
+
+bool Assets::LvglStrategy::VerifyChunks(size_t begin, size_t end) {
+    std::lock_guard<std::mutex> lock(verify_mutex_);
+    if (chunk_crcs_ == nullptr) {
+        return true;
+    }
+
+    for (uint32_t i = begin / chunk_size_; i < chunk_count_ && (size_t)i * chunk_size_ < end; i++) {
+        if (chunk_verified_[i]) {
+            continue;
+        }
+        size_t offset = (size_t)i * chunk_size_;
+        size_t length = std::min<size_t>(chunk_size_, image_size_ - offset);
+        uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)mmap_root_ + offset, length);
+        if (crc != chunk_crcs_[i]) {
+            ESP_LOGE(TAG, "The chunk at 0x%x is corrupted (crc 0x%08lx, expected 0x%08lx)", offset, crc, chunk_crcs_[i]);
+            return false;
+        }
+        chunk_verified_[i] = 1;
+        chunks_left_--;
+    }
+
+    if (chunks_left_ == 0) {
+        ESP_LOGI(TAG, "All %lu chunks of the partition are verified", chunk_count_);
+        Settings settings("assets", true);
+        settings.SetString("verified", verified_key_);
+        chunk_crcs_ = nullptr;
+        chunk_verified_.clear();
+    }
+    return true;
+}
+
+// Checks the first chunk not verified yet, false once none is left or one is corrupted
+bool Assets::LvglStrategy::VerifyNextChunk() {
+    size_t begin;
+    {
+        std::lock_guard<std::mutex> lock(verify_mutex_);
+        if (chunk_crcs_ == nullptr) {
+            return false;
+        }
+        auto it = std::find(chunk_verified_.begin(), chunk_verified_.end(), 0);
+        if (it == chunk_verified_.end()) {
+            return false;
+        }
+        begin = (size_t)(it - chunk_verified_.begin()) * chunk_size_;
+    }
+    return VerifyChunks(begin, begin + 1);
+}
+
+void Assets::LvglStrategy::StartBackgroundVerify() {
+    if (chunk_crcs_ == nullptr || background_verify_running_.exchange(true)) {
+        return;
+    }
+    // Chunks of files Apply() never reads would otherwise keep the partition unverified on every boot
+    if (xTaskCreate([](void* arg) {
+        auto self = static_cast<LvglStrategy*>(arg);
+        vTaskDelay(pdMS_TO_TICKS(ASSETS_VERIFY_TASK_DELAY_MS));
+        auto start_time = esp_timer_get_time();
+        int chunks = 0;
+        // One chunk per call, so asset reads in between only wait for the chunk being checked
+        while (self->VerifyNextChunk()) {
+            chunks++;
+            vTaskDelay(1);
+        }
+        ESP_LOGI(TAG, "Checked %d chunks in the background in %d ms", chunks, int((esp_timer_get_time() - start_time) / 1000));
+        self->background_verify_running_ = false;
+        vTaskDelete(NULL);
+    }, "assets_verify", ASSETS_VERIFY_TASK_STACK_SIZE, this, ASSETS_VERIFY_TASK_PRIORITY, nullptr) != pdPASS) {
+        ESP_LOGW(TAG, "Failed to create the background verify task");
+        background_verify_running_ = false;
+    }
+}
+
+bool Assets::LvglStrategy::VerifyAll(Assets* assets) {
+    return checksum_valid_ && VerifyChunks(0, image_size_);
+}
+
+bool Assets::LvglStrategy::FindAsset(const std::string& name, Asset& asset) const {
+    if (table_ == nullptr) {
+        auto it = assets_.find(name);
+        if (it == assets_.end()) {
+            return false;
+        }
+        asset = it->second;
+        return true;
+    }
+
+    // Names are NUL padded to the field, longer ones can not be in the table
+    if (name.size() > sizeof(mmap_assets_table::asset_name)) {
+        return false;
+    }
+    auto end = table_ + table_files_;
+    auto item = std::lower_bound(table_, end, name, [](const mmap_assets_table& item, const std::string& name) {
+        return strncmp(item.asset_name, name.c_str(), sizeof(item.asset_name)) < 0;
+    });
+    if (item == end || strncmp(item->asset_name, name.c_str(), sizeof(item->asset_name)) != 0) {
+        return false;
+    }
+    asset.size = item->asset_size;
+    asset.offset = 12 + sizeof(mmap_assets_table) * table_files_ + item->asset_offset;
+    return true;
+}
+
 void Assets::LvglStrategy::UnApplyPartition(Assets* assets) {
+    {
+        // Stops the background check before the mapping goes away
+        std::lock_guard<std::mutex> lock(verify_mutex_);
+        chunk_crcs_ = nullptr;
+        chunk_verified_.clear();
+    }
     if (mmap_handle_ != 0) {
         esp_partition_munmap(mmap_handle_);
         mmap_handle_ = 0;
@@ -191,25 +415,78 @@ void Assets::LvglStrategy::UnApplyPartition(Assets* assets) {
     }
     checksum_valid_ = false;
     assets_.clear();
+    table_ = nullptr;
+    table_files_ = 0;
+    {
+        std::lock_guard<std::mutex> lock(pinned_mutex_);
+        pinned_.clear();
+    }
+    cache_.Clear();
     (void)assets; // Unused parameter
 }
 
-bool Assets::LvglStrategy::GetAssetData(Assets* assets, const std::string& name, void*& ptr, size_t& size) {
-    auto asset = assets_.find(name);
-    if (asset == assets_.end()) {
-        return false;
+const char* Assets::LvglStrategy::LoadAsset(const std::string& name, size_t& size, std::shared_ptr<const char>& owner) {
+    Asset asset;
+    if (!FindAsset(name, asset)) {
+        return nullptr;
+    }
+    if (!VerifyChunks(asset.offset, asset.offset + 2 + asset.size)) {
+        ESP_LOGE(TAG, "The asset %s is corrupted", name.c_str());
+        return nullptr;
+    }
+    auto data = (const char*)(mmap_root_ + asset.offset);
+    if (data[0] == 'Z' && data[1] == 'Z') {
+        size = asset.size;
+        return data + 2;
     }
-    auto data = (const char*)(mmap_root_ + asset->second.offset);
-    if (data[0] != 'Z' || data[1] != 'Z') {
+
+    // 'ZC', the decompressed size and an LZ4 block
+    if (data[0] != 'Z' || data[1] != 'C' || asset.size < 4) {
         ESP_LOGE(TAG, "The asset %s is not valid with magic %02x%02x", name.c_str(), data[0], data[1]);
+        return nullptr;
+    }
+    uint32_t raw_size;
+    memcpy(&raw_size, data + 2, sizeof(raw_size));
+    auto compressed = (const uint8_t*)data + 6;
+    size_t compressed_size = asset.size - 4;
+    owner = cache_.Get(name, raw_size, [compressed, compressed_size](char* buffer, size_t size) {
+        return Lz4DecompressBlock(compressed, compressed_size, (uint8_t*)buffer, size);
+    });
+    if (owner == nullptr) {
+        ESP_LOGE(TAG, "The asset %s failed to decompress", name.c_str());
+        return nullptr;
+    }
+    size = raw_size;
+    return owner.get();
+}
+
+bool Assets::LvglStrategy::GetAssetData(Assets* assets, const std::string& name, void*& ptr, size_t& size) {
+    std::shared_ptr<const char> owner;
+    auto data = LoadAsset(name, size, owner);
+    if (data == nullptr) {
         return false;
     }
+    if (owner != nullptr) {
+        std::lock_guard<std::mutex> lock(pinned_mutex_);
+        if (std::find(pinned_.begin(), pinned_.end(), owner) == pinned_.end()) {
+            pinned_.push_back(std::move(owner));
+        }
+    }
 
-    ptr = static_cast<void*>(const_cast<char*>(data + 2));
-    size = asset->second.size;
+    ptr = static_cast<void*>(const_cast<char*>(data));
     return true;
 }
 
+std::shared_ptr<const char> Assets::LvglStrategy::AcquireAssetData(Assets* assets, const std::string& name, size_t& size) {
+    std::shared_ptr<const char> owner;
+    auto data = LoadAsset(name, size, owner);
+    if (data == nullptr || owner != nullptr) {
+        return owner;
+    }
+    // Mapped data lives until the partition is unmapped
+    return std::shared_ptr<const char>(data, [](const char*) {});
+}
+
 bool Assets::LvglStrategy::Apply(Assets* assets) {
     void* ptr = nullptr;
     size_t size = 0;
@@ -226,7 +503,8 @@ bool Assets::LvglStrategy::Apply(Assets* assets) {
 
     cJSON* version = cJSON_GetObjectItem(root, "version");
     if (cJSON_IsNumber(version)) {
-        if (version->valuedouble > 1) {
+        // Version 2 packs may hold compressed entries
+        if (version->valuedouble > 2) {
             ESP_LOGE(TAG, "The assets version %d is not supported, please upgrade the firmware", version->valueint);
             return false;
         }
@@ -269,11 +547,12 @@ bool Assets::LvglStrategy::Apply(Assets* assets) {
                 cJSON* file = cJSON_GetObjectItem(emoji, "file");
                 cJSON* eaf = cJSON_GetObjectItem(emoji, "eaf");
                 if (cJSON_IsString(name) && cJSON_IsString(file) && (NULL== eaf)) {
-                    if (!assets->GetAssetData(file->valuestring, ptr, size)) {
+                    auto data = assets->AcquireAssetData(file->valuestring, size);
+                    if (data == nullptr) {
                         ESP_LOGE(TAG, "Emoji %s image file %s is not found", name->valuestring, file->valuestring);
                         continue;
                     }
-                    custom_emoji_collection->AddEmoji(name->valuestring, new LvglRawImage(ptr, size));
+                    custom_emoji_collection->AddEmoji(name->valuestring, new LvglRawImage(std::move(data), size));
                 }
             }
         }
@@ -300,11 +579,12 @@ bool Assets::LvglStrategy::Apply(Assets* assets) {
                 light_theme->set_chat_background_color(LvglTheme::ParseColor(background_color->valuestring));
             }
             if (cJSON_IsString(background_image)) {
-                if (!assets->GetAssetData(background_image->valuestring, ptr, size)) {
+                auto data = assets->AcquireAssetData(background_image->valuestring, size);
+                if (data == nullptr) {
                     ESP_LOGE(TAG, "The background image file %s is not found", background_image->valuestring);
                     return false;
                 }
-                auto background_image = std::make_shared<LvglCBinImage>(ptr);
+                auto background_image = std::make_shared<LvglCBinImage>(std::move(data));
                 light_theme->set_background_image(background_image);
             }
         }
@@ -321,11 +601,12 @@ bool Assets::LvglStrategy::Apply(Assets* assets) {
                 dark_theme->set_chat_background_color(LvglTheme::ParseColor(background_color->valuestring));
             }
             if (cJSON_IsString(background_image)) {
-                if (!assets->GetAssetData(background_image->valuestring, ptr, size)) {
+                auto data = assets->AcquireAssetData(background_image->valuestring, size);
+                if (data == nullptr) {
                     ESP_LOGE(TAG, "The background image file %s is not found", background_image->valuestring);
                     return false;
                 }
-                auto background_image = std::make_shared<LvglCBinImage>(ptr);
+                auto background_image = std::make_shared<LvglCBinImage>(std::move(data));
                 dark_theme->set_background_image(background_image);
             }
         }
@@ -351,6 +632,9 @@ bool Assets::LvglStrategy::Apply(Assets* assets) {
     }
     
     cJSON_Delete(root);
+#if CONFIG_ASSETS_LAZY_VERIFY
+    StartBackgroundVerify();
+#endif
     return true;
 }
 #endif // HAVE_LVGL
@@ -428,123 +712,372 @@ bool Assets::Download(std::string url, std::function<void(int progress, size_t s
     // 取消当前资源分区的内存映射
     UnApplyPartition();
 
-    // 下载新的资源文件
+    // A download of the same url that stopped part way continues from the last saved block
+    size_t offset = 0;
+    size_t total_size = 0;
+    {
+        Settings settings("assets", true);
+        settings.EraseKey("verified");
+        if (settings.GetString("dl_url") == url) {
+            offset = settings.GetInt("dl_done");
+            total_size = settings.GetInt("dl_size");
+            settings.SetInt("dl_tries", settings.GetInt("dl_tries") + 1);
+        } else {
+            settings.SetString("dl_url", url);
+            settings.SetInt("dl_done", 0);
+            settings.SetInt("dl_size", 0);
+            settings.SetInt("dl_tries", 1);
+        }
+    }
+    // The partition is erased next, a reboot from here on has to find the download recorded
+    SettingsStore::GetInstance().Flush();
+
+    size_t erased_end = offset;
+    size_t start_offset = offset;
+    auto start_time = esp_timer_get_time();
+    for (int attempt = 1; !DownloadRange(url, offset, total_size, erased_end, progress_callback); attempt++) {
+        if (attempt == ASSETS_DOWNLOAD_MAX_ATTEMPTS) {
+            ESP_LOGE(TAG, "Failed to download assets after %d attempts, stopped at %u bytes", attempt, offset);
+            return false;
+        }
+        ESP_LOGW(TAG, "Download stopped at %u of %u bytes, retrying", offset, total_size);
+        vTaskDelay(pdMS_TO_TICKS(1000 * attempt));
+    }
+
+    int elapsed_ms = (esp_timer_get_time() - start_time) / 1000;
+    ESP_LOGI(TAG, "Assets download completed, %u bytes in %d ms (%d KB/s), resumed at %u",
+             total_size - start_offset, elapsed_ms, int((total_size - start_offset) / std::max(elapsed_ms, 1)), start_offset);
+    ClearDownloadProgress();
+
+    // 重新初始化资源分区
+    if (!InitializePartition()) {
+        ESP_LOGE(TAG, "Failed to re-initialize assets partition");
+        return false;
+    }
+
+    // The image may be stitched from several sessions, check all of it before it is applied
+    if (!strategy_->VerifyAll(this)) {
+        ESP_LOGE(TAG, "The downloaded assets are corrupted");
+        return false;
+    }
+    return true;
+}
+
+bool Assets::DownloadRange(const std::string& url, size_t& offset, size_t& total_size, size_t& erased_end,
+    const std::function<void(int progress, size_t speed)>& progress_callback) {
     auto network = Board::GetInstance().GetNetwork();
     auto http = network->CreateHttp(0);
-    
+    if (offset > 0) {
+        http->SetHeader("Range", "bytes=" + std::to_string(offset) + "-");
+    }
+
+    auto connect_timer = ConnectionCache::GetInstance().TimeConnect(url);
     if (!http->Open("GET", url)) {
         ESP_LOGE(TAG, "Failed to open HTTP connection");
         return false;
     }
-
-    if (http->GetStatusCode() != 200) {
-        ESP_LOGE(TAG, "Failed to get assets, status code: %d", http->GetStatusCode());
+    connect_timer.Finish(true);
+
+    int status_code = http->GetStatusCode();
+    size_t body_length = http->GetBodyLength();
+    if (status_code == 206 && offset > 0) {
+        if (total_size != 0 && offset + body_length != total_size) {
+            ESP_LOGW(TAG, "The assets file changed size, downloading from the start");
+            offset = 0;
+            total_size = 0;
+            erased_end = 0;
+            return false;
+        }
+        total_size = offset + body_length;
+        ESP_LOGI(TAG, "Resuming the download at %u of %u bytes", offset, total_size);
+    } else if (status_code == 200) {
+        if (offset > 0) {
+            ESP_LOGW(TAG, "The server ignored the range, downloading from the start");
+        }
+        offset = 0;
+        erased_end = 0;
+        total_size = body_length;
+    } else {
+        ESP_LOGE(TAG, "Failed to get assets, status code: %d", status_code);
         return false;
     }
 
-    size_t content_length = http->GetBodyLength();
-    if (content_length == 0) {
+    if (total_size == 0) {
         ESP_LOGE(TAG, "Failed to get content length");
         return false;
     }
 
-    if (content_length > partition_->size) {
-        ESP_LOGE(TAG, "Assets file size (%u) is larger than partition size (%lu)", content_length, partition_->size);
+    if (total_size > partition_->size) {
+        ESP_LOGE(TAG, "Assets file size (%u) is larger than partition size (%lu)", total_size, partition_->size);
         return false;
     }
+    if (offset == 0) {
+        Settings settings("assets", true);
+        settings.SetInt("dl_size", total_size);
+        SettingsStore::GetInstance().Flush();
+    }
 
     // 定义扇区大小为4KB（ESP32的标准扇区大小）
     const size_t SECTOR_SIZE = esp_partition_get_main_flash_sector_size();
-    
-    // 计算需要擦除的扇区数量
-    size_t sectors_to_erase = (content_length + SECTOR_SIZE - 1) / SECTOR_SIZE; // 向上取整
-    size_t total_erase_size = sectors_to_erase * SECTOR_SIZE;
-    
-    ESP_LOGI(TAG, "Sector size: %u, content length: %u, sectors to erase: %u, total erase size: %u", 
-             SECTOR_SIZE, content_length, sectors_to_erase, total_erase_size);
-    
-    // 写入新的资源文件到分区，一边erase一边写入
-    char buffer[512];
-    size_t total_written = 0;
-    size_t recent_written = 0;
-    size_t current_sector = 0;
-    auto last_calc_time = esp_timer_get_time();
-    
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
-            return false;
-        }
-
-        if (ret == 0) {
-            break;
-        }
-
-        // 检查是否需要擦除新的扇区
-        size_t write_end_offset = total_written + ret;
-        size_t needed_sectors = (write_end_offset + SECTOR_SIZE - 1) / SECTOR_SIZE;
-        
-        // 擦除需要的新扇区
-        while (current_sector < needed_sectors) {
-            size_t sector_start = current_sector * SECTOR_SIZE;
-            size_t sector_end = (current_sector + 1) * SECTOR_SIZE;
-            
-            // 确保擦除范围不超过分区大小
-            if (sector_end > partition_->size) {
-                ESP_LOGE(TAG, "Sector end (%u) exceeds partition size (%lu)", sector_end, partition_->size);
-                return false;
+    const size_t base = offset;
+    WritePipeline pipeline(ASSETS_DOWNLOAD_BUFFER_SIZE, ASSETS_DOWNLOAD_BUFFER_COUNT,
+        [this, base, SECTOR_SIZE, &erased_end](size_t position, const char* data, size_t size) {
+        size_t address = base + position;
+        // Whole blocks are erased in one go where aligned, that is much faster than sector by sector
+        while (erased_end < address + size) {
+            size_t erase_size = SECTOR_SIZE;
+            if (erased_end % ASSETS_DOWNLOAD_BLOCK_SIZE == 0 && erased_end + ASSETS_DOWNLOAD_BLOCK_SIZE <= partition_->size) {
+                erase_size = ASSETS_DOWNLOAD_BLOCK_SIZE;
             }
-            
-            ESP_LOGD(TAG, "Erasing sector %u (offset: %u, size: %u)", current_sector, sector_start, SECTOR_SIZE);
-            esp_err_t err = esp_partition_erase_range(partition_, sector_start, SECTOR_SIZE);
+            esp_err_t err = esp_partition_erase_range(partition_, erased_end, erase_size);
             if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to erase sector %u at offset %u: %s", current_sector, sector_start, esp_err_to_name(err));
+                ESP_LOGE(TAG, "Failed to erase %u bytes at offset %u: %s", erase_size, erased_end, esp_err_to_name(err));
                 return false;
             }
-            
-            current_sector++;
+            erased_end += erase_size;
         }
 
         // 写入数据到分区
-        esp_err_t err = esp_partition_write(partition_, total_written, buffer, ret);
+        esp_err_t err = esp_partition_write(partition_, address, data, size);
         if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to write to assets partition at offset %u: %s", total_written, esp_err_to_name(err));
+            ESP_LOGE(TAG, "Failed to write to assets partition at offset %u: %s", address, esp_err_to_name(err));
             return false;
         }
+        if ((address + size) % ASSETS_DOWNLOAD_BLOCK_SIZE == 0) {
+            Settings settings("assets", true);
+            settings.SetInt("dl_done", address + size);
+        }
+        return true;
+    });
+
+    if (xTaskCreate([](void* arg) {
+        static_cast<WritePipeline*>(arg)->RunWriter();
+        vTaskDelete(NULL);
+    }, "assets_writer", ASSETS_DOWNLOAD_WRITER_STACK_SIZE, &pipeline, ASSETS_DOWNLOAD_WRITER_PRIORITY, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the assets writer task");
+        return false;
+    }
 
-        total_written += ret;
-        recent_written += ret;
+    // The reader fills whole buffers, a partial one is dropped on error and read again on retry
+    bool read_ok = true;
+    size_t received = offset;
+    size_t recent_received = 0;
+    auto last_calc_time = esp_timer_get_time();
+    while (received < total_size) {
+        char* buffer = pipeline.Acquire();
+        if (buffer == nullptr) {
+            break;
+        }
+        size_t length = std::min(pipeline.buffer_size(), total_size - received);
+        size_t filled = 0;
+        while (filled < length) {
+            int ret = http->Read(buffer + filled, length - filled);
+            if (ret <= 0) {
+                ESP_LOGE(TAG, "Failed to read HTTP data at %u: %s", received + filled, ret < 0 ? esp_err_to_name(ret) : "closed");
+                read_ok = false;
+                break;
+            }
+            filled += ret;
+        }
+        if (!read_ok) {
+            break;
+        }
+        pipeline.Submit(filled);
+        received += filled;
+        recent_received += filled;
 
         // 计算进度和速度
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || total_written == content_length || ret == 0) {
-            size_t progress = total_written * 100 / content_length;
-            size_t speed = recent_written; // 每秒的字节数
-            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %u B/s, Sectors erased: %u", 
-                     progress, total_written, content_length, speed, current_sector);
+        if (esp_timer_get_time() - last_calc_time >= 1000000 || received == total_size) {
+            size_t progress = received * 100 / total_size;
+            size_t speed = recent_received; // 每秒的字节数
+            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %u B/s", progress, received, total_size, speed);
             if (progress_callback) {
                 progress_callback(progress, speed);
             }
             last_calc_time = esp_timer_get_time();
-            recent_written = 0; // 重置最近写入的字节数
+            recent_received = 0;
         }
     }
-    
     http->Close();
 
-    if (total_written != content_length) {
-        ESP_LOGE(TAG, "Downloaded size (%u) does not match expected size (%u)", total_written, content_length);
+    bool write_ok = pipeline.Finish();
+    auto stats = pipeline.stats();
+    offset = base + stats.bytes;
+    ESP_LOGI(TAG, "Wrote %u bytes, flash busy %d ms, reader waited %d ms for the flash, writer waited %d ms for the network",
+             stats.bytes, int(stats.write_us / 1000), int(stats.reader_wait_us / 1000), int(stats.writer_wait_us / 1000));
+    return read_ok && write_ok && offset == total_size;
+}
+
+void Assets::ClearDownloadProgress() {
+    Settings settings("assets", true);
+    settings.EraseKey("dl_url");
+    settings.EraseKey("dl_done");
+    settings.EraseKey("dl_size");
+    settings.EraseKey("dl_tries");
+}
+
+bool Assets::CalculatePartitionCrc(size_t size, uint32_t& crc) {
+    std::unique_ptr<char[]> buffer(new char[ASSETS_DOWNLOAD_BUFFER_SIZE]);
+    crc = 0;
+    for (size_t offset = 0; offset < size; offset += ASSETS_DOWNLOAD_BUFFER_SIZE) {
+        size_t length = std::min((size_t)ASSETS_DOWNLOAD_BUFFER_SIZE, size - offset);
+        esp_err_t err = esp_partition_read(partition_, offset, buffer.get(), length);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read assets partition at offset %u: %s", offset, esp_err_to_name(err));
+            return false;
+        }
+        crc = esp_rom_crc32_le(crc, (const uint8_t*)buffer.get(), length);
+    }
+    return true;
+}
+
+bool Assets::DownloadDelta(const std::string& url, const std::string& full_url,
+    std::function<void(int progress, size_t speed)> progress_callback) {
+    ESP_LOGI(TAG, "Downloading assets patch from %s", url.c_str());
+
+    auto network = Board::GetInstance().GetNetwork();
+    auto http = network->CreateHttp(0);
+    auto connect_timer = ConnectionCache::GetInstance().TimeConnect(url);
+    if (!http->Open("GET", url)) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection");
+        return false;
+    }
+    connect_timer.Finish(true);
+    if (http->GetStatusCode() != 200) {
+        ESP_LOGE(TAG, "Failed to get assets patch, status code: %d", http->GetStatusCode());
+        http->Close();
+        return false;
+    }
+    size_t patch_size = http->GetBodyLength();
+
+    char header_data[DELTA_HEADER_SIZE];
+    size_t filled = 0;
+    while (filled < sizeof(header_data)) {
+        int ret = http->Read(header_data + filled, sizeof(header_data) - filled);
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "Failed to read the assets patch header");
+            http->Close();
+            return false;
+        }
+        filled += ret;
+    }
+
+    // Only in place patches fit the partition, made for exactly the installed assets
+    DeltaHeader header;
+    const size_t SECTOR_SIZE = esp_partition_get_main_flash_sector_size();
+    if (!DeltaPatcher::ParseHeader(header_data, header) || header.window == 0 || header.window % SECTOR_SIZE != 0 ||
+        header.window > ASSETS_DELTA_MAX_WINDOW || header.base_size > partition_->size || header.target_size > partition_->size) {
+        ESP_LOGE(TAG, "Invalid assets patch");
+        http->Close();
+        return false;
+    }
+    uint32_t base_crc;
+    if (!CalculatePartitionCrc(header.base_size, base_crc) || base_crc != header.base_crc) {
+        ESP_LOGW(TAG, "The patch was made for other assets");
+        http->Close();
         return false;
     }
 
-    ESP_LOGI(TAG, "Assets download completed, total written: %u bytes, total sectors erased: %u", 
-             total_written, current_sector);
+    // The partition holds neither the old nor the new assets until the patch completes
+    UnApplyPartition();
+    {
+        Settings settings("assets", true);
+        settings.EraseKey("verified");
+        if (!full_url.empty()) {
+            settings.SetString("dl_url", full_url);
+            settings.SetInt("dl_done", 0);
+            settings.SetInt("dl_size", 0);
+            settings.SetInt("dl_tries", 0);
+        }
+    }
+    // Written before the first sector is patched, so a reboot part way falls back to the full download
+    SettingsStore::GetInstance().Flush();
+
+    DeltaPatcher patcher(header, SECTOR_SIZE,
+        [this](size_t offset, char* data, size_t size) {
+            esp_err_t err = esp_partition_read(partition_, offset, data, size);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to read assets partition at offset %u: %s", offset, esp_err_to_name(err));
+                return false;
+            }
+            return true;
+        },
+        [this, SECTOR_SIZE](size_t offset, const char* data, size_t size) {
+            esp_err_t err = esp_partition_erase_range(partition_, offset, SECTOR_SIZE);
+            if (err == ESP_OK) {
+                err = esp_partition_write(partition_, offset, data, size);
+            }
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write the patched sector at offset %u: %s", offset, esp_err_to_name(err));
+                return false;
+            }
+            return true;
+        });
+
+    std::unique_ptr<char[]> buffer(new char[ASSETS_DOWNLOAD_BUFFER_SIZE]);
+    bool read_ok = true;
+    size_t received = DELTA_HEADER_SIZE;
+    size_t recent_received = 0;
+    auto start_time = esp_timer_get_time();
+    auto last_calc_time = start_time;
+    while (patch_size == 0 || received < patch_size) {
+        int ret = http->Read(buffer.get(), ASSETS_DOWNLOAD_BUFFER_SIZE);
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to read HTTP data at %u: %s", received, esp_err_to_name(ret));
+            read_ok = false;
+            break;
+        }
+        if (ret == 0) {
+            break;
+        }
+        if (!patcher.Feed(buffer.get(), ret)) {
+            read_ok = false;
+            break;
+        }
+        received += ret;
+        recent_received += ret;
+
+        if (esp_timer_get_time() - last_calc_time >= 1000000) {
+            size_t progress = patcher.stats().target_bytes * 100 / header.target_size;
+            ESP_LOGI(TAG, "Progress: %u%% (%u patch bytes), Speed: %u B/s", progress, received, recent_received);
+            if (progress_callback) {
+                progress_callback(progress, recent_received);
+            }
+            last_calc_time = esp_timer_get_time();
+            recent_received = 0;
+        }
+    }
+    http->Close();
+
+    if (!read_ok || !patcher.Finish()) {
+        ESP_LOGE(TAG, "Failed to apply the assets patch");
+        return false;
+    }
+    uint32_t target_crc;
+    if (!CalculatePartitionCrc(header.target_size, target_crc) || target_crc != header.target_crc) {
+        ESP_LOGE(TAG, "The patched assets do not match the patch digest");
+        return false;
+    }
+    auto& stats = patcher.stats();
+    ESP_LOGI(TAG, "Assets patched with %u bytes in %d ms, %u sectors written, %u unchanged", received,
+             int((esp_timer_get_time() - start_time) / 1000), stats.sectors_written, stats.sectors_unchanged);
+    ClearDownloadProgress();
 
-    // 重新初始化资源分区
     if (!InitializePartition()) {
         ESP_LOGE(TAG, "Failed to re-initialize assets partition");
         return false;
     }
-
+    if (!strategy_->VerifyAll(this)) {
+        ESP_LOGE(TAG, "The patched assets are corrupted");
+        return false;
+    }
     return true;
 }
+
+std::string Assets::GetResumableDownloadUrl() {
+    Settings settings("assets");
+    if (settings.GetInt("dl_tries") >= ASSETS_DOWNLOAD_MAX_RESUMES) {
+        return "";
+    }
+    return settings.GetString("dl_url");
+}
@@ -10,16 +10,44 @@
 #include <model_path.h>
 #include <map>
 #include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+#include "asset_cache.h"
 
 #if HAVE_LVGL
 #include <spi_flash_mmap.h>
 #endif
 
+// With CONFIG_ASSETS_LAZY_VERIFY the chunks no asset was read from are checked in the background after boot
+#define ASSETS_VERIFY_TASK_DELAY_MS 10000
+#define ASSETS_VERIFY_TASK_STACK_SIZE 3072
+#define ASSETS_VERIFY_TASK_PRIORITY 1
+
+// PSRAM kept for decompressed assets that are not in use anymore
+#define ASSETS_CACHE_BUDGET (2 * 1024 * 1024)
+
+// Download: a ring of buffers between the HTTP reader and a flash writer task
+#define ASSETS_DOWNLOAD_BUFFER_SIZE 8192
+#define ASSETS_DOWNLOAD_BUFFER_COUNT 4
+#define ASSETS_DOWNLOAD_WRITER_STACK_SIZE 4096
+#define ASSETS_DOWNLOAD_WRITER_PRIORITY 4
+// Erase unit where aligned, progress is saved to NVS each time one is written
+#define ASSETS_DOWNLOAD_BLOCK_SIZE (64 * 1024)
+// Range requests within one Download() call, and boots that resume an interrupted download
+#define ASSETS_DOWNLOAD_MAX_ATTEMPTS 5
+#define ASSETS_DOWNLOAD_MAX_RESUMES 3
+// Delta updates: the most overwritten assets a patch may still read, kept in RAM while patching
+#define ASSETS_DELTA_MAX_WINDOW (256 * 1024)
+
 struct Asset {
     size_t size;
     size_t offset;
 };
 
+struct mmap_assets_table;
+
 class Assets {
 public:
     static Assets& GetInstance() {
@@ -29,8 +57,24 @@ public:
     ~Assets();
 
     bool Download(std::string url, std::function<void(int progress, size_t speed)> progress_callback);
+    /**
+     * Patch the installed assets in place (scripts/delta_patch.py). Nothing is written if the patch
+     * was made for other assets. Once patching starts, full_url is left to be downloaded in case the
+     * patch fails or the device reboots, see GetResumableDownloadUrl().
+     */
+    bool DownloadDelta(const std::string& url, const std::string& full_url,
+        std::function<void(int progress, size_t speed)> progress_callback);
+    /**
+     * The url of a download that stopped part way and can continue, empty if there is none
+     */
+    std::string GetResumableDownloadUrl();
     bool Apply();
     bool GetAssetData(const std::string& name, void*& ptr, size_t& size);
+    /**
+     * The data stays valid while the returned pointer is held. Prefer this over GetAssetData()
+     * for data that is dropped again, a compressed asset can then leave the decompression cache.
+     */
+    std::shared_ptr<const char> AcquireAssetData(const std::string& name, size_t& size);
 
     inline bool partition_valid() const { return partition_valid_; }
     inline std::string default_assets_url() const { return default_assets_url_; }
@@ -44,6 +88,10 @@ private:
     void UnApplyPartition();
     static bool FindPartition(Assets* assets);
     static bool LoadSrmodelsFromIndex(Assets* assets, cJSON* root = nullptr);
+    bool DownloadRange(const std::string& url, size_t& offset, size_t& total_size, size_t& erased_end,
+        const std::function<void(int progress, size_t speed)>& progress_callback);
+    void ClearDownloadProgress();
+    bool CalculatePartitionCrc(size_t size, uint32_t& crc);
   
     class AssetStrategy {
     public:
@@ -52,6 +100,15 @@ private:
         virtual bool InitializePartition(Assets* assets) = 0;
         virtual void UnApplyPartition(Assets* assets) = 0;
         virtual bool GetAssetData(Assets* assets, const std::string& name, void*& ptr, size_t& size) = 0;
+        virtual std::shared_ptr<const char> AcquireAssetData(Assets* assets, const std::string& name, size_t& size) {
+            void* ptr = nullptr;
+            if (!GetAssetData(assets, name, ptr, size)) {
+                return nullptr;
+            }
+            return std::shared_ptr<const char>(static_cast<const char*>(ptr), [](const char*) {});
+        }
+        // Check the whole partition now, also what would only be checked on first access
+        virtual bool VerifyAll(Assets* assets) { return true; }
     };
     
     class LvglStrategy : public AssetStrategy {
@@ -60,12 +117,41 @@ private:
         bool InitializePartition(Assets* assets) override;
         void UnApplyPartition(Assets* assets) override;
         bool GetAssetData(Assets* assets, const std::string& name, void*& ptr, size_t& size) override;
+        std::shared_ptr<const char> AcquireAssetData(Assets* assets, const std::string& name, size_t& size) override;
+        bool VerifyAll(Assets* assets) override;
     private:
         static uint32_t CalculateChecksum(const char* data, uint32_t length);
+        bool FindAsset(const std::string& name, Asset& asset) const;
+        bool VerifyPartition(Assets* assets, uint32_t stored_files, uint32_t stored_chksum, uint32_t stored_len);
+        bool LoadChunkDigests(Assets* assets, uint32_t stored_len, uint32_t& digests_crc);
+        bool VerifyChunks(size_t begin, size_t end);
+        bool VerifyNextChunk();
+        void StartBackgroundVerify();
+        // Mapped data of a stored asset, or the decompressed copy with its owner set
+        const char* LoadAsset(const std::string& name, size_t& size, std::shared_ptr<const char>& owner);
+        // Only filled for packs whose table is not sorted by name
         std::map<std::string, Asset> assets_;
+        // Packs with a sorted table are searched in place in the mapped flash
+        const mmap_assets_table* table_ = nullptr;
+        uint32_t table_files_ = 0;
         esp_partition_mmap_handle_t mmap_handle_ = 0;
         const char* mmap_root_ = nullptr;
         bool checksum_valid_ = false;
+        // CRC32 of each chunk of the image, nullptr once everything is verified
+        const uint32_t* chunk_crcs_ = nullptr;
+        uint32_t chunk_size_ = 0;
+        uint32_t chunk_count_ = 0;
+        uint32_t chunks_left_ = 0;
+        size_t image_size_ = 0;
+        std::vector<uint8_t> chunk_verified_;
+        // NVS value saved when the whole partition has been verified
+        std::string verified_key_;
+        std::mutex verify_mutex_;
+        std::atomic<bool> background_verify_running_{false};
+        AssetCache cache_{ASSETS_CACHE_BUDGET};
+        // Decompressed assets returned by GetAssetData(), valid until the partition is unmapped
+        std::vector<std::shared_ptr<const char>> pinned_;
+        std::mutex pinned_mutex_;
     };
     
     class EmoteStrategy : public AssetStrategy {
@@ -51,6 +51,9 @@ AudioService::~AudioService() {
     if (opus_decoder_ != nullptr) {
         esp_opus_dec_close(opus_decoder_);
     }
+    if (redundancy_encoder_ != nullptr) {
+        esp_opus_enc_close(redundancy_encoder_);
+    }
     if (input_resampler_ != nullptr) {
         esp_ae_rate_cvt_close(input_resampler_);
     }
@@ -405,6 +408,8 @@ void AudioService::OpusCodecTask() {
             audio_queue_cv_.notify_all();
             lock.unlock();
 
+            UpdateUplinkEncoders();
+
             auto packet = std::make_unique<AudioStreamPacket>();
             packet->frame_duration = OPUS_FRAME_DURATION_MS;
             packet->sample_rate = 16000;
@@ -426,8 +431,12 @@ void AudioService::OpusCodecTask() {
                     packet->payload.assign(buf.data(), buf.data() + out.encoded_bytes);
 
                     if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+                        if (redundancy_encoder_ != nullptr) {
+                            EncodeRedundancy(task->pcm, buf, *packet);
+                        }
                         {
                             std::lock_guard<std::mutex> lock2(audio_queue_mutex_);
+                            packet->enqueue_time = esp_timer_get_time();
                             audio_send_queue_.push_back(std::move(packet));
                         }
                         if (callbacks_.on_send_queue_available) {
@@ -488,6 +497,99 @@ void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
     }
 }
 
+// Runs in the opus codec task, the only user of the uplink encoders
+void AudioService::UpdateUplinkEncoders() {
+    bool fec = uplink_fec_;
+    if (opus_encoder_ != nullptr && fec != encoder_fec_) {
+        // FEC can only be chosen when the encoder is opened
+        esp_opus_enc_close(opus_encoder_);
+        opus_encoder_ = nullptr;
+        esp_opus_enc_config_t opus_enc_cfg = AS_OPUS_ENC_CONFIG();
+        opus_enc_cfg.enable_fec = fec;
+        auto ret = esp_opus_enc_open(&opus_enc_cfg, sizeof(esp_opus_enc_config_t), &opus_encoder_);
+        if (opus_encoder_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to reopen audio encoder, error code: %d", ret);
+        }
+        encoder_fec_ = fec;
+    }
+
+    bool redundancy = uplink_redundancy_;
+    if (redundancy && redundancy_encoder_ == nullptr) {
+        esp_opus_enc_config_t opus_enc_cfg = AS_OPUS_ENC_CONFIG();
+        opus_enc_cfg.bitrate = AS_OPUS_REDUNDANCY_BITRATE;
+        opus_enc_cfg.enable_dtx = false;
+        opus_enc_cfg.enable_vbr = false;
+        auto ret = esp_opus_enc_open(&opus_enc_cfg, sizeof(esp_opus_enc_config_t), &redundancy_encoder_);
+        if (redundancy_encoder_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to create redundancy encoder, error code: %d", ret);
+            uplink_redundancy_ = false;
+        }
+    } else if (!redundancy && redundancy_encoder_ != nullptr) {
+        esp_opus_enc_close(redundancy_encoder_);
+        redundancy_encoder_ = nullptr;
+        redundancy_frame_.clear();
+        redundancy_frame_.shrink_to_fit();
+    }
+}
+
+// Attach the previous low bitrate frame to the packet and keep this one for the next packet
+void AudioService::EncodeRedundancy(const std::vector<int16_t>& pcm, std::vector<uint8_t>& buffer, AudioStreamPacket& packet) {
+    esp_audio_enc_in_frame_t in = {
+        .buffer = (uint8_t *)(pcm.data()),
+        .len = (uint32_t)(pcm.size() * sizeof(int16_t)),
+    };
+    esp_audio_enc_out_frame_t out = {
+        .buffer = buffer.data(),
+        .len = (uint32_t)buffer.size(),
+        .encoded_bytes = 0,
+    };
+    auto ret = esp_opus_enc_process(redundancy_encoder_, &in, &out);
+    auto now = esp_timer_get_time();
+    // After a pause the stored frame does not precede this one
+    if (now - redundancy_frame_time_ <= 2 * OPUS_FRAME_DURATION_MS * 1000) {
+        packet.redundancy.swap(redundancy_frame_);
+    }
+    if (ret == ESP_AUDIO_ERR_OK) {
+        redundancy_frame_.assign(buffer.data(), buffer.data() + out.encoded_bytes);
+        redundancy_frame_time_ = now;
+    } else {
+        ESP_LOGE(TAG, "Failed to encode redundant audio, error code: %d", ret);
+        redundancy_frame_.clear();
+    }
+}
+
+void AudioService::ReportUplinkLoss(int loss_percent) {
+#if CONFIG_USE_UPLINK_LOSS_RESILIENCE
+    // Turn on at the threshold, turn off only after a few reports well below it
+    auto adapt = [loss_percent](bool enabled, int threshold, int& quiet_reports) {
+        if (loss_percent >= threshold) {
+            quiet_reports = 0;
+            return true;
+        }
+        if (!enabled) {
+            return false;
+        }
+        quiet_reports = loss_percent * 2 < threshold ? quiet_reports + 1 : 0;
+        return quiet_reports < AS_UPLINK_RESILIENCE_OFF_REPORTS;
+    };
+    bool fec = adapt(uplink_fec_wanted_, AS_UPLINK_FEC_LOSS_PERCENT, uplink_fec_quiet_reports_);
+    bool redundancy = adapt(uplink_redundancy_wanted_, AS_UPLINK_REDUNDANCY_LOSS_PERCENT, uplink_redundancy_quiet_reports_);
+    if (fec != uplink_fec_wanted_ || redundancy != uplink_redundancy_wanted_) {
+        ESP_LOGI(TAG, "Uplink loss %d%%, FEC %s, redundancy %s", loss_percent, fec ? "on" : "off",
+            redundancy ? (uplink_redundancy_allowed_ ? "on" : "not supported by server") : "off");
+    }
+    uplink_fec_wanted_ = fec;
+    uplink_redundancy_wanted_ = redundancy;
+    uplink_fec_ = fec;
+    uplink_redundancy_ = redundancy && uplink_redundancy_allowed_;
+#endif
+}
+
+void AudioService::SetUplinkRedundancyAllowed(bool allowed) {
+    uplink_redundancy_allowed_ = allowed;
+    uplink_redundancy_ = uplink_redundancy_wanted_ && allowed;
+}
+
 void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
     auto task = std::make_unique<AudioTask>();
     task->type = type;
@@ -535,6 +637,19 @@ std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
     return packet;
 }
 
+bool AudioService::PopPacketsFromSendQueue(std::vector<std::unique_ptr<AudioStreamPacket>>& packets, size_t max_packets) {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    if (audio_send_queue_.empty()) {
+        return false;
+    }
+    while (!audio_send_queue_.empty() && packets.size() < max_packets) {
+        packets.push_back(std::move(audio_send_queue_.front()));
+        audio_send_queue_.pop_front();
+    }
+    audio_queue_cv_.notify_all();
+    return true;
+}
+
 void AudioService::EncodeWakeWord() {
     if (wake_word_) {
         wake_word_->EncodeWakeWordData();
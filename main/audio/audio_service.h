@@ -6,6 +6,7 @@
 #include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -44,6 +45,13 @@
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
 #define MAX_TIMESTAMPS_IN_QUEUE 3
 
+// Loss-adaptive uplink resilience, thresholds are in percent of uplink packets lost
+#define AS_UPLINK_FEC_LOSS_PERCENT 2
+#define AS_UPLINK_REDUNDANCY_LOSS_PERCENT 8
+// Consecutive reports below half the threshold before FEC or redundancy is turned off again
+#define AS_UPLINK_RESILIENCE_OFF_REPORTS 3
+#define AS_OPUS_REDUNDANCY_BITRATE 8000
+
 #define AUDIO_POWER_TIMEOUT_MS 15000
 #define AUDIO_POWER_CHECK_INTERVAL_MS 1000
 
@@ -128,6 +136,21 @@ public:
 
     bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
     std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
+    /**
+     * Move up to max_packets packets from the send queue into packets
+     * Returns false if the send queue was empty
+     */
+    bool PopPacketsFromSendQueue(std::vector<std::unique_ptr<AudioStreamPacket>>& packets, size_t max_packets);
+    /**
+     * Adapt the uplink encoding to the packet loss reported by the server
+     * Opus in-band FEC is used from AS_UPLINK_FEC_LOSS_PERCENT and, if allowed, a low bitrate copy of
+     * the previous frame is attached to every packet from AS_UPLINK_REDUNDANCY_LOSS_PERCENT
+     */
+    void ReportUplinkLoss(int loss_percent);
+    /**
+     * Whether the current audio channel can carry redundant frames
+     */
+    void SetUplinkRedundancyAllowed(bool allowed);
     void PlaySound(const std::string_view& sound);
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
@@ -141,6 +164,7 @@ private:
     std::unique_ptr<AudioDebugger> audio_debugger_;
     void* opus_encoder_ = nullptr;
     void* opus_decoder_ = nullptr;
+    void* redundancy_encoder_ = nullptr;
     std::mutex decoder_mutex_;
     esp_ae_rate_cvt_handle_t input_resampler_ = nullptr;
     esp_ae_rate_cvt_handle_t output_resampler_ = nullptr;
@@ -150,6 +174,9 @@ private:
     int encoder_duration_ms_ = OPUS_FRAME_DURATION_MS;
     int encoder_frame_size_ = 0;
     int encoder_outbuf_size_ = 0;
+    bool encoder_fec_ = false;
+    std::vector<uint8_t> redundancy_frame_;     // Previous frame from redundancy_encoder_
+    int64_t redundancy_frame_time_ = 0;
     int decoder_sample_rate_ = 0;
     int decoder_duration_ms_ = OPUS_FRAME_DURATION_MS;
     int decoder_frame_size_ = 0;
@@ -178,6 +205,15 @@ private:
     bool service_stopped_ = true;
     bool audio_input_need_warmup_ = false;
 
+    // Uplink resilience, decided on the main task and applied by the opus codec task
+    bool uplink_fec_wanted_ = false;
+    bool uplink_redundancy_wanted_ = false;
+    bool uplink_redundancy_allowed_ = false;
+    int uplink_fec_quiet_reports_ = 0;
+    int uplink_redundancy_quiet_reports_ = 0;
+    std::atomic<bool> uplink_fec_ = false;
+    std::atomic<bool> uplink_redundancy_ = false;
+
     esp_timer_handle_t audio_power_timer_ = nullptr;
     std::chrono::steady_clock::time_point last_input_time_;
     std::chrono::steady_clock::time_point last_output_time_;
@@ -187,6 +223,8 @@ private:
     void OpusCodecTask();
     void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
+    void UpdateUplinkEncoders();
+    void EncodeRedundancy(const std::vector<int16_t>& pcm, std::vector<uint8_t>& buffer, AudioStreamPacket& packet);
     void CheckAndUpdateAudioPowerState();
 };
 
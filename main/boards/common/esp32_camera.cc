@@ -14,6 +14,7 @@
 #include "linux/videodev2.h"
 
 #include "board.h"
+#include "connection_cache.h"
 #include "display.h"
 #include "esp32_camera.h"
 #include "esp_jpeg_common.h"
@@ -952,6 +953,7 @@ std::string Esp32Camera::Explain(const std::string& question) {
     }
     http->SetHeader("Content-Type", "multipart/form-data; boundary=" + boundary);
     http->SetHeader("Transfer-Encoding", "chunked");
+    auto connect_timer = ConnectionCache::GetInstance().TimeConnect(explain_url_);
     if (!http->Open("POST", explain_url_)) {
         ESP_LOGE(TAG, "Failed to connect to explain URL");
         // Clear the queue
@@ -967,6 +969,7 @@ std::string Esp32Camera::Explain(const std::string& question) {
         vQueueDelete(jpeg_queue);
         throw std::runtime_error("Failed to connect to explain URL");
     }
+    connect_timer.Finish(true);
 
     {
         // 第一块：question字段
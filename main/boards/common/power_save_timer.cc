@@ -1,6 +1,7 @@
 #include "power_save_timer.h"
 #include "application.h"
 #include "settings.h"
+#include "settings_store.h"
 
 #include <esp_log.h>
 
@@ -74,6 +75,7 @@ void PowerSaveTimer::PowerSaveCheck() {
             if (on_enter_sleep_mode_) {
                 on_enter_sleep_mode_();
             }
+            SettingsStore::GetInstance().Flush();
 
             if (cpu_max_freq_ != -1) {
                 // Disable wake word detection
@@ -99,6 +101,7 @@ void PowerSaveTimer::PowerSaveCheck() {
         }
     }
     if (seconds_to_shutdown_ != -1 && ticks_ >= seconds_to_shutdown_ && on_shutdown_request_) {
+        SettingsStore::GetInstance().Flush();
         on_shutdown_request_();
     }
 }
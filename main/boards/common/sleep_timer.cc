@@ -3,6 +3,7 @@
 #include "board.h"
 #include "display.h"
 #include "settings.h"
+#include "settings_store.h"
 
 #include <esp_log.h>
 #include <esp_sleep.h>
@@ -86,6 +87,8 @@ void SleepTimer::CheckTimer() {
             }
         
             app.Schedule([this, &app]() {
+                // The commit timer does not run while asleep
+                SettingsStore::GetInstance().Flush();
                 while (in_light_sleep_mode_) {
                     auto& board = Board::GetInstance();
                     board.GetDisplay()->UpdateStatusBar(true);
@@ -118,6 +121,7 @@ void SleepTimer::CheckTimer() {
             on_enter_deep_sleep_mode_();
         }
 
+        SettingsStore::GetInstance().Flush();
         esp_deep_sleep_start();
     }
 }
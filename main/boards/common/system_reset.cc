@@ -1,4 +1,5 @@
 #include "system_reset.h"
+#include "settings_store.h"
 
 #include <esp_log.h>
 #include <nvs_flash.h>
@@ -46,6 +47,8 @@ void SystemReset::ResetNvsFlash() {
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to initialize NVS flash");
     }
+    // Cached values and pending changes belong to the erased NVS
+    SettingsStore::GetInstance().Reset();
 }
 
 void SystemReset::ResetToFactory() {
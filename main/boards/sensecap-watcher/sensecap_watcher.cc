@@ -9,6 +9,7 @@
 #include "led/single_led.h"
 #include "power_save_timer.h"
 #include "sscma_camera.h"
+#include "settings_store.h"
 #include "lvgl_theme.h"
 
 #include <esp_log.h>
@@ -291,6 +292,7 @@ private:
             if (self->long_press_cnt_ > 400) {
                 ESP_LOGI(TAG, "Factory reset");
                 nvs_flash_erase();
+                SettingsStore::GetInstance().Reset();
                 esp_restart();
             }
         }, this);
@@ -483,6 +485,7 @@ private:
             .argtable = NULL,
             .func_w_context = [](void *context,int argc, char** argv) -> int {
                 nvs_flash_erase();
+                SettingsStore::GetInstance().Reset();
                 esp_restart();
                 return 0;
             },
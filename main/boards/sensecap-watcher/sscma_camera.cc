@@ -6,6 +6,7 @@
 #include "system_info.h"
 #include "config.h"
 #include "settings.h"
+#include "connection_cache.h"
 
 #include <esp_log.h>
 #include <esp_heap_caps.h>
@@ -710,10 +711,12 @@ std::string SscmaCamera::Explain(const std::string& question) {
     }
     http->SetHeader("Content-Type", "multipart/form-data; boundary=" + boundary);
     http->SetHeader("Transfer-Encoding", "chunked");
+    auto connect_timer = ConnectionCache::GetInstance().TimeConnect(explain_url_);
     if (!http->Open("POST", explain_url_)) {
         ESP_LOGE(TAG, "Failed to connect to explain URL");
         return "{\"success\": false, \"message\": \"Failed to connect to explain URL\"}";
     }
+    connect_timer.Finish(true);
     
     // 第一块：question字段
     http->Write(question_field.c_str(), question_field.size());
@@ -0,0 +1,184 @@
+#include "boot_sequence.h"
+#include "json_writer.h"
+
+#include <cstring>
+#include <algorithm>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define TAG "BootSequence"
+
+void BootSequence::AddStep(const char* name, std::initializer_list<const char*> dependencies, std::function<void()> run) {
+    Step step;
+    step.name = name;
+    step.run = std::move(run);
+    for (auto dependency : dependencies) {
+        int index = FindStep(dependency);
+        if (index < 0) {
+            ESP_LOGE(TAG, "Step %s depends on unknown step %s", name, dependency);
+            continue;
+        }
+        step.dependencies.push_back(index);
+    }
+    step.pending_dependencies = step.dependencies.size();
+    steps_.push_back(std::move(step));
+}
+
+void BootSequence::Run() {
+    start_time_ = esp_timer_get_time();
+    finished_steps_ = 0;
+    // The worker and the calling task both run WorkerLoop() and each count themselves out
+    running_workers_ = 2;
+
+    int other_core = (xPortGetCoreID() + 1) % portNUM_PROCESSORS;
+    if (xTaskCreatePinnedToCore([](void* arg) {
+        BootSequence* boot_sequence = (BootSequence*)arg;
+        boot_sequence->WorkerLoop();
+        vTaskDelete(NULL);
+    }, "boot_worker", BOOT_SEQUENCE_WORKER_STACK_SIZE, this, BOOT_SEQUENCE_WORKER_PRIORITY, nullptr, other_core) != pdPASS) {
+        ESP_LOGW(TAG, "Failed to create the boot worker, running all steps on this core");
+        running_workers_ = 1;
+    }
+
+    WorkerLoop();
+
+    // The worker still references this object until it has left WorkerLoop()
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return running_workers_ == 0; });
+    end_time_ = esp_timer_get_time();
+    lock.unlock();
+
+    PrintTimeline();
+}
+
+void BootSequence::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (finished_steps_ < (int)steps_.size()) {
+        auto it = std::find_if(steps_.begin(), steps_.end(), [](const Step& step) {
+            return !step.started && step.pending_dependencies == 0;
+        });
+        if (it == steps_.end()) {
+            cv_.wait(lock);
+            continue;
+        }
+
+        auto& step = *it;
+        step.started = true;
+        step.core = xPortGetCoreID();
+        step.start_time = esp_timer_get_time();
+        lock.unlock();
+        step.run();
+        lock.lock();
+        step.end_time = esp_timer_get_time();
+
+        int index = it - steps_.begin();
+        for (auto& other : steps_) {
+            other.pending_dependencies -= std::count(other.dependencies.begin(), other.dependencies.end(), index);
+        }
+        finished_steps_++;
+        cv_.notify_all();
+    }
+    running_workers_--;
+    cv_.notify_all();
+}
+
+void BootSequence::MarkMilestone(const char* name) {
+    if (milestones_.size() >= BOOT_SEQUENCE_MAX_MILESTONES) {
+        return;
+    }
+    for (const auto& milestone : milestones_) {
+        if (strcmp(milestone.name, name) == 0) {
+            return;
+        }
+    }
+    int64_t now = esp_timer_get_time();
+    milestones_.push_back({name, now});
+    ESP_LOGI(TAG, "Boot milestone %s at %lu ms", name, (uint32_t)(now / 1000));
+}
+
+int BootSequence::FindStep(const char* name) const {
+    for (size_t i = 0; i < steps_.size(); i++) {
+        if (strcmp(steps_[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+std::vector<int> BootSequence::GetCriticalPath() const {
+    std::vector<int> path;
+    if (steps_.empty()) {
+        return path;
+    }
+    int index = std::max_element(steps_.begin(), steps_.end(), [](const Step& a, const Step& b) {
+        return a.end_time < b.end_time;
+    }) - steps_.begin();
+    while (index >= 0) {
+        path.push_back(index);
+        // The dependency that finished last is the one the step waited for
+        int next = -1;
+        for (int dependency : steps_[index].dependencies) {
+            if (next < 0 || steps_[dependency].end_time > steps_[next].end_time) {
+                next = dependency;
+            }
+        }
+        index = next;
+    }
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+std::string BootSequence::GetTimelineJson() const {
+    std::string json;
+    JsonWriter writer(json);
+    writer.BeginObject();
+    writer.Member("start_ms", (int)(start_time_ / 1000));
+    writer.Member("total_ms", (int)((end_time_ - start_time_) / 1000));
+
+    writer.Key("steps").BeginArray();
+    for (const auto& step : steps_) {
+        writer.BeginObject();
+        writer.Member("name", step.name);
+        writer.Member("core", step.core);
+        writer.Member("start_ms", (int)((step.start_time - start_time_) / 1000));
+        writer.Member("ms", (int)((step.end_time - step.start_time) / 1000));
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    writer.Key("critical_path").BeginArray();
+    for (int index : GetCriticalPath()) {
+        writer.String(steps_[index].name);
+    }
+    writer.EndArray();
+
+    writer.Key("milestones").BeginArray();
+    for (const auto& milestone : milestones_) {
+        writer.BeginObject();
+        writer.Member("name", milestone.name);
+        writer.Member("ms", (int)(milestone.time / 1000));
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+    return json;
+}
+
+void BootSequence::PrintTimeline() const {
+    for (const auto& step : steps_) {
+        ESP_LOGI(TAG, "%-16s core %d  +%4lu ms  %4lu ms", step.name, step.core,
+            (uint32_t)((step.start_time - start_time_) / 1000), (uint32_t)((step.end_time - step.start_time) / 1000));
+    }
+
+    std::string path;
+    for (int index : GetCriticalPath()) {
+        if (!path.empty()) {
+            path += " -> ";
+        }
+        path += steps_[index].name;
+    }
+    ESP_LOGI(TAG, "Boot steps took %lu ms from %lu ms since boot, critical path: %s",
+        (uint32_t)((end_time_ - start_time_) / 1000), (uint32_t)(start_time_ / 1000), path.c_str());
+}
@@ -0,0 +1,78 @@
+#ifndef BOOT_SEQUENCE_H
+#define BOOT_SEQUENCE_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#define BOOT_SEQUENCE_WORKER_STACK_SIZE (4096 * 2)
+#define BOOT_SEQUENCE_WORKER_PRIORITY 3
+#define BOOT_SEQUENCE_MAX_MILESTONES 8
+
+/**
+ * BootSequence - Runs the boot steps as a dependency graph and keeps a boot timeline
+ *
+ * A step starts once all of its dependencies have finished. The calling task and one worker
+ * pinned to the other core pick up ready steps, so independent steps overlap. Milestones
+ * reached after Run() (network connected, wake word ready, ...) are added to the same timeline.
+ */
+class BootSequence {
+public:
+    /**
+     * Add a step, dependencies are names of steps added before it
+     */
+    void AddStep(const char* name, std::initializer_list<const char*> dependencies, std::function<void()> run);
+
+    /**
+     * Run all steps and return once every one of them has finished
+     */
+    void Run();
+
+    /**
+     * Record the time since boot of the first occurrence of a milestone
+     */
+    void MarkMilestone(const char* name);
+
+    std::string GetTimelineJson() const;
+    void PrintTimeline() const;
+
+private:
+    struct Step {
+        const char* name;
+        std::vector<int> dependencies;
+        std::function<void()> run;
+        int pending_dependencies = 0;
+        bool started = false;
+        int core = -1;
+        int64_t start_time = 0;
+        int64_t end_time = 0;
+    };
+
+    struct Milestone {
+        const char* name;
+        int64_t time;
+    };
+
+    std::vector<Step> steps_;
+    std::vector<Milestone> milestones_;
+    int64_t start_time_ = 0;
+    int64_t end_time_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int finished_steps_ = 0;
+    int running_workers_ = 0;
+
+    void WorkerLoop();
+    int FindStep(const char* name) const;
+    /**
+     * Step indexes from the first to the last step of the chain that finished last
+     */
+    std::vector<int> GetCriticalPath() const;
+};
+
+#endif // BOOT_SEQUENCE_H
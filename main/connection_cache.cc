@@ -0,0 +1,188 @@
+#include "connection_cache.h"
+#include "board.h"
+
+#include <esp_log.h>
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <lwip/netdb.h>
+#include <lwip/inet.h>
+
+#include <algorithm>
+
+#define TAG "ConnCache"
+
+void ConnectionCache::ConnectTimer::Finish(bool success) {
+    if (finished_) {
+        return;
+    }
+    finished_ = true;
+    cache_.RecordConnect(host_, esp_timer_get_time() - start_time_, success);
+}
+
+std::string ConnectionCache::ParseHost(const std::string& url) {
+    // Accepts "scheme://[user@]host[:port][/path]" as well as "host[:port]"
+    size_t start = url.find("://");
+    start = (start == std::string::npos) ? 0 : start + 3;
+    size_t end = url.find_first_of("/?#", start);
+    if (end == std::string::npos) {
+        end = url.size();
+    }
+    size_t at = url.rfind('@', end);
+    if (at != std::string::npos && at >= start) {
+        start = at + 1;
+    }
+    size_t colon = url.find(':', start);
+    if (colon != std::string::npos && colon < end) {
+        end = colon;
+    }
+    return url.substr(start, end - start);
+}
+
+bool ConnectionCache::CanResolveLocally() {
+    // ML307 modems run their own resolver, the lwIP netif is not up on cellular
+    return Board::GetInstance().GetBoardType() == "wifi";
+}
+
+std::string ConnectionCache::Resolve(const std::string& host) {
+    struct in_addr numeric;
+    if (host.empty() || inet_aton(host.c_str(), &numeric) || !CanResolveLocally()) {
+        return host;
+    }
+
+    auto now = esp_timer_get_time();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = dns_cache_.find(host);
+        if (it != dns_cache_.end() && it->second.expire_time > now) {
+            dns_hits_++;
+            return it->second.address;
+        }
+        dns_misses_++;
+    }
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    int err = getaddrinfo(host.c_str(), nullptr, &hints, &result);
+    auto lookup_ms = (esp_timer_get_time() - now) / 1000;
+    if (err != 0 || result == nullptr) {
+        ESP_LOGW(TAG, "Failed to resolve %s, err=%d", host.c_str(), err);
+        return host;
+    }
+
+    char address[16];
+    auto addr = &((struct sockaddr_in*)result->ai_addr)->sin_addr;
+    inet_ntoa_r(*addr, address, sizeof(address));
+    freeaddrinfo(result);
+
+    ESP_LOGI(TAG, "Resolved %s -> %s in %d ms", host.c_str(), address, int(lookup_ms));
+    std::lock_guard<std::mutex> lock(mutex_);
+    dns_lookup_ms_ += lookup_ms;
+    if (dns_cache_.size() >= DNS_CACHE_MAX_ENTRIES && dns_cache_.find(host) == dns_cache_.end()) {
+        // Evict the entry closest to expiry
+        auto oldest = std::min_element(dns_cache_.begin(), dns_cache_.end(), [](const auto& a, const auto& b) {
+            return a.second.expire_time < b.second.expire_time;
+        });
+        dns_cache_.erase(oldest);
+    }
+    dns_cache_[host] = DnsEntry{
+        .address = address,
+        .expire_time = esp_timer_get_time() + DNS_CACHE_TTL_SECONDS * 1000000LL
+    };
+    return address;
+}
+
+void ConnectionCache::Prefetch(const std::vector<std::string>& urls) {
+    if (!CanResolveLocally()) {
+        return;
+    }
+
+    auto hosts = new std::vector<std::string>();
+    for (const auto& url : urls) {
+        auto host = ParseHost(url);
+        if (!host.empty() && std::find(hosts->begin(), hosts->end(), host) == hosts->end()) {
+            hosts->push_back(host);
+        }
+    }
+    if (hosts->empty()) {
+        delete hosts;
+        return;
+    }
+
+    auto ret = xTaskCreate([](void* arg) {
+        auto hosts = static_cast<std::vector<std::string>*>(arg);
+        auto& cache = ConnectionCache::GetInstance();
+        for (const auto& host : *hosts) {
+            cache.Resolve(host);
+        }
+        delete hosts;
+        vTaskDelete(NULL);
+    }, "dns_prefetch", 4096, hosts, 1, nullptr);
+    if (ret != pdPASS) {
+        ESP_LOGW(TAG, "Failed to create DNS prefetch task");
+        delete hosts;
+    }
+}
+
+void ConnectionCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dns_cache_.clear();
+}
+
+void ConnectionCache::RecordConnect(const std::string& host, int64_t duration_us, bool success) {
+    uint32_t duration_ms = duration_us / 1000;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& stats = host_stats_[host];
+    if (!success) {
+        stats.failures++;
+        ESP_LOGW(TAG, "Connect to %s failed after %lu ms", host.c_str(), duration_ms);
+        return;
+    }
+    stats.connects++;
+    stats.total_ms += duration_ms;
+    stats.last_ms = duration_ms;
+    stats.max_ms = std::max(stats.max_ms, duration_ms);
+    ESP_LOGI(TAG, "Connected to %s in %lu ms (avg %lu ms over %lu)", host.c_str(), duration_ms,
+        stats.total_ms / stats.connects, stats.connects);
+}
+
+std::string ConnectionCache::GetStatsJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cJSON* root = cJSON_CreateObject();
+    cJSON* dns = cJSON_CreateObject();
+    cJSON_AddNumberToObject(dns, "hits", dns_hits_);
+    cJSON_AddNumberToObject(dns, "misses", dns_misses_);
+    cJSON_AddNumberToObject(dns, "lookup_ms", dns_lookup_ms_);
+    cJSON_AddNumberToObject(dns, "entries", dns_cache_.size());
+    cJSON_AddItemToObject(root, "dns", dns);
+
+    cJSON* hosts = cJSON_CreateArray();
+    for (const auto& [host, stats] : host_stats_) {
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "host", host.c_str());
+        cJSON_AddNumberToObject(item, "connects", stats.connects);
+        cJSON_AddNumberToObject(item, "failures", stats.failures);
+        cJSON_AddNumberToObject(item, "avg_ms", stats.connects > 0 ? stats.total_ms / stats.connects : 0);
+        cJSON_AddNumberToObject(item, "max_ms", stats.max_ms);
+        cJSON_AddNumberToObject(item, "last_ms", stats.last_ms);
+        cJSON_AddItemToArray(hosts, item);
+    }
+    cJSON_AddItemToObject(root, "hosts", hosts);
+
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
+
+void ConnectionCache::PrintStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ESP_LOGI(TAG, "DNS hits: %lu, misses: %lu, lookup time: %lu ms", dns_hits_, dns_misses_, dns_lookup_ms_);
+    for (const auto& [host, stats] : host_stats_) {
+        ESP_LOGI(TAG, "%s: connects=%lu failures=%lu avg=%lu ms max=%lu ms", host.c_str(), stats.connects,
+            stats.failures, stats.connects > 0 ? stats.total_ms / stats.connects : 0, stats.max_ms);
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef CONNECTION_CACHE_H
+#define CONNECTION_CACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+#include <esp_timer.h>
+
+#define DNS_CACHE_TTL_SECONDS 300
+#define DNS_CACHE_MAX_ENTRIES 16
+
+/**
+ * ConnectionCache - Shared connection setup state for HTTP / WebSocket / MQTT / UDP
+ *
+ * Caches DNS answers per host with a TTL, pre-resolves hosts in the background as soon
+ * as their URL is known (which also keeps the lwIP resolver table warm for transports
+ * that resolve internally), and records connect/handshake timing per host.
+ *
+ * DNS is only resolved locally on WiFi boards; cellular modems resolve names on the modem.
+ */
+class ConnectionCache {
+public:
+    static ConnectionCache& GetInstance() {
+        static ConnectionCache instance;
+        return instance;
+    }
+
+    ConnectionCache(const ConnectionCache&) = delete;
+    ConnectionCache& operator=(const ConnectionCache&) = delete;
+
+    /**
+     * Measures one connect attempt from construction until Finish() (or destruction)
+     */
+    class ConnectTimer {
+    public:
+        ConnectTimer(ConnectionCache& cache, const std::string& host)
+            : cache_(cache), host_(host), start_time_(esp_timer_get_time()) {}
+        ~ConnectTimer() { Finish(false); }
+        void Finish(bool success);
+
+    private:
+        ConnectionCache& cache_;
+        std::string host_;
+        int64_t start_time_;
+        bool finished_ = false;
+    };
+
+    /**
+     * Resolve a host to a dotted IPv4 address, served from the cache while the entry is fresh
+     * Returns the host itself if it is already numeric or cannot be resolved locally
+     */
+    std::string Resolve(const std::string& host);
+
+    /**
+     * Resolve the hosts of the given URLs / endpoints in a background task
+     */
+    void Prefetch(const std::vector<std::string>& urls);
+
+    /**
+     * Start timing a connect to the given URL or endpoint
+     */
+    ConnectTimer TimeConnect(const std::string& url) { return ConnectTimer(*this, ParseHost(url)); }
+
+    /**
+     * Drop all cached DNS answers, e.g. after the network has changed
+     */
+    void Clear();
+
+    std::string GetStatsJson();
+    void PrintStats();
+
+    static std::string ParseHost(const std::string& url);
+
+private:
+    ConnectionCache() = default;
+
+    struct DnsEntry {
+        std::string address;
+        int64_t expire_time = 0;
+    };
+
+    struct HostStats {
+        uint32_t connects = 0;
+        uint32_t failures = 0;
+        uint32_t total_ms = 0;
+        uint32_t max_ms = 0;
+        uint32_t last_ms = 0;
+    };
+
+    std::mutex mutex_;
+    std::map<std::string, DnsEntry> dns_cache_;
+    std::map<std::string, HostStats> host_stats_;
+    uint32_t dns_hits_ = 0;
+    uint32_t dns_misses_ = 0;
+    uint32_t dns_lookup_ms_ = 0;
+
+    bool CanResolveLocally();
+    void RecordConnect(const std::string& host, int64_t duration_us, bool success);
+};
+
+#endif // CONNECTION_CACHE_H
@@ -0,0 +1,221 @@
+#include "delta_patcher.h"
+#include "lz4_block.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "DeltaPatcher"
+
+DeltaPatcher::DeltaPatcher(const DeltaHeader& header, size_t sector_size, Reader read_base, Writer write_target)
+    : header_(header), sector_size_(sector_size), read_base_(std::move(read_base)), write_target_(std::move(write_target)) {
+    sector_.reset(new char[sector_size_]);
+    if (header_.window > 0) {
+        ring_.reset(new char[header_.window]);
+    }
+    frame_.reset(new char[DELTA_FRAME_SIZE]);
+    raw_.reset(new char[DELTA_FRAME_SIZE]);
+}
+
+bool DeltaPatcher::ParseHeader(const char* data, DeltaHeader& header) {
+    memcpy(&header, data, sizeof(header));
+    return header.magic == DELTA_MAGIC;
+}
+
+bool DeltaPatcher::Feed(const char* data, size_t size) {
+    stats_.patch_bytes += size;
+    while (size > 0 && !failed_) {
+        if (frame_header_length_ < sizeof(frame_header_)) {
+            size_t length = std::min(size, sizeof(frame_header_) - frame_header_length_);
+            memcpy(frame_header_ + frame_header_length_, data, length);
+            frame_header_length_ += length;
+            data += length;
+            size -= length;
+            if (frame_header_length_ < sizeof(frame_header_)) {
+                break;
+            }
+            memcpy(&frame_raw_size_, frame_header_, 4);
+            memcpy(&frame_stored_size_, frame_header_ + 4, 4);
+            if (frame_raw_size_ == 0 || frame_raw_size_ > DELTA_FRAME_SIZE || frame_stored_size_ > frame_raw_size_) {
+                ESP_LOGE(TAG, "Invalid frame of %lu bytes stored in %lu", frame_raw_size_, frame_stored_size_);
+                failed_ = true;
+                break;
+            }
+            frame_filled_ = 0;
+            continue;
+        }
+
+        size_t length = std::min(size, frame_stored_size_ - frame_filled_);
+        memcpy(frame_.get() + frame_filled_, data, length);
+        frame_filled_ += length;
+        data += length;
+        size -= length;
+        if (frame_filled_ < frame_stored_size_) {
+            break;
+        }
+
+        const char* frame = frame_.get();
+        if (frame_stored_size_ < frame_raw_size_) {
+            if (!Lz4DecompressBlock((const uint8_t*)frame_.get(), frame_stored_size_, (uint8_t*)raw_.get(), frame_raw_size_)) {
+                ESP_LOGE(TAG, "Failed to decompress a frame at target offset %u", target_position_);
+                failed_ = true;
+                break;
+            }
+            frame = raw_.get();
+        }
+        frame_header_length_ = 0;
+        if (!RunOperations((const uint8_t*)frame, frame_raw_size_)) {
+            failed_ = true;
+        }
+    }
+    return !failed_;
+}
+
+bool DeltaPatcher::RunOperations(const uint8_t* data, size_t size) {
+    char buffer[256];
+    while (size > 0) {
+        if (state_ == kControl) {
+            size_t length = std::min(size, sizeof(control_) - control_length_);
+            memcpy(control_ + control_length_, data, length);
+            control_length_ += length;
+            data += length;
+            size -= length;
+            if (control_length_ < sizeof(control_)) {
+                break;
+            }
+            control_length_ = 0;
+            memcpy(&diff_left_, control_, 4);
+            memcpy(&extra_left_, control_ + 4, 4);
+            memcpy(&seek_, control_ + 8, 4);
+            if ((uint64_t)target_position_ + diff_left_ + extra_left_ > header_.target_size) {
+                ESP_LOGE(TAG, "Operation at %u runs past the target size %lu", target_position_, header_.target_size);
+                return false;
+            }
+            state_ = kDiff;
+            if (diff_left_ == 0) {
+                state_ = kExtra;
+                if (extra_left_ == 0) {
+                    EndOperation();
+                }
+            }
+        } else if (state_ == kDiff) {
+            size_t length = std::min({ size, (size_t)diff_left_, sizeof(buffer) });
+            if (!ReadBase(base_position_, buffer, length)) {
+                return false;
+            }
+            for (size_t i = 0; i < length; i++) {
+                buffer[i] += data[i];
+            }
+            if (!Emit(buffer, length)) {
+                return false;
+            }
+            base_position_ += length;
+            diff_left_ -= length;
+            data += length;
+            size -= length;
+            if (diff_left_ == 0) {
+                state_ = kExtra;
+                if (extra_left_ == 0) {
+                    EndOperation();
+                }
+            }
+        } else {
+            size_t length = std::min(size, (size_t)extra_left_);
+            if (!Emit((const char*)data, length)) {
+                return false;
+            }
+            extra_left_ -= length;
+            data += length;
+            size -= length;
+            if (extra_left_ == 0) {
+                EndOperation();
+            }
+        }
+    }
+    return true;
+}
+
+void DeltaPatcher::EndOperation() {
+    base_position_ += seek_;
+    state_ = kControl;
+}
+
+bool DeltaPatcher::ReadBase(int64_t offset, char* data, size_t size) {
+    if (offset < 0 || offset + size > header_.base_size) {
+        ESP_LOGE(TAG, "Base read of %u bytes at %lld is out of range", size, offset);
+        return false;
+    }
+    if (header_.window == 0) {
+        return read_base_(offset, data, size);
+    }
+
+    // In place, the base before the first unwritten sector comes from the ring
+    size_t written_end = target_position_ - sector_filled_;
+    while (size > 0 && (size_t)offset < written_end) {
+        if ((size_t)offset + header_.window < written_end) {
+            ESP_LOGE(TAG, "Base at %lld was overwritten, the patch needs a window over %lu bytes", offset, header_.window);
+            return false;
+        }
+        size_t in_sector = offset % sector_size_;
+        size_t length = std::min({ size, sector_size_ - in_sector, written_end - (size_t)offset });
+        size_t slot = (offset / sector_size_) % (header_.window / sector_size_);
+        memcpy(data, ring_.get() + slot * sector_size_ + in_sector, length);
+        offset += length;
+        data += length;
+        size -= length;
+    }
+    return size == 0 || read_base_(offset, data, size);
+}
+
+bool DeltaPatcher::Emit(const char* data, size_t size) {
+    while (size > 0) {
+        size_t length = std::min(size, sector_size_ - sector_filled_);
+        memcpy(sector_.get() + sector_filled_, data, length);
+        sector_filled_ += length;
+        target_position_ += length;
+        data += length;
+        size -= length;
+        if (sector_filled_ == sector_size_ && !FlushSector()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DeltaPatcher::FlushSector() {
+    size_t offset = target_position_ - sector_filled_;
+    size_t size = sector_filled_;
+    sector_filled_ = 0;
+    stats_.target_bytes += size;
+
+    if (header_.window > 0 && offset < header_.base_size) {
+        // Keep the base content for reads behind the write position, skip the write if nothing changed
+        size_t slot = (offset / sector_size_) % (header_.window / sector_size_);
+        char* base = ring_.get() + slot * sector_size_;
+        size_t base_size = std::min(sector_size_, (size_t)header_.base_size - offset);
+        if (!read_base_(offset, base, base_size)) {
+            return false;
+        }
+        if (base_size >= size && memcmp(base, sector_.get(), size) == 0) {
+            stats_.sectors_unchanged++;
+            return true;
+        }
+    }
+    stats_.sectors_written++;
+    return write_target_(offset, sector_.get(), size);
+}
+
+bool DeltaPatcher::Finish() {
+    if (failed_) {
+        return false;
+    }
+    if (sector_filled_ > 0 && !FlushSector()) {
+        failed_ = true;
+        return false;
+    }
+    if (target_position_ != header_.target_size || state_ != kControl || control_length_ != 0 || frame_header_length_ != 0) {
+        ESP_LOGE(TAG, "The patch ended at %u of %lu bytes", target_position_, header_.target_size);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,114 @@
+#ifndef DELTA_PATCHER_H
+#define DELTA_PATCHER_H
+
+#include <memory>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+#define DELTA_MAGIC 0x41544c44 // "DLTA"
+#define DELTA_HEADER_SIZE 24
+// Largest decoded frame, and largest stored one
+#define DELTA_FRAME_SIZE 16384
+
+/**
+ * Patch header, followed by frames of [u32 raw_size][u32 stored_size][data]. A frame is an LZ4
+ * block, or stored as is when stored_size equals raw_size. The decoded frames form a stream of
+ * bsdiff style operations: [u32 diff_len][u32 extra_len][i32 seek], diff_len bytes added to the
+ * base at the base position, extra_len bytes copied to the target, then the base position moves
+ * by seek. Generated by scripts/delta_patch.py.
+ */
+struct DeltaHeader {
+    uint32_t magic;         /*!< DELTA_MAGIC */
+    uint32_t window;        /*!< 0 if the base is read from elsewhere, else bytes of overwritten base kept in RAM */
+    uint32_t base_size;
+    uint32_t base_crc;      /*!< CRC32 of the base the patch was made for */
+    uint32_t target_size;
+    uint32_t target_crc;
+};
+
+struct DeltaPatcherStats {
+    size_t patch_bytes = 0;
+    size_t target_bytes = 0;
+    size_t sectors_written = 0;
+    size_t sectors_unchanged = 0;   // In place only, equal to the base and not written
+};
+
+/**
+ * DeltaPatcher - Applies a streamed patch sector by sector
+ *
+ * Feed() takes the patch after the header in pieces of any size. Each target sector is handed to
+ * the write callback once complete, in order. With a window the target overwrites the base in
+ * place: before a sector is written its base content moves to a ring of window bytes, so the
+ * patch can still read up to window bytes behind the write position. Sectors equal to the base
+ * are not written at all.
+ */
+class DeltaPatcher {
+public:
+    using Reader = std::function<bool(size_t offset, char* data, size_t size)>;
+    using Writer = std::function<bool(size_t offset, const char* data, size_t size)>;
+
+    /**
+     * The window of the header must be a multiple of sector_size
+     */
+    DeltaPatcher(const DeltaHeader& header, size_t sector_size, Reader read_base, Writer write_target);
+
+    /**
+     * False if data is not a patch header
+     */
+    static bool ParseHeader(const char* data, DeltaHeader& header);
+
+    /**
+     * False for a malformed patch or a failed read or write, the patcher is stopped then
+     */
+    bool Feed(const char* data, size_t size);
+    /**
+     * Write the last sector, true if the patch produced the whole target
+     */
+    bool Finish();
+
+    const DeltaPatcherStats& stats() const { return stats_; }
+
+private:
+    enum State {
+        kControl,
+        kDiff,
+        kExtra,
+    };
+
+    DeltaHeader header_;
+    size_t sector_size_;
+    Reader read_base_;
+    Writer write_target_;
+    std::unique_ptr<char[]> sector_;
+    std::unique_ptr<char[]> ring_;
+    std::unique_ptr<char[]> frame_;
+    std::unique_ptr<char[]> raw_;
+
+    uint8_t frame_header_[8];
+    size_t frame_header_length_ = 0;
+    uint32_t frame_raw_size_ = 0;
+    uint32_t frame_stored_size_ = 0;
+    size_t frame_filled_ = 0;
+
+    State state_ = kControl;
+    uint8_t control_[12];
+    size_t control_length_ = 0;
+    uint32_t diff_left_ = 0;
+    uint32_t extra_left_ = 0;
+    int32_t seek_ = 0;
+    int64_t base_position_ = 0;
+
+    size_t target_position_ = 0;
+    size_t sector_filled_ = 0;
+    bool failed_ = false;
+    DeltaPatcherStats stats_;
+
+    bool RunOperations(const uint8_t* data, size_t size);
+    bool ReadBase(int64_t offset, char* data, size_t size);
+    bool Emit(const char* data, size_t size);
+    bool FlushSector();
+    void EndOperation();
+};
+
+#endif // DELTA_PATCHER_H
@@ -1,10 +1,26 @@
 #include "device_state_machine.h"
+#include "json_writer.h"
 
 #include <algorithm>
+#include <cstring>
 #include <esp_log.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <esp_system.h>
 
 static const char* TAG = "StateMachine";
 
+#define STATE_TRACE_MAGIC 0x53545254
+
+// Kept in no-init memory, so it survives panics, watchdog and software resets and the trace
+// of a crashed boot can be logged by the next one. There is only one state machine.
+struct StateTraceBuffer {
+    uint32_t magic;
+    uint32_t write_index;
+    StateTransition entries[STATE_TRACE_SIZE];
+};
+static __NOINIT_ATTR StateTraceBuffer s_trace;
+
 // State name strings for logging
 static const char* const STATE_STRINGS[] = {
     "unknown",
@@ -21,7 +37,38 @@ static const char* const STATE_STRINGS[] = {
     "invalid_state"
 };
 
+static bool IsCrashReset(int reason) {
+    return reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT ||
+        reason == ESP_RST_WDT || reason == ESP_RST_BROWNOUT;
+}
+
+static void PrintTransitions(const std::vector<StateTransition>& trace) {
+    for (const auto& transition : trace) {
+        ESP_LOGI(TAG, "%8lu ms %s -> %s by %s, listeners %lu us, handler %lu us", transition.time_ms,
+            DeviceStateMachine::GetStateName((DeviceState)transition.old_state),
+            DeviceStateMachine::GetStateName((DeviceState)transition.new_state),
+            transition.cause[0] != '\0' ? transition.cause : "-", transition.listener_us, transition.handler_us);
+    }
+}
+
+void StateTurnStats::Add(uint32_t ms) {
+    count++;
+    total_ms += ms;
+    last_ms = ms;
+    max_ms = std::max(max_ms, ms);
+}
+
 DeviceStateMachine::DeviceStateMachine() {
+    previous_reset_reason_ = esp_reset_reason();
+    if (s_trace.magic == STATE_TRACE_MAGIC && previous_reset_reason_ != ESP_RST_POWERON) {
+        previous_trace_ = GetTrace();
+        if (IsCrashReset(previous_reset_reason_) && !previous_trace_.empty()) {
+            ESP_LOGW(TAG, "State transitions before the last reset (reason %d):", previous_reset_reason_);
+            PrintTransitions(previous_trace_);
+        }
+    }
+    memset(&s_trace, 0, sizeof(s_trace));
+    s_trace.magic = STATE_TRACE_MAGIC;
 }
 
 const char* DeviceStateMachine::GetStateName(DeviceState state) {
@@ -105,7 +152,7 @@ bool DeviceStateMachine::CanTransitionTo(DeviceState target) const {
     return IsValidTransition(current_state_.load(), target);
 }
 
-bool DeviceStateMachine::TransitionTo(DeviceState new_state) {
+bool DeviceStateMachine::TransitionTo(DeviceState new_state, const char* cause) {
     DeviceState old_state = current_state_.load();
     
     // No-op if already in the target state
@@ -121,15 +168,160 @@ bool DeviceStateMachine::TransitionTo(DeviceState new_state) {
     }
 
     // Perform transition
+    int64_t time = esp_timer_get_time();
     current_state_.store(new_state);
     ESP_LOGI(TAG, "State: %s -> %s",
              GetStateName(old_state), GetStateName(new_state));
+    UpdateMetrics(time / 1000, old_state, new_state);
 
     // Notify callback
     NotifyStateChange(old_state, new_state);
+    RecordTransition(time / 1000, old_state, new_state, cause, esp_timer_get_time() - time);
     return true;
 }
 
+void DeviceStateMachine::RecordTransition(uint32_t time_ms, DeviceState old_state, DeviceState new_state,
+    const char* cause, uint32_t listener_us) {
+    // Claim a slot, readers skip it until its sequence matches the claimed index again
+    uint32_t index = __atomic_fetch_add(&s_trace.write_index, 1, __ATOMIC_RELAXED);
+    auto& slot = s_trace.entries[index & (STATE_TRACE_SIZE - 1)];
+    __atomic_store_n(&slot.sequence, 0, __ATOMIC_RELEASE);
+    slot.time_ms = time_ms;
+    slot.old_state = old_state;
+    slot.new_state = new_state;
+    slot.listener_us = listener_us;
+    slot.handler_us = 0;
+    strncpy(slot.cause, cause != nullptr ? cause : "", STATE_TRACE_CAUSE_LENGTH - 1);
+    slot.cause[STATE_TRACE_CAUSE_LENGTH - 1] = '\0';
+    __atomic_store_n(&slot.sequence, index + 1, __ATOMIC_RELEASE);
+}
+
+void DeviceStateMachine::UpdateMetrics(uint32_t time_ms, DeviceState old_state, DeviceState new_state) {
+    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    state_ms_[old_state] += time_ms - state_enter_ms_;
+    state_enter_ms_ = time_ms;
+
+    if (old_state == kDeviceStateIdle && (new_state == kDeviceStateConnecting || new_state == kDeviceStateListening)) {
+        idle_exit_ms_ = time_ms;
+    }
+    if (new_state == kDeviceStateListening) {
+        if (idle_exit_ms_ != 0) {
+            idle_to_listening_.Add(time_ms - idle_exit_ms_);
+            idle_exit_ms_ = 0;
+        }
+        listening_enter_ms_ = time_ms;
+    } else if (new_state == kDeviceStateSpeaking && old_state == kDeviceStateListening) {
+        listening_to_speaking_.Add(time_ms - listening_enter_ms_);
+    } else if (new_state == kDeviceStateIdle) {
+        idle_exit_ms_ = 0;
+    }
+}
+
+void DeviceStateMachine::RecordHandlerDuration(uint32_t duration_us) {
+    uint32_t index = __atomic_load_n(&s_trace.write_index, __ATOMIC_ACQUIRE);
+    if (index == 0) {
+        return;
+    }
+    auto& slot = s_trace.entries[(index - 1) & (STATE_TRACE_SIZE - 1)];
+    if (__atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE) == index) {
+        __atomic_store_n(&slot.handler_us, duration_us, __ATOMIC_RELAXED);
+    }
+}
+
+std::vector<StateTransition> DeviceStateMachine::GetTrace() const {
+    std::vector<StateTransition> trace;
+    uint32_t end = __atomic_load_n(&s_trace.write_index, __ATOMIC_ACQUIRE);
+    uint32_t begin = end > STATE_TRACE_SIZE ? end - STATE_TRACE_SIZE : 0;
+    trace.reserve(end - begin);
+    for (uint32_t i = begin; i < end; i++) {
+        const auto& slot = s_trace.entries[i & (STATE_TRACE_SIZE - 1)];
+        if (__atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE) != i + 1) {
+            continue;
+        }
+        StateTransition transition;
+        memcpy(&transition, &slot, sizeof(transition));
+        // Drop the copy if the slot was claimed again while it was being read
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot.sequence, __ATOMIC_RELAXED) != i + 1) {
+            continue;
+        }
+        transition.cause[STATE_TRACE_CAUSE_LENGTH - 1] = '\0';
+        trace.push_back(transition);
+    }
+    return trace;
+}
+
+static void WriteTransitions(JsonWriter& writer, const std::vector<StateTransition>& trace) {
+    writer.BeginArray();
+    for (const auto& transition : trace) {
+        writer.BeginObject();
+        writer.Member("ms", (double)transition.time_ms);
+        writer.Member("from", DeviceStateMachine::GetStateName((DeviceState)transition.old_state));
+        writer.Member("to", DeviceStateMachine::GetStateName((DeviceState)transition.new_state));
+        writer.Member("cause", transition.cause);
+        writer.Member("listener_us", (int)transition.listener_us);
+        writer.Member("handler_us", (int)transition.handler_us);
+        writer.EndObject();
+    }
+    writer.EndArray();
+}
+
+static void WriteTurnStats(JsonWriter& writer, std::string_view key, const StateTurnStats& stats) {
+    writer.Key(key).BeginObject();
+    writer.Member("count", (int)stats.count);
+    writer.Member("avg_ms", (int)(stats.count > 0 ? stats.total_ms / stats.count : 0));
+    writer.Member("max_ms", (int)stats.max_ms);
+    writer.Member("last_ms", (int)stats.last_ms);
+    writer.EndObject();
+}
+
+std::string DeviceStateMachine::GetTraceJson() const {
+    std::string json;
+    JsonWriter writer(json);
+    writer.BeginObject();
+    writer.Member("state", GetStateName(GetState()));
+    writer.Key("transitions");
+    WriteTransitions(writer, GetTrace());
+
+    {
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        uint32_t now_ms = esp_timer_get_time() / 1000;
+        DeviceState state = GetState();
+        writer.Key("time_in_state_ms").BeginObject();
+        for (int i = 0; i < STATE_COUNT; i++) {
+            uint32_t ms = state_ms_[i] + (i == state ? now_ms - state_enter_ms_ : 0);
+            if (ms > 0) {
+                writer.Member(GetStateName((DeviceState)i), (double)ms);
+            }
+        }
+        writer.EndObject();
+
+        writer.Key("turns").BeginObject();
+        WriteTurnStats(writer, "idle_to_listening", idle_to_listening_);
+        WriteTurnStats(writer, "listening_to_speaking", listening_to_speaking_);
+        writer.EndObject();
+    }
+
+    if (!previous_trace_.empty()) {
+        writer.Key("previous_boot").BeginObject();
+        writer.Member("reset_reason", previous_reset_reason_);
+        writer.Key("transitions");
+        WriteTransitions(writer, previous_trace_);
+        writer.EndObject();
+    }
+    writer.EndObject();
+    return json;
+}
+
+void DeviceStateMachine::PrintTrace() const {
+    PrintTransitions(GetTrace());
+    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    ESP_LOGI(TAG, "Turns: idle -> listening avg %lu ms max %lu ms, listening -> speaking avg %lu ms max %lu ms",
+        idle_to_listening_.count > 0 ? idle_to_listening_.total_ms / idle_to_listening_.count : 0, idle_to_listening_.max_ms,
+        listening_to_speaking_.count > 0 ? listening_to_speaking_.total_ms / listening_to_speaking_.count : 0,
+        listening_to_speaking_.max_ms);
+}
+
 int DeviceStateMachine::AddStateChangeListener(StateCallback callback) {
     std::lock_guard<std::mutex> lock(mutex_);
     int id = next_listener_id_++;
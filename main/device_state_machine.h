@@ -4,10 +4,39 @@
 #include <atomic>
 #include <functional>
 #include <mutex>
+#include <string>
 #include <vector>
+#include <cstdint>
 
 #include "device_state.h"
 
+// Transitions kept in the trace ring, must be a power of two
+#define STATE_TRACE_SIZE 32
+#define STATE_TRACE_CAUSE_LENGTH 24
+#define STATE_COUNT (kDeviceStateFatalError + 1)
+
+struct StateTransition {
+    uint32_t sequence;          // Transition number + 1 once written, 0 while being written
+    uint32_t time_ms;           // Since boot
+    uint8_t old_state;
+    uint8_t new_state;
+    uint32_t listener_us;       // Run time of the listeners called by TransitionTo()
+    uint32_t handler_us;        // Run time of the deferred handler, see RecordHandlerDuration()
+    char cause[STATE_TRACE_CAUSE_LENGTH];
+};
+
+/**
+ * Time from one state to another within a conversation turn
+ */
+struct StateTurnStats {
+    uint32_t count = 0;
+    uint32_t total_ms = 0;
+    uint32_t max_ms = 0;
+    uint32_t last_ms = 0;
+
+    void Add(uint32_t ms);
+};
+
 /**
  * DeviceStateMachine - Manages device state transitions with validation
  * 
@@ -31,9 +60,10 @@ public:
     /**
      * Attempt to transition to a new state
      * @param new_state The target state
+     * @param cause Who asked for the transition, recorded in the trace
      * @return true if transition was successful, false if invalid transition
      */
-    bool TransitionTo(DeviceState new_state);
+    bool TransitionTo(DeviceState new_state, const char* cause = nullptr);
 
     /**
      * Check if transition to target state is valid from current state
@@ -63,12 +93,45 @@ public:
      */
     static const char* GetStateName(DeviceState state);
 
+    /**
+     * Attach the run time of work deferred by a listener (display, LED, audio) to the latest transition
+     */
+    void RecordHandlerDuration(uint32_t duration_us);
+
+    /**
+     * Completed transitions in the trace ring, oldest first
+     */
+    std::vector<StateTransition> GetTrace() const;
+
+    /**
+     * Trace, time spent in each state and idle -> listening -> speaking turn latencies,
+     * plus the trace left by the previous boot if it ended in a crash or reboot
+     */
+    std::string GetTraceJson() const;
+    void PrintTrace() const;
+
 private:
     std::atomic<DeviceState> current_state_{kDeviceStateUnknown};
     std::vector<std::pair<int, StateCallback>> listeners_;
     int next_listener_id_{0};
     std::mutex mutex_;
 
+    // Derived metrics, guarded by metrics_mutex_
+    mutable std::mutex metrics_mutex_;
+    uint32_t state_enter_ms_ = 0;
+    uint32_t state_ms_[STATE_COUNT] = {};
+    uint32_t idle_exit_ms_ = 0;         // Start of the turn, 0 when no turn is in progress
+    uint32_t listening_enter_ms_ = 0;
+    StateTurnStats idle_to_listening_;
+    StateTurnStats listening_to_speaking_;
+
+    // The trace the previous boot left behind in no-init memory
+    std::vector<StateTransition> previous_trace_;
+    int previous_reset_reason_ = 0;
+
+    void RecordTransition(uint32_t time_ms, DeviceState old_state, DeviceState new_state, const char* cause, uint32_t listener_us);
+    void UpdateMetrics(uint32_t time_ms, DeviceState old_state, DeviceState new_state);
+
     /**
      * Check if transition from source to target is valid
      */
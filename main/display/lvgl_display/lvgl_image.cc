@@ -19,6 +19,11 @@ LvglRawImage::LvglRawImage(void* data, size_t size) {
     image_dsc_.header.h = 0;
 }
 
+LvglRawImage::LvglRawImage(std::shared_ptr<const char> data, size_t size)
+    : LvglRawImage(const_cast<char*>(data.get()), size) {
+    data_ = std::move(data);
+}
+
 bool LvglRawImage::IsGif() const {
     auto ptr = (const uint8_t*)image_dsc_.data;
     return ptr[0] == 'G' && ptr[1] == 'I' && ptr[2] == 'F';
@@ -28,6 +33,11 @@ LvglCBinImage::LvglCBinImage(void* data) {
     image_dsc_ = cbin_img_dsc_create(static_cast<uint8_t*>(data));
 }
 
+LvglCBinImage::LvglCBinImage(std::shared_ptr<const char> data)
+    : LvglCBinImage(const_cast<char*>(data.get())) {
+    data_ = std::move(data);
+}
+
 LvglCBinImage::~LvglCBinImage() {
     if (image_dsc_ != nullptr) {
         cbin_img_dsc_delete(image_dsc_);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <lvgl.h>
+#include <memory>
 
 
 // Wrap around lv_img_dsc_t
@@ -15,21 +16,27 @@ public:
 class LvglRawImage : public LvglImage {
 public:
     LvglRawImage(void* data, size_t size);
+    // Keeps data alive as long as the image
+    LvglRawImage(std::shared_ptr<const char> data, size_t size);
     virtual const lv_img_dsc_t* image_dsc() const override { return &image_dsc_; }
     virtual bool IsGif() const;
 
 private:
     lv_img_dsc_t image_dsc_;
+    std::shared_ptr<const char> data_;
 };
 
 class LvglCBinImage : public LvglImage {
 public:
     LvglCBinImage(void* data);
+    // Keeps data alive as long as the image
+    LvglCBinImage(std::shared_ptr<const char> data);
     virtual ~LvglCBinImage();
     virtual const lv_img_dsc_t* image_dsc() const override { return image_dsc_; }
 
 private:
     lv_img_dsc_t* image_dsc_ = nullptr;
+    std::shared_ptr<const char> data_;
 };
 
 class LvglSourceImage : public LvglImage {
@@ -0,0 +1,430 @@
+#include "json_reader.h"
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+inline bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline int HexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+inline size_t SkipSpace(std::string_view text, size_t pos) {
+    while (pos < text.size() && IsSpace(text[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+JsonType TypeOf(char c) {
+    switch (c) {
+        case '{': return kJsonObject;
+        case '[': return kJsonArray;
+        case '"': return kJsonString;
+        case 't':
+        case 'f': return kJsonBool;
+        case 'n': return kJsonNull;
+        default: return (c == '-' || IsDigit(c)) ? kJsonNumber : kJsonInvalid;
+    }
+}
+
+// Single pass validation of the whole document
+class Validator {
+public:
+    explicit Validator(std::string_view text) : text_(text) {}
+
+    bool Run() {
+        pos_ = SkipSpace(text_, 0);
+        if (!Value(0)) {
+            return false;
+        }
+        return SkipSpace(text_, pos_) == text_.size();
+    }
+
+    size_t root_start() const { return SkipSpace(text_, 0); }
+    size_t end() const { return pos_; }
+
+private:
+    std::string_view text_;
+    size_t pos_ = 0;
+
+    bool Literal(const char* literal) {
+        size_t length = strlen(literal);
+        if (text_.compare(pos_, length, literal) != 0) {
+            return false;
+        }
+        pos_ += length;
+        return true;
+    }
+
+    bool String() {
+        pos_++; // opening quote
+        while (pos_ < text_.size()) {
+            unsigned char c = text_[pos_++];
+            if (c == '"') {
+                return true;
+            }
+            if (c < 0x20) {
+                return false;
+            }
+            if (c == '\\') {
+                if (pos_ >= text_.size()) {
+                    return false;
+                }
+                char e = text_[pos_++];
+                if (e == 'u') {
+                    if (pos_ + 4 > text_.size()) {
+                        return false;
+                    }
+                    for (int i = 0; i < 4; i++) {
+                        if (HexValue(text_[pos_++]) < 0) {
+                            return false;
+                        }
+                    }
+                } else if (strchr("\"\\/bfnrt", e) == nullptr || e == '\0') {
+                    return false;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool Number() {
+        if (text_[pos_] == '-') {
+            pos_++;
+        }
+        if (pos_ >= text_.size()) {
+            return false;
+        }
+        if (text_[pos_] == '0') {
+            pos_++;
+        } else if (IsDigit(text_[pos_])) {
+            while (pos_ < text_.size() && IsDigit(text_[pos_])) pos_++;
+        } else {
+            return false;
+        }
+        if (pos_ < text_.size() && text_[pos_] == '.') {
+            pos_++;
+            if (pos_ >= text_.size() || !IsDigit(text_[pos_])) {
+                return false;
+            }
+            while (pos_ < text_.size() && IsDigit(text_[pos_])) pos_++;
+        }
+        if (pos_ < text_.size() && (text_[pos_] == 'e' || text_[pos_] == 'E')) {
+            pos_++;
+            if (pos_ < text_.size() && (text_[pos_] == '+' || text_[pos_] == '-')) {
+                pos_++;
+            }
+            if (pos_ >= text_.size() || !IsDigit(text_[pos_])) {
+                return false;
+            }
+            while (pos_ < text_.size() && IsDigit(text_[pos_])) pos_++;
+        }
+        return true;
+    }
+
+    bool Container(int depth, char close, bool object) {
+        if (depth >= JsonReader::kMaxDepth) {
+            return false;
+        }
+        pos_ = SkipSpace(text_, pos_ + 1);
+        if (pos_ < text_.size() && text_[pos_] == close) {
+            pos_++;
+            return true;
+        }
+        while (true) {
+            if (object) {
+                if (pos_ >= text_.size() || text_[pos_] != '"' || !String()) {
+                    return false;
+                }
+                pos_ = SkipSpace(text_, pos_);
+                if (pos_ >= text_.size() || text_[pos_] != ':') {
+                    return false;
+                }
+                pos_ = SkipSpace(text_, pos_ + 1);
+            }
+            if (!Value(depth + 1)) {
+                return false;
+            }
+            pos_ = SkipSpace(text_, pos_);
+            if (pos_ >= text_.size()) {
+                return false;
+            }
+            char c = text_[pos_++];
+            if (c == close) {
+                return true;
+            }
+            if (c != ',') {
+                return false;
+            }
+            pos_ = SkipSpace(text_, pos_);
+        }
+    }
+
+    bool Value(int depth) {
+        if (pos_ >= text_.size()) {
+            return false;
+        }
+        switch (text_[pos_]) {
+            case '{': return Container(depth, '}', true);
+            case '[': return Container(depth, ']', false);
+            case '"': return String();
+            case 't': return Literal("true");
+            case 'f': return Literal("false");
+            case 'n': return Literal("null");
+            default: return Number();
+        }
+    }
+};
+
+// Returns the end of the value starting at pos, the text is known to be valid
+size_t SkipValue(std::string_view text, size_t pos) {
+    char c = text[pos];
+    if (c == '"') {
+        pos++;
+        while (text[pos] != '"') {
+            pos += (text[pos] == '\\') ? 2 : 1;
+        }
+        return pos + 1;
+    }
+    if (c == '{' || c == '[') {
+        int depth = 0;
+        do {
+            c = text[pos];
+            if (c == '"') {
+                pos = SkipValue(text, pos);
+                continue;
+            }
+            if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || c == ']') {
+                depth--;
+            }
+            pos++;
+        } while (depth > 0);
+        return pos;
+    }
+    // Literal or number
+    while (pos < text.size() && text[pos] != ',' && text[pos] != '}' && text[pos] != ']' && !IsSpace(text[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+void AppendUtf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += (char)cp;
+    } else if (cp < 0x800) {
+        out += (char)(0xC0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += (char)(0xE0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else {
+        out += (char)(0xF0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3F));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+uint32_t ReadHex4(std::string_view text, size_t pos) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < 4; i++) {
+        value = (value << 4) | HexValue(text[pos + i]);
+    }
+    return value;
+}
+
+} // namespace
+
+JsonValue JsonReader::Parse(std::string_view json) {
+    Validator validator(json);
+    if (!validator.Run()) {
+        return JsonValue();
+    }
+    size_t start = validator.root_start();
+    return JsonValue(TypeOf(json[start]), json.substr(start, validator.end() - start));
+}
+
+std::string_view JsonValue::string_view() const {
+    if (type_ != kJsonString) {
+        return std::string_view();
+    }
+    return raw_.substr(1, raw_.size() - 2);
+}
+
+bool JsonValue::HasEscapes() const {
+    auto contents = string_view();
+    return memchr(contents.data(), '\\', contents.size()) != nullptr;
+}
+
+std::string JsonValue::ToString() const {
+    auto contents = string_view();
+    if (!HasEscapes()) {
+        return std::string(contents);
+    }
+
+    std::string out;
+    out.reserve(contents.size());
+    for (size_t i = 0; i < contents.size(); i++) {
+        char c = contents[i];
+        if (c != '\\') {
+            out += c;
+            continue;
+        }
+        char e = contents[++i];
+        switch (e) {
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                uint32_t cp = ReadHex4(contents, i + 1);
+                i += 4;
+                // Combine a surrogate pair into one code point
+                if (cp >= 0xD800 && cp <= 0xDBFF && i + 6 < contents.size() &&
+                    contents[i + 1] == '\\' && contents[i + 2] == 'u') {
+                    uint32_t low = ReadHex4(contents, i + 3);
+                    if (low >= 0xDC00 && low <= 0xDFFF) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        i += 6;
+                    }
+                }
+                AppendUtf8(out, cp);
+                break;
+            }
+            default: out += e; break;
+        }
+    }
+    return out;
+}
+
+bool JsonValue::Equals(std::string_view text) const {
+    if (type_ != kJsonString) {
+        return false;
+    }
+    if (!HasEscapes()) {
+        return string_view() == text;
+    }
+    return ToString() == text;
+}
+
+double JsonValue::ToDouble(double default_value) const {
+    if (type_ != kJsonNumber) {
+        return default_value;
+    }
+    // strtod needs a terminated string, numbers are short
+    char buffer[40];
+    if (raw_.size() >= sizeof(buffer)) {
+        return default_value;
+    }
+    memcpy(buffer, raw_.data(), raw_.size());
+    buffer[raw_.size()] = '\0';
+    return strtod(buffer, nullptr);
+}
+
+int JsonValue::ToInt(int default_value) const {
+    if (type_ != kJsonNumber) {
+        return default_value;
+    }
+    // Clamped like cJSON's valueint, converting a double outside the int range is undefined
+    double value = ToDouble(default_value);
+    if (value >= INT_MAX) {
+        return INT_MAX;
+    }
+    if (value <= (double)INT_MIN) {
+        return INT_MIN;
+    }
+    return (int)value;
+}
+
+bool JsonValue::ToBool(bool default_value) const {
+    if (type_ != kJsonBool) {
+        return default_value;
+    }
+    return raw_[0] == 't';
+}
+
+bool JsonValue::Next(size_t& pos, JsonValue& key, JsonValue& value) const {
+    if (type_ != kJsonObject && type_ != kJsonArray) {
+        return false;
+    }
+    // pos is 0 before the first member, otherwise it points after the previous value
+    pos = SkipSpace(raw_, pos == 0 ? 1 : pos);
+    char c = raw_[pos];
+    if (c == ',') {
+        pos = SkipSpace(raw_, pos + 1);
+        c = raw_[pos];
+    }
+    if (c == '}' || c == ']') {
+        return false;
+    }
+
+    if (type_ == kJsonObject) {
+        size_t key_end = SkipValue(raw_, pos);
+        key = JsonValue(kJsonString, raw_.substr(pos, key_end - pos));
+        pos = SkipSpace(raw_, key_end);
+        pos = SkipSpace(raw_, pos + 1); // colon
+    } else {
+        key = JsonValue();
+    }
+    size_t value_end = SkipValue(raw_, pos);
+    value = JsonValue(TypeOf(raw_[pos]), raw_.substr(pos, value_end - pos));
+    pos = value_end;
+    return true;
+}
+
+JsonValue JsonValue::operator[](std::string_view key) const {
+    if (type_ != kJsonObject) {
+        return JsonValue();
+    }
+    JsonValue result;
+    ForEach([&](const JsonValue& member_key, const JsonValue& member_value) {
+        if (member_key.Equals(key)) {
+            result = member_value;
+            return false;
+        }
+        return true;
+    });
+    return result;
+}
+
+JsonValue JsonValue::operator[](size_t index) const {
+    if (type_ != kJsonArray) {
+        return JsonValue();
+    }
+    JsonValue result;
+    size_t i = 0;
+    ForEach([&](const JsonValue&, const JsonValue& element) {
+        if (i++ == index) {
+            result = element;
+            return false;
+        }
+        return true;
+    });
+    return result;
+}
+
+size_t JsonValue::size() const {
+    size_t count = 0;
+    ForEach([&](const JsonValue&, const JsonValue&) {
+        count++;
+        return true;
+    });
+    return count;
+}
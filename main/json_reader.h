@@ -0,0 +1,109 @@
+#ifndef JSON_READER_H
+#define JSON_READER_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+enum JsonType : uint8_t {
+    kJsonInvalid,
+    kJsonNull,
+    kJsonBool,
+    kJsonNumber,
+    kJsonString,
+    kJsonArray,
+    kJsonObject,
+};
+
+/**
+ * JsonValue - A view of one value inside a validated JSON document
+ *
+ * The value does not own any memory, it points into the buffer passed to JsonReader::Parse(),
+ * which must outlive it. Lookups walk the text in place, so no DOM is ever built.
+ */
+class JsonValue {
+public:
+    JsonValue() = default;
+    JsonValue(JsonType type, std::string_view raw) : type_(type), raw_(raw) {}
+
+    JsonType type() const { return type_; }
+    bool IsValid() const { return type_ != kJsonInvalid; }
+    bool IsNull() const { return type_ == kJsonNull; }
+    bool IsBool() const { return type_ == kJsonBool; }
+    bool IsNumber() const { return type_ == kJsonNumber; }
+    bool IsString() const { return type_ == kJsonString; }
+    bool IsArray() const { return type_ == kJsonArray; }
+    bool IsObject() const { return type_ == kJsonObject; }
+
+    /**
+     * The exact JSON text of this value, e.g. an object including its braces
+     */
+    std::string_view raw() const { return raw_; }
+
+    /**
+     * String contents without the quotes, escape sequences are left as they are
+     */
+    std::string_view string_view() const;
+    bool HasEscapes() const;
+
+    /**
+     * String contents with escape sequences decoded
+     */
+    std::string ToString() const;
+
+    /**
+     * Compare the decoded string contents, without allocating if there is nothing to decode
+     */
+    bool Equals(std::string_view text) const;
+
+    double ToDouble(double default_value = 0) const;
+    int ToInt(int default_value = 0) const;
+    bool ToBool(bool default_value = false) const;
+
+    /**
+     * Object member lookup, returns an invalid value if this is not an object or the key is missing
+     */
+    JsonValue operator[](std::string_view key) const;
+
+    /**
+     * Array element lookup, returns an invalid value if out of range
+     */
+    JsonValue operator[](size_t index) const;
+    size_t size() const;
+
+    /**
+     * Iterate over object members (key is the string value of the member name) or array elements
+     * (key is invalid). Return false from the callback to stop early.
+     */
+    template <typename Callback>
+    void ForEach(Callback&& callback) const {
+        size_t pos = 0;
+        JsonValue key, value;
+        while (Next(pos, key, value)) {
+            if (!callback(key, value)) {
+                break;
+            }
+        }
+    }
+
+private:
+    JsonType type_ = kJsonInvalid;
+    std::string_view raw_;
+
+    bool Next(size_t& pos, JsonValue& key, JsonValue& value) const;
+};
+
+/**
+ * JsonReader - Validating, non-allocating JSON reader
+ *
+ * Parse() checks the whole document in one pass (structure, string escapes, number syntax,
+ * nesting depth) and returns a view of the root value. Values are then read in place.
+ */
+class JsonReader {
+public:
+    static constexpr int kMaxDepth = 32;
+
+    static JsonValue Parse(std::string_view json);
+};
+
+#endif // JSON_READER_H
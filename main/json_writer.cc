@@ -0,0 +1,170 @@
+#include "json_writer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+JsonWriter::JsonWriter(std::string& buffer) : buffer_(buffer) {
+    buffer_.clear();
+}
+
+void JsonWriter::BeforeValue() {
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+    if (depth_ == 0 || depth_ > kMaxDepth) {
+        return;
+    }
+    uint32_t bit = 1u << (depth_ - 1);
+    if (has_items_ & bit) {
+        buffer_ += ',';
+    }
+    has_items_ |= bit;
+}
+
+void JsonWriter::Open(char c) {
+    BeforeValue();
+    buffer_ += c;
+    depth_++;
+    if (depth_ > kMaxDepth) {
+        overflow_ = true;
+    } else {
+        has_items_ &= ~(1u << (depth_ - 1));
+    }
+}
+
+void JsonWriter::Close(char c) {
+    buffer_ += c;
+    if (depth_ > 0) {
+        depth_--;
+    }
+}
+
+JsonWriter& JsonWriter::BeginObject() {
+    Open('{');
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndObject() {
+    Close('}');
+    return *this;
+}
+
+JsonWriter& JsonWriter::BeginArray() {
+    Open('[');
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndArray() {
+    Close(']');
+    return *this;
+}
+
+JsonWriter& JsonWriter::Key(std::string_view key) {
+    BeforeValue();
+    AppendEscaped(buffer_, key);
+    buffer_ += ':';
+    after_key_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(std::string_view value) {
+    BeforeValue();
+    AppendEscaped(buffer_, value);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Int(int64_t value) {
+    BeforeValue();
+    char digits[24];
+    int length = 0;
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    do {
+        digits[length++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        buffer_ += '-';
+    }
+    while (length > 0) {
+        buffer_ += digits[--length];
+    }
+    return *this;
+}
+
+JsonWriter& JsonWriter::Double(double value) {
+    // Same formatting as cJSON: integers print without a fraction, NaN and infinity become null
+    if (std::isnan(value) || std::isinf(value)) {
+        return Null();
+    }
+    // The range check comes first, converting a double beyond int64_t is undefined
+    if (std::fabs(value) < 1e15 && value == (double)(int64_t)value) {
+        return Int((int64_t)value);
+    }
+    BeforeValue();
+    char number[32];
+    int length = snprintf(number, sizeof(number), "%1.15g", value);
+    if (strtod(number, nullptr) != value) {
+        length = snprintf(number, sizeof(number), "%1.17g", value);
+    }
+    buffer_.append(number, length);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Bool(bool value) {
+    BeforeValue();
+    buffer_ += value ? "true" : "false";
+    return *this;
+}
+
+JsonWriter& JsonWriter::Null() {
+    BeforeValue();
+    buffer_ += "null";
+    return *this;
+}
+
+JsonWriter& JsonWriter::Raw(std::string_view json) {
+    BeforeValue();
+    buffer_ += json;
+    return *this;
+}
+
+void JsonWriter::Rollback(const Checkpoint& checkpoint) {
+    buffer_.resize(checkpoint.size);
+    depth_ = checkpoint.depth;
+    has_items_ = checkpoint.has_items;
+    after_key_ = false;
+}
+
+void JsonWriter::AppendEscaped(std::string& out, std::string_view value) {
+    static const char kHex[] = "0123456789abcdef";
+    out += '"';
+    // Copy runs of characters that need no escaping in one append
+    size_t run_start = 0;
+    for (size_t i = 0; i < value.size(); i++) {
+        unsigned char c = value[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.append(value.data() + run_start, i - run_start);
+        run_start = i + 1;
+        out += '\\';
+        switch (c) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '\b': out += 'b'; break;
+            case '\f': out += 'f'; break;
+            case '\n': out += 'n'; break;
+            case '\r': out += 'r'; break;
+            case '\t': out += 't'; break;
+            default:
+                out += "u00";
+                out += kHex[c >> 4];
+                out += kHex[c & 0xF];
+                break;
+        }
+    }
+    out.append(value.data() + run_start, value.size() - run_start);
+    out += '"';
+}
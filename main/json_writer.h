@@ -0,0 +1,86 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+/**
+ * JsonWriter - Streams compact JSON into a caller owned buffer
+ *
+ * The buffer is cleared but keeps its capacity, so a buffer reused across messages stops
+ * allocating once it has grown to the largest message. Commas are inserted automatically and
+ * strings are escaped, the output is always valid JSON as long as Begin/End calls are balanced.
+ *
+ *   JsonWriter writer(buffer);
+ *   writer.BeginObject().Member("type", "listen").Member("state", "start").EndObject();
+ */
+class JsonWriter {
+public:
+    static constexpr int kMaxDepth = 32;
+
+    explicit JsonWriter(std::string& buffer);
+
+    JsonWriter& BeginObject();
+    JsonWriter& EndObject();
+    JsonWriter& BeginArray();
+    JsonWriter& EndArray();
+
+    /**
+     * Start an object member, must be followed by exactly one value
+     */
+    JsonWriter& Key(std::string_view key);
+
+    JsonWriter& String(std::string_view value);
+    JsonWriter& Int(int64_t value);
+    JsonWriter& Double(double value);
+    JsonWriter& Bool(bool value);
+    JsonWriter& Null();
+
+    /**
+     * Insert an already serialized JSON value as it is
+     */
+    JsonWriter& Raw(std::string_view json);
+
+    JsonWriter& Member(std::string_view key, std::string_view value) { return Key(key).String(value); }
+    JsonWriter& Member(std::string_view key, const char* value) { return Key(key).String(value); }
+    JsonWriter& Member(std::string_view key, const std::string& value) { return Key(key).String(value); }
+    JsonWriter& Member(std::string_view key, int value) { return Key(key).Int(value); }
+    JsonWriter& Member(std::string_view key, double value) { return Key(key).Double(value); }
+    JsonWriter& Member(std::string_view key, bool value) { return Key(key).Bool(value); }
+
+    /**
+     * A position to roll back to, e.g. to drop an array element that made the message too large
+     */
+    struct Checkpoint {
+        size_t size;
+        int depth;
+        uint32_t has_items;
+    };
+    Checkpoint GetCheckpoint() const { return { buffer_.size(), depth_, has_items_ }; }
+    void Rollback(const Checkpoint& checkpoint);
+
+    size_t size() const { return buffer_.size(); }
+    /**
+     * True when every container has been closed and nesting stayed within kMaxDepth
+     */
+    bool IsComplete() const { return depth_ == 0 && !overflow_; }
+
+    /**
+     * Append a JSON string literal (with quotes) for value to out
+     */
+    static void AppendEscaped(std::string& out, std::string_view value);
+
+private:
+    std::string& buffer_;
+    int depth_ = 0;
+    uint32_t has_items_ = 0;    // Bit n is set once the container at depth n has a value
+    bool after_key_ = false;
+    bool overflow_ = false;
+
+    void BeforeValue();
+    void Open(char c);
+    void Close(char c);
+};
+
+#endif // JSON_WRITER_H
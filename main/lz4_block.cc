@@ -0,0 +1,72 @@
+#include "lz4_block.h"
+
+#include <cstring>
+
+static bool ReadLength(const uint8_t*& ip, const uint8_t* iend, size_t& length) {
+    uint8_t byte;
+    do {
+        if (ip >= iend) {
+            return false;
+        }
+        byte = *ip++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool Lz4DecompressBlock(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_size;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t length = token >> 4;
+        if (length == 15 && !ReadLength(ip, iend, length)) {
+            return false;
+        }
+        if (length > (size_t)(iend - ip) || length > (size_t)(oend - op)) {
+            return false;
+        }
+        memcpy(op, ip, length);
+        op += length;
+        ip += length;
+
+        // The last sequence only has literals
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return false;
+        }
+
+        length = token & 15;
+        if (length == 15 && !ReadLength(ip, iend, length)) {
+            return false;
+        }
+        length += 4;
+        if (length > (size_t)(oend - op)) {
+            return false;
+        }
+
+        const uint8_t* match = op - offset;
+        if (offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        } else {
+            // Overlapping match, repeats the last offset bytes
+            while (length--) {
+                *op++ = *match++;
+            }
+        }
+    }
+    return op == oend;
+}
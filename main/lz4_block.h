@@ -0,0 +1,14 @@
+#ifndef LZ4_BLOCK_H
+#define LZ4_BLOCK_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Decode one LZ4 block (the block format, without a frame) into exactly dst_size bytes.
+ * Returns false for malformed input or a different decoded size, it never reads or writes
+ * outside the given buffers.
+ */
+bool Lz4DecompressBlock(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size);
+
+#endif // LZ4_BLOCK_H
@@ -0,0 +1,265 @@
+#include "main_loop_profiler.h"
+
+#if CONFIG_USE_MAIN_LOOP_PROFILER
+
+#include "application.h"
+#include "json_writer.h"
+
+#include <cstring>
+#include <esp_log.h>
+
+#define TAG "MainLoopProfiler"
+
+static_assert(MAIN_EVENT_STATE_CHANGED < (1 << MLP_MAX_EVENTS), "MLP_MAX_EVENTS is too small");
+
+std::atomic<uint32_t> MainLoopProfiler::set_times_[MLP_MAX_EVENTS] = {};
+
+static const char* GetEventName(int index) {
+    switch (1 << index) {
+        case MAIN_EVENT_SCHEDULE: return "schedule";
+        case MAIN_EVENT_WAKE_WORD_DETECTED: return "wake_word_detected";
+        case MAIN_EVENT_VAD_CHANGE: return "vad_change";
+        case MAIN_EVENT_ERROR: return "error";
+        case MAIN_EVENT_ACTIVATION_DONE: return "activation_done";
+        case MAIN_EVENT_CLOCK_TICK: return "clock_tick";
+        case MAIN_EVENT_NETWORK_CONNECTED: return "network_connected";
+        case MAIN_EVENT_NETWORK_DISCONNECTED: return "network_disconnected";
+        case MAIN_EVENT_TOGGLE_CHAT: return "toggle_chat";
+        case MAIN_EVENT_START_LISTENING: return "start_listening";
+        case MAIN_EVENT_STOP_LISTENING: return "stop_listening";
+        case MAIN_EVENT_STATE_CHANGED: return "state_changed";
+        default: return "unknown";
+    }
+}
+
+static const char* GetBaseName(const char* file) {
+    const char* slash = strrchr(file, '/');
+    return slash != nullptr ? slash + 1 : file;
+}
+
+void MainLoopHistogram::Add(uint32_t us) {
+    uint32_t scaled = us / MLP_HISTOGRAM_BASE_US;
+    int bucket = scaled != 0 ? 32 - __builtin_clz(scaled) : 0;
+    if (bucket >= MLP_HISTOGRAM_BUCKETS) {
+        bucket = MLP_HISTOGRAM_BUCKETS - 1;
+    }
+    buckets[bucket]++;
+    count++;
+    total_us += us;
+    if (us > max_us) {
+        max_us = us;
+    }
+}
+
+uint32_t MainLoopHistogram::Percentile(int percent) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint32_t target = ((uint64_t)count * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (int i = 0; i < MLP_HISTOGRAM_BUCKETS - 1; i++) {
+        seen += buckets[i];
+        if (seen >= target) {
+            return std::min<uint32_t>(MLP_HISTOGRAM_BASE_US << i, max_us);
+        }
+    }
+    return max_us;
+}
+
+void MainLoopProfiler::MarkEvents(uint32_t bits) {
+    uint32_t now = Now();
+    while (bits != 0) {
+        int index = __builtin_ctz(bits);
+        bits &= bits - 1;
+        uint32_t expected = 0;
+        set_times_[index].compare_exchange_strong(expected, now, std::memory_order_relaxed);
+    }
+}
+
+// A bit set again between xEventGroupWaitBits() and the handler start is served by this run and
+// gets no latency sample of its own
+MainLoopProfiler::EventScope::EventScope(uint32_t bit) : index_(__builtin_ctz(bit)) {
+    start_time_ = Now();
+    uint32_t set_time = set_times_[index_].exchange(0, std::memory_order_relaxed);
+    latency_us_ = set_time != 0 ? start_time_ - set_time : 0;
+}
+
+MainLoopProfiler::EventScope::~EventScope() {
+    MainLoopProfiler::GetInstance().RecordEvent(index_, latency_us_, Now() - start_time_);
+}
+
+MainLoopProfiler::TaskScope::~TaskScope() {
+    uint32_t latency_us = site_.enqueue_time != 0 ? start_time_ - site_.enqueue_time : 0;
+    MainLoopProfiler::GetInstance().RecordTask(site_, latency_us, Now() - start_time_);
+}
+
+void MainLoopProfiler::RecordEvent(int index, uint32_t latency_us, uint32_t duration_us) {
+    auto& stats = events_[index];
+    stats.latency.Add(latency_us);
+    stats.duration.Add(duration_us);
+
+    interval_busy_us_ += duration_us;
+    if (duration_us > interval_worst_event_us_) {
+        interval_worst_event_us_ = duration_us;
+        interval_worst_event_ = index;
+    }
+    if (latency_us > interval_worst_latency_us_) {
+        interval_worst_latency_us_ = latency_us;
+        interval_worst_latency_event_ = index;
+    }
+}
+
+void MainLoopProfiler::RecordTask(const MainTaskSite& site, uint32_t latency_us, uint32_t duration_us) {
+    tasks_.latency.Add(latency_us);
+    tasks_.duration.Add(duration_us);
+
+    auto& stats = FindSite(site.file != nullptr ? site.file : "unknown", site.line);
+    stats.count++;
+    stats.total_us += duration_us;
+    stats.max_us = std::max(stats.max_us, duration_us);
+    stats.max_latency_us = std::max(stats.max_latency_us, latency_us);
+
+    if (duration_us > interval_worst_task_us_) {
+        interval_worst_task_us_ = duration_us;
+        interval_worst_file_ = stats.file;
+        interval_worst_line_ = stats.line;
+    }
+}
+
+MainLoopProfiler::SiteStats& MainLoopProfiler::FindSite(const char* file, int line) {
+    SiteStats* least = &sites_[0];
+    for (auto& site : sites_) {
+        if (site.line == line && site.file == file) {
+            return site;
+        }
+        if (site.file == nullptr) {
+            site.file = file;
+            site.line = line;
+            return site;
+        }
+        if (site.total_us < least->total_us) {
+            least = &site;
+        }
+    }
+    replaced_sites_++;
+    *least = SiteStats();
+    least->file = file;
+    least->line = line;
+    return *least;
+}
+
+static void WriteHistogram(JsonWriter& writer, std::string_view key, const MainLoopHistogram& histogram) {
+    writer.Key(key).BeginObject();
+    writer.Member("avg_us", (int)(histogram.count > 0 ? histogram.total_us / histogram.count : 0));
+    writer.Member("p50_us", (int)histogram.Percentile(50));
+    writer.Member("p99_us", (int)histogram.Percentile(99));
+    writer.Member("max_us", (int)histogram.max_us);
+    writer.Key("histogram").BeginArray();
+    for (auto bucket : histogram.buckets) {
+        writer.Int(bucket);
+    }
+    writer.EndArray();
+    writer.EndObject();
+}
+
+std::string MainLoopProfiler::GetStatsJson() {
+    std::string json;
+    JsonWriter writer(json);
+    writer.BeginObject();
+    writer.Key("histogram_bounds_us").BeginArray();
+    for (int i = 0; i < MLP_HISTOGRAM_BUCKETS - 1; i++) {
+        writer.Int(MLP_HISTOGRAM_BASE_US << i);
+    }
+    writer.EndArray();
+
+    writer.Key("events").BeginArray();
+    for (int i = 0; i < MLP_MAX_EVENTS; i++) {
+        const auto& stats = events_[i];
+        if (stats.duration.count == 0) {
+            continue;
+        }
+        writer.BeginObject();
+        writer.Member("name", GetEventName(i));
+        writer.Member("count", (int)stats.duration.count);
+        WriteHistogram(writer, "latency", stats.latency);
+        WriteHistogram(writer, "duration", stats.duration);
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    writer.Key("tasks").BeginObject();
+    writer.Member("count", (int)tasks_.duration.count);
+    WriteHistogram(writer, "latency", tasks_.latency);
+    WriteHistogram(writer, "duration", tasks_.duration);
+    writer.EndObject();
+
+    // Call sites with the most total run time first
+    const SiteStats* top[MLP_TOP_SITES] = {};
+    for (const auto& site : sites_) {
+        if (site.file == nullptr) {
+            break;
+        }
+        const SiteStats* candidate = &site;
+        for (auto& slot : top) {
+            if (slot == nullptr || candidate->total_us > slot->total_us) {
+                std::swap(slot, candidate);
+                if (candidate == nullptr) {
+                    break;
+                }
+            }
+        }
+    }
+    writer.Key("top_tasks").BeginArray();
+    for (auto site : top) {
+        if (site == nullptr) {
+            break;
+        }
+        writer.BeginObject();
+        writer.Member("site", std::string(GetBaseName(site->file)) + ":" + std::to_string(site->line));
+        writer.Member("count", (int)site->count);
+        writer.Member("total_us", (double)site->total_us);
+        writer.Member("avg_us", (int)(site->total_us / site->count));
+        writer.Member("max_us", (int)site->max_us);
+        writer.Member("max_latency_us", (int)site->max_latency_us);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.Member("replaced_sites", (int)replaced_sites_);
+    writer.EndObject();
+    return json;
+}
+
+void MainLoopProfiler::PrintStats() {
+    uint32_t now = Now();
+    uint32_t elapsed_us = interval_start_ != 0 ? now - interval_start_ : 0;
+    if (elapsed_us > 0) {
+        ESP_LOGI(TAG, "Busy %lu ms of %lu ms, slowest event %s %lu us, latency %s %lu us, slowest task %s:%d %lu us",
+            (uint32_t)(interval_busy_us_ / 1000), elapsed_us / 1000,
+            interval_worst_event_ >= 0 ? GetEventName(interval_worst_event_) : "-", interval_worst_event_us_,
+            interval_worst_latency_event_ >= 0 ? GetEventName(interval_worst_latency_event_) : "-", interval_worst_latency_us_,
+            interval_worst_file_ != nullptr ? GetBaseName(interval_worst_file_) : "-", interval_worst_line_, interval_worst_task_us_);
+    }
+
+    interval_start_ = now;
+    interval_busy_us_ = 0;
+    interval_worst_event_ = -1;
+    interval_worst_event_us_ = 0;
+    interval_worst_latency_event_ = -1;
+    interval_worst_latency_us_ = 0;
+    interval_worst_file_ = nullptr;
+    interval_worst_line_ = 0;
+    interval_worst_task_us_ = 0;
+}
+
+void MainLoopProfiler::Reset() {
+    for (auto& stats : events_) {
+        stats = EventStats();
+    }
+    tasks_ = EventStats();
+    for (auto& site : sites_) {
+        site = SiteStats();
+    }
+    replaced_sites_ = 0;
+}
+
+#endif // CONFIG_USE_MAIN_LOOP_PROFILER
@@ -0,0 +1,157 @@
+#ifndef MAIN_LOOP_PROFILER_H
+#define MAIN_LOOP_PROFILER_H
+
+#include <sdkconfig.h>
+
+#if CONFIG_USE_MAIN_LOOP_PROFILER
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+
+#include <esp_timer.h>
+
+#include "main_task_queue.h"
+
+// Bucket n counts samples below (MLP_HISTOGRAM_BASE_US << n), the last bucket everything above
+#define MLP_HISTOGRAM_BUCKETS 12
+#define MLP_HISTOGRAM_BASE_US 128
+// One slot per MAIN_EVENT_* bit
+#define MLP_MAX_EVENTS 16
+// Scheduled task call sites tracked, the site with the least total time is replaced when full
+#define MLP_MAX_SITES 32
+#define MLP_TOP_SITES 8
+
+struct MainLoopHistogram {
+    uint32_t buckets[MLP_HISTOGRAM_BUCKETS] = {};
+    uint32_t count = 0;
+    uint32_t max_us = 0;
+    uint64_t total_us = 0;
+
+    void Add(uint32_t us);
+    /**
+     * Upper bound of the bucket holding the given percentile, max_us for the last bucket
+     */
+    uint32_t Percentile(int percent) const;
+};
+
+/**
+ * MainLoopProfiler - Latency and run time of every main loop event and scheduled task
+ *
+ * Latency is measured from the first time an event bit is set (or a task is scheduled) until
+ * its handler starts, duration is the handler run time. Scheduled tasks are keyed by the file
+ * and line where they were scheduled. Everything but MarkEvents() runs in the main task.
+ */
+class MainLoopProfiler {
+public:
+    static MainLoopProfiler& GetInstance() {
+        static MainLoopProfiler instance;
+        return instance;
+    }
+
+    MainLoopProfiler(const MainLoopProfiler&) = delete;
+    MainLoopProfiler& operator=(const MainLoopProfiler&) = delete;
+
+    /**
+     * Stamp the given event bits as set unless they are already pending, safe in an ISR
+     */
+    static void MarkEvents(uint32_t bits);
+    static void MarkScheduled(InlineTask& task) { task.site().enqueue_time = Now(); }
+
+    /**
+     * Measures one event handler from construction until destruction
+     */
+    class EventScope {
+    public:
+        explicit EventScope(uint32_t bit);
+        ~EventScope();
+
+    private:
+        int index_;
+        uint32_t latency_us_;
+        uint32_t start_time_;
+    };
+
+    /**
+     * Measures one scheduled task from construction until destruction
+     */
+    class TaskScope {
+    public:
+        explicit TaskScope(InlineTask& task) : site_(task.site()), start_time_(Now()) {}
+        ~TaskScope();
+
+    private:
+        const MainTaskSite& site_;
+        uint32_t start_time_;
+    };
+
+    std::string GetStatsJson();
+    /**
+     * Log one line for the time since the last call: busy time and the worst event and task
+     */
+    void PrintStats();
+    void Reset();
+
+private:
+    MainLoopProfiler() = default;
+
+    struct EventStats {
+        MainLoopHistogram latency;
+        MainLoopHistogram duration;
+    };
+
+    struct SiteStats {
+        const char* file = nullptr;
+        int line = 0;
+        uint32_t count = 0;
+        uint32_t max_us = 0;
+        uint32_t max_latency_us = 0;
+        uint64_t total_us = 0;
+    };
+
+    // First set time of each pending event bit, 0 when not pending
+    static std::atomic<uint32_t> set_times_[MLP_MAX_EVENTS];
+
+    EventStats events_[MLP_MAX_EVENTS];
+    EventStats tasks_;
+    SiteStats sites_[MLP_MAX_SITES];
+    uint32_t replaced_sites_ = 0;
+
+    // Since the last PrintStats()
+    uint32_t interval_start_ = 0;
+    uint64_t interval_busy_us_ = 0;
+    int interval_worst_event_ = -1;
+    uint32_t interval_worst_event_us_ = 0;
+    int interval_worst_latency_event_ = -1;
+    uint32_t interval_worst_latency_us_ = 0;
+    const char* interval_worst_file_ = nullptr;
+    int interval_worst_line_ = 0;
+    uint32_t interval_worst_task_us_ = 0;
+
+    static uint32_t Now() {
+        // Wraps after 71 minutes, only differences are used and 0 means unset
+        uint32_t now = (uint32_t)esp_timer_get_time();
+        return now != 0 ? now : 1;
+    }
+
+    void RecordEvent(int index, uint32_t latency_us, uint32_t duration_us);
+    void RecordTask(const MainTaskSite& site, uint32_t latency_us, uint32_t duration_us);
+    SiteStats& FindSite(const char* file, int line);
+};
+
+#define MAIN_LOOP_PROFILE_MARK(bits) MainLoopProfiler::MarkEvents(bits)
+#define MAIN_LOOP_PROFILE_SCHEDULED(task) MainLoopProfiler::MarkScheduled(task)
+#define MAIN_LOOP_PROFILE_EVENT(bit) MainLoopProfiler::EventScope main_loop_event_scope(bit)
+#define MAIN_LOOP_PROFILE_TASK(task) MainLoopProfiler::TaskScope main_loop_task_scope(task)
+
+#else
+
+#define MAIN_LOOP_PROFILE_MARK(bits)
+#define MAIN_LOOP_PROFILE_SCHEDULED(task)
+#define MAIN_LOOP_PROFILE_EVENT(bit)
+#define MAIN_LOOP_PROFILE_TASK(task)
+
+#endif // CONFIG_USE_MAIN_LOOP_PROFILER
+
+#endif // MAIN_LOOP_PROFILER_H
@@ -0,0 +1,73 @@
+#include "main_task_queue.h"
+
+void MainTaskQueue::Push(InlineTask&& task, ScheduleLane lane) {
+    if (task.IsHeapAllocated()) {
+        heap_allocated_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Once a lane has spilled, later tasks queue up behind the spilled ones to keep the order
+    if (overflow_pending_[lane].load(std::memory_order_acquire) == 0 && PushToRing(task, lane)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    overflow_[lane].push_back(std::move(task));
+    overflow_pending_[lane].fetch_add(1, std::memory_order_release);
+    overflowed_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool MainTaskQueue::PushFromIsr(InlineTask&& task, ScheduleLane lane) {
+    if (PushToRing(task, lane)) {
+        return true;
+    }
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool MainTaskQueue::Pop(InlineTask& task) {
+    return PopLane(task, kScheduleLaneControl) || PopLane(task, kScheduleLaneUi);
+}
+
+MainTaskQueueStats MainTaskQueue::stats() const {
+    MainTaskQueueStats stats;
+    for (int lane = 0; lane < kScheduleLaneCount; lane++) {
+        stats.executed[lane] = executed_[lane];
+        stats.peak_depth[lane] = peak_depth_[lane];
+    }
+    stats.overflowed = overflowed_.load(std::memory_order_relaxed);
+    stats.dropped = dropped_.load(std::memory_order_relaxed);
+    stats.heap_allocated = heap_allocated_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+bool MainTaskQueue::PushToRing(InlineTask& task, ScheduleLane lane) {
+    if (lane == kScheduleLaneControl) {
+        return control_.Push(std::move(task));
+    }
+    return ui_.Push(std::move(task));
+}
+
+// Runs in the consumer (main) task only
+bool MainTaskQueue::PopLane(InlineTask& task, ScheduleLane lane) {
+    size_t depth = lane == kScheduleLaneControl ? control_.size() : ui_.size();
+    depth += overflow_pending_[lane].load(std::memory_order_acquire);
+    if (depth > peak_depth_[lane]) {
+        peak_depth_[lane] = depth;
+    }
+
+    if (lane == kScheduleLaneControl ? control_.Pop(task) : ui_.Pop(task)) {
+        executed_[lane]++;
+        return true;
+    }
+    if (overflow_pending_[lane].load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    if (overflow_[lane].empty()) {
+        return false;
+    }
+    task = std::move(overflow_[lane].front());
+    overflow_[lane].pop_front();
+    overflow_pending_[lane].fetch_sub(1, std::memory_order_release);
+    executed_[lane]++;
+    return true;
+}
@@ -0,0 +1,286 @@
+#ifndef MAIN_TASK_QUEUE_H
+#define MAIN_TASK_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifdef ESP_PLATFORM
+#include <sdkconfig.h>
+#endif
+
+// Room for a few pointers plus a std::string, enough for the usual scheduled lambdas
+#define MAIN_TASK_INLINE_SIZE (8 * sizeof(void*))
+// Lane capacities, must be powers of two
+#define MAIN_TASK_CONTROL_QUEUE_SIZE 16
+#define MAIN_TASK_UI_QUEUE_SIZE 16
+
+#if CONFIG_USE_MAIN_LOOP_PROFILER
+/**
+ * Where and when a task was scheduled, for MainLoopProfiler
+ */
+struct MainTaskSite {
+    const char* file = nullptr;
+    int line = 0;
+    uint32_t enqueue_time = 0;
+};
+#endif
+
+/**
+ * InlineTask - Move-only void() callable stored in place
+ *
+ * Callables up to MAIN_TASK_INLINE_SIZE bytes live inside the object, larger ones fall back to
+ * the heap. std::function allocates for almost any lambda that captures more than a pointer.
+ */
+class InlineTask {
+public:
+    template <typename F>
+    static constexpr bool FitsInline() {
+        return sizeof(F) <= MAIN_TASK_INLINE_SIZE && alignof(F) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible_v<F>;
+    }
+
+    InlineTask() = default;
+
+    // With the profiler enabled the call site is taken from where the lambda becomes an InlineTask
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineTask>>>
+#if CONFIG_USE_MAIN_LOOP_PROFILER
+    InlineTask(F&& callable, const char* file = __builtin_FILE(), int line = __builtin_LINE())
+        : site_{file, line, 0} {
+#else
+    InlineTask(F&& callable) {
+#endif
+        using Callable = std::decay_t<F>;
+        if constexpr (FitsInline<Callable>()) {
+            new (storage_) Callable(std::forward<F>(callable));
+            ops_ = &InlineOps<Callable>::ops;
+        } else {
+            *reinterpret_cast<Callable**>(storage_) = new Callable(std::forward<F>(callable));
+            ops_ = &HeapOps<Callable>::ops;
+        }
+    }
+
+    InlineTask(InlineTask&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    InlineTask& operator=(InlineTask&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    InlineTask(const InlineTask&) = delete;
+    InlineTask& operator=(const InlineTask&) = delete;
+
+    ~InlineTask() {
+        Reset();
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+    bool IsHeapAllocated() const { return ops_ != nullptr && ops_->heap; }
+
+    void operator()() {
+        ops_->invoke(storage_);
+    }
+
+    void Reset() {
+        if (ops_ != nullptr) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+#if CONFIG_USE_MAIN_LOOP_PROFILER
+    MainTaskSite& site() { return site_; }
+#endif
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* to, void* from);     // Move construct into to and destroy from
+        void (*destroy)(void* storage);
+        bool heap;
+    };
+
+    template <typename Callable>
+    struct InlineOps {
+        static void Invoke(void* storage) {
+            (*static_cast<Callable*>(storage))();
+        }
+        static void Move(void* to, void* from) {
+            new (to) Callable(std::move(*static_cast<Callable*>(from)));
+            static_cast<Callable*>(from)->~Callable();
+        }
+        static void Destroy(void* storage) {
+            static_cast<Callable*>(storage)->~Callable();
+        }
+        static constexpr Ops ops = { Invoke, Move, Destroy, false };
+    };
+
+    template <typename Callable>
+    struct HeapOps {
+        static void Invoke(void* storage) {
+            (**static_cast<Callable**>(storage))();
+        }
+        static void Move(void* to, void* from) {
+            *static_cast<Callable**>(to) = *static_cast<Callable**>(from);
+        }
+        static void Destroy(void* storage) {
+            delete *static_cast<Callable**>(storage);
+        }
+        static constexpr Ops ops = { Invoke, Move, Destroy, true };
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[MAIN_TASK_INLINE_SIZE];
+    const Ops* ops_ = nullptr;
+#if CONFIG_USE_MAIN_LOOP_PROFILER
+    MainTaskSite site_;
+#endif
+
+    void MoveFrom(InlineTask& other) {
+        if (other.ops_ != nullptr) {
+            other.ops_->move(storage_, other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+#if CONFIG_USE_MAIN_LOOP_PROFILER
+        site_ = other.site_;
+#endif
+    }
+};
+
+/**
+ * BoundedTaskQueue - Fixed capacity multi-producer single-consumer ring of InlineTasks
+ *
+ * Producers claim a slot with a compare-and-swap and publish it with a per slot sequence number,
+ * so Push() never blocks or allocates and can be called from an ISR. Pop() is for the one consumer.
+ */
+template <size_t Capacity>
+class BoundedTaskQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    BoundedTaskQueue() {
+        for (size_t i = 0; i < Capacity; i++) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Returns false if the queue is full, the task is left untouched
+     */
+    bool Push(InlineTask&& task) {
+        size_t position = enqueue_position_.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots_[position & (Capacity - 1)];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+            if (difference == 0) {
+                if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = enqueue_position_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->task = std::move(task);
+        slot->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Returns false if the queue is empty or the oldest slot is still being written
+     */
+    bool Pop(InlineTask& task) {
+        Slot& slot = slots_[dequeue_position_ & (Capacity - 1)];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != dequeue_position_ + 1) {
+            return false;
+        }
+        task = std::move(slot.task);
+        slot.sequence.store(dequeue_position_ + Capacity, std::memory_order_release);
+        dequeue_position_++;
+        return true;
+    }
+
+    /**
+     * Number of queued tasks, exact only when called by the consumer with no producer active
+     */
+    size_t size() const {
+        size_t enqueued = enqueue_position_.load(std::memory_order_relaxed);
+        size_t dequeued = dequeue_position_;
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        InlineTask task;
+    };
+
+    Slot slots_[Capacity];
+    std::atomic<size_t> enqueue_position_ = 0;
+    size_t dequeue_position_ = 0;
+};
+
+enum ScheduleLane {
+    kScheduleLaneControl,   // Device state, audio channel, protocol and MCP work
+    kScheduleLaneUi,        // Display updates that can wait for control work
+    kScheduleLaneCount,
+};
+
+struct MainTaskQueueStats {
+    uint32_t executed[kScheduleLaneCount] = {};
+    uint32_t peak_depth[kScheduleLaneCount] = {};
+    uint32_t overflowed = 0;        // Did not fit in the ring and went to the overflow list
+    uint32_t dropped = 0;           // Did not fit in the ring when scheduled from an ISR
+    uint32_t heap_allocated = 0;    // Too large for InlineTask
+};
+
+/**
+ * MainTaskQueue - The queue behind Application::Schedule()
+ *
+ * One bounded ring per lane, Pop() always prefers the control lane. When a ring is full, tasks
+ * scheduled from a task go to a mutex protected overflow list (and stay in order behind it),
+ * tasks scheduled from an ISR are dropped. Both are counted.
+ */
+class MainTaskQueue {
+public:
+    void Push(InlineTask&& task, ScheduleLane lane);
+    bool PushFromIsr(InlineTask&& task, ScheduleLane lane);
+    bool Pop(InlineTask& task);
+    MainTaskQueueStats stats() const;
+
+private:
+    BoundedTaskQueue<MAIN_TASK_CONTROL_QUEUE_SIZE> control_;
+    BoundedTaskQueue<MAIN_TASK_UI_QUEUE_SIZE> ui_;
+
+    std::mutex overflow_mutex_;
+    std::deque<InlineTask> overflow_[kScheduleLaneCount];
+    std::atomic<uint32_t> overflow_pending_[kScheduleLaneCount] = {};
+
+    std::atomic<uint32_t> overflowed_ = 0;
+    std::atomic<uint32_t> dropped_ = 0;
+    std::atomic<uint32_t> heap_allocated_ = 0;
+    // Only updated by the consumer
+    uint32_t executed_[kScheduleLaneCount] = {};
+    uint32_t peak_depth_[kScheduleLaneCount] = {};
+
+    bool PushToRing(InlineTask& task, ScheduleLane lane);
+    bool PopLane(InlineTask& task, ScheduleLane lane);
+};
+
+#endif // MAIN_TASK_QUEUE_H
@@ -0,0 +1,126 @@
+#include "mcp_resources.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "McpResources"
+
+void McpResources::Add(const char* uri, const char* name, const char* description, std::function<std::string()> read) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Resource resource;
+    resource.uri = uri;
+    resource.name = name;
+    resource.description = description;
+    resource.read = std::move(read);
+    resources_.push_back(std::move(resource));
+}
+
+McpResources::Resource* McpResources::Find(std::string_view uri) {
+    for (auto& resource : resources_) {
+        if (uri == resource.uri) {
+            return &resource;
+        }
+    }
+    return nullptr;
+}
+
+void McpResources::WriteList(JsonWriter& writer) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    writer.BeginObject().Key("resources").BeginArray();
+    for (const auto& resource : resources_) {
+        writer.BeginObject()
+            .Member("uri", resource.uri)
+            .Member("name", resource.name)
+            .Member("description", resource.description)
+            .Member("mimeType", "application/json")
+            .EndObject();
+    }
+    writer.EndArray().EndObject();
+}
+
+bool McpResources::WriteRead(std::string_view uri, JsonWriter& writer) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& resource : resources_) {
+        if (uri != resource.uri) {
+            continue;
+        }
+        writer.BeginObject().Key("contents").BeginArray().BeginObject()
+            .Member("uri", resource.uri)
+            .Member("mimeType", "application/json")
+            .Member("text", resource.read())
+            .EndObject().EndArray().EndObject();
+        return true;
+    }
+    return false;
+}
+
+bool McpResources::Subscribe(std::string_view uri) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto resource = Find(uri);
+    if (resource == nullptr) {
+        return false;
+    }
+    // The first check pushes the current value
+    resource->subscribed = true;
+    resource->last_value.clear();
+    resource->last_time = 0;
+    ESP_LOGI(TAG, "Subscribed to %s", resource->uri);
+    return true;
+}
+
+bool McpResources::Unsubscribe(std::string_view uri) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto resource = Find(uri);
+    if (resource == nullptr) {
+        return false;
+    }
+    resource->subscribed = false;
+    return true;
+}
+
+void McpResources::UnsubscribeAll() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& resource : resources_) {
+        resource.subscribed = false;
+    }
+}
+
+std::string McpResources::Check() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = esp_timer_get_time();
+    std::string message;
+    JsonWriter writer(message);
+    int count = 0;
+    size_t first_start = 0;
+
+    for (auto& resource : resources_) {
+        if (!resource.subscribed || (resource.last_time != 0 && now - resource.last_time < MCP_RESOURCE_MIN_INTERVAL_MS * 1000)) {
+            continue;
+        }
+        auto value = resource.read();
+        if (value == resource.last_value) {
+            continue;
+        }
+        resource.last_value = std::move(value);
+        resource.last_time = now;
+
+        if (count == 0) {
+            // Turned into a batch array if a second notification follows
+            writer.BeginArray();
+            first_start = message.size();
+        }
+        writer.BeginObject().Member("jsonrpc", "2.0").Member("method", "notifications/resources/updated");
+        writer.Key("params").BeginObject().Member("uri", resource.uri).Key("value").Raw(resource.last_value).EndObject();
+        writer.EndObject();
+        count++;
+    }
+
+    if (count == 0) {
+        return "";
+    }
+    if (count == 1) {
+        return message.substr(first_start);
+    }
+    writer.EndArray();
+    return message;
+}
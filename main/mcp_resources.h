@@ -0,0 +1,64 @@
+#ifndef MCP_RESOURCES_H
+#define MCP_RESOURCES_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <cstdint>
+
+#include "json_writer.h"
+
+// A subscribed resource is pushed at most once per interval, later changes wait for the next check
+#define MCP_RESOURCE_MIN_INTERVAL_MS 1000
+
+/**
+ * McpResources - Device state exposed as MCP resources the server can read and subscribe to
+ *
+ * Each resource is read as a small JSON value. Check() compares the subscribed resources with
+ * the value last pushed and returns notifications/resources/updated for the ones that changed,
+ * carrying the new value so the server does not have to read it back. Changes within
+ * MCP_RESOURCE_MIN_INTERVAL_MS of the last push are coalesced, only the latest value is sent.
+ */
+class McpResources {
+public:
+    void Add(const char* uri, const char* name, const char* description, std::function<std::string()> read);
+
+    /**
+     * Write the resources/list result
+     */
+    void WriteList(JsonWriter& writer) const;
+    /**
+     * Write the resources/read result, false for an unknown uri
+     */
+    bool WriteRead(std::string_view uri, JsonWriter& writer) const;
+
+    bool Subscribe(std::string_view uri);
+    bool Unsubscribe(std::string_view uri);
+    void UnsubscribeAll();
+
+    /**
+     * Notifications due for subscribed resources, one JSON-RPC message or a batch array of them,
+     * empty when there is nothing to send
+     */
+    std::string Check();
+
+private:
+    struct Resource {
+        const char* uri;
+        const char* name;
+        const char* description;
+        std::function<std::string()> read;
+        bool subscribed = false;
+        std::string last_value;
+        int64_t last_time = 0;
+    };
+
+    std::vector<Resource> resources_;
+    mutable std::mutex mutex_;
+
+    Resource* Find(std::string_view uri);
+};
+
+#endif // MCP_RESOURCES_H
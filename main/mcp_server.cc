@@ -4,6 +4,7 @@
  */
 
 #include "mcp_server.h"
+#include "mcp_typed_tool.h"
 #include <esp_log.h>
 #include <esp_app_desc.h>
 #include <algorithm>
@@ -11,16 +12,19 @@
 #include <esp_pthread.h>
 
 #include "application.h"
+#include "json_reader.h"
 #include "display.h"
 #include "oled_display.h"
 #include "board.h"
 #include "settings.h"
+#include "connection_cache.h"
+#include "settings_store.h"
 #include "lvgl_theme.h"
 #include "lvgl_display.h"
 
 #define TAG "MCP"
 
-McpServer::McpServer() {
+McpServer::McpServer() : executor_([this](McpToolCall& call) { return RunToolCall(call); }) {
 }
 
 McpServer::~McpServer() {
@@ -52,41 +56,32 @@ void McpServer::AddCommonTools() {
             return board.GetDeviceStatusJson();
         });
 
-    AddTool("self.audio_speaker.set_volume", 
+    AddTool(NewTypedTool("self.audio_speaker.set_volume",
         "Set the volume of the audio speaker. If the current volume is unknown, you must call `self.get_device_status` tool first and then call this tool.",
-        PropertyList({
-            Property("volume", kPropertyTypeInteger, 0, 100)
-        }), 
-        [&board](const PropertyList& properties) -> ReturnValue {
+        [&board](int volume) -> ReturnValue {
             auto codec = board.GetAudioCodec();
-            codec->SetOutputVolume(properties["volume"].value<int>());
+            codec->SetOutputVolume(volume);
             return true;
-        });
+        },
+        IntParam("volume", 0, 100)));
     
     auto backlight = board.GetBacklight();
     if (backlight) {
-        AddTool("self.screen.set_brightness",
+        AddTool(NewTypedTool("self.screen.set_brightness",
             "Set the brightness of the screen.",
-            PropertyList({
-                Property("brightness", kPropertyTypeInteger, 0, 100)
-            }),
-            [backlight](const PropertyList& properties) -> ReturnValue {
-                uint8_t brightness = static_cast<uint8_t>(properties["brightness"].value<int>());
-                backlight->SetBrightness(brightness, true);
+            [backlight](int brightness) -> ReturnValue {
+                backlight->SetBrightness(static_cast<uint8_t>(brightness), true);
                 return true;
-            });
+            },
+            IntParam("brightness", 0, 100)));
     }
 
 #ifdef HAVE_LVGL
     auto display = board.GetDisplay();
     if (display && display->GetTheme() != nullptr) {
-        AddTool("self.screen.set_theme",
+        AddTool(NewTypedTool("self.screen.set_theme",
             "Set the theme of the screen. The theme can be `light` or `dark`.",
-            PropertyList({
-                Property("theme", kPropertyTypeString)
-            }),
-            [display](const PropertyList& properties) -> ReturnValue {
-                auto theme_name = properties["theme"].value<std::string>();
+            [display](const std::string& theme_name) -> ReturnValue {
                 auto& theme_manager = LvglThemeManager::GetInstance();
                 auto theme = theme_manager.GetTheme(theme_name);
                 if (theme != nullptr) {
@@ -94,7 +89,8 @@ void McpServer::AddCommonTools() {
                     return true;
                 }
                 return false;
-            });
+            },
+            StringParam("theme")));
     }
 
     auto camera = board.GetCamera();
@@ -108,21 +104,24 @@ void McpServer::AddCommonTools() {
             PropertyList({
                 Property("question", kPropertyTypeString)
             }),
-            [camera](const PropertyList& properties) -> ReturnValue {
-                // Lower the priority to do the camera capture
-                TaskPriorityReset priority_reset(1);
-
+            [this, camera](const PropertyList& properties) -> ReturnValue {
+                // Runs in the low priority long running tool task, off the main task
                 if (!camera->Capture()) {
                     throw std::runtime_error("Failed to capture photo");
                 }
+                if (IsToolCallCancelled()) {
+                    throw std::runtime_error("Cancelled");
+                }
+                ReportProgress(1, 2, "Photo captured, explaining");
                 auto question = properties["question"].value<std::string>();
                 return camera->Explain(question);
-            });
+            }, kToolExecutionLongRunning);
     }
 #endif
 
     // Restore the original tools list to the end of the tools list
     tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
+    InvalidateToolsList();
 }
 
 void McpServer::AddUserOnlyTools() {
@@ -135,6 +134,58 @@ void McpServer::AddUserOnlyTools() {
             return board.GetSystemInfoJson();
         });
 
+    AddUserOnlyTool("self.network.get_connection_stats",
+        "Get the DNS cache and connection setup timing statistics",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return ConnectionCache::GetInstance().GetStatsJson();
+        });
+
+    AddUserOnlyTool("self.get_settings_stats",
+        "Get the settings cache statistics: reads served from RAM, sets that changed nothing, and NVS commits per namespace for flash wear monitoring",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return SettingsStore::GetInstance().GetStatsJson();
+        });
+
+    AddUserOnlyTool("self.get_boot_timeline",
+        "Get the boot timeline: duration and core of every boot step, the critical path and the time since boot of milestones such as network connected and wake word ready",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return Application::GetInstance().GetBootTimelineJson();
+        });
+
+    AddUserOnlyTool("self.get_state_trace",
+        "Get the recent device state transitions with their cause and listener run time, the time spent in each state and the idle -> listening -> speaking turn latencies",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return Application::GetInstance().GetStateTraceJson();
+        });
+
+    AddUserOnlyTool("self.get_mcp_tool_stats",
+        "Get the MCP tool calls in flight and the call count, queueing time and run time of every tool called so far",
+        PropertyList(),
+        [this](const PropertyList& properties) -> ReturnValue {
+            return GetToolStatsJson();
+        });
+
+#if CONFIG_USE_MAIN_LOOP_PROFILER
+    AddUserOnlyTool("self.get_main_loop_profile",
+        "Get the latency and run time histograms of the main loop events and the slowest scheduled tasks by call site",
+        PropertyList({
+            Property("reset", kPropertyTypeBoolean, false)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            // Tool calls run in the main task, like the profiler itself
+            auto& profiler = MainLoopProfiler::GetInstance();
+            auto json = profiler.GetStatsJson();
+            if (properties["reset"].value<bool>()) {
+                profiler.Reset();
+            }
+            return json;
+        });
+#endif
+
     AddUserOnlyTool("self.reboot", "Reboot the system",
         PropertyList(),
         [this](const PropertyList& properties) -> ReturnValue {
@@ -151,15 +202,17 @@ void McpServer::AddUserOnlyTools() {
     // Firmware upgrade
     AddUserOnlyTool("self.upgrade_firmware", "Upgrade firmware from a specific URL. This will download and install the firmware, then reboot the device.",
         PropertyList({
-            Property("url", kPropertyTypeString, "The URL of the firmware binary file to download and install")
+            Property("url", kPropertyTypeString, "The URL of the firmware binary file to download and install"),
+            Property("sha256", kPropertyTypeString, std::string())
         }),
         [this](const PropertyList& properties) -> ReturnValue {
             auto url = properties["url"].value<std::string>();
+            auto sha256 = properties["sha256"].value<std::string>();
             ESP_LOGI(TAG, "User requested firmware upgrade from URL: %s", url.c_str());
             
             auto& app = Application::GetInstance();
-            app.Schedule([url, &app]() {
-                bool success = app.UpgradeFirmware(url);
+            app.Schedule([url, sha256, &app]() {
+                bool success = app.UpgradeFirmware(url, "", sha256);
                 if (!success) {
                     ESP_LOGE(TAG, "Firmware upgrade failed");
                 }
@@ -287,44 +340,114 @@ void McpServer::AddUserOnlyTools() {
     // Assets download url
     auto& assets = Assets::GetInstance();
     if (assets.partition_valid()) {
-        AddUserOnlyTool("self.assets.set_download_url", "Set the download url for the assets",
+        AddUserOnlyTool("self.assets.set_download_url", "Set the download url for the assets, "
+            "optionally with the url of a patch from the installed assets that is tried first",
             PropertyList({
-                Property("url", kPropertyTypeString)
+                Property("url", kPropertyTypeString),
+                Property("delta_url", kPropertyTypeString, std::string())
             }),
             [](const PropertyList& properties) -> ReturnValue {
                 auto url = properties["url"].value<std::string>();
+                auto delta_url = properties["delta_url"].value<std::string>();
                 Settings settings("assets", true);
                 settings.SetString("download_url", url);
+                if (delta_url.empty()) {
+                    settings.EraseKey("delta_url");
+                } else {
+                    settings.SetString("delta_url", delta_url);
+                }
                 return true;
             });
     }
 }
 
+void McpServer::AddDeviceResources() {
+    auto& board = Board::GetInstance();
+
+    resources_.Add("device://state", "Device state",
+        "The device state: idle, listening, speaking, connecting, upgrading...",
+        []() -> std::string {
+            std::string json;
+            JsonWriter writer(json);
+            auto state = Application::GetInstance().GetDeviceState();
+            writer.BeginObject().Member("state", DeviceStateMachine::GetStateName(state)).EndObject();
+            return json;
+        });
+
+    resources_.Add("device://volume", "Speaker volume", "The output volume of the audio speaker, 0 to 100",
+        [&board]() -> std::string {
+            std::string json;
+            JsonWriter writer(json);
+            auto codec = board.GetAudioCodec();
+            writer.BeginObject().Member("volume", codec != nullptr ? codec->output_volume() : 0).EndObject();
+            return json;
+        });
+
+    resources_.Add("device://battery", "Battery", "The battery level and whether it is charging, null without a battery",
+        [&board]() -> std::string {
+            int level = 0;
+            bool charging = false, discharging = false;
+            if (!board.GetBatteryLevel(level, charging, discharging)) {
+                return "null";
+            }
+            std::string json;
+            JsonWriter writer(json);
+            writer.BeginObject().Member("level", level).Member("charging", charging).EndObject();
+            return json;
+        });
+
+    resources_.Add("device://network", "Network", "The network type, name and signal strength",
+        [&board]() -> std::string {
+            // Same fields as the network part of self.get_device_status
+            auto status = board.GetDeviceStatusJson();
+            auto network = JsonReader::Parse(status)["network"];
+            return network.IsObject() ? std::string(network.raw()) : "null";
+        });
+}
+
+void McpServer::CheckSubscriptions() {
+    auto message = resources_.Check();
+    if (!message.empty()) {
+        Application::GetInstance().SendMcpMessage(std::move(message));
+    }
+}
+
 void McpServer::AddTool(McpTool* tool) {
     // Prevent adding duplicate tools
-    if (std::find_if(tools_.begin(), tools_.end(), [tool](const McpTool* t) { return t->name() == tool->name(); }) != tools_.end()) {
+    if (tool_index_.find(tool->name()) != tool_index_.end()) {
         ESP_LOGW(TAG, "Tool %s already added", tool->name().c_str());
         return;
     }
 
     ESP_LOGI(TAG, "Add tool: %s%s", tool->name().c_str(), tool->user_only() ? " [user]" : "");
     tools_.push_back(tool);
+    tool_index_.emplace(tool->name(), tool);
+    InvalidateToolsList();
 }
 
-void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
-    AddTool(new McpTool(name, description, properties, callback));
+void McpServer::InvalidateToolsList() {
+    for (auto& pages : tools_list_pages_) {
+        pages.clear();
+    }
 }
 
-void McpServer::AddUserOnlyTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
+void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback, ToolExecution execution) {
+    auto tool = new McpTool(name, description, properties, callback);
+    tool->set_execution(execution);
+    AddTool(tool);
+}
+
+void McpServer::AddUserOnlyTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback, ToolExecution execution) {
     auto tool = new McpTool(name, description, properties, callback);
     tool->set_user_only(true);
+    tool->set_execution(execution);
     AddTool(tool);
 }
 
-void McpServer::ParseMessage(const std::string& message) {
-    cJSON* json = cJSON_Parse(message.c_str());
+void McpServer::ParseMessage(std::string_view message) {
+    cJSON* json = cJSON_ParseWithLength(message.data(), message.size());
     if (json == nullptr) {
-        ESP_LOGE(TAG, "Failed to parse MCP message: %s", message.c_str());
+        ESP_LOGE(TAG, "Failed to parse MCP message: %.*s", (int)message.size(), message.data());
         return;
     }
     ParseMessage(json);
@@ -345,12 +468,35 @@ void McpServer::ParseCapabilities(const cJSON* capabilities) {
                     token_str = std::string(token->valuestring);
                 }
                 camera->SetExplainUrl(url_str, token_str);
+                ConnectionCache::GetInstance().Prefetch({url_str});
             }
         }
     }
 }
 
+McpBatch::~McpBatch() {
+    if (!replies.empty()) {
+        Application::GetInstance().SendMcpMessage("[" + replies + "]");
+    }
+}
+
 void McpServer::ParseMessage(const cJSON* json) {
+    // A batch holds request objects only, a nested array fails the version check below
+    if (cJSON_IsArray(json) && parsing_batch_ == nullptr) {
+        if (cJSON_GetArraySize(json) == 0) {
+            ESP_LOGE(TAG, "Empty batch");
+            return;
+        }
+        parsing_batch_ = std::make_shared<McpBatch>();
+        const cJSON* request;
+        cJSON_ArrayForEach(request, json) {
+            ParseMessage(request);
+        }
+        // Tool calls still running hold the batch until they have replied
+        parsing_batch_.reset();
+        return;
+    }
+
     // Check JSONRPC version
     auto version = cJSON_GetObjectItem(json, "jsonrpc");
     if (version == nullptr || !cJSON_IsString(version) || strcmp(version->valuestring, "2.0") != 0) {
@@ -366,6 +512,14 @@ void McpServer::ParseMessage(const cJSON* json) {
     }
     
     auto method_str = std::string(method->valuestring);
+    if (method_str == "notifications/cancelled") {
+        auto params = cJSON_GetObjectItem(json, "params");
+        auto request_id = cJSON_GetObjectItem(params, "requestId");
+        if (cJSON_IsNumber(request_id) && !executor_.Cancel(request_id->valueint)) {
+            ESP_LOGW(TAG, "notifications/cancelled: No tool call in flight with id %d", request_id->valueint);
+        }
+        return;
+    }
     if (method_str.find("notifications") == 0) {
         return;
     }
@@ -391,11 +545,18 @@ void McpServer::ParseMessage(const cJSON* json) {
                 ParseCapabilities(capabilities);
             }
         }
+        // A new session starts without subscriptions
+        resources_.UnsubscribeAll();
         auto app_desc = esp_app_get_description();
-        std::string message = "{\"protocolVersion\":\"2024-11-05\",\"capabilities\":{\"tools\":{}},\"serverInfo\":{\"name\":\"" BOARD_NAME "\",\"version\":\"";
-        message += app_desc->version;
-        message += "\"}}";
-        ReplyResult(id_int, message);
+        std::string payload;
+        JsonWriter writer(payload);
+        BeginResult(writer, id_int);
+        writer.BeginObject().Member("protocolVersion", "2024-11-05");
+        writer.Key("capabilities").BeginObject().Key("tools").BeginObject().EndObject();
+        writer.Key("resources").BeginObject().Member("subscribe", true).EndObject().EndObject();
+        writer.Key("serverInfo").BeginObject().Member("name", BOARD_NAME).Member("version", app_desc->version).EndObject();
+        writer.EndObject();
+        SendResult(writer, payload);
     } else if (method_str == "tools/list") {
         std::string cursor_str = "";
         bool list_user_only_tools = false;
@@ -428,99 +589,151 @@ void McpServer::ParseMessage(const cJSON* json) {
             ReplyError(id_int, "Invalid arguments");
             return;
         }
-        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments);
+        auto meta = cJSON_GetObjectItem(params, "_meta");
+        auto progress_token = cJSON_GetObjectItem(meta, "progressToken");
+        DoToolCall(id_int, tool_name->valuestring, tool_arguments, progress_token);
+    } else if (method_str == "resources/list") {
+        std::string payload;
+        JsonWriter writer(payload);
+        BeginResult(writer, id_int);
+        resources_.WriteList(writer);
+        SendResult(writer, payload);
+    } else if (method_str == "resources/read" || method_str == "resources/subscribe" || method_str == "resources/unsubscribe") {
+        auto uri = cJSON_GetObjectItem(params, "uri");
+        if (!cJSON_IsString(uri)) {
+            ESP_LOGE(TAG, "%s: Missing uri", method_str.c_str());
+            ReplyError(id_int, "Missing uri");
+            return;
+        }
+        std::string payload;
+        JsonWriter writer(payload);
+        BeginResult(writer, id_int);
+        bool found;
+        if (method_str == "resources/read") {
+            found = resources_.WriteRead(uri->valuestring, writer);
+        } else {
+            found = method_str == "resources/subscribe" ? resources_.Subscribe(uri->valuestring) : resources_.Unsubscribe(uri->valuestring);
+            writer.BeginObject().EndObject();
+        }
+        if (!found) {
+            ReplyError(id_int, "Unknown resource: " + std::string(uri->valuestring));
+            return;
+        }
+        SendResult(writer, payload);
     } else {
         ESP_LOGE(TAG, "Method not implemented: %s", method_str.c_str());
         ReplyError(id_int, "Method not implemented: " + method_str);
     }
 }
 
-void McpServer::ReplyResult(int id, const std::string& result) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-    payload += std::to_string(id) + ",\"result\":";
-    payload += result;
-    payload += "}";
-    Application::GetInstance().SendMcpMessage(payload);
+void McpServer::BeginResult(JsonWriter& writer, int id) {
+    writer.BeginObject().Member("jsonrpc", "2.0").Member("id", id).Key("result");
+}
+
+void McpServer::SendResult(JsonWriter& writer, std::string& payload) {
+    writer.EndObject();
+    SendReply(std::move(payload));
+}
+
+void McpServer::SendReply(std::string payload) {
+    // Replies to requests of a batch are sent together once the last one is in
+    auto call = McpToolExecutor::current_call();
+    auto& batch = call != nullptr ? call->batch : parsing_batch_;
+    if (batch != nullptr) {
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        if (!batch->replies.empty()) {
+            batch->replies += ',';
+        }
+        batch->replies += payload;
+        return;
+    }
+    Application::GetInstance().SendMcpMessage(std::move(payload));
 }
 
 void McpServer::ReplyError(int id, const std::string& message) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-    payload += std::to_string(id);
-    payload += ",\"error\":{\"message\":\"";
-    payload += message;
-    payload += "\"}}";
-    Application::GetInstance().SendMcpMessage(payload);
+    std::string payload;
+    JsonWriter writer(payload);
+    writer.BeginObject().Member("jsonrpc", "2.0").Member("id", id);
+    writer.Key("error").BeginObject().Member("message", message).EndObject();
+    writer.EndObject();
+    SendReply(std::move(payload));
 }
 
 void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_only_tools) {
+    auto& pages = tools_list_pages_[list_user_only_tools ? 1 : 0];
+    auto page = pages.find(cursor);
+    if (page == pages.end()) {
+        std::string result;
+        std::string error;
+        if (!BuildToolsListPage(cursor, list_user_only_tools, result, error)) {
+            ESP_LOGE(TAG, "tools/list: %s", error.c_str());
+            ReplyError(id, error);
+            return;
+        }
+        page = pages.emplace(cursor, std::move(result)).first;
+    }
+
+    std::string payload;
+    payload.reserve(page->second.size() + 48);
+    JsonWriter writer(payload);
+    BeginResult(writer, id);
+    writer.Raw(page->second);
+    SendResult(writer, payload);
+}
+
+bool McpServer::BuildToolsListPage(const std::string& cursor, bool list_user_only_tools, std::string& result, std::string& error) {
     const int max_payload_size = 8000;
-    std::string json = "{\"tools\":[";
-    
-    bool found_cursor = cursor.empty();
+    // Room for the JSON-RPC envelope around the result
+    const int envelope_size = 30;
+
     auto it = tools_.begin();
-    std::string next_cursor = "";
-    
-    while (it != tools_.end()) {
-        // 如果我们还没有找到起始位置，继续搜索
-        if (!found_cursor) {
-            if ((*it)->name() == cursor) {
-                found_cursor = true;
-            } else {
-                ++it;
-                continue;
-            }
+    if (!cursor.empty()) {
+        auto tool = tool_index_.find(cursor);
+        if (tool == tool_index_.end()) {
+            error = "Unknown cursor: " + cursor;
+            return false;
         }
+        it = std::find(tools_.begin(), tools_.end(), tool->second);
+    }
+
+    JsonWriter writer(result);
+    writer.BeginObject().Key("tools").BeginArray();
 
+    bool added = false;
+    std::string next_cursor = "";
+    for (; it != tools_.end(); ++it) {
         if (!list_user_only_tools && (*it)->user_only()) {
-            ++it;
             continue;
         }
-        
-        // 添加tool前检查大小
-        std::string tool_json = (*it)->to_json() + ",";
-        if (json.length() + tool_json.length() + 30 > max_payload_size) {
+
+        // 添加tool后检查大小，超出则回退
+        auto checkpoint = writer.GetCheckpoint();
+        (*it)->WriteJson(writer);
+        if (writer.size() + envelope_size > max_payload_size) {
             // 如果添加这个tool会超出大小限制，设置next_cursor并退出循环
+            writer.Rollback(checkpoint);
             next_cursor = (*it)->name();
             break;
         }
-        
-        json += tool_json;
-        ++it;
-    }
-    
-    if (json.back() == ',') {
-        json.pop_back();
+        added = true;
     }
-    
-    if (json.back() == '[' && !tools_.empty()) {
+
+    if (!added && !next_cursor.empty()) {
         // 如果没有添加任何tool，返回错误
-        ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", next_cursor.c_str());
-        ReplyError(id, "Failed to add tool " + next_cursor + " because of payload size limit");
-        return;
+        error = "Failed to add tool " + next_cursor + " because of payload size limit";
+        return false;
     }
 
-    if (next_cursor.empty()) {
-        json += "]}";
-    } else {
-        json += "],\"nextCursor\":\"" + next_cursor + "\"}";
+    writer.EndArray();
+    if (!next_cursor.empty()) {
+        writer.Member("nextCursor", next_cursor);
     }
-    
-    ReplyResult(id, json);
+    writer.EndObject();
+    return true;
 }
 
-void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments) {
-    auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
-                                 [&tool_name](const McpTool* tool) { 
-                                     return tool->name() == tool_name; 
-                                 });
-    
-    if (tool_iter == tools_.end()) {
-        ESP_LOGE(TAG, "tools/call: Unknown tool: %s", tool_name.c_str());
-        ReplyError(id, "Unknown tool: " + tool_name);
-        return;
-    }
-
-    PropertyList arguments = (*tool_iter)->properties();
+bool McpTool::BindArguments(const cJSON* tool_arguments, McpToolCall& call, std::string& error) {
+    PropertyList arguments = properties_;
     try {
         for (auto& argument : arguments) {
             bool found = false;
@@ -539,25 +752,137 @@ void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* to
             }
 
             if (!argument.has_default_value() && !found) {
-                ESP_LOGE(TAG, "tools/call: Missing valid argument: %s", argument.name().c_str());
-                ReplyError(id, "Missing valid argument: " + argument.name());
-                return;
+                error = "Missing valid argument: " + argument.name();
+                return false;
             }
         }
     } catch (const std::exception& e) {
-        ESP_LOGE(TAG, "tools/call: %s", e.what());
-        ReplyError(id, e.what());
+        error = e.what();
+        return false;
+    }
+
+    call.invoke = [this, arguments = std::move(arguments)]() {
+        return callback_(arguments);
+    };
+    return true;
+}
+
+void McpServer::DoToolCall(int id, std::string_view tool_name, const cJSON* tool_arguments, const cJSON* progress_token) {
+    auto tool_iter = tool_index_.find(tool_name);
+    if (tool_iter == tool_index_.end()) {
+        ESP_LOGE(TAG, "tools/call: Unknown tool: %.*s", (int)tool_name.size(), tool_name.data());
+        ReplyError(id, "Unknown tool: " + std::string(tool_name));
         return;
     }
 
-    // Use main thread to call the tool
-    auto& app = Application::GetInstance();
-    app.Schedule([this, id, tool_iter, arguments = std::move(arguments)]() {
-        try {
-            ReplyResult(id, (*tool_iter)->Call(arguments));
-        } catch (const std::exception& e) {
-            ESP_LOGE(TAG, "tools/call: %s", e.what());
-            ReplyError(id, e.what());
+    McpTool* tool = tool_iter->second;
+    auto call = std::make_shared<McpToolCall>();
+    call->id = id;
+    call->tool = tool;
+    call->batch = parsing_batch_;
+    std::string error;
+    if (!tool->BindArguments(tool_arguments, *call, error)) {
+        ESP_LOGE(TAG, "tools/call: %s", error.c_str());
+        ReplyError(id, error);
+        return;
+    }
+    if (cJSON_IsString(progress_token)) {
+        JsonWriter::AppendEscaped(call->progress_token, progress_token->valuestring);
+    } else if (cJSON_IsNumber(progress_token)) {
+        call->progress_token = std::to_string(progress_token->valueint);
+    }
+    executor_.Submit(std::move(call));
+}
+
+bool McpServer::RunToolCall(McpToolCall& call) {
+    try {
+        ReturnValue return_value = call.invoke();
+        // Batched replies are collected as strings, an image in a batch is written in one piece
+        if (std::holds_alternative<ImageContent*>(return_value) && call.batch == nullptr) {
+            std::unique_ptr<ImageContent> image(std::get<ImageContent*>(return_value));
+            if (!call.cancelled) {
+                SendImageResult(call.id, std::move(image));
+                return true;
+            }
+        } else {
+            std::string payload;
+            JsonWriter writer(payload);
+            BeginResult(writer, call.id);
+            McpTool::WriteResult(return_value, writer);
+            if (!call.cancelled) {
+                SendResult(writer, payload);
+                return true;
+            }
+        }
+        // The client no longer expects a reply to a cancelled request
+        ESP_LOGI(TAG, "tools/call: %s was cancelled, result dropped", call.tool->name().c_str());
+        return true;
+    } catch (const std::exception& e) {
+        if (call.cancelled) {
+            ESP_LOGI(TAG, "tools/call: %s was cancelled: %s", call.tool->name().c_str(), e.what());
+            return true;
         }
+        ESP_LOGE(TAG, "tools/call: %s", e.what());
+        ReplyError(call.id, e.what());
+        return false;
+    }
+}
+
+void McpServer::SendImageResult(int id, std::unique_ptr<ImageContent> image) {
+    std::shared_ptr<ImageContent> content(std::move(image));
+    bool started = false;
+    size_t offset = 0;
+    Application::GetInstance().SendMcpMessageStream([this, id, content, started, offset](std::string& piece) mutable -> bool {
+        if (content == nullptr) {
+            return false;
+        }
+        if (!started) {
+            // The envelope up to the opening quote of the data string
+            JsonWriter writer(piece);
+            BeginResult(writer, id);
+            writer.BeginObject().Key("content").BeginArray().BeginObject();
+            writer.Member("type", "image").Member("mimeType", content->mime_type()).Key("data");
+            piece += '"';
+            started = true;
+            return true;
+        }
+        if (offset < content->size()) {
+            size_t size = std::min<size_t>(MCP_STREAM_CHUNK_SIZE, content->size() - offset);
+            piece.clear();
+            content->AppendBase64(piece, offset, size);
+            offset += size;
+            return true;
+        }
+        // Close the data string and everything opened above, then release the image
+        piece = "\"}],\"isError\":false}}";
+        content.reset();
+        return true;
     });
 }
+
+void McpServer::ReportProgress(int progress, int total, const std::string& message) {
+    auto call = McpToolExecutor::current_call();
+    if (call == nullptr || call->progress_token.empty() || call->cancelled) {
+        return;
+    }
+
+    std::string payload;
+    JsonWriter writer(payload);
+    writer.BeginObject().Member("jsonrpc", "2.0").Member("method", "notifications/progress");
+    writer.Key("params").BeginObject();
+    writer.Key("progressToken").Raw(call->progress_token);
+    writer.Member("progress", progress);
+    if (total > 0) {
+        writer.Member("total", total);
+    }
+    if (!message.empty()) {
+        writer.Member("message", message);
+    }
+    writer.EndObject().EndObject();
+    Application::GetInstance().SendMcpMessage(std::move(payload));
+}
+
+bool McpServer::IsToolCallCancelled() const {
+    auto call = McpToolExecutor::current_call();
+    return call != nullptr && call->cancelled;
+}
@@ -4,44 +4,75 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <string_view>
 #include <functional>
 #include <variant>
 #include <optional>
 #include <stdexcept>
+#include <cstdio>
 #include <thread>
+#include <atomic>
+#include <memory>
 #include <mbedtls/base64.h>
 
 #include <cJSON.h>
+#include "json_writer.h"
+#include "mcp_tool_executor.h"
+#include "mcp_resources.h"
 
+// Image bytes base64 encoded per piece of a streamed tools/call result, a multiple of 3
+#define MCP_STREAM_CHUNK_SIZE 3072
+
+/**
+ * ImageContent - An image tool result, kept as raw bytes and base64 encoded while it is sent
+ */
 class ImageContent {
 private:
-    std::string encoded_data_;
     std::string mime_type_;
+    std::string data_;
+    const uint8_t* external_data_ = nullptr;
+    size_t external_size_ = 0;
 
-    static std::string Base64Encode(const std::string& data) {
-        size_t dlen = 0, olen = 0;
-        mbedtls_base64_encode((unsigned char*)nullptr, 0, &dlen, (const unsigned char*)data.data(), data.size());
-        std::string result(dlen, 0);
-        mbedtls_base64_encode((unsigned char*)result.data(), result.size(), &olen, (const unsigned char*)data.data(), data.size());
-        return result;
+public:
+    ImageContent(const std::string& mime_type, const std::string& data)
+        : mime_type_(mime_type), data_(data) {}
+    ImageContent(const std::string& mime_type, std::string&& data)
+        : mime_type_(mime_type), data_(std::move(data)) {}
+    /**
+     * Refer to the caller's buffer without a copy, it must stay valid until the result has been sent
+     */
+    ImageContent(const std::string& mime_type, const uint8_t* data, size_t size)
+        : mime_type_(mime_type), external_data_(data), external_size_(size) {}
+
+    inline const std::string& mime_type() const { return mime_type_; }
+    inline const uint8_t* data() const { return external_data_ != nullptr ? external_data_ : (const uint8_t*)data_.data(); }
+    inline size_t size() const { return external_data_ != nullptr ? external_size_ : data_.size(); }
+
+    /**
+     * Append the base64 of size bytes from offset, offset must be a multiple of 3
+     */
+    void AppendBase64(std::string& out, size_t offset, size_t size) const {
+        size_t start = out.size(), olen = 0;
+        out.resize(start + (size + 2) / 3 * 4 + 1);
+        mbedtls_base64_encode((unsigned char*)&out[start], out.size() - start, &olen, data() + offset, size);
+        out.resize(start + olen);
     }
 
-public:
-    ImageContent(const std::string& mime_type, const std::string& data) {
-        mime_type_ = mime_type;
-        // base64 encode data
-        encoded_data_ = Base64Encode(data);
+    void WriteJson(JsonWriter& writer) const {
+        std::string encoded_data;
+        AppendBase64(encoded_data, 0, size());
+        writer.BeginObject()
+            .Member("type", "image")
+            .Member("mimeType", mime_type_)
+            .Member("data", encoded_data)
+            .EndObject();
     }
 
     std::string to_json() const {
-        cJSON *json = cJSON_CreateObject();
-        cJSON_AddStringToObject(json, "type", "image");
-        cJSON_AddStringToObject(json, "mimeType", mime_type_.c_str());
-        cJSON_AddStringToObject(json, "data", encoded_data_.c_str());
-        char* json_str = cJSON_PrintUnformatted(json);
-        std::string result(json_str);
-        cJSON_free(json_str);
-        cJSON_Delete(json);
+        std::string result;
+        JsonWriter writer(result);
+        WriteJson(writer);
         return result;
     }
 };
@@ -120,37 +151,37 @@ public:
         value_ = value;
     }
 
-    std::string to_json() const {
-        cJSON *json = cJSON_CreateObject();
-        
+    void WriteJson(JsonWriter& writer) const {
+        writer.BeginObject();
         if (type_ == kPropertyTypeBoolean) {
-            cJSON_AddStringToObject(json, "type", "boolean");
+            writer.Member("type", "boolean");
             if (has_default_value_) {
-                cJSON_AddBoolToObject(json, "default", value<bool>());
+                writer.Member("default", value<bool>());
             }
         } else if (type_ == kPropertyTypeInteger) {
-            cJSON_AddStringToObject(json, "type", "integer");
+            writer.Member("type", "integer");
             if (has_default_value_) {
-                cJSON_AddNumberToObject(json, "default", value<int>());
+                writer.Member("default", value<int>());
             }
             if (min_value_.has_value()) {
-                cJSON_AddNumberToObject(json, "minimum", min_value_.value());
+                writer.Member("minimum", min_value_.value());
             }
             if (max_value_.has_value()) {
-                cJSON_AddNumberToObject(json, "maximum", max_value_.value());
+                writer.Member("maximum", max_value_.value());
             }
         } else if (type_ == kPropertyTypeString) {
-            cJSON_AddStringToObject(json, "type", "string");
+            writer.Member("type", "string");
             if (has_default_value_) {
-                cJSON_AddStringToObject(json, "default", value<std::string>().c_str());
+                writer.Member("default", value<std::string>());
             }
         }
-        
-        char *json_str = cJSON_PrintUnformatted(json);
-        std::string result(json_str);
-        cJSON_free(json_str);
-        cJSON_Delete(json);
-        
+        writer.EndObject();
+    }
+
+    std::string to_json() const {
+        std::string result;
+        JsonWriter writer(result);
+        WriteJson(writer);
         return result;
     }
 };
@@ -166,17 +197,20 @@ public:
         properties_.push_back(property);
     }
 
-    const Property& operator[](const std::string& name) const {
+    // Tools take a handful of properties, a scan beats hashing, but avoid building a std::string per lookup
+    const Property& operator[](std::string_view name) const {
         for (const auto& property : properties_) {
             if (property.name() == name) {
                 return property;
             }
         }
-        throw std::runtime_error("Property not found: " + name);
+        throw std::runtime_error("Property not found: " + std::string(name));
     }
 
     auto begin() { return properties_.begin(); }
     auto end() { return properties_.end(); }
+    auto begin() const { return properties_.begin(); }
+    auto end() const { return properties_.end(); }
 
     std::vector<std::string> GetRequired() const {
         std::vector<std::string> required;
@@ -188,23 +222,31 @@ public:
         return required;
     }
 
-    std::string to_json() const {
-        cJSON *json = cJSON_CreateObject();
-        
+    void WriteJson(JsonWriter& writer) const {
+        writer.BeginObject();
         for (const auto& property : properties_) {
-            cJSON *prop_json = cJSON_Parse(property.to_json().c_str());
-            cJSON_AddItemToObject(json, property.name().c_str(), prop_json);
+            writer.Key(property.name());
+            property.WriteJson(writer);
         }
-        
-        char *json_str = cJSON_PrintUnformatted(json);
-        std::string result(json_str);
-        cJSON_free(json_str);
-        cJSON_Delete(json);
-        
+        writer.EndObject();
+    }
+
+    std::string to_json() const {
+        std::string result;
+        JsonWriter writer(result);
+        WriteJson(writer);
         return result;
     }
 };
 
+enum ToolExecution {
+    kToolExecutionMain,         // In the main task through Application::Schedule(), the default
+    kToolExecutionWorker,       // In the worker pool, for tools that block for a moment
+    kToolExecutionLongRunning,  // In a low priority task of their own, e.g. capture and upload a photo
+};
+
+struct McpToolCall;
+
 class McpTool {
 private:
     std::string name_;
@@ -212,6 +254,7 @@ private:
     PropertyList properties_;
     std::function<ReturnValue(const PropertyList&)> callback_;
     bool user_only_ = false;
+    ToolExecution execution_ = kToolExecutionMain;
 
 public:
     McpTool(const std::string& name, 
@@ -222,95 +265,142 @@ public:
         description_(description), 
         properties_(properties), 
         callback_(callback) {}
+    virtual ~McpTool() = default;
 
     void set_user_only(bool user_only) { user_only_ = user_only; }
+    void set_execution(ToolExecution execution) { execution_ = execution; }
     inline const std::string& name() const { return name_; }
     inline const std::string& description() const { return description_; }
     inline const PropertyList& properties() const { return properties_; }
     inline bool user_only() const { return user_only_; }
+    inline ToolExecution execution() const { return execution_; }
 
-    std::string to_json() const {
-        std::vector<std::string> required = properties_.GetRequired();
-        
-        cJSON *json = cJSON_CreateObject();
-        cJSON_AddStringToObject(json, "name", name_.c_str());
-        cJSON_AddStringToObject(json, "description", description_.c_str());
-        
-        cJSON *input_schema = cJSON_CreateObject();
-        cJSON_AddStringToObject(input_schema, "type", "object");
-        
-        cJSON *properties = cJSON_Parse(properties_.to_json().c_str());
-        cJSON_AddItemToObject(input_schema, "properties", properties);
-        
-        if (!required.empty()) {
-            cJSON *required_array = cJSON_CreateArray();
-            for (const auto& property : required) {
-                cJSON_AddItemToArray(required_array, cJSON_CreateString(property.c_str()));
-            }
-            cJSON_AddItemToObject(input_schema, "required", required_array);
-        }
-        
-        cJSON_AddItemToObject(json, "inputSchema", input_schema);
+    void WriteJson(JsonWriter& writer) const {
+        writer.BeginObject().Member("name", name_).Member("description", description_);
+
+        writer.Key("inputSchema");
+        WriteInputSchema(writer);
 
         // Add audience annotation if the tool is user only (invisible to AI)
         if (user_only_) {
-            cJSON *annotations = cJSON_CreateObject();
-            cJSON *audience = cJSON_CreateArray();
-            cJSON_AddItemToArray(audience, cJSON_CreateString("user"));
-            cJSON_AddItemToObject(annotations, "audience", audience);
-            cJSON_AddItemToObject(json, "annotations", annotations);
+            writer.Key("annotations").BeginObject().Key("audience").BeginArray().String("user").EndArray().EndObject();
         }
-        
-        char *json_str = cJSON_PrintUnformatted(json);
-        std::string result(json_str);
-        cJSON_free(json_str);
-        cJSON_Delete(json);
-        
+        writer.EndObject();
+    }
+
+    virtual void WriteInputSchema(JsonWriter& writer) const {
+        writer.BeginObject().Member("type", "object");
+        writer.Key("properties");
+        properties_.WriteJson(writer);
+        bool has_required = false;
+        for (const auto& property : properties_) {
+            if (property.has_default_value()) {
+                continue;
+            }
+            if (!has_required) {
+                writer.Key("required").BeginArray();
+                has_required = true;
+            }
+            writer.String(property.name());
+        }
+        if (has_required) {
+            writer.EndArray();
+        }
+        writer.EndObject();
+    }
+
+    /**
+     * Check the tools/call arguments and bind them to call.invoke, false with error set if they are invalid
+     */
+    virtual bool BindArguments(const cJSON* arguments, McpToolCall& call, std::string& error);
+
+    std::string to_json() const {
+        std::string result;
+        JsonWriter writer(result);
+        WriteJson(writer);
         return result;
     }
 
-    std::string Call(const PropertyList& properties) {
+    ReturnValue Run(const PropertyList& properties) {
+        return callback_(properties);
+    }
+
+    /**
+     * Run the tool and write the tools/call result object
+     */
+    void Call(const PropertyList& properties, JsonWriter& writer) {
         ReturnValue return_value = callback_(properties);
-        // 返回结果
-        cJSON* result = cJSON_CreateObject();
-        cJSON* content = cJSON_CreateArray();
+        WriteResult(return_value, writer);
+    }
 
+    /**
+     * Write the tools/call result object for a return value and free what it points to
+     */
+    static void WriteResult(ReturnValue& return_value, JsonWriter& writer) {
+        // 返回结果
+        writer.BeginObject().Key("content").BeginArray().BeginObject();
         if (std::holds_alternative<ImageContent*>(return_value)) {
             auto image_content = std::get<ImageContent*>(return_value);
-            cJSON* image = cJSON_CreateObject();
-            cJSON_AddStringToObject(image, "type", "image");
-            cJSON_AddStringToObject(image, "image", image_content->to_json().c_str());
-            cJSON_AddItemToArray(content, image);
+            std::string encoded_data;
+            image_content->AppendBase64(encoded_data, 0, image_content->size());
+            writer.Member("type", "image").Member("mimeType", image_content->mime_type()).Member("data", encoded_data);
             delete image_content;
         } else {
-            cJSON* text = cJSON_CreateObject();
-            cJSON_AddStringToObject(text, "type", "text");
+            writer.Member("type", "text");
             if (std::holds_alternative<std::string>(return_value)) {
-                cJSON_AddStringToObject(text, "text", std::get<std::string>(return_value).c_str());
+                writer.Member("text", std::get<std::string>(return_value));
             } else if (std::holds_alternative<bool>(return_value)) {
-                cJSON_AddStringToObject(text, "text", std::get<bool>(return_value) ? "true" : "false");
+                writer.Member("text", std::get<bool>(return_value) ? "true" : "false");
             } else if (std::holds_alternative<int>(return_value)) {
-                cJSON_AddStringToObject(text, "text", std::to_string(std::get<int>(return_value)).c_str());
+                char number[16];
+                snprintf(number, sizeof(number), "%d", std::get<int>(return_value));
+                writer.Member("text", number);
             } else if (std::holds_alternative<cJSON*>(return_value)) {
                 cJSON* json = std::get<cJSON*>(return_value);
                 char* json_str = cJSON_PrintUnformatted(json);
-                cJSON_AddStringToObject(text, "text", json_str);
+                writer.Member("text", json_str);
                 cJSON_free(json_str);
                 cJSON_Delete(json);
             }
-            cJSON_AddItemToArray(content, text);
         }
-        cJSON_AddItemToObject(result, "content", content);
-        cJSON_AddBoolToObject(result, "isError", false);
-
-        auto json_str = cJSON_PrintUnformatted(result);
-        std::string result_str(json_str);
-        cJSON_free(json_str);
-        cJSON_Delete(result);
-        return result_str;
+        writer.EndObject().EndArray().Member("isError", false).EndObject();
+    }
+
+    std::string Call(const PropertyList& properties) {
+        std::string result;
+        JsonWriter writer(result);
+        Call(properties, writer);
+        return result;
     }
 };
 
+/**
+ * Replies to the requests of one JSON-RPC batch, sent as one array when the last reference is released
+ */
+struct McpBatch {
+    std::mutex mutex;
+    std::string replies;
+
+    ~McpBatch();
+};
+
+/**
+ * One tools/call request from the time it is parsed until its reply is sent
+ */
+struct McpToolCall {
+    int id;
+    McpTool* tool;
+    // Runs the tool with the arguments of this call
+    std::function<ReturnValue()> invoke;
+    // params._meta.progressToken as serialized JSON, empty when the client did not ask for progress
+    std::string progress_token;
+    std::atomic<bool> cancelled{false};
+    // Set when the request came in a batch, the reply joins the batch reply
+    std::shared_ptr<McpBatch> batch;
+    int64_t submit_time = 0;
+    int64_t start_time = 0;
+};
+
 class McpServer {
 public:
     static McpServer& GetInstance() {
@@ -320,11 +410,29 @@ public:
 
     void AddCommonTools();
     void AddUserOnlyTools();
+    /**
+     * Register the device state resources the server can subscribe to
+     */
+    void AddDeviceResources();
     void AddTool(McpTool* tool);
-    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
-    void AddUserOnlyTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
+    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback, ToolExecution execution = kToolExecutionMain);
+    void AddUserOnlyTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback, ToolExecution execution = kToolExecutionMain);
     void ParseMessage(const cJSON* json);
-    void ParseMessage(const std::string& message);
+    void ParseMessage(std::string_view message);
+
+    /**
+     * Send notifications/progress for the tool call running in this task, if the client asked for it
+     */
+    void ReportProgress(int progress, int total = 0, const std::string& message = "");
+    /**
+     * True once the client has cancelled the tool call running in this task
+     */
+    bool IsToolCallCancelled() const;
+    std::string GetToolStatsJson() { return executor_.GetStatsJson(); }
+    /**
+     * Push the subscribed resources that changed, called from the main task on state changes and every second
+     */
+    void CheckSubscriptions();
 
 private:
     McpServer();
@@ -332,13 +440,35 @@ private:
 
     void ParseCapabilities(const cJSON* capabilities);
 
-    void ReplyResult(int id, const std::string& result);
+    // A reply is written into one payload: BeginResult() opens the envelope up to "result":,
+    // the caller writes the result value and SendResult() closes the envelope and sends it
+    void BeginResult(JsonWriter& writer, int id);
+    void SendResult(JsonWriter& writer, std::string& payload);
     void ReplyError(int id, const std::string& message);
+    void SendReply(std::string payload);
 
     void GetToolsList(int id, const std::string& cursor, bool list_user_only_tools);
-    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments);
+    /**
+     * Write the tools/list result starting at the tool named by cursor, false if it cannot be built
+     */
+    bool BuildToolsListPage(const std::string& cursor, bool list_user_only_tools, std::string& result, std::string& error);
+    void InvalidateToolsList();
+    void DoToolCall(int id, std::string_view tool_name, const cJSON* tool_arguments, const cJSON* progress_token);
+    bool RunToolCall(McpToolCall& call);
+    /**
+     * Send an image result in pieces, base64 encoded from the image bytes as the transport takes them
+     */
+    void SendImageResult(int id, std::unique_ptr<ImageContent> image);
 
     std::vector<McpTool*> tools_;
+    // Keyed by the name stored in the tool itself
+    std::unordered_map<std::string_view, McpTool*> tool_index_;
+    // tools/list results by cursor, without and with the user only tools, until the tool set changes
+    std::map<std::string, std::string> tools_list_pages_[2];
+    McpToolExecutor executor_;
+    McpResources resources_;
+    // The batch being parsed, only used by the task that parses incoming messages
+    std::shared_ptr<McpBatch> parsing_batch_;
 };
 
 #endif // MCP_SERVER_H
@@ -0,0 +1,173 @@
+#include "mcp_tool_executor.h"
+#include "mcp_server.h"
+#include "application.h"
+#include "json_writer.h"
+
+#include <algorithm>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define TAG "McpToolExecutor"
+
+thread_local McpToolCall* McpToolExecutor::current_call_ = nullptr;
+
+McpToolExecutor::McpToolExecutor(Runner runner) : runner_(std::move(runner)) {
+}
+
+void McpToolExecutor::Submit(std::shared_ptr<McpToolCall> call) {
+    call->submit_time = esp_timer_get_time();
+    auto execution = call->tool->execution();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    in_flight_.push_back(call);
+    max_in_flight_ = std::max(max_in_flight_, in_flight_.size());
+    if (execution == kToolExecutionMain) {
+        lock.unlock();
+        Application::GetInstance().Schedule([this, call = std::move(call)]() {
+            Execute(call);
+        });
+        return;
+    }
+
+    bool long_running = execution == kToolExecutionLongRunning;
+    (long_running ? long_running_queue_ : worker_queue_).push_back(std::move(call));
+    StartTasks(long_running);
+    cv_.notify_all();
+}
+
+void McpToolExecutor::StartTasks(bool long_running) {
+    if (long_running) {
+        if (long_running_tasks_ == 0) {
+            long_running_tasks_++;
+            xTaskCreate([](void* arg) {
+                static_cast<McpToolExecutor*>(arg)->WorkerLoop(true);
+            }, "mcp_long_tool", MCP_TOOL_LONG_RUNNING_STACK_SIZE, this, MCP_TOOL_LONG_RUNNING_PRIORITY, nullptr);
+        }
+        return;
+    }
+
+    while (worker_tasks_ < MCP_TOOL_WORKER_COUNT) {
+        worker_tasks_++;
+        xTaskCreate([](void* arg) {
+            static_cast<McpToolExecutor*>(arg)->WorkerLoop(false);
+        }, "mcp_tool", MCP_TOOL_WORKER_STACK_SIZE, this, MCP_TOOL_WORKER_PRIORITY, nullptr);
+    }
+}
+
+void McpToolExecutor::WorkerLoop(bool long_running) {
+    auto& queue = long_running ? long_running_queue_ : worker_queue_;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        // Skip calls of a tool that is already running, they keep their order
+        auto it = std::find_if(queue.begin(), queue.end(), [this](const std::shared_ptr<McpToolCall>& call) {
+            return std::find(running_tools_.begin(), running_tools_.end(), call->tool) == running_tools_.end();
+        });
+        if (it == queue.end()) {
+            cv_.wait(lock);
+            continue;
+        }
+
+        auto call = std::move(*it);
+        queue.erase(it);
+        running_tools_.push_back(call->tool);
+        lock.unlock();
+        Execute(call);
+        lock.lock();
+        running_tools_.erase(std::find(running_tools_.begin(), running_tools_.end(), call->tool));
+        cv_.notify_all();
+    }
+}
+
+void McpToolExecutor::Execute(const std::shared_ptr<McpToolCall>& call) {
+    bool success = true;
+    if (!call->cancelled) {
+        call->start_time = esp_timer_get_time();
+        current_call_ = call.get();
+        success = runner_(*call);
+        current_call_ = nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Finish(*call, success);
+}
+
+bool McpToolExecutor::Cancel(int id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find_if(in_flight_.begin(), in_flight_.end(), [id](const std::shared_ptr<McpToolCall>& call) {
+        return call->id == id;
+    });
+    if (it == in_flight_.end()) {
+        return false;
+    }
+    auto call = *it;
+    call->cancelled = true;
+    ESP_LOGI(TAG, "Cancel %s (id %d)%s", call->tool->name().c_str(), id, call->start_time != 0 ? " while running" : "");
+
+    // Main thread calls are skipped when their turn comes
+    for (auto queue : { &worker_queue_, &long_running_queue_ }) {
+        auto queued = std::find(queue->begin(), queue->end(), call);
+        if (queued != queue->end()) {
+            queue->erase(queued);
+            Finish(*call, true);
+            break;
+        }
+    }
+    return true;
+}
+
+void McpToolExecutor::Finish(McpToolCall& call, bool success) {
+    auto& stats = stats_[call.tool->name()];
+    stats.calls++;
+    if (!success) {
+        stats.failed++;
+    }
+    if (call.cancelled) {
+        stats.cancelled++;
+    }
+    if (call.start_time != 0) {
+        uint32_t queued_us = call.start_time - call.submit_time;
+        uint32_t run_us = esp_timer_get_time() - call.start_time;
+        stats.started++;
+        stats.total_queued_us += queued_us;
+        stats.total_run_us += run_us;
+        stats.max_queued_us = std::max(stats.max_queued_us, queued_us);
+        stats.max_run_us = std::max(stats.max_run_us, run_us);
+        ESP_LOGI(TAG, "%s took %lu ms, queued %lu ms", call.tool->name().c_str(), run_us / 1000, queued_us / 1000);
+    }
+
+    auto it = std::find_if(in_flight_.begin(), in_flight_.end(), [&call](const std::shared_ptr<McpToolCall>& other) {
+        return other.get() == &call;
+    });
+    if (it != in_flight_.end()) {
+        in_flight_.erase(it);
+    }
+}
+
+std::string McpToolExecutor::GetStatsJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string json;
+    JsonWriter writer(json);
+    writer.BeginObject();
+    writer.Member("in_flight", (int)in_flight_.size());
+    writer.Member("max_in_flight", (int)max_in_flight_);
+    writer.Member("queued", (int)(worker_queue_.size() + long_running_queue_.size()));
+
+    writer.Key("tools").BeginArray();
+    for (const auto& [name, stats] : stats_) {
+        writer.BeginObject();
+        writer.Member("name", name);
+        writer.Member("calls", (int)stats.calls);
+        writer.Member("failed", (int)stats.failed);
+        writer.Member("cancelled", (int)stats.cancelled);
+        writer.Member("avg_queued_ms", (int)(stats.started > 0 ? stats.total_queued_us / stats.started / 1000 : 0));
+        writer.Member("max_queued_ms", (int)(stats.max_queued_us / 1000));
+        writer.Member("avg_run_ms", (int)(stats.started > 0 ? stats.total_run_us / stats.started / 1000 : 0));
+        writer.Member("max_run_ms", (int)(stats.max_run_us / 1000));
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+    return json;
+}
@@ -0,0 +1,89 @@
+#ifndef MCP_TOOL_EXECUTOR_H
+#define MCP_TOOL_EXECUTOR_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+#define MCP_TOOL_WORKER_COUNT 2
+#define MCP_TOOL_WORKER_STACK_SIZE (4096 * 2)
+#define MCP_TOOL_WORKER_PRIORITY 3
+// Sized like the main task, where these tools used to run
+#define MCP_TOOL_LONG_RUNNING_STACK_SIZE (4096 * 3)
+#define MCP_TOOL_LONG_RUNNING_PRIORITY 1
+
+class McpTool;
+struct McpToolCall;
+
+/**
+ * McpToolExecutor - Runs tools/call requests by the execution class of their tool
+ *
+ * Main thread tools are scheduled on the main task as before. Worker tools run in a small pool
+ * and long running tools in a low priority task of their own, started on first use. A tool never
+ * runs twice at the same time. Calls stay in flight until they finish, so they can be cancelled,
+ * and their queueing and run time is added to the per-tool stats.
+ */
+class McpToolExecutor {
+public:
+    /**
+     * Runs the tool and sends the reply, false if the tool failed
+     */
+    using Runner = std::function<bool(McpToolCall& call)>;
+
+    explicit McpToolExecutor(Runner runner);
+
+    void Submit(std::shared_ptr<McpToolCall> call);
+    /**
+     * Mark an in flight call as cancelled, a call that has not started yet is dropped
+     */
+    bool Cancel(int id);
+
+    /**
+     * The call running in the calling task, nullptr outside of a tool
+     */
+    static McpToolCall* current_call() { return current_call_; }
+
+    std::string GetStatsJson();
+
+private:
+    struct ToolStats {
+        uint32_t calls = 0;
+        uint32_t started = 0;
+        uint32_t failed = 0;
+        uint32_t cancelled = 0;
+        uint32_t max_queued_us = 0;
+        uint32_t max_run_us = 0;
+        uint64_t total_queued_us = 0;
+        uint64_t total_run_us = 0;
+    };
+
+    static thread_local McpToolCall* current_call_;
+
+    Runner runner_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::shared_ptr<McpToolCall>> worker_queue_;
+    std::deque<std::shared_ptr<McpToolCall>> long_running_queue_;
+    std::vector<std::shared_ptr<McpToolCall>> in_flight_;
+    std::vector<const McpTool*> running_tools_;
+    // Keyed by the name stored in the tool itself
+    std::map<std::string_view, ToolStats> stats_;
+    int worker_tasks_ = 0;
+    int long_running_tasks_ = 0;
+    size_t max_in_flight_ = 0;
+
+    void StartTasks(bool long_running);
+    void WorkerLoop(bool long_running);
+    void Execute(const std::shared_ptr<McpToolCall>& call);
+    // Called with mutex_ held
+    void Finish(McpToolCall& call, bool success);
+};
+
+#endif // MCP_TOOL_EXECUTOR_H
@@ -0,0 +1,198 @@
+#ifndef MCP_TYPED_TOOL_H
+#define MCP_TYPED_TOOL_H
+
+#include "mcp_server.h"
+
+#include <tuple>
+#include <limits>
+#include <utility>
+#include <type_traits>
+
+/**
+ * One parameter of a typed tool, declared with IntParam(), BoolParam() or StringParam()
+ *
+ * The spec is constexpr and lives in flash, the callback gets int, bool or const std::string&.
+ */
+template <typename T>
+struct McpParam {
+    using Value = std::conditional_t<std::is_same_v<T, const char*>, std::string, T>;
+
+    const char* name;
+    T default_value;
+    bool has_default;
+    int min_value;
+    int max_value;
+    bool has_range;
+
+    void WriteJson(JsonWriter& writer) const {
+        writer.BeginObject();
+        if constexpr (std::is_same_v<T, bool>) {
+            writer.Member("type", "boolean");
+            if (has_default) {
+                writer.Member("default", default_value);
+            }
+        } else if constexpr (std::is_same_v<T, int>) {
+            writer.Member("type", "integer");
+            if (has_default) {
+                writer.Member("default", default_value);
+            }
+            if (has_range) {
+                writer.Member("minimum", min_value);
+                writer.Member("maximum", max_value);
+            }
+        } else {
+            writer.Member("type", "string");
+            if (has_default) {
+                writer.Member("default", default_value);
+            }
+        }
+        writer.EndObject();
+    }
+
+    /**
+     * Parse the argument into value, false with error set if it is missing or out of range
+     */
+    bool Parse(const cJSON* arguments, Value& value, std::string& error) const {
+        const cJSON* item = cJSON_IsObject(arguments) ? cJSON_GetObjectItem(arguments, name) : nullptr;
+        bool found = false;
+        if constexpr (std::is_same_v<T, bool>) {
+            if (cJSON_IsBool(item)) {
+                value = item->valueint == 1;
+                found = true;
+            }
+        } else if constexpr (std::is_same_v<T, int>) {
+            if (cJSON_IsNumber(item)) {
+                value = item->valueint;
+                found = true;
+                if (has_range && value < min_value) {
+                    error = "Value is below minimum allowed: " + std::to_string(min_value);
+                    return false;
+                }
+                if (has_range && value > max_value) {
+                    error = "Value exceeds maximum allowed: " + std::to_string(max_value);
+                    return false;
+                }
+            }
+        } else {
+            if (cJSON_IsString(item)) {
+                value = item->valuestring;
+                found = true;
+            }
+        }
+
+        if (!found) {
+            if (!has_default) {
+                error = std::string("Missing valid argument: ") + name;
+                return false;
+            }
+            value = default_value;
+        }
+        return true;
+    }
+};
+
+constexpr McpParam<bool> BoolParam(const char* name) {
+    return { name, false, false, 0, 0, false };
+}
+
+constexpr McpParam<bool> BoolParam(const char* name, bool default_value) {
+    return { name, default_value, true, 0, 0, false };
+}
+
+constexpr McpParam<int> IntParam(const char* name) {
+    return { name, 0, false, 0, 0, false };
+}
+
+constexpr McpParam<int> IntParam(const char* name, int min_value, int max_value) {
+    return { name, 0, false, min_value, max_value, true };
+}
+
+constexpr McpParam<int> IntParam(const char* name, int default_value, int min_value, int max_value) {
+    return { name, default_value, true, min_value, max_value, true };
+}
+
+constexpr McpParam<const char*> StringParam(const char* name) {
+    return { name, "", false, 0, 0, false };
+}
+
+constexpr McpParam<const char*> StringParam(const char* name, const char* default_value) {
+    return { name, default_value, true, 0, 0, false };
+}
+
+/**
+ * McpTypedTool - A tool whose callback takes its arguments as typed parameters
+ *
+ * Arguments are parsed straight from the request into the parameter types, without a
+ * PropertyList copy, variants or exceptions, and the input schema is written from the
+ * parameter specs. Create one with NewTypedTool() and register it with McpServer::AddTool().
+ */
+template <typename Callback, typename... Params>
+class McpTypedTool : public McpTool {
+public:
+    McpTypedTool(const std::string& name, const std::string& description, Callback callback, Params... params)
+        : McpTool(name, description, PropertyList(), nullptr), callback_(std::move(callback)), params_(params...) {
+        static_assert(std::is_invocable_r_v<ReturnValue, Callback&, typename Params::Value&...>,
+            "The callback must take one parameter per spec, in order, and return a ReturnValue");
+    }
+
+    void WriteInputSchema(JsonWriter& writer) const override {
+        writer.BeginObject().Member("type", "object");
+        writer.Key("properties").BeginObject();
+        std::apply([&writer](const auto&... param) {
+            ((writer.Key(param.name), param.WriteJson(writer)), ...);
+        }, params_);
+        writer.EndObject();
+
+        bool has_required = false;
+        std::apply([&writer, &has_required](const auto&... param) {
+            ([&writer, &has_required](const auto& param) {
+                if (param.has_default) {
+                    return;
+                }
+                if (!has_required) {
+                    writer.Key("required").BeginArray();
+                    has_required = true;
+                }
+                writer.String(param.name);
+            }(param), ...);
+        }, params_);
+        if (has_required) {
+            writer.EndArray();
+        }
+        writer.EndObject();
+    }
+
+    bool BindArguments(const cJSON* arguments, McpToolCall& call, std::string& error) override {
+        std::tuple<typename Params::Value...> values;
+        if (!ParseArguments(arguments, values, error, std::index_sequence_for<Params...>())) {
+            return false;
+        }
+        call.invoke = [this, values = std::move(values)]() mutable -> ReturnValue {
+            return std::apply(callback_, values);
+        };
+        return true;
+    }
+
+private:
+    Callback callback_;
+    std::tuple<Params...> params_;
+
+    template <size_t... I>
+    bool ParseArguments(const cJSON* arguments, std::tuple<typename Params::Value...>& values, std::string& error,
+        std::index_sequence<I...>) const {
+        return (std::get<I>(params_).Parse(arguments, std::get<I>(values), error) && ...);
+    }
+};
+
+/**
+ * new McpTypedTool with the template arguments deduced, e.g.
+ *
+ *   mcp_server.AddTool(NewTypedTool("self.audio_speaker.set_volume", "Set the volume...",
+ *       [](int volume) -> ReturnValue { ... }, IntParam("volume", 0, 100)));
+ */
+template <typename Callback, typename... Params>
+McpTool* NewTypedTool(const std::string& name, const std::string& description, Callback callback, Params... params) {
+    return new McpTypedTool<Callback, Params...>(name, description, std::move(callback), params...);
+}
+
+#endif // MCP_TYPED_TOOL_H
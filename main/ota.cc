@@ -1,6 +1,9 @@
 #include "ota.h"
 #include "system_info.h"
 #include "settings.h"
+#include "connection_cache.h"
+#include "resumable_download.h"
+#include "delta_patcher.h"
 #include "assets/lang_config.h"
 
 #include <cJSON.h>
@@ -10,6 +13,9 @@
 #include <esp_app_format.h>
 #include <esp_efuse.h>
 #include <esp_efuse_table.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+#include <mbedtls/sha256.h>
 #ifdef SOC_HMAC_SUPPORTED
 #include <esp_hmac.h>
 #endif
@@ -91,11 +97,14 @@ esp_err_t Ota::CheckVersion() {
     std::string method = data.length() > 0 ? "POST" : "GET";
     http->SetContent(std::move(data));
 
+    auto connect_timer = ConnectionCache::GetInstance().TimeConnect(url);
     if (!http->Open(method, url)) {
+        connect_timer.Finish(false);
         int last_error = http->GetLastError();
         ESP_LOGE(TAG, "Failed to open HTTP connection, code=0x%x", last_error);
         return last_error;
     }
+    connect_timer.Finish(true);
 
     auto status_code = http->GetStatusCode();
     if (status_code != 200) {
@@ -218,6 +227,22 @@ esp_err_t Ota::CheckVersion() {
         if (cJSON_IsString(url)) {
             firmware_url_ = url->valuestring;
         }
+        // Optional digest of the image, checked before the new firmware is made bootable
+        firmware_sha256_.clear();
+        cJSON *sha256 = cJSON_GetObjectItem(firmware, "sha256");
+        if (cJSON_IsString(sha256)) {
+            firmware_sha256_ = sha256->valuestring;
+        }
+        // Optional patch from the running version: "delta": { "from": "1.0.0", "url": "http://" }
+        firmware_delta_url_.clear();
+        cJSON *delta = cJSON_GetObjectItem(firmware, "delta");
+        if (cJSON_IsObject(delta)) {
+            cJSON *from = cJSON_GetObjectItem(delta, "from");
+            cJSON *delta_url = cJSON_GetObjectItem(delta, "url");
+            if (cJSON_IsString(from) && cJSON_IsString(delta_url) && current_version_ == from->valuestring) {
+                firmware_delta_url_ = delta_url->valuestring;
+            }
+        }
 
         if (cJSON_IsString(version) && cJSON_IsString(url)) {
             // Check if the version is newer, for example, 0.1.0 is newer than 0.0.1
@@ -238,6 +263,19 @@ esp_err_t Ota::CheckVersion() {
     }
 
     cJSON_Delete(root);
+
+    // Resolve the servers we are about to connect to while activation continues
+    std::vector<std::string> prefetch_urls;
+    if (has_websocket_config_) {
+        prefetch_urls.push_back(Settings("websocket", false).GetString("url"));
+    }
+    if (has_mqtt_config_) {
+        prefetch_urls.push_back(Settings("mqtt", false).GetString("endpoint"));
+    }
+    if (has_new_version_) {
+        prefetch_urls.push_back(firmware_delta_url_.empty() ? firmware_url_ : firmware_delta_url_);
+    }
+    ConnectionCache::GetInstance().Prefetch(prefetch_urls);
     return ESP_OK;
 }
 
@@ -261,9 +299,9 @@ void Ota::MarkCurrentVersionValid() {
     }
 }
 
-bool Ota::Upgrade(const std::string& firmware_url, std::function<void(int progress, size_t speed)> callback) {
+bool Ota::Upgrade(const std::string& firmware_url, std::function<void(int progress, size_t speed)> callback,
+    const std::string& sha256) {
     ESP_LOGI(TAG, "Upgrading firmware from %s", firmware_url.c_str());
-    esp_ota_handle_t update_handle = 0;
     auto update_partition = esp_ota_get_next_update_partition(NULL);
     if (update_partition == NULL) {
         ESP_LOGE(TAG, "Failed to get update partition");
@@ -271,104 +309,248 @@ bool Ota::Upgrade(const std::string& firmware_url, std::function<void(int progre
     }
 
     ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition->label, update_partition->address);
-    bool image_header_checked = false;
-    std::string image_header;
 
-    auto network = Board::GetInstance().GetNetwork();
-    auto http = network->CreateHttp(0);
-    if (!http->Open("GET", firmware_url)) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection");
+    // esp_ota_write() can only start at the beginning of the partition, so the image is written with
+    // the partition API and a download that stopped continues where it was. esp_ota_set_boot_partition()
+    // validates the image like esp_ota_end() would.
+    DownloadTarget target;
+    target.name = update_partition->label;
+    target.size = update_partition->size;
+    target.sector_size = update_partition->erase_size;
+    target.read = [update_partition](size_t offset, char* data, size_t size) {
+        return esp_partition_read(update_partition, offset, data, size) == ESP_OK;
+    };
+    target.erase = [update_partition](size_t offset, size_t size) {
+        return esp_partition_erase_range(update_partition, offset, size) == ESP_OK;
+    };
+    target.write = [update_partition](size_t offset, const char* data, size_t size) {
+        return esp_partition_write(update_partition, offset, data, size) == ESP_OK;
+    };
+    ResumableDownload download("ota", target, OTA_DOWNLOAD_BUFFER_SIZE, OTA_DOWNLOAD_BUFFER_COUNT);
+    if (!download.Run(firmware_url, callback)) {
         return false;
     }
 
-    if (http->GetStatusCode() != 200) {
-        ESP_LOGE(TAG, "Failed to get firmware, status code: %d", http->GetStatusCode());
+    esp_app_desc_t new_app_info;
+    if (esp_ota_get_partition_description(update_partition, &new_app_info) == ESP_OK) {
+        ESP_LOGI(TAG, "Current version: %s, New version: %s", esp_app_get_description()->version, new_app_info.version);
+    }
+
+    ESP_LOGI(TAG, "Firmware SHA-256: %s", download.sha256().c_str());
+    if (!sha256.empty() && strcasecmp(sha256.c_str(), download.sha256().c_str()) != 0) {
+        ESP_LOGE(TAG, "Firmware SHA-256 does not match the expected %s", sha256.c_str());
+        download.Clear();
         return false;
     }
 
-    size_t content_length = http->GetBodyLength();
-    if (content_length == 0) {
-        ESP_LOGE(TAG, "Failed to get content length");
+    esp_err_t err = esp_ota_set_boot_partition(update_partition);
+    download.Clear();
+    if (err != ESP_OK) {
+        if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
+            ESP_LOGE(TAG, "Image validation failed, image is corrupted");
+        } else {
+            ESP_LOGE(TAG, "Failed to set boot partition: %s", esp_err_to_name(err));
+        }
         return false;
     }
 
-    char buffer[512];
-    size_t total_read = 0, recent_read = 0;
-    auto last_calc_time = esp_timer_get_time();
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
+    ESP_LOGI(TAG, "Firmware upgrade successful");
+    return true;
+}
+
+// CRC32 of the first size bytes of a partition, as in the patch header, and their SHA-256 (hex) if asked for
+static bool CalculatePartitionDigest(const esp_partition_t* partition, size_t size, uint32_t& crc, std::string* sha256 = nullptr) {
+    std::unique_ptr<char[]> buffer(new char[OTA_DOWNLOAD_BUFFER_SIZE]);
+    mbedtls_sha256_context sha256_context;
+    mbedtls_sha256_init(&sha256_context);
+    mbedtls_sha256_starts(&sha256_context, 0);
+    crc = 0;
+    bool ok = true;
+    for (size_t offset = 0; offset < size; offset += OTA_DOWNLOAD_BUFFER_SIZE) {
+        size_t length = std::min((size_t)OTA_DOWNLOAD_BUFFER_SIZE, size - offset);
+        esp_err_t err = esp_partition_read(partition, offset, buffer.get(), length);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read partition %s at offset %u: %s", partition->label, offset, esp_err_to_name(err));
+            ok = false;
+            break;
+        }
+        crc = esp_rom_crc32_le(crc, (const uint8_t*)buffer.get(), length);
+        if (sha256 != nullptr) {
+            mbedtls_sha256_update(&sha256_context, (const unsigned char*)buffer.get(), length);
+        }
+    }
+
+    unsigned char digest[32];
+    mbedtls_sha256_finish(&sha256_context, digest);
+    mbedtls_sha256_free(&sha256_context);
+    if (ok && sha256 != nullptr) {
+        sha256->clear();
+        for (size_t i = 0; i < sizeof(digest); i++) {
+            char hex[3];
+            sprintf(hex, "%02x", digest[i]);
+            *sha256 += hex;
+        }
+    }
+    return ok;
+}
+
+bool Ota::UpgradeDelta(const std::string& patch_url, std::function<void(int progress, size_t speed)> callback,
+    const std::string& sha256) {
+    ESP_LOGI(TAG, "Upgrading firmware with the patch from %s", patch_url.c_str());
+    auto running_partition = esp_ota_get_running_partition();
+    auto update_partition = esp_ota_get_next_update_partition(NULL);
+    if (running_partition == NULL || update_partition == NULL) {
+        ESP_LOGE(TAG, "Failed to get the running and update partitions");
+        return false;
+    }
+
+    auto network = Board::GetInstance().GetNetwork();
+    auto http = network->CreateHttp(0);
+    auto connect_timer = ConnectionCache::GetInstance().TimeConnect(patch_url);
+    if (!http->Open("GET", patch_url)) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection");
+        return false;
+    }
+    connect_timer.Finish(true);
+    if (http->GetStatusCode() != 200) {
+        ESP_LOGE(TAG, "Failed to get firmware patch, status code: %d", http->GetStatusCode());
+        http->Close();
+        return false;
+    }
+    size_t patch_size = http->GetBodyLength();
+
+    char header_data[DELTA_HEADER_SIZE];
+    size_t filled = 0;
+    while (filled < sizeof(header_data)) {
+        int ret = http->Read(header_data + filled, sizeof(header_data) - filled);
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "Failed to read the firmware patch header");
+            http->Close();
             return false;
         }
+        filled += ret;
+    }
 
-        // Calculate speed and progress every second
-        recent_read += ret;
-        total_read += ret;
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || ret == 0) {
-            size_t progress = total_read * 100 / content_length;
-            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s", progress, total_read, content_length, recent_read);
-            if (callback) {
-                callback(progress, recent_read);
+    // The base is the running image, read in place, and the target goes to the other partition
+    DeltaHeader header;
+    if (!DeltaPatcher::ParseHeader(header_data, header) || header.window != 0 ||
+        header.base_size > running_partition->size || header.target_size > update_partition->size) {
+        ESP_LOGE(TAG, "Invalid firmware patch");
+        http->Close();
+        return false;
+    }
+    uint32_t base_crc;
+    if (!CalculatePartitionDigest(running_partition, header.base_size, base_crc) || base_crc != header.base_crc) {
+        ESP_LOGW(TAG, "The patch was made for another firmware");
+        http->Close();
+        return false;
+    }
+
+    // Sectors come in order, whole blocks are erased in one go where aligned. A full download saved
+    // for this partition no longer matches its digest afterwards and starts over.
+    size_t erased_end = 0;
+    const size_t SECTOR_SIZE = update_partition->erase_size;
+    DeltaPatcher patcher(header, SECTOR_SIZE,
+        [running_partition](size_t offset, char* data, size_t size) {
+            esp_err_t err = esp_partition_read(running_partition, offset, data, size);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to read the running firmware at offset %u: %s", offset, esp_err_to_name(err));
+                return false;
             }
-            last_calc_time = esp_timer_get_time();
-            recent_read = 0;
+            return true;
+        },
+        [update_partition, SECTOR_SIZE, &erased_end](size_t offset, const char* data, size_t size) {
+            esp_err_t err = ESP_OK;
+            while (err == ESP_OK && erased_end < offset + size) {
+                size_t erase_size = SECTOR_SIZE;
+                if (erased_end % RESUMABLE_DOWNLOAD_BLOCK_SIZE == 0 && erased_end + RESUMABLE_DOWNLOAD_BLOCK_SIZE <= update_partition->size) {
+                    erase_size = RESUMABLE_DOWNLOAD_BLOCK_SIZE;
+                }
+                err = esp_partition_erase_range(update_partition, erased_end, erase_size);
+                erased_end += erase_size;
+            }
+            if (err == ESP_OK) {
+                err = esp_partition_write(update_partition, offset, data, size);
+            }
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write the patched firmware at offset %u: %s", offset, esp_err_to_name(err));
+                return false;
+            }
+            return true;
+        });
+
+    std::unique_ptr<char[]> buffer(new char[OTA_DOWNLOAD_BUFFER_SIZE]);
+    bool read_ok = true;
+    size_t received = DELTA_HEADER_SIZE;
+    size_t recent_received = 0;
+    auto start_time = esp_timer_get_time();
+    auto last_calc_time = start_time;
+    while (patch_size == 0 || received < patch_size) {
+        int ret = http->Read(buffer.get(), OTA_DOWNLOAD_BUFFER_SIZE);
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to read HTTP data at %u: %s", received, esp_err_to_name(ret));
+            read_ok = false;
+            break;
         }
-
         if (ret == 0) {
             break;
         }
+        if (!patcher.Feed(buffer.get(), ret)) {
+            read_ok = false;
+            break;
+        }
+        received += ret;
+        recent_received += ret;
 
-        if (!image_header_checked) {
-            image_header.append(buffer, ret);
-            if (image_header.size() >= sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
-                esp_app_desc_t new_app_info;
-                memcpy(&new_app_info, image_header.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
-                
-                auto current_version = esp_app_get_description()->version;
-                ESP_LOGI(TAG, "Current version: %s, New version: %s", current_version, new_app_info.version);
-
-                if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle)) {
-                    esp_ota_abort(update_handle);
-                    ESP_LOGE(TAG, "Failed to begin OTA");
-                    return false;
-                }
-
-                image_header_checked = true;
-                std::string().swap(image_header);
+        if (esp_timer_get_time() - last_calc_time >= 1000000) {
+            size_t progress = patcher.stats().target_bytes * 100 / header.target_size;
+            ESP_LOGI(TAG, "Progress: %u%% (%u patch bytes), Speed: %uB/s", progress, received, recent_received);
+            if (callback) {
+                callback(progress, recent_received);
             }
-        }
-        auto err = esp_ota_write(update_handle, buffer, ret);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
-            esp_ota_abort(update_handle);
-            return false;
+            last_calc_time = esp_timer_get_time();
+            recent_received = 0;
         }
     }
     http->Close();
 
-    esp_err_t err = esp_ota_end(update_handle);
-    if (err != ESP_OK) {
-        if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
-            ESP_LOGE(TAG, "Image validation failed, image is corrupted");
-        } else {
-            ESP_LOGE(TAG, "Failed to end OTA: %s", esp_err_to_name(err));
-        }
+    if (!read_ok || !patcher.Finish()) {
+        ESP_LOGE(TAG, "Failed to apply the firmware patch");
+        return false;
+    }
+    int elapsed_ms = (esp_timer_get_time() - start_time) / 1000;
+    if (callback) {
+        callback(100, received * 1000 / std::max(elapsed_ms, 1));
+    }
+
+    // The image is read back from flash, so the digests cover what will actually boot
+    uint32_t target_crc;
+    std::string digest;
+    if (!CalculatePartitionDigest(update_partition, header.target_size, target_crc, &digest) || target_crc != header.target_crc) {
+        ESP_LOGE(TAG, "The patched firmware does not match the patch digest");
+        return false;
+    }
+    ESP_LOGI(TAG, "Firmware SHA-256: %s", digest.c_str());
+    if (!sha256.empty() && strcasecmp(sha256.c_str(), digest.c_str()) != 0) {
+        ESP_LOGE(TAG, "Firmware SHA-256 does not match the expected %s", sha256.c_str());
         return false;
     }
+    ESP_LOGI(TAG, "Firmware patched with %u bytes in %d ms, %u bytes written", received, elapsed_ms, header.target_size);
 
-    err = esp_ota_set_boot_partition(update_partition);
+    esp_err_t err = esp_ota_set_boot_partition(update_partition);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to set boot partition: %s", esp_err_to_name(err));
         return false;
     }
-
     ESP_LOGI(TAG, "Firmware upgrade successful");
     return true;
 }
 
 bool Ota::StartUpgrade(std::function<void(int progress, size_t speed)> callback) {
-    return Upgrade(firmware_url_, callback);
+    if (!firmware_delta_url_.empty() && UpgradeDelta(firmware_delta_url_, callback, firmware_sha256_)) {
+        return true;
+    }
+    return Upgrade(firmware_url_, callback, firmware_sha256_);
 }
 
 
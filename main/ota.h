@@ -7,6 +7,10 @@
 #include <esp_err.h>
 #include "board.h"
 
+// Upgrade: a ring of buffers between the HTTP reader and a flash writer task
+#define OTA_DOWNLOAD_BUFFER_SIZE CONFIG_OTA_DOWNLOAD_BUFFER_SIZE
+#define OTA_DOWNLOAD_BUFFER_COUNT 4
+
 class Ota {
 public:
     Ota();
@@ -21,12 +25,28 @@ public:
     bool HasActivationCode() { return has_activation_code_; }
     bool HasServerTime() { return has_server_time_; }
     bool StartUpgrade(std::function<void(int progress, size_t speed)> callback);
-    static bool Upgrade(const std::string& firmware_url, std::function<void(int progress, size_t speed)> callback);
+    /**
+     * The image is only made bootable if its SHA-256 matches sha256 (hex), when one is given.
+     * A download that stopped, even before a reboot, continues from its last saved block.
+     */
+    static bool Upgrade(const std::string& firmware_url, std::function<void(int progress, size_t speed)> callback,
+        const std::string& sha256 = "");
+    /**
+     * Apply a patch made by scripts/delta_patch.py (without --window) from the running firmware to the
+     * update partition. False, with the running firmware untouched, if the patch is for another base.
+     */
+    static bool UpgradeDelta(const std::string& patch_url, std::function<void(int progress, size_t speed)> callback,
+        const std::string& sha256 = "");
     void MarkCurrentVersionValid();
 
     const std::string& GetFirmwareVersion() const { return firmware_version_; }
     const std::string& GetCurrentVersion() const { return current_version_; }
     const std::string& GetFirmwareUrl() const { return firmware_url_; }
+    const std::string& GetFirmwareSha256() const { return firmware_sha256_; }
+    /**
+     * Patch from the running version, empty unless the server offered one
+     */
+    const std::string& GetFirmwareDeltaUrl() const { return firmware_delta_url_; }
     const std::string& GetActivationMessage() const { return activation_message_; }
     const std::string& GetActivationCode() const { return activation_code_; }
     std::string GetCheckVersionUrl();
@@ -44,6 +64,8 @@ private:
     std::string current_version_;
     std::string firmware_version_;
     std::string firmware_url_;
+    std::string firmware_sha256_;
+    std::string firmware_delta_url_;
     std::string activation_challenge_;
     std::string serial_number_;
     int activation_timeout_ms_ = 30000;
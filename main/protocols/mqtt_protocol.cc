@@ -2,6 +2,7 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "connection_cache.h"
 
 #include <esp_log.h>
 #include <cstring>
@@ -98,24 +99,24 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
-        if (root == nullptr) {
+        auto root = JsonReader::Parse(payload);
+        if (!root.IsObject()) {
             ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
             return;
         }
-        cJSON* type = cJSON_GetObjectItem(root, "type");
-        if (!cJSON_IsString(type)) {
+        auto type = root["type"];
+        if (!type.IsString()) {
             ESP_LOGE(TAG, "Message type is invalid");
-            cJSON_Delete(root);
             return;
         }
 
-        if (strcmp(type->valuestring, "hello") == 0) {
+        if (type.Equals("hello")) {
             ParseServerHello(root);
-        } else if (strcmp(type->valuestring, "goodbye") == 0) {
-            auto session_id = cJSON_GetObjectItem(root, "session_id");
-            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
-            if (session_id == nullptr || session_id_ == session_id->valuestring) {
+        } else if (type.Equals("goodbye")) {
+            auto session_id = root["session_id"];
+            auto session_id_str = session_id.ToString();
+            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id.IsString() ? session_id_str.c_str() : "null");
+            if (!session_id.IsString() || session_id_ == session_id_str) {
                 auto alive = alive_;  // Capture alive flag
                 Application::GetInstance().Schedule([this, alive]() {
                     if (*alive) {
@@ -126,7 +127,6 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
         } else if (on_incoming_json_ != nullptr) {
             on_incoming_json_(root);
         }
-        cJSON_Delete(root);
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -140,11 +140,13 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     } else {
         broker_address = endpoint;
     }
+    auto connect_timer = ConnectionCache::GetInstance().TimeConnect(broker_address);
     if (!mqtt_->Connect(broker_address, broker_port, client_id, username, password)) {
         ESP_LOGE(TAG, "Failed to connect to endpoint, code=%d", mqtt_->GetLastError());
         SetError(Lang::Strings::SERVER_NOT_CONNECTED);
         return false;
     }
+    connect_timer.Finish(true);
 
     ESP_LOGI(TAG, "Connected to endpoint");
     return true;
@@ -168,24 +170,71 @@ bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         return false;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
+    std::string nonce;
+    std::string encrypted;
+    return SendEncryptedAudio(*packet, nonce, encrypted);
+}
 
+size_t MqttProtocol::SendAudioBatch(std::vector<std::unique_ptr<AudioStreamPacket>>& packets) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (udp_ == nullptr) {
+        return 0;
+    }
+
+    // Lock once and reuse the nonce / datagram buffers for the whole batch
+    std::string nonce;
     std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
+    size_t sent = 0;
+    for (auto& packet : packets) {
+        if (!SendEncryptedAudio(*packet, nonce, encrypted)) {
+            break;
+        }
+        sent++;
+    }
+    return sent;
+}
+
+// Caller must hold channel_mutex_
+bool MqttProtocol::SendEncryptedAudio(const AudioStreamPacket& packet, std::string& nonce, std::string& buffer) {
+    /*
+     * With MQTT_AUDIO_FLAG_REDUNDANCY the payload starts with the previous frame at low bitrate:
+     * |redundancy_len 2u|redundancy redundancy_len|opus frame|
+     */
+    bool redundancy = server_accepts_redundancy_ && !packet.redundancy.empty();
+    size_t payload_size = packet.payload.size();
+    if (redundancy) {
+        payload_size += 2 + packet.redundancy.size();
+    }
+
+    nonce.assign(aes_nonce_);
+    if (redundancy) {
+        nonce[1] |= MQTT_AUDIO_FLAG_REDUNDANCY;
+    }
+    *(uint16_t*)&nonce[2] = htons(payload_size);
+    *(uint32_t*)&nonce[8] = htonl(packet.timestamp);
+    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
 
+    buffer.resize(aes_nonce_.size() + payload_size);
+    memcpy(buffer.data(), nonce.data(), nonce.size());
+    auto payload = (uint8_t*)&buffer[nonce.size()];
+    if (redundancy) {
+        *(uint16_t*)payload = htons(packet.redundancy.size());
+        memcpy(payload + 2, packet.redundancy.data(), packet.redundancy.size());
+        memcpy(payload + 2 + packet.redundancy.size(), packet.payload.data(), packet.payload.size());
+    } else {
+        memcpy(payload, packet.payload.data(), packet.payload.size());
+    }
+
+    // CTR mode can encrypt in place
     size_t nc_off = 0;
     uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, payload_size, &nc_off, (uint8_t*)nonce.data(), stream_block,
+        payload, payload) != 0) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return false;
     }
 
-    return udp_->Send(encrypted) > 0;
+    return udp_->Send(buffer) > 0;
 }
 
 void MqttProtocol::CloseAudioChannel() {
@@ -194,11 +243,12 @@ void MqttProtocol::CloseAudioChannel() {
         udp_.reset();
     }
 
-    std::string message = "{";
-    message += "\"session_id\":\"" + session_id_ + "\",";
-    message += "\"type\":\"goodbye\"";
-    message += "}";
-    SendText(message);
+    {
+        std::lock_guard<std::mutex> lock(json_mutex_);
+        JsonWriter writer(json_buffer_);
+        writer.BeginObject().Member("session_id", session_id_).Member("type", "goodbye").EndObject();
+        SendText(json_buffer_);
+    }
 
     if (on_audio_channel_closed_ != nullptr) {
         on_audio_channel_closed_();
@@ -279,7 +329,8 @@ bool MqttProtocol::OpenAudioChannel() {
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
-    udp_->Connect(udp_server_, udp_port_);
+    // UDP carries no TLS, so the cached address can be used directly
+    udp_->Connect(ConnectionCache::GetInstance().Resolve(udp_server_), udp_port_);
 
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
@@ -289,64 +340,67 @@ bool MqttProtocol::OpenAudioChannel() {
 
 std::string MqttProtocol::GetHelloMessage() {
     // 发送 hello 消息申请 UDP 通道
-    cJSON* root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "type", "hello");
-    cJSON_AddNumberToObject(root, "version", 3);
-    cJSON_AddStringToObject(root, "transport", "udp");
-    cJSON* features = cJSON_CreateObject();
+    std::string message;
+    JsonWriter writer(message);
+    writer.BeginObject().Member("type", "hello").Member("version", 3).Member("transport", "udp");
+    writer.Key("features").BeginObject();
 #if CONFIG_USE_SERVER_AEC
-    cJSON_AddBoolToObject(features, "aec", true);
+    writer.Member("aec", true);
 #endif
-    cJSON_AddBoolToObject(features, "mcp", true);
-    cJSON_AddItemToObject(root, "features", features);
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
-    auto json_str = cJSON_PrintUnformatted(root);
-    std::string message(json_str);
-    cJSON_free(json_str);
-    cJSON_Delete(root);
+#if CONFIG_USE_UPLINK_LOSS_RESILIENCE
+    writer.Member("fec", true);
+    writer.Member("red", true);
+#endif
+    writer.Member("mcp", true);
+    writer.EndObject();
+    writer.Key("audio_params").BeginObject()
+        .Member("format", "opus")
+        .Member("sample_rate", 16000)
+        .Member("channels", 1)
+        .Member("frame_duration", OPUS_FRAME_DURATION_MS)
+        .EndObject();
+    writer.EndObject();
     return message;
 }
 
-void MqttProtocol::ParseServerHello(const cJSON* root) {
-    auto transport = cJSON_GetObjectItem(root, "transport");
-    if (transport == nullptr || strcmp(transport->valuestring, "udp") != 0) {
-        ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
+void MqttProtocol::ParseServerHello(const JsonValue& root) {
+    auto transport = root["transport"];
+    if (!transport.Equals("udp")) {
+        ESP_LOGE(TAG, "Unsupported transport: %s", transport.ToString().c_str());
         return;
     }
 
-    auto session_id = cJSON_GetObjectItem(root, "session_id");
-    if (cJSON_IsString(session_id)) {
-        session_id_ = session_id->valuestring;
+    auto session_id = root["session_id"];
+    if (session_id.IsString()) {
+        session_id_ = session_id.ToString();
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
     // Get sample rate from hello message
-    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
-    if (cJSON_IsObject(audio_params)) {
-        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
-        if (cJSON_IsNumber(sample_rate)) {
-            server_sample_rate_ = sample_rate->valueint;
+    auto audio_params = root["audio_params"];
+    if (audio_params.IsObject()) {
+        auto sample_rate = audio_params["sample_rate"];
+        if (sample_rate.IsNumber()) {
+            server_sample_rate_ = sample_rate.ToInt();
         }
-        auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
-        if (cJSON_IsNumber(frame_duration)) {
-            server_frame_duration_ = frame_duration->valueint;
+        auto frame_duration = audio_params["frame_duration"];
+        if (frame_duration.IsNumber()) {
+            server_frame_duration_ = frame_duration.ToInt();
         }
     }
 
-    auto udp = cJSON_GetObjectItem(root, "udp");
-    if (!cJSON_IsObject(udp)) {
+    // Redundant frames change the UDP payload layout, only send them if the server understands it
+    server_accepts_redundancy_ = root["features"]["red"].ToBool();
+
+    auto udp = root["udp"];
+    if (!udp.IsObject()) {
         ESP_LOGE(TAG, "UDP is not specified");
         return;
     }
-    udp_server_ = cJSON_GetObjectItem(udp, "server")->valuestring;
-    udp_port_ = cJSON_GetObjectItem(udp, "port")->valueint;
-    auto key = cJSON_GetObjectItem(udp, "key")->valuestring;
-    auto nonce = cJSON_GetObjectItem(udp, "nonce")->valuestring;
+    udp_server_ = udp["server"].ToString();
+    udp_port_ = udp["port"].ToInt();
+    auto key = udp["key"].ToString();
+    auto nonce = udp["nonce"].ToString();
 
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
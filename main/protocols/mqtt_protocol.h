@@ -23,6 +23,9 @@
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+// Flags byte of the UDP audio packet header
+#define MQTT_AUDIO_FLAG_REDUNDANCY 0x01
+
 class MqttProtocol : public Protocol {
 public:
     MqttProtocol();
@@ -30,6 +33,7 @@ public:
 
     bool Start() override;
     bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    size_t SendAudioBatch(std::vector<std::unique_ptr<AudioStreamPacket>>& packets) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -54,8 +58,9 @@ private:
     esp_timer_handle_t reconnect_timer_;
 
     bool StartMqttClient(bool report_error=false);
-    void ParseServerHello(const cJSON* root);
+    void ParseServerHello(const JsonValue& root);
     std::string DecodeHexString(const std::string& hex_string);
+    bool SendEncryptedAudio(const AudioStreamPacket& packet, std::string& nonce, std::string& buffer);
 
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
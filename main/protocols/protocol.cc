@@ -4,7 +4,7 @@
 
 #define TAG "Protocol"
 
-void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
+void Protocol::OnIncomingJson(std::function<void(const JsonValue& root)> callback) {
     on_incoming_json_ = callback;
 }
 
@@ -39,43 +39,84 @@ void Protocol::SetError(const std::string& message) {
     }
 }
 
+size_t Protocol::SendAudioBatch(std::vector<std::unique_ptr<AudioStreamPacket>>& packets) {
+    size_t sent = 0;
+    for (auto& packet : packets) {
+        if (!SendAudio(std::move(packet))) {
+            break;
+        }
+        sent++;
+    }
+    return sent;
+}
+
 void Protocol::SendAbortSpeaking(AbortReason reason) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
+    std::lock_guard<std::mutex> lock(json_mutex_);
+    JsonWriter writer(json_buffer_);
+    writer.BeginObject().Member("session_id", session_id_).Member("type", "abort");
     if (reason == kAbortReasonWakeWordDetected) {
-        message += ",\"reason\":\"wake_word_detected\"";
+        writer.Member("reason", "wake_word_detected");
     }
-    message += "}";
-    SendText(message);
+    writer.EndObject();
+    SendText(json_buffer_);
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
-    std::string json = "{\"session_id\":\"" + session_id_ + 
-                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
+    std::lock_guard<std::mutex> lock(json_mutex_);
+    JsonWriter writer(json_buffer_);
+    writer.BeginObject()
+        .Member("session_id", session_id_)
+        .Member("type", "listen")
+        .Member("state", "detect")
+        .Member("text", wake_word)
+        .EndObject();
+    SendText(json_buffer_);
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\"";
-    message += ",\"type\":\"listen\",\"state\":\"start\"";
+    std::lock_guard<std::mutex> lock(json_mutex_);
+    JsonWriter writer(json_buffer_);
+    writer.BeginObject().Member("session_id", session_id_).Member("type", "listen").Member("state", "start");
     if (mode == kListeningModeRealtime) {
-        message += ",\"mode\":\"realtime\"";
+        writer.Member("mode", "realtime");
     } else if (mode == kListeningModeAutoStop) {
-        message += ",\"mode\":\"auto\"";
+        writer.Member("mode", "auto");
     } else {
-        message += ",\"mode\":\"manual\"";
+        writer.Member("mode", "manual");
     }
-    message += "}";
-    SendText(message);
+    writer.EndObject();
+    SendText(json_buffer_);
 }
 
 void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
-    SendText(message);
+    std::lock_guard<std::mutex> lock(json_mutex_);
+    JsonWriter writer(json_buffer_);
+    writer.BeginObject().Member("session_id", session_id_).Member("type", "listen").Member("state", "stop").EndObject();
+    SendText(json_buffer_);
 }
 
 void Protocol::SendMcpMessage(const std::string& payload) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":" + payload + "}";
-    SendText(message);
+    // payload is an already serialized JSON-RPC message
+    std::lock_guard<std::mutex> lock(json_mutex_);
+    JsonWriter writer(json_buffer_);
+    writer.BeginObject().Member("session_id", session_id_).Member("type", "mcp").Key("payload").Raw(payload).EndObject();
+    SendText(json_buffer_);
+}
+
+bool Protocol::SendMcpMessageStream(const std::function<bool(std::string& piece)>& next) {
+    // Assembled into one message for transports that cannot fragment it, the payload is copied once
+    std::lock_guard<std::mutex> lock(json_mutex_);
+    JsonWriter writer(json_buffer_);
+    writer.BeginObject().Member("session_id", session_id_).Member("type", "mcp").Key("payload");
+    std::string piece;
+    while (next(piece)) {
+        json_buffer_ += piece;
+    }
+    writer.EndObject();
+    bool sent = SendText(json_buffer_);
+    // Streamed messages are large, do not keep their buffer around for the small ones
+    std::string().swap(json_buffer_);
+    return sent;
 }
 
 bool Protocol::IsTimeout() const {
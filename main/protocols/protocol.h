@@ -2,8 +2,12 @@
 #define PROTOCOL_H
 
 #include <cJSON.h>
+#include "json_reader.h"
+#include "json_writer.h"
 #include <string>
+#include <mutex>
 #include <functional>
+#include <memory>
 #include <chrono>
 #include <vector>
 
@@ -11,7 +15,9 @@ struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
+    int64_t enqueue_time = 0;       // Local esp_timer time when queued for sending, not sent to the server
     std::vector<uint8_t> payload;
+    std::vector<uint8_t> redundancy; // Low bitrate copy of the previous frame, empty unless redundancy is on
 };
 
 struct BinaryProtocol2 {
@@ -54,9 +60,15 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    /**
+     * Whether the server hello accepted redundant audio frames (feature "red")
+     */
+    inline bool server_accepts_redundancy() const {
+        return server_accepts_redundancy_;
+    }
 
     void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
-    void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    void OnIncomingJson(std::function<void(const JsonValue& root)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
@@ -68,14 +80,23 @@ public:
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
     virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
+    /**
+     * Send packets in order, stopping at the first failure
+     * Returns the number of packets sent
+     */
+    virtual size_t SendAudioBatch(std::vector<std::unique_ptr<AudioStreamPacket>>& packets);
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
     virtual void SendMcpMessage(const std::string& message);
+    /**
+     * Send an MCP message produced in pieces, next() fills piece and returns false once the message is complete
+     */
+    virtual bool SendMcpMessageStream(const std::function<bool(std::string& piece)>& next);
 
 protected:
-    std::function<void(const cJSON* root)> on_incoming_json_;
+    std::function<void(const JsonValue& root)> on_incoming_json_;
     std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
@@ -86,8 +107,12 @@ protected:
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
     bool error_occurred_ = false;
+    bool server_accepts_redundancy_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    // Reused by the Send* helpers so control messages do not allocate once it has grown
+    std::string json_buffer_;
+    std::mutex json_mutex_;
 
     virtual bool SendText(const std::string& text) = 0;
     virtual void SetError(const std::string& message);
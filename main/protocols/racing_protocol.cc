@@ -0,0 +1,296 @@
+#include "racing_protocol.h"
+#include "settings.h"
+#include "assets/lang_config.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
+#include <cstdio>
+
+#define TAG "Racing"
+
+#define RACING_PROTOCOL_ALL_DONE (RACING_PROTOCOL_DONE_EVENT(0) | RACING_PROTOCOL_DONE_EVENT(1))
+#define RACING_PROTOCOL_ALL_FAILED (RACING_PROTOCOL_FAILED_EVENT(0) | RACING_PROTOCOL_FAILED_EVENT(1))
+
+// NVS keys are limited to 15 characters, so the network name is stored as a FNV-1a hash
+static std::string GetNetworkKey(const std::string& network_name) {
+    uint32_t hash = 2166136261u;
+    for (char c : network_name) {
+        hash = (hash ^ (uint8_t)c) * 16777619u;
+    }
+    char key[16];
+    snprintf(key, sizeof(key), "n%08lx", (unsigned long)hash);
+    return key;
+}
+
+RacingProtocol::RacingProtocol(std::unique_ptr<Protocol> first, const char* first_name,
+                               std::unique_ptr<Protocol> second, const char* second_name,
+                               const std::string& network_name) {
+    event_group_handle_ = xEventGroupCreate();
+    // No race has run yet, so nothing is pending
+    xEventGroupSetBits(event_group_handle_, RACING_PROTOCOL_ALL_DONE);
+
+    contenders_[0] = Contender{std::move(first), first_name, this, 0, 0};
+    contenders_[1] = Contender{std::move(second), second_name, this, 1, 0};
+    InstallCallbacks(0);
+    InstallCallbacks(1);
+
+    settings_key_ = GetNetworkKey(network_name);
+    Settings settings("transport", false);
+    auto winner = settings.GetString(settings_key_);
+    if (winner == contenders_[1].name) {
+        preferred_ = 1;
+    }
+    ESP_LOGI(TAG, "Network %s prefers %s", network_name.c_str(), contenders_[preferred_].name);
+}
+
+RacingProtocol::~RacingProtocol() {
+    // Attempt tasks reference the contenders, let them finish first
+    WaitForPreviousRace();
+    vEventGroupDelete(event_group_handle_);
+}
+
+Protocol* RacingProtocol::active() const {
+    int index = active_.load();
+    return index >= 0 ? contenders_[index].protocol.get() : nullptr;
+}
+
+// The session belongs to the winner, outside a session the first transport's control link does
+bool RacingProtocol::CarriesControl(int index) const {
+    int winner = active_.load();
+    if (winner == index) {
+        return true;
+    }
+    return index == 0 && (winner < 0 || !contenders_[winner].protocol->IsAudioChannelOpened());
+}
+
+Protocol* RacingProtocol::control() const {
+    auto protocol = active();
+    if (protocol != nullptr && protocol->IsAudioChannelOpened()) {
+        return protocol;
+    }
+    return contenders_[0].protocol.get();
+}
+
+void RacingProtocol::InstallCallbacks(int index) {
+    auto protocol = contenders_[index].protocol.get();
+
+    // Server pushes outside a session (custom messages, MCP requests, system commands) still get through
+    protocol->OnIncomingJson([this, index](const JsonValue& root) {
+        if (CarriesControl(index) && on_incoming_json_ != nullptr) {
+            on_incoming_json_(root);
+        }
+    });
+    protocol->OnIncomingAudio([this, index](std::unique_ptr<AudioStreamPacket> packet) {
+        if (active_ == index && on_incoming_audio_ != nullptr) {
+            last_incoming_time_ = std::chrono::steady_clock::now();
+            on_incoming_audio_(std::move(packet));
+        }
+    });
+    protocol->OnAudioChannelClosed([this, index]() {
+        if (active_ == index && on_audio_channel_closed_ != nullptr) {
+            on_audio_channel_closed_();
+        }
+    });
+    protocol->OnNetworkError([this, index](const std::string& message) {
+        if (active_ == index) {
+            SetError(message);
+        } else {
+            std::lock_guard<std::mutex> lock(race_mutex_);
+            race_error_ = message;
+        }
+    });
+    protocol->OnConnected([this]() {
+        if (on_connected_ != nullptr) {
+            on_connected_();
+        }
+    });
+    protocol->OnDisconnected([this]() {
+        if (on_disconnected_ != nullptr) {
+            on_disconnected_();
+        }
+    });
+    // on_audio_channel_opened_ is raised by OpenAudioChannel() once the race is decided
+}
+
+bool RacingProtocol::Start() {
+    bool started = false;
+    for (auto& contender : contenders_) {
+        if (contender.protocol->Start()) {
+            started = true;
+        } else {
+            ESP_LOGW(TAG, "Failed to start %s", contender.name);
+        }
+    }
+    return started;
+}
+
+bool RacingProtocol::WaitForPreviousRace() {
+    auto bits = xEventGroupWaitBits(event_group_handle_, RACING_PROTOCOL_ALL_DONE, pdFALSE, pdTRUE,
+        pdMS_TO_TICKS(RACING_PROTOCOL_ATTEMPT_TIMEOUT_MS));
+    return (bits & RACING_PROTOCOL_ALL_DONE) == RACING_PROTOCOL_ALL_DONE;
+}
+
+void RacingProtocol::SetFailed(int index) {
+    // Let the other transport start right away; the last one to fail ends the race
+    auto bits = xEventGroupSetBits(event_group_handle_, RACING_PROTOCOL_FAILED_EVENT(index) | RACING_PROTOCOL_START_NOW_EVENT);
+    if ((bits & RACING_PROTOCOL_ALL_FAILED) == RACING_PROTOCOL_ALL_FAILED) {
+        xEventGroupSetBits(event_group_handle_, RACING_PROTOCOL_LOST_EVENT);
+    }
+}
+
+void RacingProtocol::RunAttempt(int index, int delay_ms) {
+    auto& contender = contenders_[index];
+    bool skipped = false;
+    if (delay_ms > 0) {
+        // Wait for the stagger delay unless the other transport already won or failed
+        auto bits = xEventGroupWaitBits(event_group_handle_, RACING_PROTOCOL_WON_EVENT | RACING_PROTOCOL_START_NOW_EVENT,
+            pdFALSE, pdFALSE, pdMS_TO_TICKS(delay_ms));
+        skipped = bits & RACING_PROTOCOL_WON_EVENT;
+    }
+
+    if (!skipped) {
+        auto start_time = esp_timer_get_time();
+        ESP_LOGI(TAG, "Opening %s", contender.name);
+        bool opened = contender.protocol->OpenAudioChannel();
+        int elapsed_ms = int((esp_timer_get_time() - start_time) / 1000);
+
+        int expected = -1;
+        if (opened && active_.compare_exchange_strong(expected, index)) {
+            ESP_LOGI(TAG, "%s won in %d ms", contender.name, elapsed_ms);
+            xEventGroupSetBits(event_group_handle_, RACING_PROTOCOL_WON_EVENT);
+        } else if (opened) {
+            ESP_LOGI(TAG, "%s lost (%d ms), closing", contender.name, elapsed_ms);
+            contender.protocol->CloseAudioChannel();
+        } else {
+            ESP_LOGW(TAG, "%s failed in %d ms", contender.name, elapsed_ms);
+            SetFailed(index);
+        }
+    }
+    xEventGroupSetBits(event_group_handle_, RACING_PROTOCOL_DONE_EVENT(index));
+}
+
+bool RacingProtocol::OpenAudioChannel() {
+    if (!WaitForPreviousRace()) {
+        ESP_LOGE(TAG, "Previous race is still running");
+        return false;
+    }
+
+    error_occurred_ = false;
+    active_ = -1;
+    {
+        std::lock_guard<std::mutex> lock(race_mutex_);
+        race_error_.clear();
+    }
+    xEventGroupClearBits(event_group_handle_, RACING_PROTOCOL_WON_EVENT | RACING_PROTOCOL_START_NOW_EVENT |
+        RACING_PROTOCOL_LOST_EVENT | RACING_PROTOCOL_ALL_FAILED | RACING_PROTOCOL_ALL_DONE);
+
+    for (int i = 0; i < 2; i++) {
+        auto& contender = contenders_[i];
+        contender.delay_ms = (i == preferred_) ? 0 : RACING_PROTOCOL_STAGGER_MS;
+        auto ret = xTaskCreate([](void* arg) {
+            auto contender = static_cast<Contender*>(arg);
+            contender->owner->RunAttempt(contender->index, contender->delay_ms);
+            vTaskDelete(NULL);
+        }, contender.name, 4096 * 2, &contender, 3, nullptr);
+        if (ret != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create attempt task for %s", contender.name);
+            SetFailed(i);
+            xEventGroupSetBits(event_group_handle_, RACING_PROTOCOL_DONE_EVENT(i));
+        }
+    }
+
+    // Wait until one transport wins or both have failed
+    auto bits = xEventGroupWaitBits(event_group_handle_, RACING_PROTOCOL_WON_EVENT | RACING_PROTOCOL_LOST_EVENT,
+        pdFALSE, pdFALSE, pdMS_TO_TICKS(RACING_PROTOCOL_ATTEMPT_TIMEOUT_MS));
+    if (!(bits & RACING_PROTOCOL_WON_EVENT)) {
+        std::string message;
+        {
+            std::lock_guard<std::mutex> lock(race_mutex_);
+            message = race_error_;
+        }
+        ESP_LOGE(TAG, "No transport could be opened");
+        SetError(message.empty() ? Lang::Strings::SERVER_TIMEOUT : message);
+        return false;
+    }
+
+    int winner = active_.load();
+    auto protocol = contenders_[winner].protocol.get();
+    server_sample_rate_ = protocol->server_sample_rate();
+    server_frame_duration_ = protocol->server_frame_duration();
+    server_accepts_redundancy_ = protocol->server_accepts_redundancy();
+    session_id_ = protocol->session_id();
+    last_incoming_time_ = std::chrono::steady_clock::now();
+
+    if (winner != preferred_) {
+        preferred_ = winner;
+        Settings settings("transport", true);
+        settings.SetString(settings_key_, contenders_[winner].name);
+        ESP_LOGI(TAG, "Remember %s for this network", contenders_[winner].name);
+    }
+
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+    return true;
+}
+
+void RacingProtocol::CloseAudioChannel() {
+    auto protocol = active();
+    if (protocol != nullptr) {
+        protocol->CloseAudioChannel();
+    }
+}
+
+bool RacingProtocol::IsAudioChannelOpened() const {
+    auto protocol = active();
+    return protocol != nullptr && !error_occurred_ && protocol->IsAudioChannelOpened();
+}
+
+bool RacingProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    auto protocol = active();
+    return protocol != nullptr && protocol->SendAudio(std::move(packet));
+}
+
+size_t RacingProtocol::SendAudioBatch(std::vector<std::unique_ptr<AudioStreamPacket>>& packets) {
+    auto protocol = active();
+    return protocol != nullptr ? protocol->SendAudioBatch(packets) : 0;
+}
+
+void RacingProtocol::SendWakeWordDetected(const std::string& wake_word) {
+    if (auto protocol = active()) {
+        protocol->SendWakeWordDetected(wake_word);
+    }
+}
+
+void RacingProtocol::SendStartListening(ListeningMode mode) {
+    if (auto protocol = active()) {
+        protocol->SendStartListening(mode);
+    }
+}
+
+void RacingProtocol::SendStopListening() {
+    if (auto protocol = active()) {
+        protocol->SendStopListening();
+    }
+}
+
+void RacingProtocol::SendAbortSpeaking(AbortReason reason) {
+    if (auto protocol = active()) {
+        protocol->SendAbortSpeaking(reason);
+    }
+}
+
+void RacingProtocol::SendMcpMessage(const std::string& message) {
+    control()->SendMcpMessage(message);
+}
+
+bool RacingProtocol::SendMcpMessageStream(const std::function<bool(std::string& piece)>& next) {
+    return control()->SendMcpMessageStream(next);
+}
+
+bool RacingProtocol::SendText(const std::string& text) {
+    // All text messages are forwarded through the public Send* methods of the winner
+    (void)text;
+    return false;
+}
@@ -0,0 +1,84 @@
+#ifndef _RACING_PROTOCOL_H_
+#define _RACING_PROTOCOL_H_
+
+#include "protocol.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#define RACING_PROTOCOL_STAGGER_MS 1500
+#define RACING_PROTOCOL_ATTEMPT_TIMEOUT_MS 30000
+
+#define RACING_PROTOCOL_WON_EVENT           (1 << 0)
+#define RACING_PROTOCOL_START_NOW_EVENT     (1 << 1)
+#define RACING_PROTOCOL_FAILED_EVENT(i)     (1 << (2 + (i)))
+#define RACING_PROTOCOL_DONE_EVENT(i)       (1 << (4 + (i)))
+#define RACING_PROTOCOL_LOST_EVENT          (1 << 6)
+
+/**
+ * RacingProtocol - Happy-eyeballs style connector over two transports
+ *
+ * Each OpenAudioChannel() starts the preferred transport immediately and the other one
+ * after RACING_PROTOCOL_STAGGER_MS (or as soon as the preferred one fails). The first
+ * transport whose server hello arrives wins the session; the other one is closed when its
+ * attempt completes. The winner is remembered per network (SSID or cellular) in NVS and
+ * becomes the preferred transport for the next session on that network.
+ *
+ * The first transport is expected to be MQTT, which stays connected between sessions. While no
+ * audio channel is open it carries incoming JSON and outgoing MCP messages, whoever won last.
+ */
+class RacingProtocol : public Protocol {
+public:
+    RacingProtocol(std::unique_ptr<Protocol> first, const char* first_name,
+                   std::unique_ptr<Protocol> second, const char* second_name,
+                   const std::string& network_name);
+    ~RacingProtocol();
+
+    bool Start() override;
+    bool OpenAudioChannel() override;
+    void CloseAudioChannel() override;
+    bool IsAudioChannelOpened() const override;
+    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    size_t SendAudioBatch(std::vector<std::unique_ptr<AudioStreamPacket>>& packets) override;
+    void SendWakeWordDetected(const std::string& wake_word) override;
+    void SendStartListening(ListeningMode mode) override;
+    void SendStopListening() override;
+    void SendAbortSpeaking(AbortReason reason) override;
+    void SendMcpMessage(const std::string& message) override;
+    bool SendMcpMessageStream(const std::function<bool(std::string& piece)>& next) override;
+
+private:
+    struct Contender {
+        std::unique_ptr<Protocol> protocol;
+        const char* name;
+        RacingProtocol* owner;
+        int index;
+        int delay_ms;
+    };
+
+    std::array<Contender, 2> contenders_;
+    std::atomic<int> active_{-1};
+    int preferred_ = 0;
+    std::string settings_key_;
+    std::mutex race_mutex_;
+    std::string race_error_;
+    EventGroupHandle_t event_group_handle_;
+
+    Protocol* active() const;
+    Protocol* control() const;
+    bool CarriesControl(int index) const;
+    void InstallCallbacks(int index);
+    void RunAttempt(int index, int delay_ms);
+    void SetFailed(int index);
+    bool WaitForPreviousRace();
+
+    bool SendText(const std::string& text) override;
+};
+
+#endif // _RACING_PROTOCOL_H_
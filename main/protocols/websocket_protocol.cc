@@ -3,6 +3,7 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "connection_cache.h"
 
 #include <cstring>
 #include <cJSON.h>
@@ -26,38 +27,61 @@ bool WebsocketProtocol::Start() {
 }
 
 bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    std::lock_guard<std::mutex> lock(send_mutex_);
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
 
+    std::string serialized;
+    return SendAudioFrame(*packet, serialized);
+}
+
+size_t WebsocketProtocol::SendAudioBatch(std::vector<std::unique_ptr<AudioStreamPacket>>& packets) {
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+        return 0;
+    }
+
+    // Reuse one frame buffer for the whole batch instead of allocating per packet
+    std::string serialized;
+    size_t sent = 0;
+    for (auto& packet : packets) {
+        if (!SendAudioFrame(*packet, serialized)) {
+            break;
+        }
+        sent++;
+    }
+    return sent;
+}
+
+bool WebsocketProtocol::SendAudioFrame(const AudioStreamPacket& packet, std::string& buffer) {
     if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
+        buffer.resize(sizeof(BinaryProtocol2) + packet.payload.size());
+        auto bp2 = (BinaryProtocol2*)buffer.data();
         bp2->version = htons(version_);
         bp2->type = 0;
         bp2->reserved = 0;
-        bp2->timestamp = htonl(packet->timestamp);
-        bp2->payload_size = htonl(packet->payload.size());
-        memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
+        bp2->timestamp = htonl(packet.timestamp);
+        bp2->payload_size = htonl(packet.payload.size());
+        memcpy(bp2->payload, packet.payload.data(), packet.payload.size());
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        return websocket_->Send(buffer.data(), buffer.size(), true);
     } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
+        buffer.resize(sizeof(BinaryProtocol3) + packet.payload.size());
+        auto bp3 = (BinaryProtocol3*)buffer.data();
         bp3->type = 0;
         bp3->reserved = 0;
-        bp3->payload_size = htons(packet->payload.size());
-        memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
+        bp3->payload_size = htons(packet.payload.size());
+        memcpy(bp3->payload, packet.payload.data(), packet.payload.size());
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        return websocket_->Send(buffer.data(), buffer.size(), true);
     } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+        return websocket_->Send(packet.payload.data(), packet.payload.size(), true);
     }
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
+    std::lock_guard<std::mutex> lock(send_mutex_);
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
@@ -71,12 +95,45 @@ bool WebsocketProtocol::SendText(const std::string& text) {
     return true;
 }
 
+bool WebsocketProtocol::SendMcpMessageStream(const std::function<bool(std::string& piece)>& next) {
+    std::string piece;
+    JsonWriter writer(piece);
+    writer.BeginObject().Member("session_id", session_id_).Member("type", "mcp").Key("payload");
+
+    // One text message in fragments, audio frames wait until the final fragment has been sent
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+        return false;
+    }
+
+    bool more = true;
+    while (more) {
+        if (!piece.empty() && !websocket_->Send(piece.data(), piece.size(), false, false)) {
+            ESP_LOGE(TAG, "Failed to send MCP message fragment");
+            SetError(Lang::Strings::SERVER_ERROR);
+            return false;
+        }
+        more = next(piece);
+    }
+    if (!websocket_->Send("}", 1, false, true)) {
+        ESP_LOGE(TAG, "Failed to send MCP message fragment");
+        SetError(Lang::Strings::SERVER_ERROR);
+        return false;
+    }
+    return true;
+}
+
 bool WebsocketProtocol::IsAudioChannelOpened() const {
     return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
-    websocket_.reset();
+    std::unique_ptr<WebSocket> websocket;
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        websocket = std::move(websocket_);
+    }
+    websocket.reset();
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
@@ -91,7 +148,11 @@ bool WebsocketProtocol::OpenAudioChannel() {
     error_occurred_ = false;
 
     auto network = Board::GetInstance().GetNetwork();
-    websocket_ = network->CreateWebSocket(1);
+    CloseAudioChannel();
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        websocket_ = network->CreateWebSocket(1);
+    }
     if (websocket_ == nullptr) {
         ESP_LOGE(TAG, "Failed to create websocket");
         return false;
@@ -122,7 +183,8 @@ bool WebsocketProtocol::OpenAudioChannel() {
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
                         .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
+                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size),
+                        .redundancy = {}
                     }));
                 } else if (version_ == 3) {
                     BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
@@ -133,23 +195,25 @@ bool WebsocketProtocol::OpenAudioChannel() {
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
                         .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
+                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size),
+                        .redundancy = {}
                     }));
                 } else {
                     on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
                         .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
+                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len),
+                        .redundancy = {}
                     }));
                 }
             }
         } else {
             // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (cJSON_IsString(type)) {
-                if (strcmp(type->valuestring, "hello") == 0) {
+            auto root = JsonReader::Parse(std::string_view(data, len));
+            auto type = root["type"];
+            if (type.IsString()) {
+                if (type.Equals("hello")) {
                     ParseServerHello(root);
                 } else {
                     if (on_incoming_json_ != nullptr) {
@@ -157,9 +221,8 @@ bool WebsocketProtocol::OpenAudioChannel() {
                     }
                 }
             } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
+                ESP_LOGE(TAG, "Missing message type, data: %.*s", (int)len, data);
             }
-            cJSON_Delete(root);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
@@ -172,11 +235,13 @@ bool WebsocketProtocol::OpenAudioChannel() {
     });
 
     ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
+    auto connect_timer = ConnectionCache::GetInstance().TimeConnect(url);
     if (!websocket_->Connect(url.c_str())) {
         ESP_LOGE(TAG, "Failed to connect to websocket server, code=%d", websocket_->GetLastError());
         SetError(Lang::Strings::SERVER_NOT_CONNECTED);
         return false;
     }
+    connect_timer.Finish(true);
 
     // Send hello message to describe the client
     auto message = GetHelloMessage();
@@ -201,51 +266,52 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
 std::string WebsocketProtocol::GetHelloMessage() {
     // keys: message type, version, audio_params (format, sample_rate, channels)
-    cJSON* root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "type", "hello");
-    cJSON_AddNumberToObject(root, "version", version_);
-    cJSON* features = cJSON_CreateObject();
+    std::string message;
+    JsonWriter writer(message);
+    writer.BeginObject().Member("type", "hello").Member("version", version_);
+    writer.Key("features").BeginObject();
 #if CONFIG_USE_SERVER_AEC
-    cJSON_AddBoolToObject(features, "aec", true);
+    writer.Member("aec", true);
+#endif
+#if CONFIG_USE_UPLINK_LOSS_RESILIENCE
+    // TCP does not lose frames, redundant copies are only offered on the UDP channel
+    writer.Member("fec", true);
 #endif
-    cJSON_AddBoolToObject(features, "mcp", true);
-    cJSON_AddItemToObject(root, "features", features);
-    cJSON_AddStringToObject(root, "transport", "websocket");
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
-    auto json_str = cJSON_PrintUnformatted(root);
-    std::string message(json_str);
-    cJSON_free(json_str);
-    cJSON_Delete(root);
+    writer.Member("mcp", true);
+    writer.EndObject();
+    writer.Member("transport", "websocket");
+    writer.Key("audio_params").BeginObject()
+        .Member("format", "opus")
+        .Member("sample_rate", 16000)
+        .Member("channels", 1)
+        .Member("frame_duration", OPUS_FRAME_DURATION_MS)
+        .EndObject();
+    writer.EndObject();
     return message;
 }
 
-void WebsocketProtocol::ParseServerHello(const cJSON* root) {
-    auto transport = cJSON_GetObjectItem(root, "transport");
-    if (transport == nullptr || strcmp(transport->valuestring, "websocket") != 0) {
-        ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
+void WebsocketProtocol::ParseServerHello(const JsonValue& root) {
+    auto transport = root["transport"];
+    if (!transport.Equals("websocket")) {
+        ESP_LOGE(TAG, "Unsupported transport: %s", transport.ToString().c_str());
         return;
     }
 
-    auto session_id = cJSON_GetObjectItem(root, "session_id");
-    if (cJSON_IsString(session_id)) {
-        session_id_ = session_id->valuestring;
+    auto session_id = root["session_id"];
+    if (session_id.IsString()) {
+        session_id_ = session_id.ToString();
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
-    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
-    if (cJSON_IsObject(audio_params)) {
-        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
-        if (cJSON_IsNumber(sample_rate)) {
-            server_sample_rate_ = sample_rate->valueint;
+    auto audio_params = root["audio_params"];
+    if (audio_params.IsObject()) {
+        auto sample_rate = audio_params["sample_rate"];
+        if (sample_rate.IsNumber()) {
+            server_sample_rate_ = sample_rate.ToInt();
         }
-        auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
-        if (cJSON_IsNumber(frame_duration)) {
-            server_frame_duration_ = frame_duration->valueint;
+        auto frame_duration = audio_params["frame_duration"];
+        if (frame_duration.IsNumber()) {
+            server_frame_duration_ = frame_duration.ToInt();
         }
     }
 
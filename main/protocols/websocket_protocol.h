@@ -7,6 +7,7 @@
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <mutex>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
@@ -17,16 +18,21 @@ public:
 
     bool Start() override;
     bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    size_t SendAudioBatch(std::vector<std::unique_ptr<AudioStreamPacket>>& packets) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    bool SendMcpMessageStream(const std::function<bool(std::string& piece)>& next) override;
 
 private:
     EventGroupHandle_t event_group_handle_;
     std::unique_ptr<WebSocket> websocket_;
+    // Audio is sent from the uplink task while text comes from the main task
+    std::mutex send_mutex_;
     int version_ = 1;
 
-    void ParseServerHello(const cJSON* root);
+    void ParseServerHello(const JsonValue& root);
+    bool SendAudioFrame(const AudioStreamPacket& packet, std::string& buffer);
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
 };
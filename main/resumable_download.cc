@@ -0,0 +1,295 @@
+#include "resumable_download.h"
+#include "board.h"
+#include "settings.h"
+#include "settings_store.h"
+#include "connection_cache.h"
+#include "write_pipeline.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <algorithm>
+#include <memory>
+
+#define TAG "ResumableDownload"
+
+ResumableDownload::ResumableDownload(const std::string& ns, const DownloadTarget& target, size_t buffer_size, int buffer_count)
+    : ns_(ns), target_(target), buffer_size_(buffer_size), buffer_count_(buffer_count) {
+    mbedtls_sha256_init(&sha256_context_);
+}
+
+ResumableDownload::~ResumableDownload() {
+    mbedtls_sha256_free(&sha256_context_);
+}
+
+bool ResumableDownload::Run(const std::string& url, std::function<void(int progress, size_t speed)> callback, int max_attempts) {
+    url_ = url;
+    sha256_.clear();
+    size_t offset = LoadProgress(url);
+    if (offset == 0) {
+        mbedtls_sha256_starts(&sha256_context_, 0);
+        etag_.clear();
+        size_ = 0;
+        Settings settings(ns_, true);
+        settings.SetString("url", url);
+        settings.SetString("target", target_.name);
+        settings.SetString("etag", "");
+        settings.SetInt("size", 0);
+        settings.SetInt("done", 0);
+        settings.SetString("sha256", "");
+    } else {
+        ESP_LOGI(TAG, "Continuing the download into %s at %u of %u bytes", target_.name.c_str(), offset, size_);
+    }
+    resumed_at_ = offset;
+    erased_end_ = offset;
+
+    auto start_time = esp_timer_get_time();
+    if (size_ == 0 || offset < size_) {
+        for (int attempt = 1; !DownloadRange(offset, callback); attempt++) {
+            if (attempt == max_attempts) {
+                ESP_LOGE(TAG, "Failed to download after %d attempts, stopped at %u bytes", attempt, offset);
+                return false;
+            }
+            ESP_LOGW(TAG, "Download stopped at %u of %u bytes, retrying", offset, size_);
+            vTaskDelay(pdMS_TO_TICKS(1000 * attempt));
+        }
+    }
+    SaveProgress(size_);
+    sha256_ = DigestSoFar();
+
+    int elapsed_ms = (esp_timer_get_time() - start_time) / 1000;
+    ESP_LOGI(TAG, "Download completed, %u bytes in %d ms (%d KB/s), resumed at %u",
+             size_ - resumed_at_, elapsed_ms, int((size_ - resumed_at_) / std::max(elapsed_ms, 1)), resumed_at_);
+    if (callback) {
+        callback(100, (size_ - resumed_at_) * 1000 / std::max(elapsed_ms, 1));
+    }
+    return true;
+}
+
+void ResumableDownload::Clear() {
+    Settings settings(ns_, true);
+    settings.EraseKey("url");
+    settings.EraseKey("target");
+    settings.EraseKey("etag");
+    settings.EraseKey("size");
+    settings.EraseKey("done");
+    settings.EraseKey("sha256");
+}
+
+size_t ResumableDownload::LoadProgress(const std::string& url) {
+    Settings settings(ns_);
+    if (settings.GetString("url") != url || settings.GetString("target") != target_.name) {
+        return 0;
+    }
+    size_t done = settings.GetInt("done");
+    size_t size = settings.GetInt("size");
+    if (done == 0 || size == 0 || done > size || size > target_.size) {
+        return 0;
+    }
+
+    // The target may hold more than was saved, or have been changed since, only a matching prefix is kept
+    mbedtls_sha256_starts(&sha256_context_, 0);
+    if (!HashTarget(done) || DigestSoFar() != settings.GetString("sha256")) {
+        ESP_LOGW(TAG, "The first %u bytes in %s no longer match the saved digest, downloading from the start", done,
+            target_.name.c_str());
+        return 0;
+    }
+    etag_ = settings.GetString("etag");
+    size_ = size;
+    return done;
+}
+
+void ResumableDownload::SaveProgress(size_t done) {
+    Settings settings(ns_, true);
+    settings.SetInt("done", done);
+    settings.SetString("sha256", DigestSoFar());
+}
+
+bool ResumableDownload::DownloadRange(size_t& offset, const std::function<void(int progress, size_t speed)>& callback) {
+    auto network = Board::GetInstance().GetNetwork();
+    auto http = network->CreateHttp(0);
+    if (offset > 0) {
+        http->SetHeader("Range", "bytes=" + std::to_string(offset) + "-");
+        // A server whose file changed answers 200 with all of it instead of the range
+        if (!etag_.empty()) {
+            http->SetHeader("If-Range", etag_);
+        }
+    }
+
+    auto connect_timer = ConnectionCache::GetInstance().TimeConnect(url_);
+    if (!http->Open("GET", url_)) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection");
+        return false;
+    }
+    connect_timer.Finish(true);
+
+    int status_code = http->GetStatusCode();
+    size_t body_length = http->GetBodyLength();
+    if (status_code == 206 && offset > 0) {
+        if (offset + body_length != size_) {
+            ESP_LOGW(TAG, "The file changed size, downloading from the start");
+            offset = 0;
+            erased_end_ = 0;
+            etag_.clear();
+            mbedtls_sha256_starts(&sha256_context_, 0);
+            return false;
+        }
+    } else if (status_code == 200) {
+        if (offset > 0) {
+            ESP_LOGW(TAG, "The file changed or the server ignored the range, downloading from the start");
+        }
+        offset = 0;
+        erased_end_ = 0;
+        size_ = body_length;
+        etag_ = http->GetResponseHeader("ETag");
+        mbedtls_sha256_starts(&sha256_context_, 0);
+    } else {
+        ESP_LOGE(TAG, "Failed to download %s, status code: %d", url_.c_str(), status_code);
+        return false;
+    }
+
+    if (size_ == 0) {
+        ESP_LOGE(TAG, "Failed to get content length");
+        return false;
+    }
+    if (size_ > target_.size) {
+        ESP_LOGE(TAG, "File size (%u) is larger than %s (%u)", size_, target_.name.c_str(), target_.size);
+        return false;
+    }
+    if (offset == 0) {
+        Settings settings(ns_, true);
+        settings.SetString("etag", etag_);
+        settings.SetInt("size", size_);
+        settings.SetInt("done", 0);
+        settings.SetString("sha256", "");
+    }
+    // The progress has to be in NVS before the target is erased
+    SettingsStore::GetInstance().Flush();
+
+    // Network reads and flash writes overlap, the writer task erases and writes while the next buffer fills
+    const size_t base = offset;
+    WritePipeline pipeline(buffer_size_, buffer_count_, [this, base](size_t position, const char* data, size_t size) {
+        return WriteBlock(base + position, data, size);
+    });
+    if (xTaskCreate([](void* arg) {
+        static_cast<WritePipeline*>(arg)->RunWriter();
+        vTaskDelete(NULL);
+    }, "download_writer", RESUMABLE_DOWNLOAD_WRITER_STACK_SIZE, &pipeline, RESUMABLE_DOWNLOAD_WRITER_PRIORITY, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the writer task");
+        return false;
+    }
+
+    // The reader fills whole buffers, a partial one is dropped on error and read again on retry
+    bool read_ok = true;
+    size_t received = offset;
+    size_t last_written = offset;
+    auto last_calc_time = esp_timer_get_time();
+    while (received < size_) {
+        char* buffer = pipeline.Acquire();
+        if (buffer == nullptr) {
+            break;
+        }
+        size_t length = std::min(pipeline.buffer_size(), size_ - received);
+        size_t filled = 0;
+        while (filled < length) {
+            int ret = http->Read(buffer + filled, length - filled);
+            if (ret <= 0) {
+                ESP_LOGE(TAG, "Failed to read HTTP data at %u: %s", received + filled, ret < 0 ? "error" : "closed");
+                read_ok = false;
+                break;
+            }
+            filled += ret;
+        }
+        if (!read_ok) {
+            break;
+        }
+        pipeline.Submit(filled);
+        received += filled;
+
+        // Progress and speed count what reached the flash, over the time actually elapsed
+        auto now = esp_timer_get_time();
+        if (now - last_calc_time >= 1000000) {
+            size_t written = base + pipeline.stats().bytes;
+            size_t speed = (written - last_written) * 1000000 / (now - last_calc_time);
+            size_t progress = written * 100 / size_;
+            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s", progress, written, size_, speed);
+            if (callback) {
+                callback(progress, speed);
+            }
+            last_calc_time = now;
+            last_written = written;
+        }
+    }
+    http->Close();
+
+    bool write_ok = pipeline.Finish();
+    auto stats = pipeline.stats();
+    offset = base + stats.bytes;
+    ESP_LOGI(TAG, "Wrote %u bytes, flash busy %d ms, reader waited %d ms for the flash, writer waited %d ms for the network",
+             stats.bytes, int(stats.write_us / 1000), int(stats.reader_wait_us / 1000), int(stats.writer_wait_us / 1000));
+    return read_ok && write_ok && offset == size_;
+}
+
+bool ResumableDownload::WriteBlock(size_t offset, const char* data, size_t size) {
+    // Whole blocks are erased in one go where aligned, that is much faster than sector by sector
+    while (erased_end_ < offset + size) {
+        size_t erase_size = target_.sector_size;
+        if (erased_end_ % RESUMABLE_DOWNLOAD_BLOCK_SIZE == 0 && erased_end_ + RESUMABLE_DOWNLOAD_BLOCK_SIZE <= target_.size) {
+            erase_size = RESUMABLE_DOWNLOAD_BLOCK_SIZE;
+        }
+        if (!target_.erase(erased_end_, erase_size)) {
+            ESP_LOGE(TAG, "Failed to erase %u bytes at offset %u", erase_size, erased_end_);
+            return false;
+        }
+        erased_end_ += erase_size;
+    }
+    if (!target_.write(offset, data, size)) {
+        ESP_LOGE(TAG, "Failed to write %u bytes at offset %u", size, offset);
+        return false;
+    }
+
+    // Saved progress always ends on a block, which a resumed download erases again before writing
+    while (size > 0) {
+        size_t length = std::min(size, RESUMABLE_DOWNLOAD_BLOCK_SIZE - offset % RESUMABLE_DOWNLOAD_BLOCK_SIZE);
+        mbedtls_sha256_update(&sha256_context_, (const unsigned char*)data, length);
+        offset += length;
+        data += length;
+        size -= length;
+        if (offset % RESUMABLE_DOWNLOAD_BLOCK_SIZE == 0) {
+            SaveProgress(offset);
+        }
+    }
+    return true;
+}
+
+bool ResumableDownload::HashTarget(size_t size) {
+    std::unique_ptr<char[]> buffer(new char[buffer_size_]);
+    for (size_t offset = 0; offset < size; offset += buffer_size_) {
+        size_t length = std::min(buffer_size_, size - offset);
+        if (!target_.read(offset, buffer.get(), length)) {
+            ESP_LOGE(TAG, "Failed to read %u bytes at offset %u", length, offset);
+            return false;
+        }
+        mbedtls_sha256_update(&sha256_context_, (const unsigned char*)buffer.get(), length);
+    }
+    return true;
+}
+
+std::string ResumableDownload::DigestSoFar() {
+    mbedtls_sha256_context context;
+    mbedtls_sha256_init(&context);
+    mbedtls_sha256_clone(&context, &sha256_context_);
+    unsigned char digest[32];
+    mbedtls_sha256_finish(&context, digest);
+    mbedtls_sha256_free(&context);
+
+    std::string hex;
+    for (size_t i = 0; i < sizeof(digest); i++) {
+        char buffer[3];
+        snprintf(buffer, sizeof(buffer), "%02x", digest[i]);
+        hex += buffer;
+    }
+    return hex;
+}
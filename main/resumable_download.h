@@ -0,0 +1,80 @@
+#ifndef RESUMABLE_DOWNLOAD_H
+#define RESUMABLE_DOWNLOAD_H
+
+#include <functional>
+#include <string>
+#include <cstddef>
+
+#include <mbedtls/sha256.h>
+
+// Erased in one go where aligned, and the progress is saved each time one is complete
+#define RESUMABLE_DOWNLOAD_BLOCK_SIZE (64 * 1024)
+#define RESUMABLE_DOWNLOAD_WRITER_STACK_SIZE 4096
+#define RESUMABLE_DOWNLOAD_WRITER_PRIORITY 4
+#define RESUMABLE_DOWNLOAD_MAX_ATTEMPTS 5
+
+/**
+ * Where a ResumableDownload goes, typically a flash partition
+ */
+struct DownloadTarget {
+    std::string name;           /*!< Saved with the progress, a download only continues into the same target */
+    size_t size = 0;
+    size_t sector_size = 4096;  /*!< Smallest erase */
+    std::function<bool(size_t offset, char* data, size_t size)> read;
+    std::function<bool(size_t offset, size_t size)> erase;
+    std::function<bool(size_t offset, const char* data, size_t size)> write;
+};
+
+/**
+ * ResumableDownload - An HTTP download into a DownloadTarget that survives dropped connections and reboots
+ *
+ * The URL, its ETag, the target name, the bytes written and their SHA-256 are saved in the NVS
+ * namespace given at construction whenever another block is written. Run() for the same URL and
+ * target hashes the saved prefix from the target again and, if it still matches, continues with a
+ * Range request. If-Range carries the ETag, so a file that changed on the server starts over.
+ * The progress stays saved until Clear(), a complete download is not fetched again.
+ */
+class ResumableDownload {
+public:
+    ResumableDownload(const std::string& ns, const DownloadTarget& target, size_t buffer_size, int buffer_count);
+    ~ResumableDownload();
+
+    /**
+     * Download until complete, retrying up to max_attempts times. The progress is kept on failure.
+     */
+    bool Run(const std::string& url, std::function<void(int progress, size_t speed)> callback,
+        int max_attempts = RESUMABLE_DOWNLOAD_MAX_ATTEMPTS);
+    /**
+     * Forget the saved progress, once the download was used or turned out to be bad
+     */
+    void Clear();
+
+    size_t size() const { return size_; }
+    size_t resumed_at() const { return resumed_at_; }
+    /**
+     * Hex SHA-256 of the whole download, after Run() succeeded
+     */
+    const std::string& sha256() const { return sha256_; }
+
+private:
+    std::string ns_;
+    DownloadTarget target_;
+    size_t buffer_size_;
+    int buffer_count_;
+    std::string url_;
+    std::string etag_;
+    size_t size_ = 0;
+    size_t resumed_at_ = 0;
+    size_t erased_end_ = 0;
+    std::string sha256_;
+    mbedtls_sha256_context sha256_context_;
+
+    size_t LoadProgress(const std::string& url);
+    void SaveProgress(size_t done);
+    bool DownloadRange(size_t& offset, const std::function<void(int progress, size_t speed)>& callback);
+    bool WriteBlock(size_t offset, const char* data, size_t size);
+    bool HashTarget(size_t size);
+    std::string DigestSoFar();
+};
+
+#endif // RESUMABLE_DOWNLOAD_H
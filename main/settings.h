@@ -2,12 +2,15 @@
 #define SETTINGS_H
 
 #include <string>
-#include <nvs_flash.h>
+#include <cstdint>
 
+/**
+ * A view of one NVS namespace, served by SettingsStore. Cheap to construct, changes are
+ * committed in the background, see SettingsStore::Flush() to write them right away.
+ */
 class Settings {
 public:
     Settings(const std::string& ns, bool read_write = false);
-    ~Settings();
 
     std::string GetString(const std::string& key, const std::string& default_value = "");
     void SetString(const std::string& key, const std::string& value);
@@ -20,9 +23,7 @@ public:
 
 private:
     std::string ns_;
-    nvs_handle_t nvs_handle_ = 0;
     bool read_write_ = false;
-    bool dirty_ = false;
 };
 
 #endif
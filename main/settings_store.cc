@@ -0,0 +1,358 @@
+#include "settings_store.h"
+
+#include <esp_log.h>
+#include <esp_system.h>
+#include <nvs_flash.h>
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <algorithm>
+#include <vector>
+
+#define TAG "SettingsStore"
+
+#define ALL_TYPES 0xFF
+
+static uint8_t TypeBit(int type) {
+    return 1 << type;
+}
+
+SettingsStore::SettingsStore() {
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            static_cast<SettingsStore*>(arg)->StartCommitTask();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "settings_commit",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&timer_args, &commit_timer_);
+
+    // esp_restart() runs this before resetting, so a reboot does not lose what is still pending
+    esp_register_shutdown_handler([]() {
+        SettingsStore::GetInstance().Flush();
+    });
+}
+
+const SettingsStore::Value* SettingsStore::Load(const std::string& ns, const std::string& key, ValueType type) {
+    auto& space = namespaces_[ns];
+    auto& value = space.values[key];
+    if (value.type != ValueType::kMissing || (value.absent & TypeBit((int)type)) || space.erase_all > 0) {
+        return value.type == type ? &value : nullptr;
+    }
+
+    // NVS keeps one type per key, a lookup with another type finds nothing
+    nvs_reads_++;
+    nvs_handle_t nvs_handle;
+    esp_err_t ret = nvs_open(ns.c_str(), NVS_READONLY, &nvs_handle);
+    if (ret == ESP_OK) {
+        switch (type) {
+        case ValueType::kString: {
+            size_t length = 0;
+            ret = nvs_get_str(nvs_handle, key.c_str(), nullptr, &length);
+            if (ret == ESP_OK) {
+                value.string_value.resize(length);
+                ret = nvs_get_str(nvs_handle, key.c_str(), value.string_value.data(), &length);
+                while (!value.string_value.empty() && value.string_value.back() == '\0') {
+                    value.string_value.pop_back();
+                }
+            }
+            break;
+        }
+        case ValueType::kInt:
+            ret = nvs_get_i32(nvs_handle, key.c_str(), &value.int_value);
+            break;
+        case ValueType::kBool: {
+            uint8_t byte = 0;
+            ret = nvs_get_u8(nvs_handle, key.c_str(), &byte);
+            value.int_value = byte != 0;
+            break;
+        }
+        default:
+            break;
+        }
+        nvs_close(nvs_handle);
+    }
+
+    if (ret == ESP_OK) {
+        value.type = type;
+        return &value;
+    }
+    value.string_value.clear();
+    value.int_value = 0;
+    // Other errors, e.g. NVS not initialized yet, are not remembered and the next read tries again
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        value.absent |= TypeBit((int)type);
+    }
+    return nullptr;
+}
+
+std::string SettingsStore::GetString(const std::string& ns, const std::string& key, const std::string& default_value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reads_++;
+    auto value = Load(ns, key, ValueType::kString);
+    return value != nullptr ? value->string_value : default_value;
+}
+
+int32_t SettingsStore::GetInt(const std::string& ns, const std::string& key, int32_t default_value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reads_++;
+    auto value = Load(ns, key, ValueType::kInt);
+    return value != nullptr ? value->int_value : default_value;
+}
+
+bool SettingsStore::GetBool(const std::string& ns, const std::string& key, bool default_value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reads_++;
+    auto value = Load(ns, key, ValueType::kBool);
+    return value != nullptr ? value->int_value != 0 : default_value;
+}
+
+void SettingsStore::SetString(const std::string& ns, const std::string& key, const std::string& value) {
+    Value entry;
+    entry.type = ValueType::kString;
+    entry.string_value = value;
+    Set(ns, key, std::move(entry));
+}
+
+void SettingsStore::SetInt(const std::string& ns, const std::string& key, int32_t value) {
+    Value entry;
+    entry.type = ValueType::kInt;
+    entry.int_value = value;
+    Set(ns, key, std::move(entry));
+}
+
+void SettingsStore::SetBool(const std::string& ns, const std::string& key, bool value) {
+    Value entry;
+    entry.type = ValueType::kBool;
+    entry.int_value = value ? 1 : 0;
+    Set(ns, key, std::move(entry));
+}
+
+void SettingsStore::Set(const std::string& ns, const std::string& key, Value value) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sets_++;
+        // Writing the value NVS already holds would still wear the flash
+        auto current = Load(ns, key, value.type);
+        if (current != nullptr && current->string_value == value.string_value && current->int_value == value.int_value) {
+            unchanged_sets_++;
+            return;
+        }
+        value.dirty = true;
+        namespaces_[ns].values[key] = std::move(value);
+        ScheduleCommit();
+    }
+    Notify(ns, key);
+}
+
+void SettingsStore::EraseKey(const std::string& ns, const std::string& key) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& value = namespaces_[ns].values[key];
+        if (value.type == ValueType::kMissing && value.absent == ALL_TYPES) {
+            return;
+        }
+        value = Value();
+        value.absent = ALL_TYPES;
+        value.dirty = true;
+        ScheduleCommit();
+    }
+    Notify(ns, key);
+}
+
+void SettingsStore::EraseAll(const std::string& ns) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& space = namespaces_[ns];
+        space.values.clear();
+        space.erase_all++;
+        ScheduleCommit();
+    }
+    Notify(ns, "");
+}
+
+int SettingsStore::AddListener(const std::string& ns, std::function<void(const std::string& key)> listener) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int id = next_listener_id_++;
+    listeners_[id] = Listener{id, ns, std::move(listener)};
+    return id;
+}
+
+void SettingsStore::RemoveListener(int id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    listeners_.erase(id);
+}
+
+void SettingsStore::Notify(const std::string& ns, const std::string& key) {
+    std::vector<std::function<void(const std::string& key)>> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& [id, listener] : listeners_) {
+            if (listener.ns == ns) {
+                callbacks.push_back(listener.callback);
+            }
+        }
+    }
+    for (auto& callback : callbacks) {
+        callback(key);
+    }
+}
+
+void SettingsStore::ScheduleCommit() {
+    // Every change pushes the commit back, up to the max delay after the first one
+    auto now = esp_timer_get_time();
+    if (first_pending_time_ == 0) {
+        first_pending_time_ = now;
+    }
+    int64_t delay_us = std::min<int64_t>(SETTINGS_COMMIT_DELAY_MS * 1000LL,
+        first_pending_time_ + SETTINGS_COMMIT_MAX_DELAY_MS * 1000LL - now);
+    esp_timer_stop(commit_timer_);
+    esp_timer_start_once(commit_timer_, std::max<int64_t>(delay_us, 0));
+}
+
+void SettingsStore::StartCommitTask() {
+    // A flash commit takes tens of milliseconds, every other esp_timer callback would wait for it
+    if (xTaskCreate([](void* arg) {
+        static_cast<SettingsStore*>(arg)->Flush();
+        vTaskDelete(NULL);
+    }, "settings_commit", SETTINGS_COMMIT_TASK_STACK_SIZE, this, SETTINGS_COMMIT_TASK_PRIORITY, nullptr) != pdPASS) {
+        ESP_LOGW(TAG, "Failed to create the commit task, trying again later");
+        esp_timer_start_once(commit_timer_, SETTINGS_COMMIT_DELAY_MS * 1000);
+    }
+}
+
+void SettingsStore::Flush() {
+    std::lock_guard<std::mutex> flush_lock(flush_mutex_);
+    struct Pending {
+        std::string ns;
+        int erase_all;
+        std::map<std::string, Value> values;
+    };
+    std::vector<Pending> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        esp_timer_stop(commit_timer_);
+        first_pending_time_ = 0;
+        for (auto& [ns, space] : namespaces_) {
+            Pending item{ns, space.erase_all, {}};
+            for (auto& [key, value] : space.values) {
+                if (value.dirty) {
+                    item.values[key] = value;
+                    value.dirty = false;
+                }
+            }
+            if (item.erase_all > 0 || !item.values.empty()) {
+                pending.push_back(std::move(item));
+            }
+        }
+    }
+
+    // NVS is written without holding the lock, reads and changes meanwhile are served from RAM
+    for (auto& item : pending) {
+        esp_err_t ret = Write(item.ns, item.erase_all, item.values);
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& space = namespaces_[item.ns];
+        if (ret == ESP_OK) {
+            space.erase_all -= item.erase_all;
+            space.commits++;
+            space.writes += item.values.size();
+            commits_++;
+            continue;
+        }
+
+        // Kept pending for the next change or Flush(), unless it was changed or erased meanwhile
+        ESP_LOGE(TAG, "Failed to commit %u changes to namespace %s: %s", item.values.size(), item.ns.c_str(),
+            esp_err_to_name(ret));
+        failed_commits_++;
+        for (auto& [key, value] : item.values) {
+            auto it = space.values.find(key);
+            if (it != space.values.end() && !it->second.dirty && it->second.type == value.type &&
+                it->second.string_value == value.string_value && it->second.int_value == value.int_value) {
+                it->second.dirty = true;
+            }
+        }
+    }
+}
+
+esp_err_t SettingsStore::Write(const std::string& ns, int erase_all, const std::map<std::string, Value>& values) {
+    nvs_handle_t nvs_handle;
+    esp_err_t ret = nvs_open(ns.c_str(), NVS_READWRITE, &nvs_handle);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (erase_all > 0) {
+        ret = nvs_erase_all(nvs_handle);
+    }
+    for (auto it = values.begin(); ret == ESP_OK && it != values.end(); ++it) {
+        const auto& key = it->first;
+        const auto& value = it->second;
+        switch (value.type) {
+        case ValueType::kString:
+            ret = nvs_set_str(nvs_handle, key.c_str(), value.string_value.c_str());
+            break;
+        case ValueType::kInt:
+            ret = nvs_set_i32(nvs_handle, key.c_str(), value.int_value);
+            break;
+        case ValueType::kBool:
+            ret = nvs_set_u8(nvs_handle, key.c_str(), value.int_value ? 1 : 0);
+            break;
+        case ValueType::kMissing:
+            ret = nvs_erase_key(nvs_handle, key.c_str());
+            if (ret == ESP_ERR_NVS_NOT_FOUND) {
+                ret = ESP_OK;
+            }
+            break;
+        }
+    }
+    if (ret == ESP_OK) {
+        ret = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+    return ret;
+}
+
+void SettingsStore::Reset() {
+    std::lock_guard<std::mutex> flush_lock(flush_mutex_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    esp_timer_stop(commit_timer_);
+    first_pending_time_ = 0;
+    for (auto& [ns, space] : namespaces_) {
+        space.values.clear();
+        space.erase_all = 0;
+    }
+}
+
+std::string SettingsStore::GetStatsJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "reads", reads_);
+    cJSON_AddNumberToObject(root, "nvs_reads", nvs_reads_);
+    cJSON_AddNumberToObject(root, "sets", sets_);
+    cJSON_AddNumberToObject(root, "unchanged_sets", unchanged_sets_);
+    cJSON_AddNumberToObject(root, "commits", commits_);
+    cJSON_AddNumberToObject(root, "failed_commits", failed_commits_);
+
+    cJSON* namespaces = cJSON_CreateArray();
+    for (const auto& [ns, space] : namespaces_) {
+        int pending = space.erase_all > 0 ? 1 : 0;
+        for (const auto& [key, value] : space.values) {
+            pending += value.dirty ? 1 : 0;
+        }
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "namespace", ns.c_str());
+        cJSON_AddNumberToObject(item, "commits", space.commits);
+        cJSON_AddNumberToObject(item, "writes", space.writes);
+        cJSON_AddNumberToObject(item, "pending", pending);
+        cJSON_AddItemToArray(namespaces, item);
+    }
+    cJSON_AddItemToObject(root, "namespaces", namespaces);
+
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
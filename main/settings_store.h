@@ -0,0 +1,114 @@
+#ifndef SETTINGS_STORE_H
+#define SETTINGS_STORE_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+#include <esp_timer.h>
+
+// Changes are committed once no other change came for this long, but never later than the max delay
+#define SETTINGS_COMMIT_DELAY_MS 2000
+#define SETTINGS_COMMIT_MAX_DELAY_MS 10000
+// The commit runs in a short lived task, not in the esp_timer task it would hold up
+#define SETTINGS_COMMIT_TASK_STACK_SIZE 4096
+#define SETTINGS_COMMIT_TASK_PRIORITY 1
+
+/**
+ * SettingsStore - Write-back cache in front of NVS, shared by every Settings
+ *
+ * Values are read from NVS once and served from RAM after that. Changes stay in RAM and are
+ * written together, one nvs_commit per namespace, after SETTINGS_COMMIT_DELAY_MS without further
+ * changes, or right away by Flush(). Code that must not lose a change, e.g. a record written before
+ * erasing flash, calls Flush() itself. A value set to what it already is does not count as a change.
+ * Flush() runs from a shutdown handler on esp_restart, sleep paths call it before powering down.
+ */
+class SettingsStore {
+public:
+    static SettingsStore& GetInstance() {
+        static SettingsStore instance;
+        return instance;
+    }
+
+    SettingsStore(const SettingsStore&) = delete;
+    SettingsStore& operator=(const SettingsStore&) = delete;
+
+    std::string GetString(const std::string& ns, const std::string& key, const std::string& default_value = "");
+    void SetString(const std::string& ns, const std::string& key, const std::string& value);
+    int32_t GetInt(const std::string& ns, const std::string& key, int32_t default_value = 0);
+    void SetInt(const std::string& ns, const std::string& key, int32_t value);
+    bool GetBool(const std::string& ns, const std::string& key, bool default_value = false);
+    void SetBool(const std::string& ns, const std::string& key, bool value);
+    void EraseKey(const std::string& ns, const std::string& key);
+    void EraseAll(const std::string& ns);
+
+    /**
+     * Call the listener after a key in the namespace changed, with an empty key after EraseAll.
+     * It runs on the task that made the change, outside the store's lock. Returns an id for RemoveListener.
+     */
+    int AddListener(const std::string& ns, std::function<void(const std::string& key)> listener);
+    void RemoveListener(int id);
+
+    /**
+     * Write all pending changes to NVS now
+     */
+    void Flush();
+
+    /**
+     * Drop everything cached, after the NVS partition was erased underneath
+     */
+    void Reset();
+
+    std::string GetStatsJson();
+
+private:
+    SettingsStore();
+
+    enum class ValueType { kMissing, kString, kInt, kBool };
+
+    struct Value {
+        ValueType type = ValueType::kMissing;
+        std::string string_value;
+        int32_t int_value = 0;      /*!< Also holds bools as 0 / 1 */
+        uint8_t absent = 0;         /*!< Types NVS was found not to hold, all of them once erased */
+        bool dirty = false;
+    };
+
+    struct Namespace {
+        std::map<std::string, Value> values;
+        int erase_all = 0;          /*!< EraseAll calls not yet written, NVS is not read while set */
+        uint32_t commits = 0;
+        uint32_t writes = 0;
+    };
+
+    struct Listener {
+        int id;
+        std::string ns;
+        std::function<void(const std::string& key)> callback;
+    };
+
+    std::mutex mutex_;
+    std::mutex flush_mutex_;
+    std::map<std::string, Namespace> namespaces_;
+    std::map<int, Listener> listeners_;
+    int next_listener_id_ = 1;
+    esp_timer_handle_t commit_timer_ = nullptr;
+    int64_t first_pending_time_ = 0;
+    uint32_t reads_ = 0;
+    uint32_t nvs_reads_ = 0;
+    uint32_t sets_ = 0;
+    uint32_t unchanged_sets_ = 0;
+    uint32_t commits_ = 0;
+    uint32_t failed_commits_ = 0;
+
+    const Value* Load(const std::string& ns, const std::string& key, ValueType type);
+    void Set(const std::string& ns, const std::string& key, Value value);
+    esp_err_t Write(const std::string& ns, int erase_all, const std::map<std::string, Value>& values);
+    void ScheduleCommit();
+    void StartCommitTask();
+    void Notify(const std::string& ns, const std::string& key);
+};
+
+#endif // SETTINGS_STORE_H
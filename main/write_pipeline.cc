@@ -0,0 +1,82 @@
+#include "write_pipeline.h"
+
+#include <esp_timer.h>
+
+WritePipeline::WritePipeline(size_t buffer_size, int buffer_count, Writer writer)
+    : buffer_size_(buffer_size), writer_(std::move(writer)), lengths_(buffer_count, 0) {
+    for (int i = 0; i < buffer_count; i++) {
+        buffers_.emplace_back(new char[buffer_size]);
+    }
+}
+
+char* WritePipeline::Acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (queued_ == buffers_.size() && !stopped_) {
+        auto start_time = esp_timer_get_time();
+        cv_.wait(lock, [this]() { return queued_ < buffers_.size() || stopped_; });
+        stats_.reader_wait_us += esp_timer_get_time() - start_time;
+    }
+    return stopped_ ? nullptr : buffers_[head_].get();
+}
+
+void WritePipeline::Submit(size_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lengths_[head_] = length;
+    head_ = (head_ + 1) % buffers_.size();
+    queued_++;
+    cv_.notify_all();
+}
+
+bool WritePipeline::Finish() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    finishing_ = true;
+    cv_.notify_all();
+    cv_.wait(lock, [this]() { return writer_done_; });
+    return !failed_;
+}
+
+void WritePipeline::Abort() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopped_ = true;
+    cv_.notify_all();
+    cv_.wait(lock, [this]() { return writer_done_; });
+}
+
+void WritePipeline::RunWriter() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        auto start_time = esp_timer_get_time();
+        cv_.wait(lock, [this]() { return queued_ > 0 || finishing_ || stopped_; });
+        stats_.writer_wait_us += esp_timer_get_time() - start_time;
+        if (stopped_ || queued_ == 0) {
+            break;
+        }
+
+        // The reader does not touch the buffer until it is released below
+        size_t index = tail_;
+        size_t offset = stats_.bytes;
+        lock.unlock();
+        start_time = esp_timer_get_time();
+        bool success = writer_(offset, buffers_[index].get(), lengths_[index]);
+        auto write_us = esp_timer_get_time() - start_time;
+        lock.lock();
+
+        stats_.write_us += write_us;
+        if (!success) {
+            failed_ = true;
+            stopped_ = true;
+            break;
+        }
+        stats_.bytes += lengths_[index];
+        tail_ = (tail_ + 1) % buffers_.size();
+        queued_--;
+        cv_.notify_all();
+    }
+    writer_done_ = true;
+    cv_.notify_all();
+}
+
+WritePipelineStats WritePipeline::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
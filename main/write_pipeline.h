@@ -0,0 +1,79 @@
+#ifndef WRITE_PIPELINE_H
+#define WRITE_PIPELINE_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+struct WritePipelineStats {
+    size_t bytes = 0;               // Passed to the write callback
+    uint64_t reader_wait_us = 0;    // Reader blocked on a full ring
+    uint64_t writer_wait_us = 0;    // Writer idle on an empty ring
+    uint64_t write_us = 0;          // Spent in the write callback
+};
+
+/**
+ * WritePipeline - A ring of equally sized buffers between a reader and a writer task
+ *
+ * The reader fills the buffer returned by Acquire() and hands it over with Submit(), the writer
+ * task runs RunWriter() and passes the submitted buffers in order to the write callback. Network
+ * reads and flash erase/write overlap, each side only waits while the ring is full or empty.
+ * A failed write stops the pipeline, Acquire() returns nullptr from then on.
+ */
+class WritePipeline {
+public:
+    /**
+     * Runs in the writer task, offset counts the bytes submitted before data
+     */
+    using Writer = std::function<bool(size_t offset, const char* data, size_t size)>;
+
+    WritePipeline(size_t buffer_size, int buffer_count, Writer writer);
+
+    size_t buffer_size() const { return buffer_size_; }
+
+    /**
+     * A free buffer of buffer_size() bytes, waits while the ring is full, nullptr once stopped
+     */
+    char* Acquire();
+    /**
+     * Queue the buffer from Acquire() holding length bytes
+     */
+    void Submit(size_t length);
+    /**
+     * Wait until the writer has written every submitted buffer, true if all writes succeeded
+     */
+    bool Finish();
+    /**
+     * Stop the writer without writing the buffers still queued
+     */
+    void Abort();
+
+    /**
+     * Body of the writer task, returns after Finish() or Abort()
+     */
+    void RunWriter();
+
+    WritePipelineStats stats();
+
+private:
+    size_t buffer_size_;
+    Writer writer_;
+    std::vector<std::unique_ptr<char[]>> buffers_;
+    std::vector<size_t> lengths_;
+    size_t head_ = 0;   // Next buffer for the reader
+    size_t tail_ = 0;   // Next buffer for the writer
+    size_t queued_ = 0;
+    bool finishing_ = false;
+    bool stopped_ = false;
+    bool failed_ = false;
+    bool writer_done_ = false;
+    WritePipelineStats stats_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+#endif // WRITE_PIPELINE_H
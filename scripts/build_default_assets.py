@@ -7,7 +7,7 @@ for the current board configuration.
 
 Usage:
     ./build_default_assets.py --sdkconfig <path> --builtin_text_font <font_name> \
-        --default_emoji_collection <collection_name> --output <output_path>
+        --default_emoji_collection <collection_name> --output <output_path> [--compress]
 """
 
 import argparse
@@ -17,6 +17,7 @@ import shutil
 import sys
 import json
 import struct
+import zlib
 from datetime import datetime
 
 
@@ -272,10 +273,11 @@ def process_extra_files(extra_files_dir, assets_dir):
     return extra_files_list
 
 
-def generate_index_json(assets_dir, srmodels, text_font, emoji_collection, extra_files=None, multinet_model_info=None):
+def generate_index_json(assets_dir, srmodels, text_font, emoji_collection, extra_files=None, multinet_model_info=None, compress=False):
     """Generate index.json file"""
+    # Version 2 packs may hold compressed entries, older firmware refuses them
     index_data = {
-        "version": 1
+        "version": 2 if compress else 1
     }
     
     if srmodels:
@@ -344,13 +346,104 @@ def sort_key(filename):
     return extension, basename
 
 
-def pack_assets_simple(target_path, include_path, out_file, assets_path, max_name_len=32):
+# Read in place by the firmware or tiny, never compressed
+UNCOMPRESSED_FILES = ['index.json', 'srmodels.bin']
+
+
+def lz4_compress_block(data):
+    """
+    Compress data in the LZ4 block format (no frame), as decoded by the firmware.
+    Uses the lz4 package when installed, otherwise a greedy compressor with a 4 byte hash table.
+    """
+    try:
+        import lz4.block
+        return lz4.block.compress(data, store_size=False)
+    except ImportError:
+        pass
+
+    def write_length(out, length):
+        while length >= 255:
+            out.append(255)
+            length -= 255
+        out.append(length)
+
+    def write_sequence(out, literals, offset=0, match_length=0):
+        literal_length = len(literals)
+        match_code = match_length - 4 if offset else 0
+        out.append(min(literal_length, 15) << 4 | min(match_code, 15))
+        if literal_length >= 15:
+            write_length(out, literal_length - 15)
+        out.extend(literals)
+        if offset:
+            out.extend(offset.to_bytes(2, byteorder='little'))
+            if match_code >= 15:
+                write_length(out, match_code - 15)
+
+    out = bytearray()
+    table = {}
+    anchor = 0
+    i = 0
+    # The last match starts 12 bytes before the end at the latest and the last 5 bytes are literals
+    while i < len(data) - 12:
+        sequence = data[i:i + 4]
+        ref = table.get(sequence, -1)
+        table[sequence] = i
+        if ref < 0 or i - ref > 65535:
+            i += 1
+            continue
+        length = 4
+        max_length = len(data) - 5 - i
+        while length < max_length and data[ref + length] == data[i + length]:
+            length += 1
+        write_sequence(out, data[anchor:i], i - ref, length)
+        i += length
+        anchor = i
+    write_sequence(out, data[anchor:])
+    return bytes(out)
+
+
+def pack_entry(file_name, data, compress):
+    """
+    Entry data as stored after the table: 'ZZ' and the file, or 'ZC', the file size and the
+    LZ4 block when compression saves at least an eighth
+    """
+    if compress and file_name not in UNCOMPRESSED_FILES and len(data) >= 256:
+        compressed = lz4_compress_block(data)
+        if len(compressed) + 4 <= len(data) - len(data) // 8:
+            return b'ZC' + len(data).to_bytes(4, byteorder='little') + compressed
+    return b'ZZ' + data
+
+
+def append_chunk_digests(data, chunk_size=32768):
+    """
+    Append the CRC32 of every chunk_size bytes of the image, so the firmware can verify the
+    partition chunk by chunk. The digests follow the image (4 byte aligned) and are not counted
+    in the header length, older firmware ignores them.
+    """
+    digests = [zlib.crc32(data[i:i + chunk_size]) for i in range(0, len(data), chunk_size)]
+    padding = b'\0' * (-len(data) % 4)
+    trailer = b'ACRC' + struct.pack('<II', chunk_size, len(digests)) + struct.pack(f'<{len(digests)}I', *digests)
+    return data + padding + trailer + struct.pack('<I', zlib.crc32(trailer))
+
+
+def table_sort_key(max_name_len):
+    """
+    Order of the mmap table entries, by the name bytes as stored in the table.
+    The firmware binary searches a table in this order instead of indexing it at boot.
+    """
+    def key(file_info):
+        return file_info[0].ljust(max_name_len, '\0')[:max_name_len].encode('utf-8')
+    return key
+
+
+def pack_assets_simple(target_path, include_path, out_file, assets_path, max_name_len=32, compress=False):
     """
     Simplified version of pack_assets that handles basic file packing
     """
     merged_data = bytearray()
     file_info_list = []
     skip_files = ['config.json']
+    compressed_files = 0
 
     # Ensure output directory exists
     os.makedirs(os.path.dirname(out_file), exist_ok=True)
@@ -366,18 +459,19 @@ def pack_assets_simple(target_path, include_path, out_file, assets_path, max_nam
             continue
             
         file_name = os.path.basename(file_path)
-        file_size = os.path.getsize(file_path)
-
-        file_info_list.append((file_name, len(merged_data), file_size, 0, 0))
-        # Add 0x5A5A prefix to merged_data
-        merged_data.extend(b'\x5A' * 2)
 
         with open(file_path, 'rb') as bin_file:
             bin_data = bin_file.read()
 
-        merged_data.extend(bin_data)
+        # Add 0x5A5A prefix to merged_data, 'ZC' for compressed entries
+        entry_data = pack_entry(file_name, bin_data, compress)
+        if entry_data[:2] == b'ZC':
+            compressed_files += 1
+        file_info_list.append((file_name, len(merged_data), len(entry_data) - 2, 0, 0))
+        merged_data.extend(entry_data)
 
     total_files = len(file_info_list)
+    file_info_list.sort(key=table_sort_key(max_name_len))
 
     mmap_table = bytearray()
     for file_name, offset, file_size, width, height in file_info_list:
@@ -394,7 +488,7 @@ def pack_assets_simple(target_path, include_path, out_file, assets_path, max_nam
     combined_checksum = compute_checksum(combined_data)
     combined_data_length = len(combined_data).to_bytes(4, byteorder='little')
     header_data = total_files.to_bytes(4, byteorder='little') + combined_checksum.to_bytes(4, byteorder='little')
-    final_data = header_data + combined_data_length + combined_data
+    final_data = append_chunk_digests(header_data + combined_data_length + combined_data)
 
     with open(out_file, 'wb') as output_bin:
         output_bin.write(final_data)
@@ -425,6 +519,8 @@ def pack_assets_simple(target_path, include_path, out_file, assets_path, max_nam
 
         output_header.write('};\n')
 
+    if compress:
+        print(f'{compressed_files} of {total_files} files compressed')
     print(f'All files have been merged into {os.path.basename(out_file)}')
 
 
@@ -698,7 +794,7 @@ def get_emoji_collection_path(default_emoji_collection, xiaozhi_fonts_path):
         return None
 
 
-def build_assets_integrated(wakenet_model_paths, multinet_model_paths, text_font_path, emoji_collection_path, extra_files_path, output_path, multinet_model_info=None):
+def build_assets_integrated(wakenet_model_paths, multinet_model_paths, text_font_path, emoji_collection_path, extra_files_path, output_path, multinet_model_info=None, compress=False):
     """
     Build assets using integrated functions (no external dependencies)
     """
@@ -722,7 +818,7 @@ def build_assets_integrated(wakenet_model_paths, multinet_model_paths, text_font
         extra_files = process_extra_files(extra_files_path, assets_dir) if extra_files_path else None
         
         # Generate index.json
-        generate_index_json(assets_dir, srmodels, text_font, emoji_collection, extra_files, multinet_model_info)
+        generate_index_json(assets_dir, srmodels, text_font, emoji_collection, extra_files, multinet_model_info, compress)
         
         # Generate config.json for packing
         config_path = generate_config_json(temp_build_dir, assets_dir)
@@ -734,7 +830,7 @@ def build_assets_integrated(wakenet_model_paths, multinet_model_paths, text_font
         # Use simplified packing function
         include_path = config_data['include_path']
         image_file = config_data['image_file']
-        pack_assets_simple(assets_dir, include_path, image_file, "assets", int(config_data['name_length']))
+        pack_assets_simple(assets_dir, include_path, image_file, "assets", int(config_data['name_length']), compress)
         
         # Copy final assets.bin to output location
         if os.path.exists(image_file):
@@ -768,6 +864,7 @@ def main():
     parser.add_argument('--esp_sr_model_path', help='Path to ESP-SR model directory')
     parser.add_argument('--xiaozhi_fonts_path', help='Path to xiaozhi-fonts component directory')
     parser.add_argument('--extra_files', help='Path to extra files directory to be included in assets')
+    parser.add_argument('--compress', action='store_true', help='LZ4 compress the entries that shrink, needs firmware that reads version 2 packs')
     
     args = parser.parse_args()
     
@@ -870,7 +967,7 @@ def main():
     
     # Build the assets
     success = build_assets_integrated(wakenet_model_paths, multinet_model_paths, text_font_path, emoji_collection_path, 
-                                     extra_files_path, args.output, multinet_model_info)
+                                     extra_files_path, args.output, multinet_model_info, args.compress)
     
     if not success:
         sys.exit(1)
@@ -0,0 +1,379 @@
+#!/usr/bin/env python3
+"""
+Create and check delta patches, as applied by DeltaPatcher (main/delta_patcher.cc)
+
+A patch turns one exact base image into a target image. For the assets partition the target
+overwrites the base in place, so the patch may only read the base up to --window bytes behind
+the write position (the device keeps that much of the overwritten base in RAM).
+
+Usage:
+    ./delta_patch.py create <base> <target> <patch> [--window <bytes>]
+    ./delta_patch.py apply <base> <patch> [<target>] [--sector-size <bytes>]
+
+    # assets partition, the base is the assets.bin installed on the device
+    ./delta_patch.py create old/assets.bin new/assets.bin assets.patch --window 262144
+
+    # firmware, the base is the application image of the release running on the device,
+    # the patch goes to the "delta" entry of the OTA check response for that version
+    ./delta_patch.py create old/xiaozhi.bin new/xiaozhi.bin firmware.patch
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+from build_default_assets import lz4_compress_block
+
+DELTA_MAGIC = 0x41544c44  # "DLTA"
+DELTA_FRAME_SIZE = 16384
+# Seeds are blocks of the base at aligned offsets, every shared run of twice this size is found
+BLOCK_SIZE = 32
+# Candidate base offsets kept per block, repeated content like padding has many
+MAX_CANDIDATES = 8
+# A match keeps growing through mismatches until it scores this much below its best length
+MISMATCH_SLACK = 32
+
+
+def index_base(base):
+    index = {}
+    for offset in range(0, len(base) - BLOCK_SIZE + 1, BLOCK_SIZE):
+        offsets = index.setdefault(base[offset:offset + BLOCK_SIZE], [])
+        if len(offsets) == MAX_CANDIDATES:
+            offsets.pop(0)
+        offsets.append(offset)
+    return index
+
+
+def readable(base, window, base_offset, target_offset):
+    """In place, base bytes more than window behind the target position are already overwritten"""
+    if base_offset < 0 or base_offset + BLOCK_SIZE > len(base):
+        return False
+    return window == 0 or base_offset - target_offset >= -window
+
+
+def extend_forward(base, target, base_offset, target_offset):
+    """Length of the diff region starting at both offsets, in the style of bsdiff"""
+    limit = min(len(base) - base_offset, len(target) - target_offset)
+    length = score = best_score = best_length = run = 0
+    while length < limit:
+        if run >= 8 and length + 64 <= limit and \
+                base[base_offset + length:base_offset + length + 64] == target[target_offset + length:target_offset + length + 64]:
+            length += 64
+            score += 64
+        else:
+            if base[base_offset + length] == target[target_offset + length]:
+                score += 1
+                run += 1
+            else:
+                score -= 1
+                run = 0
+            length += 1
+        if score > best_score:
+            best_score, best_length = score, length
+        elif score < best_score - MISMATCH_SLACK:
+            break
+    return best_length
+
+
+def extend_backward(base, target, base_offset, target_offset, limit):
+    limit = min(limit, base_offset)
+    length = score = best_score = best_length = 0
+    while length < limit:
+        length += 1
+        score += 1 if base[base_offset - length] == target[target_offset - length] else -1
+        if score > best_score:
+            best_score, best_length = score, length
+        elif score < best_score - MISMATCH_SLACK:
+            break
+    return best_length
+
+
+def find_matches(base, target, window):
+    """(base_offset, target_offset, length) of the regions of target taken from base, in order"""
+    index = index_base(base)
+    matches = []
+    delta = 0
+    position = 0
+    gap_start = 0
+    while position <= len(target) - BLOCK_SIZE:
+        block = target[position:position + BLOCK_SIZE]
+        base_offset = None
+        # A run that continues after a changed region is usually at the same distance
+        if matches and readable(base, window, position + delta, position) and \
+                base[position + delta:position + delta + BLOCK_SIZE] == block:
+            base_offset = position + delta
+        else:
+            candidates = [o for o in index.get(block, []) if readable(base, window, o, position)]
+            if candidates:
+                base_offset = min(candidates, key=lambda o: abs(o - position - delta))
+        if base_offset is None:
+            position += 1
+            continue
+
+        back = extend_backward(base, target, base_offset, position, position - gap_start)
+        base_offset -= back
+        position -= back
+        length = extend_forward(base, target, base_offset, position)
+        matches.append((base_offset, position, length))
+        delta = base_offset - position
+        position += length
+        gap_start = position
+    return matches
+
+
+def diff_bytes(base, target):
+    if base == target:
+        return bytes(len(base))
+    return bytes((t - b) & 0xff for b, t in zip(base, target))
+
+
+def diff_bytes_add(base, diff):
+    if not any(diff):
+        return base
+    return bytes((b + d) & 0xff for b, d in zip(base, diff))
+
+
+def encode_operations(base, target, matches):
+    """bsdiff style [diff_len][extra_len][seek] controls, each followed by its diff and extra bytes"""
+    operations = bytearray()
+    diff_base, diff_target, diff_length = 0, 0, 0
+    for base_offset, target_offset, length in matches + [(None, len(target), 0)]:
+        extra_start = diff_target + diff_length
+        if base_offset is None:
+            base_offset = diff_base + diff_length
+        seek = base_offset - (diff_base + diff_length)
+        operations += struct.pack('<IIi', diff_length, target_offset - extra_start, seek)
+        for offset in range(0, diff_length, 4096):
+            size = min(4096, diff_length - offset)
+            operations += diff_bytes(base[diff_base + offset:diff_base + offset + size],
+                                     target[diff_target + offset:diff_target + offset + size])
+        operations += target[extra_start:target_offset]
+        diff_base, diff_target, diff_length = base_offset, target_offset, length
+    return bytes(operations)
+
+
+def encode_frames(operations):
+    frames = bytearray()
+    for offset in range(0, len(operations), DELTA_FRAME_SIZE):
+        raw = operations[offset:offset + DELTA_FRAME_SIZE]
+        compressed = lz4_compress_block(raw)
+        if len(compressed) < len(raw):
+            frames += struct.pack('<II', len(raw), len(compressed)) + compressed
+        else:
+            frames += struct.pack('<II', len(raw), len(raw)) + raw
+    return bytes(frames)
+
+
+def create_patch(base, target, window=0):
+    matches = find_matches(base, target, window)
+    operations = encode_operations(base, target, matches)
+    header = struct.pack('<6I', DELTA_MAGIC, window, len(base), zlib.crc32(base),
+                         len(target), zlib.crc32(target))
+    copied = sum(length for _, _, length in matches)
+    print(f"{len(matches)} matched regions cover {copied} of {len(target)} bytes")
+    return header + encode_frames(operations)
+
+
+def lz4_decompress_block(data, size):
+    try:
+        import lz4.block
+        return lz4.block.decompress(data, uncompressed_size=size)
+    except ImportError:
+        pass
+
+    def read_length(length, i):
+        if length == 15:
+            while True:
+                length += data[i]
+                i += 1
+                if data[i - 1] != 255:
+                    break
+        return length, i
+
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        token = data[i]
+        length, i = read_length(token >> 4, i + 1)
+        out += data[i:i + length]
+        i += length
+        if i >= len(data):
+            break
+        offset = data[i] | data[i + 1] << 8
+        length, i = read_length(token & 15, i + 2)
+        length += 4
+        if offset == 0 or offset > len(out):
+            raise ValueError("invalid LZ4 match offset")
+        start = len(out) - offset
+        while length > 0:
+            chunk = out[start:start + min(length, offset)]
+            out += chunk
+            start += len(chunk)
+            length -= len(chunk)
+    if len(out) != size:
+        raise ValueError(f"LZ4 block decoded to {len(out)} bytes instead of {size}")
+    return bytes(out)
+
+
+def decode_frames(data, offset):
+    operations = bytearray()
+    while offset < len(data):
+        raw_size, stored_size = struct.unpack_from('<II', data, offset)
+        offset += 8
+        if raw_size == 0 or raw_size > DELTA_FRAME_SIZE or stored_size > raw_size:
+            raise ValueError(f"invalid frame of {raw_size} bytes stored in {stored_size}")
+        stored = data[offset:offset + stored_size]
+        offset += stored_size
+        if stored_size < raw_size:
+            stored = lz4_decompress_block(stored, raw_size)
+        operations += stored
+    return bytes(operations)
+
+
+class InPlaceFlash:
+    """The assets partition while a patch is applied in place, checks every base read like the device"""
+
+    def __init__(self, base, window, sector_size):
+        self.flash = bytearray(base)
+        self.base_size = len(base)
+        self.window = window
+        self.sector_size = sector_size
+        self.ring = {}
+        self.written_end = 0
+        self.sectors_written = 0
+        self.sectors_unchanged = 0
+
+    def read_base(self, offset, size):
+        if offset < 0 or offset + size > self.base_size:
+            raise ValueError(f"base read of {size} bytes at {offset} is out of range")
+        if self.window == 0:
+            return bytes(self.flash[offset:offset + size])
+        data = bytearray()
+        while size > 0 and offset < self.written_end:
+            if offset + self.window < self.written_end:
+                raise ValueError(f"base at {offset} was overwritten, the patch needs a window over {self.window} bytes")
+            sector, in_sector = divmod(offset, self.sector_size)
+            length = min(size, self.sector_size - in_sector, self.written_end - offset)
+            data += self.ring[sector][in_sector:in_sector + length]
+            offset += length
+            size -= length
+        return bytes(data + self.flash[offset:offset + size])
+
+    def write_sector(self, data):
+        offset = self.written_end
+        self.written_end += len(data)
+        if self.window > 0 and offset < self.base_size:
+            sector = offset // self.sector_size
+            self.ring[sector] = bytes(self.flash[offset:min(offset + self.sector_size, self.base_size)])
+            self.ring.pop(sector - self.window // self.sector_size, None)
+            if self.flash[offset:offset + len(data)] == data:
+                self.sectors_unchanged += 1
+                return
+        self.sectors_written += 1
+        if self.window == 0:
+            # The target goes to another partition, the base stays as it is
+            return
+        end = offset + len(data)
+        if end > len(self.flash):
+            self.flash += b'\xff' * (end - len(self.flash))
+        self.flash[offset:end] = data
+
+
+def apply_patch(base, patch, sector_size=4096):
+    magic, window, base_size, base_crc, target_size, target_crc = struct.unpack_from('<6I', patch)
+    if magic != DELTA_MAGIC:
+        raise ValueError("not a delta patch")
+    if window % sector_size != 0:
+        raise ValueError(f"window {window} is not a multiple of the sector size {sector_size}")
+    if len(base) < base_size or zlib.crc32(base[:base_size]) != base_crc:
+        raise ValueError("the patch was made for a different base")
+
+    operations = decode_frames(patch, 24)
+    flash = InPlaceFlash(base[:base_size], window, sector_size)
+    target = bytearray()
+
+    def emit(data):
+        target.extend(data)
+        while len(target) - flash.written_end >= sector_size:
+            flash.write_sector(bytes(target[flash.written_end:flash.written_end + sector_size]))
+
+    position = 0
+    base_position = 0
+    while position < len(operations):
+        diff_length, extra_length, seek = struct.unpack_from('<IIi', operations, position)
+        position += 12
+        if len(target) + diff_length + extra_length > target_size:
+            raise ValueError(f"operation at {len(target)} runs past the target size {target_size}")
+        diff_end = position + diff_length
+        # Read the base like the device, never across a target sector boundary
+        while position < diff_end:
+            size = min(diff_end - position, sector_size - len(target) % sector_size)
+            emit(diff_bytes_add(flash.read_base(base_position, size), operations[position:position + size]))
+            base_position += size
+            position += size
+        emit(operations[position:position + extra_length])
+        position += extra_length
+        base_position += seek
+
+    if len(target) != target_size:
+        raise ValueError(f"the patch ended at {len(target)} of {target_size} bytes")
+    if len(target) > flash.written_end:
+        flash.write_sector(bytes(target[flash.written_end:]))
+    result = bytes(flash.flash[:target_size]) if window > 0 else bytes(target)
+    if zlib.crc32(result) != target_crc:
+        raise ValueError("the patched image does not match the target digest")
+    return result, flash
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Create and check delta patches')
+    subparsers = parser.add_subparsers(dest='command', required=True)
+    create = subparsers.add_parser('create', help='Create a patch from base to target')
+    create.add_argument('base')
+    create.add_argument('target')
+    create.add_argument('patch')
+    create.add_argument('--window', type=int, default=0,
+                        help='Apply in place, reading at most this many bytes behind the write position (assets: 262144)')
+    apply = subparsers.add_parser('apply', help='Apply a patch like the device and check the result')
+    apply.add_argument('base')
+    apply.add_argument('patch')
+    apply.add_argument('target', nargs='?')
+    apply.add_argument('--sector-size', type=int, default=4096)
+    args = parser.parse_args()
+
+    if args.command == 'create':
+        with open(args.base, 'rb') as f:
+            base = f.read()
+        with open(args.target, 'rb') as f:
+            target = f.read()
+        patch = create_patch(base, target, args.window)
+        result, _ = apply_patch(base, patch)
+        if result != target:
+            print("Error: the patch does not reproduce the target", file=sys.stderr)
+            sys.exit(1)
+        with open(args.patch, 'wb') as f:
+            f.write(patch)
+        print(f"Patch {args.patch}: {len(patch)} bytes for a {len(target)} byte target ({100 * len(patch) / max(len(target), 1):.1f}%)")
+    else:
+        with open(args.base, 'rb') as f:
+            base = f.read()
+        with open(args.patch, 'rb') as f:
+            patch = f.read()
+        try:
+            result, flash = apply_patch(base, patch, args.sector_size)
+        except ValueError as e:
+            print(f"Error: {e}", file=sys.stderr)
+            sys.exit(1)
+        print(f"Patched {len(result)} bytes, {flash.sectors_written} sectors written, {flash.sectors_unchanged} unchanged")
+        if args.target:
+            with open(args.target, 'rb') as f:
+                expected = f.read()
+            if result != expected:
+                print("Error: the result differs from the target", file=sys.stderr)
+                sys.exit(1)
+            print("The result matches the target")
+
+
+if __name__ == '__main__':
+    main()
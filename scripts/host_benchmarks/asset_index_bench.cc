@@ -0,0 +1,187 @@
+// Compares the asset lookup of Assets::LvglStrategy before (a std::map built from the mmap table
+// at every InitializePartition) and after (binary search of the sorted table in place).
+// Usage: asset_index_bench [assets] [iterations]
+
+#include "bench_common.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string_view>
+
+BENCH_DEFINE_ALLOCATION_COUNTER()
+
+// Same layout as main/assets.cc
+struct mmap_assets_table {
+    char asset_name[32];
+    uint32_t asset_size;
+    uint32_t asset_offset;
+    uint16_t asset_width;
+    uint16_t asset_height;
+};
+
+struct Asset {
+    size_t size;
+    size_t offset;
+};
+
+static std::string_view AssetName(const mmap_assets_table& item) {
+    return std::string_view(item.asset_name, strnlen(item.asset_name, sizeof(item.asset_name)));
+}
+
+// A pack shaped like the default assets: emoji images, fonts, models and index.json
+struct Pack {
+    std::vector<char> data;
+    std::vector<std::string> names;
+
+    uint32_t files() const { return *(const uint32_t*)data.data(); }
+    const mmap_assets_table* table() const { return (const mmap_assets_table*)(data.data() + 12); }
+};
+
+static Pack BuildPack(size_t count, bool sorted) {
+    static const char* kEmotions[] = { "neutral", "happy", "laughing", "funny", "sad", "angry", "crying",
+        "loving", "embarrassed", "surprised", "shocked", "thinking", "winking", "cool", "relaxed" };
+    Pack pack;
+    pack.names.push_back("index.json");
+    pack.names.push_back("srmodels.bin");
+    pack.names.push_back("font_puhui_common_20_4.bin");
+    for (size_t i = 0; pack.names.size() < count; i++) {
+        std::string name = kEmotions[i % 15];
+        name += "_" + std::to_string(i / 15) + (i % 3 == 0 ? ".gif" : ".png");
+        pack.names.push_back(name);
+    }
+
+    // The old scripts order by extension and basename, the current ones by the name bytes
+    if (sorted) {
+        std::sort(pack.names.begin(), pack.names.end());
+    } else {
+        std::sort(pack.names.begin(), pack.names.end(), [](const std::string& a, const std::string& b) {
+            auto ea = a.substr(a.rfind('.')), eb = b.substr(b.rfind('.'));
+            return ea != eb ? ea < eb : a < b;
+        });
+    }
+
+    std::vector<mmap_assets_table> table(pack.names.size());
+    uint32_t offset = 0;
+    for (size_t i = 0; i < table.size(); i++) {
+        memset(&table[i], 0, sizeof(table[i]));
+        strncpy(table[i].asset_name, pack.names[i].c_str(), sizeof(table[i].asset_name));
+        table[i].asset_size = 64 + pack.names[i].size() * 3;
+        table[i].asset_offset = offset;
+        offset += 2 + table[i].asset_size;
+    }
+
+    uint32_t header[3] = { (uint32_t)table.size(), 0, (uint32_t)(table.size() * sizeof(mmap_assets_table) + offset) };
+    pack.data.resize(12 + table.size() * sizeof(mmap_assets_table) + offset, 'Z');
+    memcpy(pack.data.data(), header, sizeof(header));
+    memcpy(pack.data.data() + 12, table.data(), table.size() * sizeof(mmap_assets_table));
+    return pack;
+}
+
+// The index InitializePartition used to build
+static std::map<std::string, Asset> BuildMap(const Pack& pack) {
+    std::map<std::string, Asset> assets;
+    uint32_t files = pack.files();
+    for (uint32_t i = 0; i < files; i++) {
+        auto item = &pack.table()[i];
+        assets[std::string(AssetName(*item))] = Asset{ item->asset_size, 12 + sizeof(mmap_assets_table) * files + item->asset_offset };
+    }
+    return assets;
+}
+
+static bool IsSorted(const Pack& pack) {
+    uint32_t files = pack.files();
+    auto table = pack.table();
+    for (uint32_t i = 1; i < files; i++) {
+        if (!(AssetName(table[i - 1]) < AssetName(table[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool FindInTable(const Pack& pack, const std::string& name, Asset& asset) {
+    uint32_t files = pack.files();
+    // Names are NUL padded to the field, longer ones can not be in the table
+    if (name.size() > sizeof(mmap_assets_table::asset_name)) {
+        return false;
+    }
+    auto end = pack.table() + files;
+    auto item = std::lower_bound(pack.table(), end, name, [](const mmap_assets_table& item, const std::string& name) {
+        return strncmp(item.asset_name, name.c_str(), sizeof(item.asset_name)) < 0;
+    });
+    if (item == end || strncmp(item->asset_name, name.c_str(), sizeof(item->asset_name)) != 0) {
+        return false;
+    }
+    asset.size = item->asset_size;
+    asset.offset = 12 + sizeof(mmap_assets_table) * files + item->asset_offset;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::stoul(argv[1]) : 500;
+    size_t iterations = argc > 2 ? std::stoul(argv[2]) : 2000;
+
+    auto old_pack = BuildPack(count, false);
+    auto new_pack = BuildPack(count, true);
+    if (IsSorted(old_pack) || !IsSorted(new_pack)) {
+        printf("Pack order check failed\n");
+        return 1;
+    }
+
+    // Lookups follow the firmware: index.json, the font, then the emoji set, plus some misses
+    std::vector<std::string> lookups = old_pack.names;
+    std::shuffle(lookups.begin(), lookups.end(), std::mt19937(42));
+    for (size_t i = 0; i < lookups.size() / 10; i++) {
+        lookups.push_back("missing_" + std::to_string(i) + ".png");
+    }
+
+    auto map = BuildMap(old_pack);
+    for (const auto& name : lookups) {
+        auto it = map.find(name);
+        Asset asset;
+        bool found = FindInTable(new_pack, name, asset);
+        if ((it != map.end()) != found || (found && it->second.size != asset.size)) {
+            printf("Lookup mismatch for %s\n", name.c_str());
+            return 1;
+        }
+    }
+
+    printf("%zu assets, %zu lookups per pass (10%% misses)\n\n", count, lookups.size());
+    printf("%-24s %14s %14s %14s\n", "", "init_us", "init_allocs", "init_bytes");
+
+    AllocationCounter::Reset();
+    double map_init = TimeIt(iterations / 10 + 1, [&]() { DoNotOptimize(BuildMap(old_pack).size()); });
+    size_t map_allocs = AllocationCounter::count / (iterations / 10 + 1);
+    size_t map_bytes = AllocationCounter::bytes / (iterations / 10 + 1);
+    printf("%-24s %14.1f %14zu %14zu\n", "std::map (before)", map_init / 1000, map_allocs, map_bytes);
+
+    AllocationCounter::Reset();
+    double sorted_init = TimeIt(iterations / 10 + 1, [&]() { DoNotOptimize(IsSorted(new_pack)); });
+    size_t sorted_allocs = AllocationCounter::count / (iterations / 10 + 1);
+    size_t sorted_bytes = AllocationCounter::bytes / (iterations / 10 + 1);
+    printf("%-24s %14.1f %14zu %14zu\n", "sorted table (after)", sorted_init / 1000, sorted_allocs, sorted_bytes);
+
+    printf("\n%-24s %14s %14s\n", "", "ns/lookup", "allocs/lookup");
+
+    AllocationCounter::Reset();
+    double map_lookup = TimeIt(iterations, [&]() {
+        for (const auto& name : lookups) {
+            auto it = map.find(name);
+            DoNotOptimize(it == map.end() ? 0 : it->second.offset);
+        }
+    }) / lookups.size();
+    printf("%-24s %14.1f %14.3f\n", "std::map (before)", map_lookup, (double)AllocationCounter::count / iterations / lookups.size());
+
+    AllocationCounter::Reset();
+    double table_lookup = TimeIt(iterations, [&]() {
+        for (const auto& name : lookups) {
+            Asset asset;
+            DoNotOptimize(FindInTable(new_pack, name, asset) ? asset.offset : 0);
+        }
+    }) / lookups.size();
+    printf("%-24s %14.1f %14.3f\n", "sorted table (after)", table_lookup, (double)AllocationCounter::count / iterations / lookups.size());
+    return 0;
+}
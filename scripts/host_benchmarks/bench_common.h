@@ -0,0 +1,78 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+
+// Heap allocation counter shared by all benchmarks (operator new is replaced in the executable)
+// Atomic so benchmarks with producer threads stay race free
+struct AllocationCounter {
+    static inline std::atomic<size_t> count = 0;
+    static inline std::atomic<size_t> bytes = 0;
+    static void Reset() { count = 0; bytes = 0; }
+};
+
+// The array forms are replaced too, so every new and delete pairs up on the same malloc / free.
+// GCC still takes the free() in operator delete for a mismatch with the builtin operator new once
+// both are inlined, -Wmismatched-new-delete is off for these definitions only
+#if defined(__GNUC__) && !defined(__clang__)
+#define BENCH_ALLOCATION_WARNINGS_OFF                                               \
+    _Pragma("GCC diagnostic push")                                                  \
+    _Pragma("GCC diagnostic ignored \"-Wmismatched-new-delete\"")
+#define BENCH_ALLOCATION_WARNINGS_ON _Pragma("GCC diagnostic pop")
+#else
+#define BENCH_ALLOCATION_WARNINGS_OFF
+#define BENCH_ALLOCATION_WARNINGS_ON
+#endif
+
+#define BENCH_DEFINE_ALLOCATION_COUNTER()                                           \
+    BENCH_ALLOCATION_WARNINGS_OFF                                                   \
+    void* operator new(size_t size) {                                               \
+        AllocationCounter::count++;                                                 \
+        AllocationCounter::bytes += size;                                           \
+        if (void* p = std::malloc(size ? size : 1)) return p;                       \
+        throw std::bad_alloc();                                                     \
+    }                                                                               \
+    void* operator new[](size_t size) { return operator new(size); }                \
+    void operator delete(void* p) noexcept { std::free(p); }                        \
+    void operator delete(void* p, size_t) noexcept { std::free(p); }                \
+    void operator delete[](void* p) noexcept { std::free(p); }                      \
+    void operator delete[](void* p, size_t) noexcept { std::free(p); }              \
+    BENCH_ALLOCATION_WARNINGS_ON
+
+inline std::vector<std::string> ReadLines(const std::string& path) {
+    std::vector<std::string> lines;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty()) {
+            lines.push_back(line);
+        }
+    }
+    return lines;
+}
+
+// Runs fn() iterations times and returns nanoseconds per call
+template <typename Fn>
+double TimeIt(size_t iterations, Fn&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        fn();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+// Prevents the compiler from optimizing away a result
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif // BENCH_COMMON_H
@@ -0,0 +1,110 @@
+// Applies a patch from scripts/delta_patch.py with DeltaPatcher the way Assets::DownloadDelta()
+// does, in place over a simulated assets partition holding the base, and checks the result.
+// The patch is fed in pieces of random size like HTTP reads. Reported are the flash sectors
+// the patch writes and the flash time that takes on the device, next to a full download.
+// Usage: delta_patch_check <base> <patch> <target>
+
+#include "bench_common.h"
+#include "delta_patcher.h"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+#define SECTOR_SIZE 4096
+
+// Typical SPI NOR flash timings, as in download_pipeline_bench
+#define SECTOR_ERASE_US 30000
+#define PAGE_PROGRAM_US 500
+#define PAGE_SIZE 256
+
+int host_log_level = 1;
+
+static bool ReadFile(const char* path, std::vector<char>& data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        printf("Failed to open %s\n", path);
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static double FlashMs(size_t sectors) {
+    return sectors * (SECTOR_ERASE_US + SECTOR_SIZE / PAGE_SIZE * PAGE_PROGRAM_US) / 1000.0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        printf("Usage: %s <base> <patch> <target>\n", argv[0]);
+        return 1;
+    }
+    std::vector<char> base, patch, target;
+    if (!ReadFile(argv[1], base) || !ReadFile(argv[2], patch) || !ReadFile(argv[3], target)) {
+        return 1;
+    }
+
+    DeltaHeader header;
+    if (patch.size() < DELTA_HEADER_SIZE || !DeltaPatcher::ParseHeader(patch.data(), header)) {
+        printf("%s is not a delta patch\n", argv[2]);
+        return 1;
+    }
+    if (header.base_size != base.size() || header.target_size != target.size()) {
+        printf("The patch is for a %u byte base and a %u byte target\n", header.base_size, header.target_size);
+        return 1;
+    }
+
+    // The partition: in place the target overwrites the base, otherwise it goes to a second one
+    std::vector<char> flash = base;
+    std::vector<char> output(header.window > 0 ? 0 : target.size(), (char)0xFF);
+    auto& target_flash = header.window > 0 ? flash : output;
+    size_t base_reads = 0;
+    DeltaPatcher patcher(header, SECTOR_SIZE,
+        [&](size_t offset, char* data, size_t size) {
+            base_reads += size;
+            memcpy(data, flash.data() + offset, size);
+            return true;
+        },
+        [&](size_t offset, const char* data, size_t size) {
+            if (target_flash.size() < offset + SECTOR_SIZE) {
+                target_flash.resize(offset + SECTOR_SIZE, (char)0xFF);
+            }
+            memset(target_flash.data() + offset, 0xFF, SECTOR_SIZE);
+            memcpy(target_flash.data() + offset, data, size);
+            return true;
+        });
+
+    std::mt19937 random(42);
+    std::uniform_int_distribution<size_t> read_size(1, 1436);
+    auto start = std::chrono::steady_clock::now();
+    size_t position = DELTA_HEADER_SIZE;
+    while (position < patch.size()) {
+        size_t length = std::min(read_size(random), patch.size() - position);
+        if (!patcher.Feed(patch.data() + position, length)) {
+            printf("The patch failed at byte %zu\n", position);
+            return 1;
+        }
+        position += length;
+    }
+    if (!patcher.Finish()) {
+        printf("The patch did not complete\n");
+        return 1;
+    }
+    double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (target_flash.size() < target.size() || memcmp(target_flash.data(), target.data(), target.size()) != 0) {
+        printf("The patched image differs from the target\n");
+        return 1;
+    }
+
+    auto& stats = patcher.stats();
+    size_t full_sectors = (target.size() + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    printf("%s, window %u bytes: the patched image matches the target\n\n", header.window > 0 ? "In place" : "To a second partition",
+        header.window);
+    printf("%-18s %12s %12s %16s\n", "", "download", "sectors", "flash_ms");
+    printf("%-18s %12zu %12zu %16.0f\n", "full download", target.size(), full_sectors, FlashMs(full_sectors));
+    printf("%-18s %12zu %12zu %16.0f\n", "patch", patch.size(), stats.sectors_written, FlashMs(stats.sectors_written));
+    printf("\n%zu sectors left unchanged, %zu base bytes read, patched in %.1f ms on this machine\n",
+        stats.sectors_unchanged, base_reads, elapsed_ms);
+    return 0;
+}
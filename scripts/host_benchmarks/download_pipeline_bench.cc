@@ -0,0 +1,161 @@
+// Compares the assets download loop before (512 byte HTTP reads, each followed by a sector
+// erase when needed and the flash write, all on one task) and after (WritePipeline: whole
+// buffers handed to a writer thread that erases 64 KB blocks where aligned).
+// The network and the flash are simulated with sleeps, time is scaled down by --scale.
+// Usage: download_pipeline_bench [image_kb] [scale]
+
+#include "bench_common.h"
+#include "write_pipeline.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#define SECTOR_SIZE 4096
+#define BLOCK_SIZE (64 * 1024)
+
+// Typical SPI NOR flash timings (GD25Q/W25Q datasheets)
+#define SECTOR_ERASE_US 30000
+#define BLOCK_ERASE_US 120000
+#define PAGE_PROGRAM_US 500
+#define PAGE_SIZE 256
+// CONFIG_LWIP_TCP_WND_DEFAULT, the repo keeps the ESP-IDF default
+#define TCP_WINDOW_SIZE 5760
+
+static double time_scale = 10;
+
+int64_t esp_timer_get_time() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void Busy(int64_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(int64_t(us / time_scale)));
+}
+
+// Delivers at most one TCP segment per read at a fixed rate. While nobody reads, the link
+// only runs ahead by the TCP receive window, then the sender stalls.
+class SimulatedHttp {
+public:
+    SimulatedHttp(size_t size, size_t bytes_per_second) : size_(size), rate_(bytes_per_second) {
+        arrival_ = std::chrono::steady_clock::now();
+    }
+
+    int Read(char* buffer, size_t size) {
+        size_t length = std::min({ size, size_ - sent_, (size_t)1436 });
+        if (length == 0) {
+            return 0;
+        }
+        auto window_start = std::chrono::steady_clock::now() - Scaled(TCP_WINDOW_SIZE);
+        arrival_ = std::max(arrival_, window_start) + Scaled(length);
+        sent_ += length;
+        std::this_thread::sleep_until(arrival_);
+        memset(buffer, 0x5A, length);
+        return length;
+    }
+
+private:
+    size_t size_;
+    size_t sent_ = 0;
+    double rate_;
+    std::chrono::steady_clock::time_point arrival_;
+
+    std::chrono::nanoseconds Scaled(size_t bytes) const {
+        return std::chrono::nanoseconds(int64_t(bytes * 1e9 / rate_ / time_scale));
+    }
+};
+
+class SimulatedFlash {
+public:
+    void Erase(size_t size) {
+        Busy(size == BLOCK_SIZE ? BLOCK_ERASE_US : SECTOR_ERASE_US);
+    }
+    void Write(size_t size) {
+        Busy((size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_PROGRAM_US);
+    }
+};
+
+// Assets::Download() before
+static double RunSerial(size_t image_size, size_t rate) {
+    SimulatedHttp http(image_size, rate);
+    SimulatedFlash flash;
+    char buffer[512];
+    size_t total_written = 0;
+    size_t current_sector = 0;
+    auto start = esp_timer_get_time();
+    while (true) {
+        int ret = http.Read(buffer, sizeof(buffer));
+        if (ret == 0) {
+            break;
+        }
+        size_t needed_sectors = (total_written + ret + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        while (current_sector < needed_sectors) {
+            flash.Erase(SECTOR_SIZE);
+            current_sector++;
+        }
+        flash.Write(ret);
+        total_written += ret;
+    }
+    return (esp_timer_get_time() - start) * time_scale / 1000;
+}
+
+// Assets::DownloadRange() after
+static double RunPipeline(size_t image_size, size_t rate, bool block_erase, WritePipelineStats& stats) {
+    SimulatedHttp http(image_size, rate);
+    SimulatedFlash flash;
+    size_t erased_end = 0;
+    WritePipeline pipeline(8192, 4, [&](size_t offset, const char*, size_t size) {
+        while (erased_end < offset + size) {
+            size_t erase_size = block_erase && erased_end % BLOCK_SIZE == 0 ? BLOCK_SIZE : SECTOR_SIZE;
+            flash.Erase(erase_size);
+            erased_end += erase_size;
+        }
+        flash.Write(size);
+        return true;
+    });
+
+    auto start = esp_timer_get_time();
+    std::thread writer([&pipeline]() { pipeline.RunWriter(); });
+    size_t received = 0;
+    while (received < image_size) {
+        char* buffer = pipeline.Acquire();
+        size_t length = std::min(pipeline.buffer_size(), image_size - received);
+        size_t filled = 0;
+        while (filled < length) {
+            filled += http.Read(buffer + filled, length - filled);
+        }
+        pipeline.Submit(filled);
+        received += filled;
+    }
+    pipeline.Finish();
+    writer.join();
+    stats = pipeline.stats();
+    return (esp_timer_get_time() - start) * time_scale / 1000;
+}
+
+int main(int argc, char** argv) {
+    size_t image_size = (argc > 1 ? std::stoul(argv[1]) : 1024) * 1024;
+    time_scale = argc > 2 ? std::stod(argv[2]) : 10;
+
+    printf("%zu KB image, sector erase %d ms, block erase %d ms, %d us per %d byte page, %d byte TCP window (time scaled by 1/%g)\n\n",
+        image_size / 1024, SECTOR_ERASE_US / 1000, BLOCK_ERASE_US / 1000, PAGE_PROGRAM_US, PAGE_SIZE, TCP_WINDOW_SIZE, time_scale);
+    printf("%-10s %-30s %10s %10s %14s %14s\n", "network", "", "ms", "KB/s", "reader_wait", "writer_wait");
+
+    for (size_t rate_kb : { 100, 250, 500, 1000 }) {
+        size_t rate = rate_kb * 1024;
+        char network[16];
+        snprintf(network, sizeof(network), "%zu KB/s", rate_kb);
+
+        double ms = RunSerial(image_size, rate);
+        printf("%-10s %-30s %10.0f %10.0f %14s %14s\n", network, "serial 512 B (before)", ms, image_size / 1024 / (ms / 1000), "-", "-");
+
+        WritePipelineStats stats;
+        ms = RunPipeline(image_size, rate, false, stats);
+        printf("%-10s %-30s %10.0f %10.0f %12.0fms %12.0fms\n", "", "pipeline, sector erase", ms, image_size / 1024 / (ms / 1000),
+            stats.reader_wait_us * time_scale / 1000, stats.writer_wait_us * time_scale / 1000);
+
+        ms = RunPipeline(image_size, rate, true, stats);
+        printf("%-10s %-30s %10.0f %10.0f %12.0fms %12.0fms\n", "", "pipeline, block erase (after)", ms, image_size / 1024 / (ms / 1000),
+            stats.reader_wait_us * time_scale / 1000, stats.writer_wait_us * time_scale / 1000);
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+// Compares the cJSON DOM path with JsonReader for incoming server control messages.
+// Usage: json_reader_bench [messages.jsonl] [iterations]
+
+#include "bench_common.h"
+#include "json_reader.h"
+
+#include <cJSON.h>
+#include <cstring>
+
+BENCH_DEFINE_ALLOCATION_COUNTER()
+
+static size_t cjson_allocations = 0;
+
+static void* CountingMalloc(size_t size) {
+    cjson_allocations++;
+    return std::malloc(size);
+}
+
+// What the firmware did before: build a DOM, strcmp on type, copy strings out
+static size_t DispatchWithCJson(const std::string& message) {
+    size_t work = 0;
+    cJSON* root = cJSON_Parse(message.c_str());
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (!cJSON_IsString(type)) {
+        cJSON_Delete(root);
+        return 0;
+    }
+    if (strcmp(type->valuestring, "tts") == 0) {
+        auto state = cJSON_GetObjectItem(root, "state");
+        if (strcmp(state->valuestring, "sentence_start") == 0) {
+            auto text = cJSON_GetObjectItem(root, "text");
+            std::string copy(text->valuestring);
+            work += copy.size();
+        }
+    } else if (strcmp(type->valuestring, "stt") == 0 || strcmp(type->valuestring, "llm") == 0) {
+        auto text = cJSON_GetObjectItem(root, strcmp(type->valuestring, "stt") == 0 ? "text" : "emotion");
+        std::string copy(text->valuestring);
+        work += copy.size();
+    } else if (strcmp(type->valuestring, "mcp") == 0) {
+        auto payload = cJSON_GetObjectItem(root, "payload");
+        auto method = cJSON_GetObjectItem(payload, "method");
+        auto id = cJSON_GetObjectItem(payload, "id");
+        work += strlen(method->valuestring) + id->valueint;
+    } else if (strcmp(type->valuestring, "hello") == 0) {
+        auto audio_params = cJSON_GetObjectItem(root, "audio_params");
+        work += cJSON_GetObjectItem(audio_params, "sample_rate")->valueint;
+    } else {
+        work += strlen(type->valuestring);
+    }
+    cJSON_Delete(root);
+    return work;
+}
+
+// The new path: validate in place, dispatch on string views, parse only the MCP payload
+static size_t DispatchWithReader(const std::string& message) {
+    size_t work = 0;
+    auto root = JsonReader::Parse(message);
+    auto type = root["type"];
+    if (!type.IsString()) {
+        return 0;
+    }
+    if (type.Equals("tts")) {
+        if (root["state"].Equals("sentence_start")) {
+            work += root["text"].ToString().size();
+        }
+    } else if (type.Equals("stt") || type.Equals("llm")) {
+        work += root[type.Equals("stt") ? "text" : "emotion"].ToString().size();
+    } else if (type.Equals("mcp")) {
+        auto payload = root["payload"].raw();
+        cJSON* json = cJSON_ParseWithLength(payload.data(), payload.size());
+        auto method = cJSON_GetObjectItem(json, "method");
+        auto id = cJSON_GetObjectItem(json, "id");
+        work += strlen(method->valuestring) + id->valueint;
+        cJSON_Delete(json);
+    } else if (type.Equals("hello")) {
+        work += root["audio_params"]["sample_rate"].ToInt();
+    } else {
+        work += type.string_view().size();
+    }
+    return work;
+}
+
+int main(int argc, char** argv) {
+    std::string path = argc > 1 ? argv[1] : DATA_DIR "/control_messages.jsonl";
+    size_t iterations = argc > 2 ? strtoul(argv[2], nullptr, 10) : 20000;
+
+    auto messages = ReadLines(path);
+    if (messages.empty()) {
+        fprintf(stderr, "No messages in %s\n", path.c_str());
+        return 1;
+    }
+
+    cJSON_Hooks hooks = { CountingMalloc, std::free };
+    cJSON_InitHooks(&hooks);
+
+    printf("%-12s %8s %12s %12s %14s %14s\n", "type", "bytes", "cjson ns", "reader ns", "cjson allocs", "reader allocs");
+    double total_cjson = 0, total_reader = 0;
+    for (const auto& message : messages) {
+        auto root = JsonReader::Parse(message);
+        if (!root.IsValid()) {
+            fprintf(stderr, "Invalid message: %s\n", message.c_str());
+            return 1;
+        }
+        if (DispatchWithCJson(message) != DispatchWithReader(message)) {
+            fprintf(stderr, "Results differ for: %s\n", message.c_str());
+            return 1;
+        }
+
+        cjson_allocations = 0;
+        AllocationCounter::Reset();
+        DispatchWithCJson(message);
+        size_t cjson_allocs = cjson_allocations + AllocationCounter::count;
+        cjson_allocations = 0;
+        AllocationCounter::Reset();
+        DispatchWithReader(message);
+        size_t reader_allocs = cjson_allocations + AllocationCounter::count;
+
+        double cjson_ns = TimeIt(iterations, [&]() { DoNotOptimize(DispatchWithCJson(message)); });
+        double reader_ns = TimeIt(iterations, [&]() { DoNotOptimize(DispatchWithReader(message)); });
+        total_cjson += cjson_ns;
+        total_reader += reader_ns;
+        printf("%-12s %8zu %12.0f %12.0f %14zu %14zu\n", root["type"].ToString().c_str(), message.size(),
+            cjson_ns, reader_ns, cjson_allocs, reader_allocs);
+    }
+    printf("average: cjson %.0f ns, reader %.0f ns per message (%.2fx)\n", total_cjson / messages.size(),
+        total_reader / messages.size(), total_cjson / total_reader);
+    return 0;
+}
@@ -0,0 +1,176 @@
+// Compares building outgoing control messages with cJSON against JsonWriter into a reused buffer.
+// Every message is checked to be byte for byte identical to the cJSON output first.
+// Usage: json_writer_bench [iterations]
+
+#include "bench_common.h"
+#include "json_writer.h"
+
+#include <cJSON.h>
+#include <cstring>
+#include <functional>
+
+BENCH_DEFINE_ALLOCATION_COUNTER()
+
+static size_t cjson_allocations = 0;
+
+static void* CountingMalloc(size_t size) {
+    cjson_allocations++;
+    return std::malloc(size);
+}
+
+static const std::string kSessionId = "3f1c2a9e-6b4d-4e8a-9c1f-2d7e5b0a8c43";
+static const std::string kWakeWord = "你好\"小智\"";
+static const std::string kMcpPayload = "{\"jsonrpc\":\"2.0\",\"id\":7,\"result\":{\"content\":[{\"type\":\"text\",\"text\":\"true\"}],\"isError\":false}}";
+
+static std::string PrintAndDelete(cJSON* root) {
+    char* json_str = cJSON_PrintUnformatted(root);
+    std::string result(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return result;
+}
+
+struct Case {
+    const char* name;
+    std::function<std::string()> cjson;
+    std::function<void(std::string&)> writer;
+};
+
+static std::vector<Case> MakeCases() {
+    std::vector<Case> cases;
+    cases.push_back({"listen", []() {
+        cJSON* root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "session_id", kSessionId.c_str());
+        cJSON_AddStringToObject(root, "type", "listen");
+        cJSON_AddStringToObject(root, "state", "start");
+        cJSON_AddStringToObject(root, "mode", "auto");
+        return PrintAndDelete(root);
+    }, [](std::string& buffer) {
+        JsonWriter writer(buffer);
+        writer.BeginObject().Member("session_id", kSessionId).Member("type", "listen")
+            .Member("state", "start").Member("mode", "auto").EndObject();
+    }});
+    cases.push_back({"abort", []() {
+        cJSON* root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "session_id", kSessionId.c_str());
+        cJSON_AddStringToObject(root, "type", "abort");
+        cJSON_AddStringToObject(root, "reason", "wake_word_detected");
+        return PrintAndDelete(root);
+    }, [](std::string& buffer) {
+        JsonWriter writer(buffer);
+        writer.BeginObject().Member("session_id", kSessionId).Member("type", "abort")
+            .Member("reason", "wake_word_detected").EndObject();
+    }});
+    cases.push_back({"detect", []() {
+        cJSON* root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "session_id", kSessionId.c_str());
+        cJSON_AddStringToObject(root, "type", "listen");
+        cJSON_AddStringToObject(root, "state", "detect");
+        cJSON_AddStringToObject(root, "text", kWakeWord.c_str());
+        return PrintAndDelete(root);
+    }, [](std::string& buffer) {
+        JsonWriter writer(buffer);
+        writer.BeginObject().Member("session_id", kSessionId).Member("type", "listen")
+            .Member("state", "detect").Member("text", kWakeWord).EndObject();
+    }});
+    cases.push_back({"mcp", []() {
+        cJSON* root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "session_id", kSessionId.c_str());
+        cJSON_AddStringToObject(root, "type", "mcp");
+        cJSON_AddItemToObject(root, "payload", cJSON_Parse(kMcpPayload.c_str()));
+        return PrintAndDelete(root);
+    }, [](std::string& buffer) {
+        JsonWriter writer(buffer);
+        writer.BeginObject().Member("session_id", kSessionId).Member("type", "mcp")
+            .Key("payload").Raw(kMcpPayload).EndObject();
+    }});
+    cases.push_back({"hello", []() {
+        cJSON* root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "type", "hello");
+        cJSON_AddNumberToObject(root, "version", 1);
+        cJSON* features = cJSON_CreateObject();
+        cJSON_AddBoolToObject(features, "mcp", true);
+        cJSON_AddItemToObject(root, "features", features);
+        cJSON_AddStringToObject(root, "transport", "websocket");
+        cJSON* audio_params = cJSON_CreateObject();
+        cJSON_AddStringToObject(audio_params, "format", "opus");
+        cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
+        cJSON_AddNumberToObject(audio_params, "channels", 1);
+        cJSON_AddNumberToObject(audio_params, "frame_duration", 60);
+        cJSON_AddItemToObject(root, "audio_params", audio_params);
+        return PrintAndDelete(root);
+    }, [](std::string& buffer) {
+        JsonWriter writer(buffer);
+        writer.BeginObject().Member("type", "hello").Member("version", 1);
+        writer.Key("features").BeginObject().Member("mcp", true).EndObject();
+        writer.Member("transport", "websocket");
+        writer.Key("audio_params").BeginObject().Member("format", "opus").Member("sample_rate", 16000)
+            .Member("channels", 1).Member("frame_duration", 60).EndObject();
+        writer.EndObject();
+    }});
+    // One tools/list entry, shaped like McpTool::to_json()
+    cases.push_back({"tool", []() {
+        cJSON* root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "name", "self.audio_speaker.set_volume");
+        cJSON_AddStringToObject(root, "description", "Set the volume of the audio speaker.\nIf the current volume is unknown, call `self.get_device_status` first.");
+        cJSON* input_schema = cJSON_CreateObject();
+        cJSON_AddStringToObject(input_schema, "type", "object");
+        cJSON* properties = cJSON_CreateObject();
+        cJSON* volume = cJSON_CreateObject();
+        cJSON_AddStringToObject(volume, "type", "integer");
+        cJSON_AddNumberToObject(volume, "minimum", 0);
+        cJSON_AddNumberToObject(volume, "maximum", 100);
+        cJSON_AddItemToObject(properties, "volume", volume);
+        cJSON_AddItemToObject(input_schema, "properties", properties);
+        cJSON* required = cJSON_CreateArray();
+        cJSON_AddItemToArray(required, cJSON_CreateString("volume"));
+        cJSON_AddItemToObject(input_schema, "required", required);
+        cJSON_AddItemToObject(root, "inputSchema", input_schema);
+        return PrintAndDelete(root);
+    }, [](std::string& buffer) {
+        JsonWriter writer(buffer);
+        writer.BeginObject().Member("name", "self.audio_speaker.set_volume")
+            .Member("description", "Set the volume of the audio speaker.\nIf the current volume is unknown, call `self.get_device_status` first.");
+        writer.Key("inputSchema").BeginObject().Member("type", "object");
+        writer.Key("properties").BeginObject().Key("volume").BeginObject().Member("type", "integer")
+            .Member("minimum", 0).Member("maximum", 100).EndObject().EndObject();
+        writer.Key("required").BeginArray().String("volume").EndArray();
+        writer.EndObject().EndObject();
+    }});
+    return cases;
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+
+    cJSON_Hooks hooks = { CountingMalloc, std::free };
+    cJSON_InitHooks(&hooks);
+
+    std::string buffer;
+    buffer.reserve(1024);   // The protocol buffer has grown to this after the first few messages
+
+    printf("%-8s %6s %12s %12s %14s %14s\n", "message", "bytes", "cjson ns", "writer ns", "cjson allocs", "writer allocs");
+    for (const auto& c : MakeCases()) {
+        std::string expected = c.cjson();
+        c.writer(buffer);
+        if (buffer != expected) {
+            fprintf(stderr, "%s differs:\n  cjson:  %s\n  writer: %s\n", c.name, expected.c_str(), buffer.c_str());
+            return 1;
+        }
+
+        cjson_allocations = 0;
+        AllocationCounter::Reset();
+        DoNotOptimize(c.cjson());
+        size_t cjson_allocs = cjson_allocations + AllocationCounter::count;
+        cjson_allocations = 0;
+        AllocationCounter::Reset();
+        c.writer(buffer);
+        size_t writer_allocs = cjson_allocations + AllocationCounter::count;
+
+        double cjson_ns = TimeIt(iterations, [&]() { DoNotOptimize(c.cjson()); });
+        double writer_ns = TimeIt(iterations, [&]() { c.writer(buffer); DoNotOptimize(buffer); });
+        printf("%-8s %6zu %12.0f %12.0f %14zu %14zu\n", c.name, buffer.size(), cjson_ns, writer_ns,
+            cjson_allocs, writer_allocs);
+    }
+    return 0;
+}
@@ -0,0 +1,232 @@
+// Compares the old Application::Schedule() path (std::function in a mutex protected std::deque)
+// with MainTaskQueue (InlineTask in bounded per-lane rings).
+// Usage: main_task_queue_bench [iterations]
+
+#include "bench_common.h"
+#include "main_task_queue.h"
+
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+BENCH_DEFINE_ALLOCATION_COUNTER()
+
+#define BURST_SIZE 8
+#define PRODUCERS 3
+
+// The code Application::Schedule() and the MAIN_EVENT_SCHEDULE handler used before
+class DequeScheduler {
+public:
+    void Schedule(std::function<void()>&& callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(callback));
+    }
+
+    size_t RunAll() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto tasks = std::move(tasks_);
+        lock.unlock();
+        for (auto& task : tasks) {
+            task();
+        }
+        return tasks.size();
+    }
+
+private:
+    std::mutex mutex_;
+    std::deque<std::function<void()>> tasks_;
+};
+
+class QueueScheduler {
+public:
+    void Schedule(InlineTask&& callback, ScheduleLane lane = kScheduleLaneControl) {
+        queue_.Push(std::move(callback), lane);
+    }
+
+    size_t RunAll() {
+        size_t count = 0;
+        InlineTask task;
+        while (queue_.Pop(task)) {
+            task();
+            task.Reset();
+            count++;
+        }
+        return count;
+    }
+
+    MainTaskQueueStats stats() const { return queue_.stats(); }
+
+private:
+    MainTaskQueue queue_;
+};
+
+static volatile size_t sink = 0;
+
+// Captures like the scheduled lambdas in the firmware
+struct Workload {
+    const char* name;
+    std::function<void(DequeScheduler&)> schedule_deque;
+    std::function<void(QueueScheduler&)> schedule_queue;
+};
+
+static std::vector<Workload> MakeWorkloads() {
+    static int state = 0;
+    static const std::string sentence = "The weather in Shanghai is sunny today, 26 degrees";
+    std::vector<Workload> workloads;
+    // SetDeviceState(...) after tts start / stop
+    workloads.push_back({"state", [](DequeScheduler& s) {
+        s.Schedule([p = &state]() { sink += *p; });
+    }, [](QueueScheduler& s) {
+        s.Schedule([p = &state]() { sink += *p; });
+    }});
+    // SetEmotion(emotion_str), short enough for the string's own small buffer
+    workloads.push_back({"emotion", [](DequeScheduler& s) {
+        s.Schedule([emotion = std::string("happy")]() { sink += emotion.size(); });
+    }, [](QueueScheduler& s) {
+        s.Schedule([emotion = std::string("happy")]() { sink += emotion.size(); }, kScheduleLaneUi);
+    }});
+    // SetChatMessage("assistant", message), the text itself allocates on both paths
+    workloads.push_back({"chat", [](DequeScheduler& s) {
+        s.Schedule([message = std::string(sentence)]() { sink += message.size(); });
+    }, [](QueueScheduler& s) {
+        s.Schedule([message = std::string(sentence)]() { sink += message.size(); }, kScheduleLaneUi);
+    }});
+    // McpServer tools/call: this, id, tool iterator and the argument list
+    workloads.push_back({"mcp", [](DequeScheduler& s) {
+        s.Schedule([p = &state, id = 7, it = (void*)nullptr, arguments = std::vector<int>{1, 2}]() {
+            sink += *p + id + arguments.size() + (it == nullptr);
+        });
+    }, [](QueueScheduler& s) {
+        s.Schedule([p = &state, id = 7, it = (void*)nullptr, arguments = std::vector<int>{1, 2}]() {
+            sink += *p + id + arguments.size() + (it == nullptr);
+        });
+    }});
+    return workloads;
+}
+
+// Position at which a control task runs when it is scheduled behind a full burst of UI updates
+static void PrintPriority() {
+    const int ui_tasks = MAIN_TASK_UI_QUEUE_SIZE;
+    int position = 0;
+    int deque_position = 0;
+    int queue_position = 0;
+
+    DequeScheduler deque_scheduler;
+    for (int i = 0; i < ui_tasks; i++) {
+        deque_scheduler.Schedule([&position]() { position++; });
+    }
+    deque_scheduler.Schedule([&position, &deque_position]() { deque_position = ++position; });
+    deque_scheduler.RunAll();
+
+    position = 0;
+    QueueScheduler queue_scheduler;
+    for (int i = 0; i < ui_tasks; i++) {
+        queue_scheduler.Schedule([&position]() { position++; }, kScheduleLaneUi);
+    }
+    queue_scheduler.Schedule([&position, &queue_position]() { queue_position = ++position; });
+    queue_scheduler.RunAll();
+
+    printf("\ncontrol task scheduled behind %d ui tasks runs at position: deque %d, queue %d\n",
+        ui_tasks, deque_position, queue_position);
+}
+
+static std::string Overflow(const DequeScheduler&) {
+    return "";
+}
+
+static std::string Overflow(const QueueScheduler& scheduler) {
+    return ", " + std::to_string(scheduler.stats().overflowed) + " overflowed";
+}
+
+// PRODUCERS threads flood the queue while the consumer drains, every task must run exactly once.
+// The rings stay full, so MainTaskQueue spills nearly everything to its overflow list here.
+template <typename Scheduler, typename ScheduleFn>
+static void RunProducers(const char* name, size_t per_producer, ScheduleFn schedule) {
+    Scheduler scheduler;
+    std::atomic<size_t> executed = 0;
+    std::atomic<int> running = PRODUCERS;
+    size_t drained = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&]() {
+            for (size_t i = 0; i < per_producer; i++) {
+                schedule(scheduler, executed);
+            }
+            running--;
+        });
+    }
+    while (running > 0 || drained < per_producer * PRODUCERS) {
+        drained += scheduler.RunAll();
+    }
+    for (auto& thread : producers) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t total = per_producer * PRODUCERS;
+    printf("%-6s %d flooding producers: %zu tasks, %zu executed, %.2f M tasks/s%s\n", name, PRODUCERS, total,
+        executed.load(), total / seconds / 1e6, Overflow(scheduler).c_str());
+    if (executed != total) {
+        fprintf(stderr, "%s lost tasks\n", name);
+        exit(1);
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+
+    printf("InlineTask storage %zu bytes, lanes control %d ui %d\n\n", (size_t)MAIN_TASK_INLINE_SIZE,
+        MAIN_TASK_CONTROL_QUEUE_SIZE, MAIN_TASK_UI_QUEUE_SIZE);
+    printf("%-8s %12s %12s %14s %14s\n", "task", "deque ns", "queue ns", "deque allocs", "queue allocs");
+
+    DequeScheduler deque_scheduler;
+    QueueScheduler queue_scheduler;
+    size_t bursts = iterations / BURST_SIZE;
+    for (const auto& w : MakeWorkloads()) {
+        // Schedule a burst, then drain it like one MAIN_EVENT_SCHEDULE wakeup, per task figures
+        auto deque_burst = [&]() {
+            for (int i = 0; i < BURST_SIZE; i++) {
+                w.schedule_deque(deque_scheduler);
+            }
+            deque_scheduler.RunAll();
+        };
+        auto queue_burst = [&]() {
+            for (int i = 0; i < BURST_SIZE; i++) {
+                w.schedule_queue(queue_scheduler);
+            }
+            queue_scheduler.RunAll();
+        };
+        deque_burst();
+        queue_burst();
+
+        AllocationCounter::Reset();
+        deque_burst();
+        double deque_allocs = (double)AllocationCounter::count / BURST_SIZE;
+        AllocationCounter::Reset();
+        queue_burst();
+        double queue_allocs = (double)AllocationCounter::count / BURST_SIZE;
+
+        double deque_ns = TimeIt(bursts, deque_burst) / BURST_SIZE;
+        double queue_ns = TimeIt(bursts, queue_burst) / BURST_SIZE;
+        printf("%-8s %12.1f %12.1f %14.2f %14.2f\n", w.name, deque_ns, queue_ns, deque_allocs, queue_allocs);
+    }
+
+    auto stats = queue_scheduler.stats();
+    printf("queue: %u overflowed, %u heap allocated tasks\n", stats.overflowed, stats.heap_allocated);
+
+    PrintPriority();
+
+    printf("\n");
+    size_t per_producer = iterations;
+    RunProducers<DequeScheduler>("deque", per_producer, [](DequeScheduler& s, std::atomic<size_t>& executed) {
+        s.Schedule([&executed]() { executed++; });
+    });
+    RunProducers<QueueScheduler>("queue", per_producer, [](QueueScheduler& s, std::atomic<size_t>& executed) {
+        s.Schedule([&executed]() { executed++; });
+    });
+    return 0;
+}
@@ -0,0 +1,252 @@
+#include "emulated_network.h"
+#include "stand_in_server.h"
+
+#include <esp_log.h>
+
+#include <atomic>
+#include <cstring>
+#include <future>
+
+#define TAG "EmulatedNetwork"
+
+// TCP handshake plus TLS 1.2 (two round trips) plus the WebSocket upgrade or MQTT CONNECT
+#define SECURE_STREAM_ROUND_TRIPS 4
+#define PLAIN_STREAM_ROUND_TRIPS 2
+
+void Mailbox::SetReceiver(std::function<void(const std::string& data, bool binary)> receiver) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    receiver_ = receiver;
+}
+
+void Mailbox::Deliver(const std::string& data, bool binary) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (receiver_ != nullptr) {
+        receiver_(data, binary);
+    }
+}
+
+void Mailbox::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    receiver_ = nullptr;
+}
+
+class EmulatedWebSocket : public WebSocket {
+public:
+    explicit EmulatedWebSocket(EmulatedNetwork& network) : network_(network) {}
+
+    ~EmulatedWebSocket() override {
+        Close();
+    }
+
+    void SetHeader(const char* key, const char* value) override {
+        if (strcmp(key, "Protocol-Version") == 0) {
+            version_ = atoi(value);
+        }
+    }
+
+    bool IsConnected() const override {
+        return connected_;
+    }
+
+    bool Connect(const char* uri) override {
+        bool secure = strncmp(uri, "wss://", 6) == 0;
+        if (!network_.RoundTrips(secure ? SECURE_STREAM_ROUND_TRIPS : PLAIN_STREAM_ROUND_TRIPS)) {
+            return false;
+        }
+        mailbox_->SetReceiver([this](const std::string& data, bool binary) {
+            if (on_data_ != nullptr) {
+                // WebsocketProtocol decodes binary headers in place, give it a writable copy
+                std::string frame(data);
+                on_data_(frame.data(), frame.size(), binary);
+            }
+        });
+        network_.server().OnWebSocketOpen(mailbox_, version_);
+        connected_ = true;
+        if (on_connected_ != nullptr) {
+            on_connected_();
+        }
+        return true;
+    }
+
+    bool Send(const std::string& data) override {
+        if (!connected_) {
+            return false;
+        }
+        auto& server = network_.server();
+        network_.uplink().SendStream(data.size() + EmulatedNetwork::StreamOverhead(), [&server, data]() {
+            server.OnText(data);
+        });
+        return true;
+    }
+
+    bool Send(const void* data, size_t len, bool binary, bool fin) override {
+        if (!binary) {
+            // Fragments of a text message reach the server as one message
+            fragments_.append((const char*)data, len);
+            if (!fin) {
+                return connected_;
+            }
+            std::string text = std::move(fragments_);
+            fragments_.clear();
+            return Send(text);
+        }
+        if (!connected_) {
+            return false;
+        }
+        auto& server = network_.server();
+        std::string frame((const char*)data, len);
+        network_.uplink().SendStream(len + EmulatedNetwork::StreamOverhead(), [&server, frame]() {
+            server.OnWebSocketBinary(frame);
+        });
+        return true;
+    }
+
+    void Close() override {
+        connected_ = false;
+        mailbox_->Close();
+    }
+
+private:
+    EmulatedNetwork& network_;
+    std::shared_ptr<Mailbox> mailbox_ = std::make_shared<Mailbox>();
+    std::atomic<bool> connected_ = false;
+    int version_ = 1;
+    std::string fragments_;
+};
+
+class EmulatedMqtt : public Mqtt {
+public:
+    explicit EmulatedMqtt(EmulatedNetwork& network) : network_(network) {}
+
+    ~EmulatedMqtt() override {
+        Disconnect();
+    }
+
+    bool Connect(const std::string broker_address, int broker_port, const std::string client_id,
+        const std::string username, const std::string password) override {
+        bool secure = broker_port == 8883;
+        if (!network_.RoundTrips(secure ? SECURE_STREAM_ROUND_TRIPS : PLAIN_STREAM_ROUND_TRIPS)) {
+            return false;
+        }
+        mailbox_->SetReceiver([this](const std::string& data, bool binary) {
+            if (on_message_ != nullptr) {
+                on_message_("devices/p2p/stand-in", data);
+            }
+        });
+        network_.server().OnMqttConnect(mailbox_);
+        connected_ = true;
+        if (on_connected_ != nullptr) {
+            on_connected_();
+        }
+        return true;
+    }
+
+    void Disconnect() override {
+        connected_ = false;
+        mailbox_->Close();
+    }
+
+    bool Publish(const std::string topic, const std::string payload, int qos) override {
+        if (!connected_) {
+            return false;
+        }
+        auto& server = network_.server();
+        network_.uplink().SendStream(topic.size() + payload.size() + EmulatedNetwork::StreamOverhead(),
+            [&server, payload]() {
+                server.OnText(payload);
+            });
+        return true;
+    }
+
+    bool IsConnected() override {
+        return connected_;
+    }
+
+private:
+    EmulatedNetwork& network_;
+    std::shared_ptr<Mailbox> mailbox_ = std::make_shared<Mailbox>();
+    std::atomic<bool> connected_ = false;
+};
+
+class EmulatedUdp : public Udp {
+public:
+    explicit EmulatedUdp(EmulatedNetwork& network) : network_(network) {}
+
+    ~EmulatedUdp() override {
+        Disconnect();
+    }
+
+    bool Connect(const std::string& host, int port) override {
+        mailbox_->SetReceiver([this](const std::string& data, bool binary) {
+            if (on_message_ != nullptr) {
+                on_message_(data);
+            }
+        });
+        network_.server().OnUdpOpen(mailbox_);
+        connected_ = true;
+        return true;
+    }
+
+    void Disconnect() override {
+        connected_ = false;
+        mailbox_->Close();
+    }
+
+    int Send(const std::string& data) override {
+        if (!connected_) {
+            return -1;
+        }
+        auto& server = network_.server();
+        network_.uplink().SendDatagram(data.size() + EmulatedNetwork::DatagramOverhead(), [&server, data]() {
+            server.OnUdpDatagram(data);
+        });
+        return data.size();
+    }
+
+private:
+    EmulatedNetwork& network_;
+    std::shared_ptr<Mailbox> mailbox_ = std::make_shared<Mailbox>();
+    std::atomic<bool> connected_ = false;
+};
+
+EmulatedNetwork::EmulatedNetwork(const NetworkProfile& profile, uint32_t seed, StandInServer& server)
+    : uplink_(profile.uplink, seed), downlink_(profile.downlink, seed * 2654435761u + 1), server_(server) {
+    server_.SetDownlink(&downlink_);
+}
+
+EmulatedNetwork::~EmulatedNetwork() {
+    // Nothing may reach the server once the uplink is stopped, then the server stops using the downlink
+    uplink_.Stop();
+    server_.Stop();
+    server_.SetDownlink(nullptr);
+    downlink_.Stop();
+}
+
+std::unique_ptr<WebSocket> EmulatedNetwork::CreateWebSocket(int connect_id) {
+    return std::make_unique<EmulatedWebSocket>(*this);
+}
+
+std::unique_ptr<Mqtt> EmulatedNetwork::CreateMqtt(int connect_id) {
+    return std::make_unique<EmulatedMqtt>(*this);
+}
+
+std::unique_ptr<Udp> EmulatedNetwork::CreateUdp(int connect_id) {
+    return std::make_unique<EmulatedUdp>(*this);
+}
+
+bool EmulatedNetwork::RoundTrips(int count) {
+    for (int i = 0; i < count; i++) {
+        auto done = std::make_shared<std::promise<void>>();
+        auto future = done->get_future();
+        uplink_.SendStream(StreamOverhead(), [this, done]() {
+            downlink_.SendStream(StreamOverhead(), [done]() {
+                done->set_value();
+            });
+        });
+        if (future.wait_for(std::chrono::seconds(10)) != std::future_status::ready) {
+            ESP_LOGE(TAG, "Handshake timed out");
+            return false;
+        }
+    }
+    return true;
+}
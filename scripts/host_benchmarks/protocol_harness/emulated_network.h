@@ -0,0 +1,65 @@
+#ifndef EMULATED_NETWORK_H
+#define EMULATED_NETWORK_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <network_interface.h>
+#include "impaired_link.h"
+
+class StandInServer;
+
+/**
+ * Mailbox - The receiving side of a socket
+ *
+ * Deliveries hold a shared pointer, so a socket can be destroyed while packets addressed to it
+ * are still in the link. Close() drops anything that arrives afterwards.
+ */
+class Mailbox {
+public:
+    void SetReceiver(std::function<void(const std::string& data, bool binary)> receiver);
+    void Deliver(const std::string& data, bool binary);
+    void Close();
+
+private:
+    std::mutex mutex_;
+    std::function<void(const std::string& data, bool binary)> receiver_;
+};
+
+/**
+ * EmulatedNetwork - NetworkInterface whose sockets reach the StandInServer through impaired links
+ *
+ * Client to server traffic goes through the uplink, server to client through the downlink.
+ * WebSocket and MQTT are byte streams, UDP is datagrams (see ImpairedLink).
+ */
+class EmulatedNetwork : public NetworkInterface {
+public:
+    EmulatedNetwork(const NetworkProfile& profile, uint32_t seed, StandInServer& server);
+    ~EmulatedNetwork();
+
+    std::unique_ptr<WebSocket> CreateWebSocket(int connect_id = -1) override;
+    std::unique_ptr<Mqtt> CreateMqtt(int connect_id = -1) override;
+    std::unique_ptr<Udp> CreateUdp(int connect_id = -1) override;
+
+    /**
+     * Exchange count small request/response segments, e.g. the TCP and TLS handshakes
+     */
+    bool RoundTrips(int count);
+
+    // Bytes added per packet on the wire (IP, TCP or UDP, TLS record, WebSocket frame)
+    static size_t StreamOverhead() { return 40 + 29 + 6; }
+    static size_t DatagramOverhead() { return 28; }
+
+    ImpairedLink& uplink() { return uplink_; }
+    ImpairedLink& downlink() { return downlink_; }
+    StandInServer& server() { return server_; }
+
+private:
+    ImpairedLink uplink_;
+    ImpairedLink downlink_;
+    StandInServer& server_;
+};
+
+#endif // EMULATED_NETWORK_H
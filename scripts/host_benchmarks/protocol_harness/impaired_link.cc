@@ -0,0 +1,178 @@
+#include "impaired_link.h"
+
+#include <algorithm>
+
+// Minimum TCP retransmission timeout, lwIP and Linux both bottom out around here
+#define STREAM_MIN_RTO_MS 200
+
+// Rough figures for a device on each kind of network, tune with the command line overrides
+static const std::vector<NetworkProfile> kNetworkProfiles = {
+    // { latency_ms, jitter_ms, loss_percent, loss_burst, reorder_percent, bandwidth_kbps, queue_ms }
+    { "ideal",   { 0, 0, 0, 1, 0, 0, 300 },          { 0, 0, 0, 1, 0, 0, 300 } },
+    { "wifi",    { 5, 3, 0.1, 1, 0, 20000, 100 },    { 5, 3, 0.1, 1, 0, 50000, 100 } },
+    { "4g",      { 35, 15, 0.5, 2, 0.1, 5000, 200 }, { 35, 15, 0.5, 2, 0.1, 20000, 200 } },
+    { "4g-edge", { 60, 40, 2, 3, 0.5, 500, 500 },    { 60, 40, 2, 3, 0.5, 2000, 500 } },
+    { "3g",      { 100, 50, 1, 2, 0.2, 384, 800 },   { 100, 50, 1, 2, 0.2, 1500, 800 } },
+    { "lossy",   { 20, 10, 5, 1, 1, 0, 300 },        { 20, 10, 5, 1, 1, 0, 300 } },
+};
+
+const std::vector<NetworkProfile>& GetNetworkProfiles() {
+    return kNetworkProfiles;
+}
+
+const NetworkProfile* FindNetworkProfile(const std::string& name) {
+    for (const auto& profile : kNetworkProfiles) {
+        if (name == profile.name) {
+            return &profile;
+        }
+    }
+    return nullptr;
+}
+
+ImpairedLink::ImpairedLink(const LinkProfile& profile, uint32_t seed)
+    : profile_(profile), random_(seed) {
+    auto now = Clock::now();
+    bottleneck_free_at_ = now;
+    last_stream_delivery_ = now;
+    last_datagram_delivery_ = now;
+    thread_ = std::thread([this]() { Run(); });
+}
+
+ImpairedLink::~ImpairedLink() {
+    Stop();
+}
+
+void ImpairedLink::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        pending_ = decltype(pending_)();
+        condition_.notify_all();
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+LinkStats ImpairedLink::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+// Gilbert-Elliott two state model, the bad state loses every packet
+bool ImpairedLink::SampleLoss() {
+    double loss = profile_.loss_percent / 100.0;
+    if (loss <= 0) {
+        return false;
+    }
+    std::uniform_real_distribution<double> uniform(0, 1);
+    if (profile_.loss_burst <= 1) {
+        return uniform(random_) < loss;
+    }
+    double bad_to_good = 1.0 / profile_.loss_burst;
+    double good_to_bad = std::min(1.0, loss * bad_to_good / (1.0 - loss));
+    in_loss_burst_ = in_loss_burst_ ? uniform(random_) >= bad_to_good : uniform(random_) < good_to_bad;
+    return in_loss_burst_;
+}
+
+ImpairedLink::Clock::duration ImpairedLink::SampleDelay() {
+    int delay_ms = profile_.latency_ms;
+    if (profile_.jitter_ms > 0) {
+        std::uniform_int_distribution<int> jitter(-profile_.jitter_ms, profile_.jitter_ms);
+        delay_ms = std::max(0, delay_ms + jitter(random_));
+    }
+    return std::chrono::milliseconds(delay_ms);
+}
+
+// Returns when the last bit leaves the bottleneck
+ImpairedLink::Clock::time_point ImpairedLink::PassBottleneck(size_t size, Clock::duration* queue_delay) {
+    auto now = Clock::now();
+    auto start = std::max(now, bottleneck_free_at_);
+    *queue_delay = start - now;
+    Clock::duration transmit(0);
+    if (profile_.bandwidth_kbps > 0) {
+        transmit = std::chrono::microseconds(size * 8 * 1000 / profile_.bandwidth_kbps);
+    }
+    return start + transmit;
+}
+
+void ImpairedLink::SendStream(size_t size, std::function<void()> deliver) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.packets++;
+    stats_.bytes += size;
+
+    Clock::duration queue_delay;
+    auto sent_at = PassBottleneck(size, &queue_delay);
+    bottleneck_free_at_ = sent_at;
+
+    auto rto = std::max<Clock::duration>(std::chrono::milliseconds(STREAM_MIN_RTO_MS),
+        std::chrono::milliseconds(4 * (profile_.latency_ms + profile_.jitter_ms)));
+    auto deliver_at = sent_at + SampleDelay();
+    while (SampleLoss()) {
+        stats_.retransmitted++;
+        deliver_at += rto;
+    }
+    // Byte stream: nothing overtakes a segment that is still being retransmitted
+    deliver_at = std::max(deliver_at, last_stream_delivery_);
+    last_stream_delivery_ = deliver_at;
+    Enqueue(deliver_at, std::move(deliver));
+}
+
+void ImpairedLink::SendDatagram(size_t size, std::function<void()> deliver) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.packets++;
+    stats_.bytes += size;
+
+    Clock::duration queue_delay;
+    auto sent_at = PassBottleneck(size, &queue_delay);
+    if (queue_delay > std::chrono::milliseconds(profile_.queue_ms)) {
+        stats_.dropped++;
+        return;
+    }
+    bottleneck_free_at_ = sent_at;
+    if (SampleLoss()) {
+        stats_.dropped++;
+        return;
+    }
+
+    auto deliver_at = sent_at + SampleDelay();
+    std::uniform_real_distribution<double> uniform(0, 100);
+    if (profile_.reorder_percent > 0 && uniform(random_) < profile_.reorder_percent) {
+        // Skip the in-order constraint and arrive ahead of packets sent earlier
+        stats_.reordered++;
+        deliver_at = sent_at + std::chrono::milliseconds(profile_.latency_ms / 2);
+    } else {
+        deliver_at = std::max(deliver_at, last_datagram_delivery_);
+        last_datagram_delivery_ = deliver_at;
+    }
+    Enqueue(deliver_at, std::move(deliver));
+}
+
+// Caller must hold mutex_
+void ImpairedLink::Enqueue(Clock::time_point deliver_at, std::function<void()> deliver) {
+    if (stopping_) {
+        return;
+    }
+    pending_.push(Pending{ deliver_at, next_order_++, std::move(deliver) });
+    condition_.notify_all();
+}
+
+void ImpairedLink::Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        if (pending_.empty()) {
+            condition_.wait(lock);
+            continue;
+        }
+        auto deliver_at = pending_.top().deliver_at;
+        if (Clock::now() < deliver_at) {
+            condition_.wait_until(lock, deliver_at);
+            continue;
+        }
+        auto deliver = std::move(const_cast<Pending&>(pending_.top()).deliver);
+        pending_.pop();
+        lock.unlock();
+        deliver();
+        lock.lock();
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef IMPAIRED_LINK_H
+#define IMPAIRED_LINK_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * LinkProfile - Impairments of one direction of the emulated link
+ */
+struct LinkProfile {
+    int latency_ms = 0;         // One-way propagation delay
+    int jitter_ms = 0;          // Uniform +/- variation added to the latency
+    double loss_percent = 0;    // Long run packet loss rate
+    double loss_burst = 1;      // Mean length of a loss burst (Gilbert-Elliott), 1 means independent losses
+    double reorder_percent = 0; // Datagrams that skip ahead of the in-order queue
+    int bandwidth_kbps = 0;     // Bottleneck rate, 0 means unlimited
+    int queue_ms = 300;         // Bottleneck buffer, datagrams that would wait longer are tail dropped
+};
+
+/**
+ * Named uplink/downlink pairs, roughly what is seen from a device on each kind of network
+ */
+struct NetworkProfile {
+    const char* name;
+    LinkProfile uplink;
+    LinkProfile downlink;
+};
+
+const NetworkProfile* FindNetworkProfile(const std::string& name);
+const std::vector<NetworkProfile>& GetNetworkProfiles();
+
+struct LinkStats {
+    size_t packets = 0;
+    size_t bytes = 0;
+    size_t dropped = 0;          // Datagrams lost or tail dropped
+    size_t retransmitted = 0;    // Stream segments that were lost and resent
+    size_t reordered = 0;
+};
+
+/**
+ * ImpairedLink - One direction of the emulated network
+ *
+ * Packets are delayed by the bottleneck (serialization and queueing), latency and jitter, then
+ * delivered on the link thread. Streams (TCP: WebSocket, MQTT) never lose data, a loss costs a
+ * retransmission timeout and holds back everything behind it. Datagrams (UDP) are dropped, tail
+ * dropped when the bottleneck buffer is full, and may be reordered.
+ */
+class ImpairedLink {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    ImpairedLink(const LinkProfile& profile, uint32_t seed);
+    ~ImpairedLink();
+
+    void SendStream(size_t size, std::function<void()> deliver);
+    void SendDatagram(size_t size, std::function<void()> deliver);
+
+    // Deliveries still waiting in the link are dropped, returns after the one in progress has finished
+    void Stop();
+
+    LinkStats stats();
+    const LinkProfile& profile() const { return profile_; }
+
+private:
+    struct Pending {
+        Clock::time_point deliver_at;
+        uint64_t order;
+        std::function<void()> deliver;
+        bool operator>(const Pending& other) const {
+            return deliver_at != other.deliver_at ? deliver_at > other.deliver_at : order > other.order;
+        }
+    };
+
+    LinkProfile profile_;
+    std::mt19937 random_;
+    bool in_loss_burst_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> pending_;
+    uint64_t next_order_ = 0;
+    bool stopping_ = false;
+    Clock::time_point bottleneck_free_at_;
+    Clock::time_point last_stream_delivery_;
+    Clock::time_point last_datagram_delivery_;
+    LinkStats stats_;
+    std::thread thread_;
+
+    bool SampleLoss();
+    Clock::duration SampleDelay();
+    Clock::time_point PassBottleneck(size_t size, Clock::duration* queue_delay);
+    void Enqueue(Clock::time_point deliver_at, std::function<void()> deliver);
+    void Run();
+};
+
+#endif // IMPAIRED_LINK_H
@@ -0,0 +1,331 @@
+// Downloads a firmware image with ResumableDownload, the way Ota::Upgrade() does, from a stand-in
+// HTTP server that cuts every connection after a random number of bytes. The partition is simulated
+// with NOR flash semantics, so a write over bytes that were not erased again fails. Checked are
+// retries within one run, reboots (a new ResumableDownload per connection), a partial image changed
+// in flash and an image replaced on the server, each must end with the exact image and its SHA-256.
+// Usage: ota_resume_check [image_kb] [mean_kb_per_connection] [seed]
+
+#include "resumable_download.h"
+
+#include <board.h>
+#include <esp_log.h>
+#include <settings.h>
+#include <freertos/task.h>
+
+#include <openssl/evp.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#define PARTITION_SIZE (4 * 1024 * 1024)
+#define SECTOR_SIZE 4096
+#define BUFFER_SIZE 8192
+#define BUFFER_COUNT 4
+
+static std::string Sha256Hex(const std::vector<char>& data) {
+    unsigned char digest[32];
+    EVP_Digest(data.data(), data.size(), digest, nullptr, EVP_sha256(), nullptr);
+    std::string hex;
+    for (unsigned char byte : digest) {
+        char buffer[3];
+        snprintf(buffer, sizeof(buffer), "%02x", byte);
+        hex += buffer;
+    }
+    return hex;
+}
+
+// Serves one file with Range and If-Range, each connection ends after an exponentially
+// distributed number of bytes with a read error
+class StandInFileServer {
+public:
+    StandInFileServer(uint32_t seed, size_t mean_bytes) : random_(seed), cut_(1.0 / mean_bytes) {}
+
+    void SetFile(std::vector<char> data, const std::string& etag) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        data_ = std::move(data);
+        etag_ = etag;
+    }
+
+    struct Response {
+        int status_code = 404;
+        size_t offset = 0;
+        size_t cut_after = 0;
+    };
+
+    Response Get(const std::string& range, const std::string& if_range) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Response response;
+        requests_++;
+        response.status_code = 200;
+        size_t start = 0;
+        if (sscanf(range.c_str(), "bytes=%zu-", &start) == 1 && start < data_.size() && (if_range.empty() || if_range == etag_)) {
+            response.status_code = 206;
+            response.offset = start;
+            ranges_++;
+        }
+        response.cut_after = size_t(cut_(random_)) + 1;
+        return response;
+    }
+
+    size_t Copy(size_t offset, char* buffer, size_t size) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t length = std::min(size, data_.size() - offset);
+        memcpy(buffer, data_.data() + offset, length);
+        bytes_sent_ += length;
+        return length;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return data_.size();
+    }
+    std::string etag() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return etag_;
+    }
+
+    size_t requests_ = 0;
+    size_t ranges_ = 0;
+    size_t bytes_sent_ = 0;
+
+private:
+    std::mutex mutex_;
+    std::vector<char> data_;
+    std::string etag_;
+    std::mt19937 random_;
+    std::exponential_distribution<double> cut_;
+};
+
+class StandInHttp : public Http {
+public:
+    explicit StandInHttp(StandInFileServer* server) : server_(server) {}
+
+    void SetTimeout(int timeout_ms) override {}
+    void SetHeader(const std::string& key, const std::string& value) override {
+        if (key == "Range") {
+            range_ = value;
+        } else if (key == "If-Range") {
+            if_range_ = value;
+        }
+    }
+    void SetContent(std::string&& content) override {}
+    bool Open(const std::string& method, const std::string& url) override {
+        response_ = server_->Get(range_, if_range_);
+        position_ = response_.offset;
+        return true;
+    }
+    void Close() override {}
+    int Read(char* buffer, size_t buffer_size) override {
+        if (sent_ >= response_.cut_after) {
+            return -1;
+        }
+        size_t length = std::min({ buffer_size, (size_t)1436, response_.cut_after - sent_ });
+        length = server_->Copy(position_, buffer, length);
+        position_ += length;
+        sent_ += length;
+        return length;
+    }
+    int Write(const char* buffer, size_t buffer_size) override { return -1; }
+    int GetStatusCode() override { return response_.status_code; }
+    std::string GetResponseHeader(const std::string& key) const override {
+        return key == "ETag" ? server_->etag() : "";
+    }
+    size_t GetBodyLength() override { return server_->size() - response_.offset; }
+    std::string ReadAll() override { return ""; }
+
+private:
+    StandInFileServer* server_;
+    std::string range_;
+    std::string if_range_;
+    StandInFileServer::Response response_;
+    size_t position_ = 0;
+    size_t sent_ = 0;
+};
+
+class HttpOnlyNetwork : public NetworkInterface {
+public:
+    explicit HttpOnlyNetwork(StandInFileServer* server) : server_(server) {}
+
+    std::unique_ptr<WebSocket> CreateWebSocket(int connect_id = -1) override { return nullptr; }
+    std::unique_ptr<Mqtt> CreateMqtt(int connect_id = -1) override { return nullptr; }
+    std::unique_ptr<Udp> CreateUdp(int connect_id = -1) override { return nullptr; }
+    std::unique_ptr<Http> CreateHttp(int connect_id = -1) override {
+        return std::make_unique<StandInHttp>(server_);
+    }
+
+private:
+    StandInFileServer* server_;
+};
+
+// NOR flash: erase sets bytes to 0xFF, a write can only clear bits
+class SimulatedPartition {
+public:
+    SimulatedPartition() : data_(PARTITION_SIZE, (char)0xFF) {}
+
+    DownloadTarget Target() {
+        DownloadTarget target;
+        target.name = "ota_0";
+        target.size = data_.size();
+        target.sector_size = SECTOR_SIZE;
+        target.read = [this](size_t offset, char* data, size_t size) {
+            memcpy(data, data_.data() + offset, size);
+            return true;
+        };
+        target.erase = [this](size_t offset, size_t size) {
+            if (offset % SECTOR_SIZE != 0 || size % SECTOR_SIZE != 0 || offset + size > data_.size()) {
+                printf("Unaligned erase of %zu bytes at %zu\n", size, offset);
+                return false;
+            }
+            memset(data_.data() + offset, 0xFF, size);
+            erased_bytes_ += size;
+            return true;
+        };
+        target.write = [this](size_t offset, const char* data, size_t size) {
+            for (size_t i = 0; i < size; i++) {
+                if ((data_[offset + i] & data[i]) != data[i]) {
+                    printf("Write at %zu needs bits set that were not erased\n", offset + i);
+                    return false;
+                }
+                data_[offset + i] &= data[i];
+            }
+            return true;
+        };
+        return target;
+    }
+
+    bool Holds(const std::vector<char>& image) const {
+        return memcmp(data_.data(), image.data(), image.size()) == 0;
+    }
+    void Corrupt(size_t offset) { data_[offset] ^= 0x01; }
+
+    size_t erased_bytes_ = 0;
+
+private:
+    std::vector<char> data_;
+};
+
+struct Result {
+    bool ok = false;
+    int runs = 0;
+    size_t resumes = 0;
+};
+
+// Runs download after download, each with max_attempts connections, like reboots in between
+static Result DownloadUntilDone(SimulatedPartition& partition, const std::string& url, int max_attempts, int max_runs,
+    std::function<void(int run)> before_run = nullptr) {
+    Result result;
+    while (result.runs < max_runs) {
+        if (before_run) {
+            before_run(result.runs);
+        }
+        ResumableDownload download("ota", partition.Target(), BUFFER_SIZE, BUFFER_COUNT);
+        result.runs++;
+        bool ok = download.Run(url, nullptr, max_attempts);
+        if (download.resumed_at() > 0) {
+            result.resumes++;
+        }
+        if (ok) {
+            result.ok = true;
+            return result;
+        }
+    }
+    return result;
+}
+
+static bool Check(const char* name, const Result& result, SimulatedPartition& partition, const std::vector<char>& image,
+    StandInFileServer& server, size_t requests_before, size_t bytes_before) {
+    ResumableDownload download("ota", partition.Target(), BUFFER_SIZE, BUFFER_COUNT);
+    // A complete download is not fetched again, Run() only checks the saved digest and hashes the image
+    bool done = result.ok && download.Run("http://stand-in/firmware.bin", nullptr, 1);
+    bool image_ok = done && partition.Holds(image) && download.sha256() == Sha256Hex(image);
+    size_t requests = server.requests_ - requests_before;
+    size_t bytes = server.bytes_sent_ - bytes_before;
+    printf("%-26s %6d %10zu %10zu %12zu %9.1f%%  %s\n", name, result.runs, requests, result.resumes, bytes,
+        (bytes * 100.0 / image.size()) - 100, image_ok ? "ok" : "FAILED");
+    download.Clear();
+    return image_ok && server.requests_ == requests_before + requests;
+}
+
+static std::vector<char> RandomImage(size_t size, uint32_t seed) {
+    std::mt19937 random(seed);
+    std::vector<char> image(size);
+    for (auto& byte : image) {
+        byte = (char)random();
+    }
+    return image;
+}
+
+int main(int argc, char** argv) {
+    size_t image_size = (argc > 1 ? std::stoul(argv[1]) : 1536) * 1024;
+    size_t mean_bytes = (argc > 2 ? std::stoul(argv[2]) : 128) * 1024;
+    uint32_t seed = argc > 3 ? std::stoul(argv[3]) : 1;
+    // Every cut logs an error, only the summary is printed
+    host_log_level = 0;
+    host_task_delay_divisor = 1000;
+    const std::string url = "http://stand-in/firmware.bin";
+
+    StandInFileServer server(seed, mean_bytes);
+    HttpOnlyNetwork network(&server);
+    Board::GetInstance().SetNetwork(&network);
+    auto image = RandomImage(image_size, seed);
+    server.SetFile(image, "\"v1\"");
+
+    printf("%zu KB image, connections cut after %zu KB on average, one connection delivers all of it %.2g%% of the time\n\n",
+        image_size / 1024, mean_bytes / 1024, 100 * exp(-double(image_size) / mean_bytes));
+    printf("%-26s %6s %10s %10s %12s %10s\n", "", "runs", "requests", "resumes", "bytes_sent", "overhead");
+    bool ok = true;
+
+    // Retries within one run
+    {
+        SimulatedPartition partition;
+        size_t requests = server.requests_, bytes = server.bytes_sent_;
+        auto result = DownloadUntilDone(partition, url, 1000, 1);
+        ok &= Check("retries in one run", result, partition, image, server, requests, bytes);
+    }
+
+    // One connection per run, the progress comes back from Settings
+    {
+        SimulatedPartition partition;
+        size_t requests = server.requests_, bytes = server.bytes_sent_;
+        auto result = DownloadUntilDone(partition, url, 1, 1000);
+        ok &= Check("reboot after every cut", result, partition, image, server, requests, bytes);
+    }
+
+    // The partial image changes in flash between runs, the saved digest no longer matches
+    {
+        SimulatedPartition partition;
+        size_t requests = server.requests_, bytes = server.bytes_sent_;
+        auto result = DownloadUntilDone(partition, url, 1, 1000, [&](int run) {
+            if (run == 2) {
+                partition.Corrupt(100);
+            }
+        });
+        ok &= Check("partial image corrupted", result, partition, image, server, requests, bytes);
+    }
+
+    // A new image with a new ETag is published part way, If-Range makes the server send all of it
+    {
+        SimulatedPartition partition;
+        size_t requests = server.requests_, bytes = server.bytes_sent_;
+        auto new_image = RandomImage(image_size, seed + 1);
+        auto result = DownloadUntilDone(partition, url, 1, 1000, [&](int run) {
+            if (run == 2) {
+                server.SetFile(new_image, "\"v2\"");
+            }
+        });
+        ok &= Check("image replaced on server", result, partition, new_image, server, requests, bytes);
+        server.SetFile(image, "\"v1\"");
+    }
+
+    if (!Settings("ota").GetString("url").empty()) {
+        printf("The progress was not cleared\n");
+        ok = false;
+    }
+    printf("\n%s\n", ok ? "All downloads completed with the right image" : "FAILED");
+    return ok ? 0 : 1;
+}
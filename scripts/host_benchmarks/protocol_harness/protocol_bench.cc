@@ -0,0 +1,366 @@
+// Runs conversation turns of WebsocketProtocol / MqttProtocol against the stand-in server through an
+// emulated network and reports session setup time, time to first audio, frame loss and goodput.
+// Usage: protocol_bench [options], see Usage() below.
+
+#include "emulated_network.h"
+#include "impaired_link.h"
+#include "stand_in_server.h"
+
+#include "websocket_protocol.h"
+#include "mqtt_protocol.h"
+
+#include <board.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <settings.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Options {
+    std::vector<std::string> transports = { "websocket", "mqtt" };
+    NetworkProfile profile = *FindNetworkProfile("4g");
+    int runs = 3;
+    uint32_t seed = 1;
+    int uplink_ms = 3000;
+    int websocket_version = 1;
+    bool csv = false;
+    StandInServer::Config server;
+};
+
+struct RunResult {
+    bool ok = false;
+    double connect_ms = 0;      // MQTT broker connection (done at boot on the device), 0 for WebSocket
+    double open_ms = 0;         // OpenAudioChannel(), what the user waits for after the wake word
+    double ttfa_ms = 0;         // From listen stop to the first downlink audio frame
+    size_t uplink_sent = 0;
+    size_t uplink_received = 0;
+    size_t downlink_sent = 0;
+    size_t downlink_received = 0;
+    double uplink_kbps = 0;
+    double downlink_kbps = 0;
+    double downlink_p95_ms = 0; // One-way delay of downlink frames, sizes the jitter buffer
+};
+
+// What the device sees of the downlink, filled on the downlink thread
+class DownlinkRecorder {
+public:
+    void OnAudio(const AudioStreamPacket& packet) {
+        uint32_t sequence;
+        int64_t sent_us;
+        if (!ParseTestFrame(packet.payload.data(), packet.payload.size(), &sequence, &sent_us)) {
+            return;
+        }
+        int64_t now = esp_timer_get_time();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!sequences_.insert(sequence).second) {
+            return;
+        }
+        if (first_us_ == 0) {
+            first_us_ = now;
+        }
+        last_us_ = now;
+        bytes_ += packet.payload.size();
+        delays_ms_.push_back((now - sent_us) / 1000.0);
+    }
+
+    void OnJson(const JsonValue& root) {
+        if (root["type"].Equals("tts") && root["state"].Equals("stop")) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tts_stopped_ = true;
+            condition_.notify_all();
+        }
+    }
+
+    bool WaitForTtsStop(int timeout_ms) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return condition_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]() { return tts_stopped_; });
+    }
+
+    void Fill(RunResult& result, int64_t stop_us) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        result.downlink_received = sequences_.size();
+        result.ttfa_ms = first_us_ != 0 ? (first_us_ - stop_us) / 1000.0 : 0;
+        if (last_us_ > first_us_) {
+            result.downlink_kbps = bytes_ * 8.0 / ((last_us_ - first_us_) / 1000.0);
+        }
+        if (!delays_ms_.empty()) {
+            std::sort(delays_ms_.begin(), delays_ms_.end());
+            result.downlink_p95_ms = delays_ms_[delays_ms_.size() * 95 / 100];
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::set<uint32_t> sequences_;
+    std::vector<double> delays_ms_;
+    int64_t first_us_ = 0;
+    int64_t last_us_ = 0;
+    size_t bytes_ = 0;
+    bool tts_stopped_ = false;
+};
+
+static double MillisecondsSince(int64_t start_us) {
+    return (esp_timer_get_time() - start_us) / 1000.0;
+}
+
+static RunResult RunOnce(const Options& options, const std::string& transport, uint32_t seed) {
+    RunResult result;
+    StandInServer server(options.server);
+    EmulatedNetwork network(options.profile, seed, server);
+    Board::GetInstance().SetNetwork(&network);
+
+    // Declared before the protocol, its callbacks must not outlive the recorder
+    DownlinkRecorder recorder;
+    std::unique_ptr<Protocol> protocol;
+    if (transport == "mqtt") {
+        Settings settings("mqtt", true);
+        settings.SetString("endpoint", "mqtt.stand-in.local:8883");
+        settings.SetString("client_id", "stand-in-client");
+        settings.SetString("publish_topic", "device-server");
+        protocol = std::make_unique<MqttProtocol>();
+    } else {
+        Settings settings("websocket", true);
+        settings.SetString("url", "wss://ws.stand-in.local/xiaozhi/v1/");
+        settings.SetInt("version", options.websocket_version);
+        protocol = std::make_unique<WebsocketProtocol>();
+    }
+
+    protocol->OnIncomingAudio([&recorder](std::unique_ptr<AudioStreamPacket> packet) {
+        recorder.OnAudio(*packet);
+    });
+    protocol->OnIncomingJson([&recorder](const JsonValue& root) {
+        recorder.OnJson(root);
+    });
+
+    int64_t start = esp_timer_get_time();
+    if (!protocol->Start()) {
+        fprintf(stderr, "%s: start failed\n", transport.c_str());
+        return result;
+    }
+    result.connect_ms = transport == "mqtt" ? MillisecondsSince(start) : 0;
+
+    start = esp_timer_get_time();
+    if (!protocol->OpenAudioChannel()) {
+        fprintf(stderr, "%s: failed to open the audio channel\n", transport.c_str());
+        return result;
+    }
+    result.open_ms = MillisecondsSince(start);
+
+    // Speak for uplink_ms, frames leave on a fixed schedule like the encoder output
+    protocol->SendStartListening(kListeningModeManualStop);
+    int frame_duration = options.server.frame_duration;
+    auto next_frame = std::chrono::steady_clock::now();
+    for (int elapsed = 0; elapsed < options.uplink_ms; elapsed += frame_duration) {
+        auto packet = std::make_unique<AudioStreamPacket>();
+        packet->sample_rate = 16000;
+        packet->frame_duration = frame_duration;
+        packet->timestamp = elapsed;
+        FillTestFrame(packet->payload, ++result.uplink_sent, options.server.frame_bytes);
+        protocol->SendAudio(std::move(packet));
+        next_frame += std::chrono::milliseconds(frame_duration);
+        std::this_thread::sleep_until(next_frame);
+    }
+    protocol->SendStopListening();
+    int64_t stop_us = esp_timer_get_time();
+
+    int timeout_ms = options.server.think_ms + options.server.reply_ms + 15000;
+    if (!recorder.WaitForTtsStop(timeout_ms)) {
+        fprintf(stderr, "%s: no tts stop within %d ms\n", transport.c_str(), timeout_ms);
+    }
+    protocol->CloseAudioChannel();
+    protocol.reset();
+
+    auto stats = server.stats();
+    result.uplink_received = stats.uplink_frames;
+    if (stats.uplink_last_us > stats.uplink_first_us) {
+        result.uplink_kbps = stats.uplink_bytes * 8.0 / ((stats.uplink_last_us - stats.uplink_first_us) / 1000.0);
+    }
+    result.downlink_sent = stats.downlink_frames;
+    recorder.Fill(result, stop_us);
+    result.ok = true;
+    return result;
+}
+
+static double LossPercent(size_t sent, size_t received) {
+    return sent > 0 ? 100.0 * (sent - std::min(sent, received)) / sent : 0;
+}
+
+static void PrintHeader(bool csv) {
+    if (csv) {
+        printf("transport,profile,run,connect_ms,open_ms,ttfa_ms,uplink_loss_pct,downlink_loss_pct,"
+            "uplink_kbps,downlink_kbps,downlink_p95_ms\n");
+    } else {
+        printf("%-10s %-8s %4s %10s %8s %8s %9s %9s %8s %8s %9s\n", "transport", "profile", "run", "connect_ms",
+            "open_ms", "ttfa_ms", "up_loss%", "down_loss%", "up_kbps", "dn_kbps", "dn_p95_ms");
+    }
+}
+
+static void PrintRow(bool csv, const std::string& transport, const char* profile, const std::string& run,
+    const RunResult& r) {
+    double up_loss = LossPercent(r.uplink_sent, r.uplink_received);
+    double down_loss = LossPercent(r.downlink_sent, r.downlink_received);
+    if (csv) {
+        printf("%s,%s,%s,%.1f,%.1f,%.1f,%.2f,%.2f,%.1f,%.1f,%.1f\n", transport.c_str(), profile, run.c_str(),
+            r.connect_ms, r.open_ms, r.ttfa_ms, up_loss, down_loss, r.uplink_kbps, r.downlink_kbps, r.downlink_p95_ms);
+    } else {
+        printf("%-10s %-8s %4s %10.1f %8.1f %8.1f %9.2f %9.2f %8.1f %8.1f %9.1f\n", transport.c_str(), profile,
+            run.c_str(), r.connect_ms, r.open_ms, r.ttfa_ms, up_loss, down_loss, r.uplink_kbps, r.downlink_kbps,
+            r.downlink_p95_ms);
+    }
+}
+
+static void Usage() {
+    fprintf(stderr,
+        "Usage: protocol_bench [options]\n"
+        "  --transport websocket|mqtt|both   (default both)\n"
+        "  --profile NAME      network profile, --profile list shows them (default 4g)\n"
+        "  --latency MS --jitter MS --loss PCT --burst N --reorder PCT --queue MS\n"
+        "                      override the profile in both directions\n"
+        "  --up-kbps N --down-kbps N   bottleneck bandwidth, 0 for unlimited\n"
+        "  --runs N            conversation turns per transport (default 3)\n"
+        "  --seed N            first random seed, run i uses seed + i (default 1)\n"
+        "  --uplink-ms MS      how long the device speaks (default 3000)\n"
+        "  --think-ms MS       server delay before the reply (default 300)\n"
+        "  --reply-ms MS       length of the reply audio (default 3000)\n"
+        "  --frame-bytes N     audio frame size in both directions (default 160)\n"
+        "  --ws-version N      WebSocket binary protocol version 1, 2 or 3 (default 1)\n"
+        "  --csv               machine readable output\n"
+        "  -v                  protocol logs, repeat for more\n");
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "%s needs a value\n", arg.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+        auto both = [&](auto setter) {
+            setter(options.profile.uplink);
+            setter(options.profile.downlink);
+        };
+        if (arg == "--transport") {
+            std::string transport = value();
+            options.transports = transport == "both" ? std::vector<std::string>{ "websocket", "mqtt" }
+                : std::vector<std::string>{ transport };
+        } else if (arg == "--profile") {
+            std::string name = value();
+            auto profile = FindNetworkProfile(name);
+            if (profile == nullptr) {
+                if (name != "list") {
+                    fprintf(stderr, "Unknown profile %s\n", name.c_str());
+                }
+                for (const auto& p : GetNetworkProfiles()) {
+                    printf("%-8s up %d+-%d ms %.1f%% loss %d kbps, down %d+-%d ms %.1f%% loss %d kbps\n", p.name,
+                        p.uplink.latency_ms, p.uplink.jitter_ms, p.uplink.loss_percent, p.uplink.bandwidth_kbps,
+                        p.downlink.latency_ms, p.downlink.jitter_ms, p.downlink.loss_percent, p.downlink.bandwidth_kbps);
+                }
+                return false;
+            }
+            options.profile = *profile;
+        } else if (arg == "--latency") {
+            int v = atoi(value());
+            both([v](LinkProfile& link) { link.latency_ms = v; });
+        } else if (arg == "--jitter") {
+            int v = atoi(value());
+            both([v](LinkProfile& link) { link.jitter_ms = v; });
+        } else if (arg == "--loss") {
+            double v = atof(value());
+            both([v](LinkProfile& link) { link.loss_percent = v; });
+        } else if (arg == "--burst") {
+            double v = atof(value());
+            both([v](LinkProfile& link) { link.loss_burst = v; });
+        } else if (arg == "--reorder") {
+            double v = atof(value());
+            both([v](LinkProfile& link) { link.reorder_percent = v; });
+        } else if (arg == "--queue") {
+            int v = atoi(value());
+            both([v](LinkProfile& link) { link.queue_ms = v; });
+        } else if (arg == "--up-kbps") {
+            options.profile.uplink.bandwidth_kbps = atoi(value());
+        } else if (arg == "--down-kbps") {
+            options.profile.downlink.bandwidth_kbps = atoi(value());
+        } else if (arg == "--runs") {
+            options.runs = std::max(1, atoi(value()));
+        } else if (arg == "--seed") {
+            options.seed = strtoul(value(), nullptr, 10);
+        } else if (arg == "--uplink-ms") {
+            options.uplink_ms = atoi(value());
+        } else if (arg == "--think-ms") {
+            options.server.think_ms = atoi(value());
+        } else if (arg == "--reply-ms") {
+            options.server.reply_ms = atoi(value());
+        } else if (arg == "--frame-bytes") {
+            options.server.frame_bytes = std::max(12, atoi(value()));
+        } else if (arg == "--ws-version") {
+            options.websocket_version = atoi(value());
+        } else if (arg == "--csv") {
+            options.csv = true;
+        } else if (arg == "-v" || arg == "-vv") {
+            host_log_level = arg == "-v" ? kHostLogInfo : kHostLogDebug;
+        } else {
+            Usage();
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        return 1;
+    }
+
+    PrintHeader(options.csv);
+    bool all_ok = true;
+    for (const auto& transport : options.transports) {
+        RunResult sum;
+        int completed = 0;
+        for (int run = 0; run < options.runs; run++) {
+            auto result = RunOnce(options, transport, options.seed + run);
+            if (!result.ok) {
+                all_ok = false;
+                continue;
+            }
+            PrintRow(options.csv, transport, options.profile.name, std::to_string(run + 1), result);
+            completed++;
+            sum.connect_ms += result.connect_ms;
+            sum.open_ms += result.open_ms;
+            sum.ttfa_ms += result.ttfa_ms;
+            sum.uplink_sent += result.uplink_sent;
+            sum.uplink_received += result.uplink_received;
+            sum.downlink_sent += result.downlink_sent;
+            sum.downlink_received += result.downlink_received;
+            sum.uplink_kbps += result.uplink_kbps;
+            sum.downlink_kbps += result.downlink_kbps;
+            sum.downlink_p95_ms += result.downlink_p95_ms;
+        }
+        if (completed > 1) {
+            // Frame counts stay summed so the loss rate is over all runs, the rest is averaged
+            sum.connect_ms /= completed;
+            sum.open_ms /= completed;
+            sum.ttfa_ms /= completed;
+            sum.uplink_kbps /= completed;
+            sum.downlink_kbps /= completed;
+            sum.downlink_p95_ms /= completed;
+            PrintRow(options.csv, transport, options.profile.name, "mean", sum);
+        }
+    }
+    Board::GetInstance().SetNetwork(nullptr);
+    return all_ok ? 0 : 1;
+}
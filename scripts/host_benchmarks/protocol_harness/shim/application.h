@@ -0,0 +1,36 @@
+// Only the parts of Application the protocols use, Schedule() runs callbacks on a host main task
+#ifndef HOST_APPLICATION_H
+#define HOST_APPLICATION_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "device_state.h"
+
+#define OPUS_FRAME_DURATION_MS 60
+
+class Application {
+public:
+    static Application& GetInstance() {
+        static Application instance;
+        return instance;
+    }
+
+    DeviceState GetDeviceState() const { return kDeviceStateIdle; }
+    void Schedule(std::function<void()> callback);
+
+private:
+    Application();
+    ~Application();
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_ = false;
+    std::thread main_task_;
+};
+
+#endif // HOST_APPLICATION_H
@@ -0,0 +1,14 @@
+// The strings the protocol code reports through SetError()
+#ifndef HOST_LANG_CONFIG_H
+#define HOST_LANG_CONFIG_H
+
+namespace Lang {
+namespace Strings {
+constexpr const char* SERVER_ERROR = "Server error";
+constexpr const char* SERVER_NOT_CONNECTED = "Server not connected";
+constexpr const char* SERVER_NOT_FOUND = "Server not found";
+constexpr const char* SERVER_TIMEOUT = "Server timeout";
+}
+}
+
+#endif // HOST_LANG_CONFIG_H
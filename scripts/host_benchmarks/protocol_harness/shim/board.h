@@ -0,0 +1,23 @@
+// Only the parts of Board the protocols use, the harness installs the emulated network
+#ifndef HOST_BOARD_H
+#define HOST_BOARD_H
+
+#include <string>
+#include "network_interface.h"
+
+class Board {
+public:
+    static Board& GetInstance() {
+        static Board instance;
+        return instance;
+    }
+
+    NetworkInterface* GetNetwork() { return network_; }
+    void SetNetwork(NetworkInterface* network) { network_ = network; }
+    std::string GetUuid() { return "00000000-0000-4000-8000-000000000000"; }
+
+private:
+    NetworkInterface* network_ = nullptr;
+};
+
+#endif // HOST_BOARD_H
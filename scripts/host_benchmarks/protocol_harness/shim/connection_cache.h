@@ -0,0 +1,23 @@
+// Name resolution and connect timing are not emulated, the harness measures setup time itself
+#ifndef HOST_CONNECTION_CACHE_H
+#define HOST_CONNECTION_CACHE_H
+
+#include <string>
+
+class ConnectionCache {
+public:
+    static ConnectionCache& GetInstance() {
+        static ConnectionCache instance;
+        return instance;
+    }
+
+    class ConnectTimer {
+    public:
+        void Finish(bool success) {}
+    };
+
+    ConnectTimer TimeConnect(const std::string& url) { return ConnectTimer(); }
+    std::string Resolve(const std::string& host) { return host; }
+};
+
+#endif // HOST_CONNECTION_CACHE_H
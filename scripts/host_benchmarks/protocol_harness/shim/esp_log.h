@@ -0,0 +1,19 @@
+// Host stand-in for esp_log.h, messages at or above host_log_level go to stderr
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+#include <cstdio>
+
+enum HostLogLevel { kHostLogError = 1, kHostLogWarn, kHostLogInfo, kHostLogDebug };
+extern int host_log_level;
+
+#define HOST_LOG(level, letter, tag, format, ...) do { \
+        if (host_log_level >= level) fprintf(stderr, letter " (%s) " format "\n", tag, ##__VA_ARGS__); \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG(kHostLogError, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG(kHostLogWarn, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG(kHostLogInfo, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HOST_LOG(kHostLogDebug, "D", tag, format, ##__VA_ARGS__)
+
+#endif // HOST_ESP_LOG_H
@@ -0,0 +1,22 @@
+// Host stand-in for the esp_timer one-shot API, callbacks run on a timer thread
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#include <cstdint>
+
+typedef struct HostTimer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+
+typedef struct {
+    esp_timer_cb_t callback;
+    void* arg;
+    const char* name;
+} esp_timer_create_args_t;
+
+int esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out_handle);
+int esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+int esp_timer_stop(esp_timer_handle_t timer);
+int esp_timer_delete(esp_timer_handle_t timer);
+int64_t esp_timer_get_time();
+
+#endif // HOST_ESP_TIMER_H
@@ -0,0 +1,18 @@
+// Host stand-in for the FreeRTOS types used by the protocol code
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef uint32_t EventBits_t;
+typedef struct HostEventGroup* EventGroupHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFFu
+// One tick is one millisecond on the host
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#endif // HOST_FREERTOS_H
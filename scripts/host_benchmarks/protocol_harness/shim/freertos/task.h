@@ -0,0 +1,21 @@
+// Host stand-in for the FreeRTOS task calls, a task is a detached thread
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void* arg);
+typedef struct HostTask* TaskHandle_t;
+
+#define pdPASS pdTRUE
+
+// vTaskDelay() sleeps for its ticks divided by this, so retry back-off does not slow down a check
+extern int host_task_delay_divisor;
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_depth, void* arg,
+    int priority, TaskHandle_t* out_handle);
+// Only vTaskDelete(NULL) at the end of the task function is supported, it returns
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+
+#endif // HOST_FREERTOS_TASK_H
@@ -0,0 +1,313 @@
+// Host implementations of the FreeRTOS, esp_timer, Settings, Application and mbedtls pieces the protocols
+// and ResumableDownload use
+
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include <mbedtls/aes.h>
+#include <mbedtls/sha256.h>
+
+#include "application.h"
+#include "settings.h"
+
+#include <openssl/evp.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+
+int host_log_level = kHostLogError;
+int host_task_delay_divisor = 1;
+
+// ---- Tasks ----
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_depth, void* arg,
+    int priority, TaskHandle_t* out_handle) {
+    std::thread([function, arg]() { function(arg); }).detach();
+    if (out_handle != nullptr) {
+        *out_handle = nullptr;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::microseconds(int64_t(ticks) * 1000 / host_task_delay_divisor));
+}
+
+// ---- Event groups ----
+
+struct HostEventGroup {
+    std::mutex mutex;
+    std::condition_variable condition;
+    EventBits_t bits = 0;
+};
+
+EventGroupHandle_t xEventGroupCreate() {
+    return new HostEventGroup();
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+    delete group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->bits |= bits;
+    group->condition.notify_all();
+    return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    EventBits_t previous = group->bits;
+    group->bits &= ~bits;
+    return previous;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+    BaseType_t wait_for_all, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto satisfied = [&]() {
+        return wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    };
+    if (ticks_to_wait == portMAX_DELAY) {
+        group->condition.wait(lock, satisfied);
+    } else {
+        group->condition.wait_for(lock, std::chrono::milliseconds(ticks_to_wait), satisfied);
+    }
+    EventBits_t result = group->bits;
+    if (satisfied() && clear_on_exit) {
+        group->bits &= ~bits;
+    }
+    return result;
+}
+
+// ---- esp_timer (one-shot only, which is all the protocols use) ----
+
+struct HostTimer {
+    esp_timer_cb_t callback;
+    void* arg;
+    std::mutex mutex;
+    std::condition_variable condition;
+    uint64_t generation = 0;
+    std::thread thread;
+};
+
+int esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out_handle) {
+    auto timer = new HostTimer();
+    timer->callback = args->callback;
+    timer->arg = args->arg;
+    *out_handle = timer;
+    return 0;
+}
+
+int esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    esp_timer_stop(timer);
+    std::lock_guard<std::mutex> lock(timer->mutex);
+    uint64_t generation = timer->generation;
+    timer->thread = std::thread([timer, generation, timeout_us]() {
+        std::unique_lock<std::mutex> lock(timer->mutex);
+        bool stopped = timer->condition.wait_for(lock, std::chrono::microseconds(timeout_us),
+            [&]() { return timer->generation != generation; });
+        if (!stopped) {
+            lock.unlock();
+            timer->callback(timer->arg);
+        }
+    });
+    return 0;
+}
+
+int esp_timer_stop(esp_timer_handle_t timer) {
+    std::thread thread;
+    {
+        std::lock_guard<std::mutex> lock(timer->mutex);
+        timer->generation++;
+        timer->condition.notify_all();
+        thread = std::move(timer->thread);
+    }
+    if (thread.joinable()) {
+        if (thread.get_id() == std::this_thread::get_id()) {
+            thread.detach();
+        } else {
+            thread.join();
+        }
+    }
+    return 0;
+}
+
+int esp_timer_delete(esp_timer_handle_t timer) {
+    esp_timer_stop(timer);
+    delete timer;
+    return 0;
+}
+
+int64_t esp_timer_get_time() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// ---- Application main task ----
+
+Application::Application() {
+    main_task_ = std::thread([this]() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            condition_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            auto task = std::move(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    });
+}
+
+Application::~Application() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    condition_.notify_all();
+    main_task_.join();
+}
+
+void Application::Schedule(std::function<void()> callback) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(callback));
+    }
+    condition_.notify_all();
+}
+
+// ---- Settings ----
+
+static std::mutex settings_mutex;
+static std::map<std::string, std::string> settings_strings;
+static std::map<std::string, int32_t> settings_ints;
+
+std::string Settings::GetString(const std::string& key, const std::string& default_value) {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    auto it = settings_strings.find(ns_ + "." + key);
+    return it != settings_strings.end() ? it->second : default_value;
+}
+
+void Settings::SetString(const std::string& key, const std::string& value) {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    settings_strings[ns_ + "." + key] = value;
+}
+
+int32_t Settings::GetInt(const std::string& key, int32_t default_value) {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    auto it = settings_ints.find(ns_ + "." + key);
+    return it != settings_ints.end() ? it->second : default_value;
+}
+
+void Settings::SetInt(const std::string& key, int32_t value) {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    settings_ints[ns_ + "." + key] = value;
+}
+
+void Settings::EraseKey(const std::string& key) {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    settings_strings.erase(ns_ + "." + key);
+    settings_ints.erase(ns_ + "." + key);
+}
+
+void Settings::EraseAll() {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    auto prefix = ns_ + ".";
+    for (auto it = settings_strings.begin(); it != settings_strings.end();) {
+        it = it->first.compare(0, prefix.size(), prefix) == 0 ? settings_strings.erase(it) : std::next(it);
+    }
+    for (auto it = settings_ints.begin(); it != settings_ints.end();) {
+        it = it->first.compare(0, prefix.size(), prefix) == 0 ? settings_ints.erase(it) : std::next(it);
+    }
+}
+
+// ---- mbedtls AES-CTR ----
+
+void mbedtls_aes_init(mbedtls_aes_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits) {
+    if (keybits != 128) {
+        return -1;
+    }
+    memcpy(ctx->key, key, sizeof(ctx->key));
+    return 0;
+}
+
+static bool EncryptBlock(const mbedtls_aes_context* ctx, const unsigned char input[16], unsigned char output[16]) {
+    EVP_CIPHER_CTX* cipher = EVP_CIPHER_CTX_new();
+    int length = 0;
+    bool ok = EVP_EncryptInit_ex(cipher, EVP_aes_128_ecb(), nullptr, ctx->key, nullptr) == 1 &&
+        EVP_CIPHER_CTX_set_padding(cipher, 0) == 1 &&
+        EVP_EncryptUpdate(cipher, output, &length, input, 16) == 1;
+    EVP_CIPHER_CTX_free(cipher);
+    return ok;
+}
+
+// Same semantics as mbedtls: the 16 byte counter block is incremented big endian after each block
+int mbedtls_aes_crypt_ctr(mbedtls_aes_context* ctx, size_t length, size_t* nc_off, unsigned char nonce_counter[16],
+    unsigned char stream_block[16], const unsigned char* input, unsigned char* output) {
+    size_t n = *nc_off;
+    for (size_t i = 0; i < length; i++) {
+        if (n == 0) {
+            if (!EncryptBlock(ctx, nonce_counter, stream_block)) {
+                return -1;
+            }
+            for (int j = 15; j >= 0; j--) {
+                if (++nonce_counter[j] != 0) {
+                    break;
+                }
+            }
+        }
+        output[i] = input[i] ^ stream_block[n];
+        n = (n + 1) & 0x0F;
+    }
+    *nc_off = n;
+    return 0;
+}
+
+// ---- mbedtls SHA-256 ----
+
+void mbedtls_sha256_init(mbedtls_sha256_context* ctx) {
+    ctx->md = EVP_MD_CTX_new();
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context* ctx) {
+    EVP_MD_CTX_free(ctx->md);
+    ctx->md = nullptr;
+}
+
+void mbedtls_sha256_clone(mbedtls_sha256_context* dst, const mbedtls_sha256_context* src) {
+    EVP_MD_CTX_copy_ex(dst->md, src->md);
+}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context* ctx, int is224) {
+    return EVP_DigestInit_ex(ctx->md, is224 ? EVP_sha224() : EVP_sha256(), nullptr) == 1 ? 0 : -1;
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context* ctx, const unsigned char* input, size_t ilen) {
+    return EVP_DigestUpdate(ctx->md, input, ilen) == 1 ? 0 : -1;
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context* ctx, unsigned char output[32]) {
+    return EVP_DigestFinal_ex(ctx->md, output, nullptr) == 1 ? 0 : -1;
+}
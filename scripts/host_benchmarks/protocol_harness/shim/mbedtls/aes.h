@@ -0,0 +1,17 @@
+// The mbedtls AES-CTR subset used by MqttProtocol, implemented with OpenSSL on the host
+#ifndef HOST_MBEDTLS_AES_H
+#define HOST_MBEDTLS_AES_H
+
+#include <cstddef>
+#include <cstdint>
+
+typedef struct {
+    unsigned char key[16];
+} mbedtls_aes_context;
+
+void mbedtls_aes_init(mbedtls_aes_context* ctx);
+int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits);
+int mbedtls_aes_crypt_ctr(mbedtls_aes_context* ctx, size_t length, size_t* nc_off, unsigned char nonce_counter[16],
+    unsigned char stream_block[16], const unsigned char* input, unsigned char* output);
+
+#endif // HOST_MBEDTLS_AES_H
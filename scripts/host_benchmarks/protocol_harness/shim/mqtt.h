@@ -0,0 +1,30 @@
+// The esp-ml307 Mqtt interface as used by MqttProtocol
+#ifndef HOST_MQTT_H
+#define HOST_MQTT_H
+
+#include <functional>
+#include <string>
+
+class Mqtt {
+public:
+    virtual ~Mqtt() = default;
+    void SetKeepAlive(int keep_alive_seconds) { keep_alive_seconds_ = keep_alive_seconds; }
+    virtual bool Connect(const std::string broker_address, int broker_port, const std::string client_id,
+        const std::string username, const std::string password) = 0;
+    virtual void Disconnect() = 0;
+    virtual bool Publish(const std::string topic, const std::string payload, int qos = 0) = 0;
+    virtual bool IsConnected() = 0;
+    virtual int GetLastError() { return 0; }
+
+    void OnConnected(std::function<void()> callback) { on_connected_ = callback; }
+    void OnDisconnected(std::function<void()> callback) { on_disconnected_ = callback; }
+    void OnMessage(std::function<void(const std::string& topic, const std::string& payload)> callback) { on_message_ = callback; }
+
+protected:
+    int keep_alive_seconds_ = 120;
+    std::function<void()> on_connected_;
+    std::function<void()> on_disconnected_;
+    std::function<void(const std::string& topic, const std::string& payload)> on_message_;
+};
+
+#endif // HOST_MQTT_H
@@ -0,0 +1,21 @@
+#ifndef HOST_NETWORK_INTERFACE_H
+#define HOST_NETWORK_INTERFACE_H
+
+#include <memory>
+
+#include "web_socket.h"
+#include "mqtt.h"
+#include "udp.h"
+#include "http.h"
+
+class NetworkInterface {
+public:
+    virtual ~NetworkInterface() = default;
+    virtual std::unique_ptr<WebSocket> CreateWebSocket(int connect_id = -1) = 0;
+    virtual std::unique_ptr<Mqtt> CreateMqtt(int connect_id = -1) = 0;
+    virtual std::unique_ptr<Udp> CreateUdp(int connect_id = -1) = 0;
+    // Only the OTA check serves HTTP, the emulated network of protocol_bench has none
+    virtual std::unique_ptr<Http> CreateHttp(int connect_id = -1) { return nullptr; }
+};
+
+#endif // HOST_NETWORK_INTERFACE_H
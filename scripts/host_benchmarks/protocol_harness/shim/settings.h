@@ -0,0 +1,23 @@
+// In-memory Settings with the same interface as the NVS backed one
+#ifndef HOST_SETTINGS_H
+#define HOST_SETTINGS_H
+
+#include <cstdint>
+#include <string>
+
+class Settings {
+public:
+    Settings(const std::string& ns, bool read_write = false) : ns_(ns) {}
+
+    std::string GetString(const std::string& key, const std::string& default_value = "");
+    void SetString(const std::string& key, const std::string& value);
+    int32_t GetInt(const std::string& key, int32_t default_value = 0);
+    void SetInt(const std::string& key, int32_t value);
+    void EraseKey(const std::string& key);
+    void EraseAll();
+
+private:
+    std::string ns_;
+};
+
+#endif // HOST_SETTINGS_H
@@ -0,0 +1,15 @@
+// The host Settings are in memory already, there is nothing to commit
+#ifndef HOST_SETTINGS_STORE_H
+#define HOST_SETTINGS_STORE_H
+
+class SettingsStore {
+public:
+    static SettingsStore& GetInstance() {
+        static SettingsStore instance;
+        return instance;
+    }
+
+    void Flush() {}
+};
+
+#endif // HOST_SETTINGS_STORE_H
@@ -0,0 +1,21 @@
+// The esp-ml307 Udp interface as used by MqttProtocol
+#ifndef HOST_UDP_H
+#define HOST_UDP_H
+
+#include <functional>
+#include <string>
+
+class Udp {
+public:
+    virtual ~Udp() = default;
+    virtual bool Connect(const std::string& host, int port) = 0;
+    virtual void Disconnect() = 0;
+    virtual int Send(const std::string& data) = 0;
+
+    void OnMessage(std::function<void(const std::string& data)> callback) { on_message_ = callback; }
+
+protected:
+    std::function<void(const std::string& data)> on_message_;
+};
+
+#endif // HOST_UDP_H
@@ -0,0 +1,30 @@
+// The esp-ml307 WebSocket interface as used by WebsocketProtocol
+#ifndef HOST_WEB_SOCKET_H
+#define HOST_WEB_SOCKET_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+class WebSocket {
+public:
+    virtual ~WebSocket() = default;
+    virtual void SetHeader(const char* key, const char* value) = 0;
+    virtual bool IsConnected() const = 0;
+    virtual bool Connect(const char* uri) = 0;
+    virtual bool Send(const std::string& data) = 0;
+    virtual bool Send(const void* data, size_t len, bool binary = false, bool fin = true) = 0;
+    virtual void Close() = 0;
+    virtual int GetLastError() const { return 0; }
+
+    void OnConnected(std::function<void()> callback) { on_connected_ = callback; }
+    void OnDisconnected(std::function<void()> callback) { on_disconnected_ = callback; }
+    void OnData(std::function<void(const char*, size_t, bool binary)> callback) { on_data_ = callback; }
+
+protected:
+    std::function<void()> on_connected_;
+    std::function<void()> on_disconnected_;
+    std::function<void(const char*, size_t, bool binary)> on_data_;
+};
+
+#endif // HOST_WEB_SOCKET_H
@@ -0,0 +1,318 @@
+#include "stand_in_server.h"
+#include "emulated_network.h"
+#include "impaired_link.h"
+
+#include "json_reader.h"
+#include "json_writer.h"
+#include "protocol.h"
+
+#include <arpa/inet.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <cstring>
+
+#define TAG "StandInServer"
+
+#define STAND_IN_UDP_SERVER "udp.stand-in.local"
+#define STAND_IN_UDP_PORT 8888
+// The first byte of the nonce is the packet type (0x01, audio), the second half is filled per packet
+#define STAND_IN_AES_KEY "0123456789abcdef0123456789abcdef"
+#define STAND_IN_AES_NONCE "01000000123456780000000000000000"
+
+void FillTestFrame(std::vector<uint8_t>& payload, uint32_t sequence, size_t size) {
+    payload.assign(std::max<size_t>(size, 12), 0x5A);
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < 4; i++) {
+        payload[i] = sequence >> (24 - 8 * i);
+    }
+    for (int i = 0; i < 8; i++) {
+        payload[4 + i] = (uint64_t)now >> (56 - 8 * i);
+    }
+}
+
+bool ParseTestFrame(const uint8_t* data, size_t size, uint32_t* sequence, int64_t* sent_us) {
+    if (size < 12) {
+        return false;
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value = (value << 8) | data[i];
+    }
+    uint64_t time = 0;
+    for (int i = 0; i < 8; i++) {
+        time = (time << 8) | data[4 + i];
+    }
+    *sequence = value;
+    *sent_us = (int64_t)time;
+    return true;
+}
+
+static std::string DecodeHex(const std::string& hex) {
+    std::string bytes;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        bytes.push_back((char)std::stoi(hex.substr(i, 2), nullptr, 16));
+    }
+    return bytes;
+}
+
+StandInServer::StandInServer(const Config& config) : config_(config) {
+    aes_key_ = DecodeHex(STAND_IN_AES_KEY);
+    aes_nonce_ = DecodeHex(STAND_IN_AES_NONCE);
+    mbedtls_aes_init(&aes_ctx_);
+    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)aes_key_.data(), 128);
+}
+
+StandInServer::~StandInServer() {
+    Stop();
+}
+
+void StandInServer::Stop() {
+    CancelReply();
+    std::lock_guard<std::mutex> lock(mutex_);
+    control_.reset();
+    udp_.reset();
+}
+
+StandInServer::Stats StandInServer::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void StandInServer::OnWebSocketOpen(std::shared_ptr<Mailbox> client, int version) {
+    CancelReply();
+    std::lock_guard<std::mutex> lock(mutex_);
+    control_ = client;
+    mqtt_ = false;
+    websocket_version_ = version;
+}
+
+void StandInServer::OnMqttConnect(std::shared_ptr<Mailbox> client) {
+    CancelReply();
+    std::lock_guard<std::mutex> lock(mutex_);
+    control_ = client;
+    mqtt_ = true;
+}
+
+void StandInServer::OnUdpOpen(std::shared_ptr<Mailbox> client) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    udp_ = client;
+}
+
+void StandInServer::OnText(const std::string& text) {
+    auto root = JsonReader::Parse(text);
+    auto type = root["type"];
+    bool start_reply = false;
+    bool cancel_reply = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.text_messages++;
+        if (type.Equals("hello")) {
+            SendHello();
+        } else if (type.Equals("listen")) {
+            // Manual mode: the client marks the end of the utterance with stop
+            start_reply = root["state"].Equals("stop");
+        } else if (type.Equals("abort") || type.Equals("goodbye")) {
+            cancel_reply = true;
+        } else if (!type.IsString()) {
+            ESP_LOGW(TAG, "Message without type: %s", text.c_str());
+        }
+    }
+    if (start_reply) {
+        StartReply();
+    } else if (cancel_reply) {
+        CancelReply();
+    }
+}
+
+void StandInServer::OnWebSocketBinary(const std::string& frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto data = (const uint8_t*)frame.data();
+    size_t size = frame.size();
+    if (websocket_version_ == 2 && size >= sizeof(BinaryProtocol2)) {
+        data += sizeof(BinaryProtocol2);
+        size -= sizeof(BinaryProtocol2);
+    } else if (websocket_version_ == 3 && size >= sizeof(BinaryProtocol3)) {
+        data += sizeof(BinaryProtocol3);
+        size -= sizeof(BinaryProtocol3);
+    }
+    CountUplinkFrame(data, size);
+}
+
+void StandInServer::OnUdpDatagram(const std::string& datagram) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (datagram.size() < aes_nonce_.size() || datagram[0] != 0x01) {
+        ESP_LOGW(TAG, "Invalid UDP packet of %u bytes", (unsigned)datagram.size());
+        return;
+    }
+    uint8_t nonce[16];
+    memcpy(nonce, datagram.data(), sizeof(nonce));
+    std::vector<uint8_t> payload(datagram.size() - sizeof(nonce));
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    mbedtls_aes_crypt_ctr(&aes_ctx_, payload.size(), &nc_off, nonce, stream_block,
+        (const uint8_t*)datagram.data() + sizeof(nonce), payload.data());
+    CountUplinkFrame(payload.data(), payload.size());
+}
+
+// Caller must hold mutex_
+void StandInServer::CountUplinkFrame(const uint8_t* data, size_t size) {
+    uint32_t sequence;
+    int64_t sent_us;
+    if (!ParseTestFrame(data, size, &sequence, &sent_us)) {
+        return;
+    }
+    if (!uplink_sequences_.insert(sequence).second) {
+        stats_.uplink_duplicates++;
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    if (stats_.uplink_frames == 0) {
+        stats_.uplink_first_us = now;
+    }
+    stats_.uplink_last_us = now;
+    stats_.uplink_frames++;
+    stats_.uplink_bytes += size;
+}
+
+// Caller must hold mutex_
+void StandInServer::SendText(const std::string& text) {
+    auto client = control_;
+    if (client == nullptr || downlink_ == nullptr) {
+        return;
+    }
+    downlink_->SendStream(text.size() + EmulatedNetwork::StreamOverhead(), [client, text]() {
+        client->Deliver(text, false);
+    });
+}
+
+// Caller must hold mutex_
+void StandInServer::SendAudio(uint32_t sequence, int64_t timestamp_ms) {
+    std::vector<uint8_t> payload;
+    FillTestFrame(payload, sequence, config_.frame_bytes);
+
+    if (!mqtt_) {
+        auto client = control_;
+        if (client == nullptr) {
+            return;
+        }
+        std::string frame;
+        if (websocket_version_ == 2) {
+            frame.resize(sizeof(BinaryProtocol2));
+            auto bp2 = (BinaryProtocol2*)frame.data();
+            bp2->version = htons(2);
+            bp2->type = 0;
+            bp2->reserved = 0;
+            bp2->timestamp = htonl((uint32_t)timestamp_ms);
+            bp2->payload_size = htonl(payload.size());
+        } else if (websocket_version_ == 3) {
+            frame.resize(sizeof(BinaryProtocol3));
+            auto bp3 = (BinaryProtocol3*)frame.data();
+            bp3->type = 0;
+            bp3->reserved = 0;
+            bp3->payload_size = htons(payload.size());
+        }
+        frame.append((const char*)payload.data(), payload.size());
+        downlink_->SendStream(frame.size() + EmulatedNetwork::StreamOverhead(), [client, frame]() {
+            client->Deliver(frame, true);
+        });
+        return;
+    }
+
+    auto client = udp_;
+    if (client == nullptr) {
+        return;
+    }
+    // Same packet layout and encryption as MqttProtocol::SendEncryptedAudio()
+    std::string datagram(aes_nonce_);
+    *(uint16_t*)&datagram[2] = htons(payload.size());
+    *(uint32_t*)&datagram[8] = htonl((uint32_t)timestamp_ms);
+    *(uint32_t*)&datagram[12] = htonl(sequence);
+    uint8_t nonce[16];
+    memcpy(nonce, datagram.data(), sizeof(nonce));
+    datagram.resize(sizeof(nonce) + payload.size());
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    mbedtls_aes_crypt_ctr(&aes_ctx_, payload.size(), &nc_off, nonce, stream_block, payload.data(),
+        (uint8_t*)&datagram[sizeof(nonce)]);
+    downlink_->SendDatagram(datagram.size() + EmulatedNetwork::DatagramOverhead(), [client, datagram]() {
+        client->Deliver(datagram, true);
+    });
+}
+
+// Caller must hold mutex_
+void StandInServer::SendHello() {
+    char session_id[32];
+    snprintf(session_id, sizeof(session_id), "stand-in-%lu", (unsigned long)++session_count_);
+    session_id_ = session_id;
+    uplink_sequences_.clear();
+    downlink_sequence_ = 0;
+
+    std::string message;
+    JsonWriter writer(message);
+    writer.BeginObject().Member("type", "hello").Member("transport", mqtt_ ? "udp" : "websocket")
+        .Member("session_id", session_id_);
+    writer.Key("audio_params").BeginObject()
+        .Member("format", "opus")
+        .Member("sample_rate", config_.sample_rate)
+        .Member("channels", 1)
+        .Member("frame_duration", config_.frame_duration)
+        .EndObject();
+    if (mqtt_) {
+        writer.Key("udp").BeginObject()
+            .Member("server", STAND_IN_UDP_SERVER)
+            .Member("port", STAND_IN_UDP_PORT)
+            .Member("key", STAND_IN_AES_KEY)
+            .Member("nonce", STAND_IN_AES_NONCE)
+            .EndObject();
+    }
+    writer.EndObject();
+    SendText(message);
+}
+
+void StandInServer::StartReply() {
+    CancelReply();
+    std::lock_guard<std::mutex> lock(mutex_);
+    reply_cancelled_ = false;
+    reply_thread_ = std::thread([this]() { Reply(); });
+}
+
+void StandInServer::CancelReply() {
+    std::thread thread;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        reply_cancelled_ = true;
+        reply_condition_.notify_all();
+        thread = std::move(reply_thread_);
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+// Frames are paced in real time like a TTS stream, on a fixed schedule so send jitter does not accumulate
+void StandInServer::Reply() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto wait_until = [&](std::chrono::steady_clock::time_point deadline) {
+        return !reply_condition_.wait_until(lock, deadline, [this]() { return reply_cancelled_; });
+    };
+
+    auto start = std::chrono::steady_clock::now() + std::chrono::milliseconds(config_.think_ms);
+    if (!wait_until(start)) {
+        return;
+    }
+    SendText("{\"type\":\"stt\",\"text\":\"stand-in request\",\"session_id\":\"" + session_id_ + "\"}");
+    SendText("{\"type\":\"tts\",\"state\":\"start\",\"session_id\":\"" + session_id_ + "\"}");
+    SendText("{\"type\":\"tts\",\"state\":\"sentence_start\",\"text\":\"stand-in reply\",\"session_id\":\"" + session_id_ + "\"}");
+
+    int frames = config_.reply_ms / config_.frame_duration;
+    for (int i = 0; i < frames; i++) {
+        if (!wait_until(start + std::chrono::milliseconds(i * config_.frame_duration))) {
+            return;
+        }
+        SendAudio(++downlink_sequence_, (int64_t)i * config_.frame_duration);
+        stats_.downlink_frames++;
+    }
+    SendText("{\"type\":\"tts\",\"state\":\"stop\",\"session_id\":\"" + session_id_ + "\"}");
+}
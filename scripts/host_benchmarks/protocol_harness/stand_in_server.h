@@ -0,0 +1,101 @@
+#ifndef STAND_IN_SERVER_H
+#define STAND_IN_SERVER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mbedtls/aes.h>
+
+class ImpairedLink;
+class Mailbox;
+
+/**
+ * Synthetic audio frames: a big endian sequence number and send time (esp_timer_get_time())
+ * followed by filler, so both ends can count losses and measure one-way delay.
+ */
+void FillTestFrame(std::vector<uint8_t>& payload, uint32_t sequence, size_t size);
+bool ParseTestFrame(const uint8_t* data, size_t size, uint32_t* sequence, int64_t* sent_us);
+
+/**
+ * StandInServer - Just enough of the xiaozhi server to exercise a conversation turn
+ *
+ * Answers hello for both transports (WebSocket, and MQTT with the encrypted UDP audio channel),
+ * counts uplink audio frames and, when listening stops, replies with stt/tts messages and
+ * reply_ms of downlink audio paced at the frame duration.
+ */
+class StandInServer {
+public:
+    struct Config {
+        int think_ms = 300;         // From listen stop to the first reply message
+        int reply_ms = 3000;        // Length of the spoken reply
+        size_t frame_bytes = 160;   // Size of every audio frame in both directions
+        int frame_duration = 60;
+        int sample_rate = 24000;
+    };
+
+    struct Stats {
+        size_t uplink_frames = 0;       // Unique frames received
+        size_t uplink_duplicates = 0;
+        size_t uplink_bytes = 0;
+        int64_t uplink_first_us = 0;
+        int64_t uplink_last_us = 0;
+        size_t downlink_frames = 0;     // Frames sent
+        size_t text_messages = 0;
+    };
+
+    explicit StandInServer(const Config& config);
+    ~StandInServer();
+
+    /**
+     * The link the server uses to reach the client
+     */
+    void SetDownlink(ImpairedLink* downlink) { downlink_ = downlink; }
+    void Stop();
+    Stats stats();
+
+    // Called on the uplink thread as client traffic arrives
+    void OnWebSocketOpen(std::shared_ptr<Mailbox> client, int version);
+    void OnMqttConnect(std::shared_ptr<Mailbox> client);
+    void OnUdpOpen(std::shared_ptr<Mailbox> client);
+    void OnText(const std::string& text);
+    void OnWebSocketBinary(const std::string& frame);
+    void OnUdpDatagram(const std::string& datagram);
+
+private:
+    Config config_;
+    ImpairedLink* downlink_ = nullptr;
+
+    std::mutex mutex_;
+    std::shared_ptr<Mailbox> control_;  // WebSocket or MQTT
+    std::shared_ptr<Mailbox> udp_;
+    bool mqtt_ = false;
+    int websocket_version_ = 1;
+    std::string session_id_;
+    uint32_t session_count_ = 0;
+    mbedtls_aes_context aes_ctx_;
+    std::string aes_key_;
+    std::string aes_nonce_;
+    uint32_t downlink_sequence_ = 0;
+    std::set<uint32_t> uplink_sequences_;
+    Stats stats_;
+
+    std::thread reply_thread_;
+    std::condition_variable reply_condition_;
+    bool reply_cancelled_ = false;
+
+    void SendText(const std::string& text);
+    void SendAudio(uint32_t sequence, int64_t timestamp_ms);
+    void SendHello();
+    void CountUplinkFrame(const uint8_t* data, size_t size);
+    void StartReply();
+    void CancelReply();
+    void Reply();
+};
+
+#endif // STAND_IN_SERVER_H
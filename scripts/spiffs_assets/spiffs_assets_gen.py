@@ -8,6 +8,8 @@ import shutil
 import math
 import sys
 import time
+import struct
+import zlib
 import numpy as np
 import importlib
 import subprocess
@@ -60,6 +62,26 @@ def sort_key(filename):
     basename, extension = os.path.splitext(filename)
     return extension, basename
 
+def append_chunk_digests(data, chunk_size=32768):
+    """
+    Append the CRC32 of every chunk_size bytes of the image, so the firmware can verify the
+    partition chunk by chunk. The digests follow the image (4 byte aligned) and are not counted
+    in the header length, older firmware ignores them.
+    """
+    digests = [zlib.crc32(data[i:i + chunk_size]) for i in range(0, len(data), chunk_size)]
+    padding = b'\0' * (-len(data) % 4)
+    trailer = b'ACRC' + struct.pack('<II', chunk_size, len(digests)) + struct.pack(f'<{len(digests)}I', *digests)
+    return data + padding + trailer + struct.pack('<I', zlib.crc32(trailer))
+
+def table_sort_key(max_name_len):
+    """
+    Order of the mmap table entries, by the name bytes as stored in the table.
+    The firmware binary searches a table in this order instead of indexing it at boot.
+    """
+    def key(file_info):
+        return file_info[0].ljust(max_name_len, '\0')[:max_name_len].encode('utf-8')
+    return key
+
 def download_v8_script(convert_path):
     """
     Ensure that the lvgl_image_converter repository is present at the specified path.
@@ -439,6 +461,7 @@ def pack_assets(config: PackModelsConfig):
         merged_data.extend(bin_data)
 
     total_files = len(file_info_list)
+    file_info_list.sort(key=table_sort_key(int(max_name_len)))
 
     mmap_table = bytearray()
     for file_name, offset, file_size, width, height in file_info_list:
@@ -455,7 +478,7 @@ def pack_assets(config: PackModelsConfig):
     combined_checksum = compute_checksum(combined_data)
     combined_data_length = len(combined_data).to_bytes(4, byteorder='little')
     header_data = total_files.to_bytes(4, byteorder='little') + combined_checksum.to_bytes(4, byteorder='little')
-    final_data = header_data + combined_data_length + combined_data
+    final_data = append_chunk_digests(header_data + combined_data_length + combined_data)
 
     with open(out_file, 'wb') as output_bin:
         output_bin.write(final_data)